@@ -164,68 +164,63 @@ void algorithmRunner()
     inferenceType = 1;
   }
 
-  // per-patient registration
+  // per-patient registration: the images that are not in the T1-Ce space are registered to it
+  // in one batch, so that the T1-Ce image is read once
   auto greedyExe = getApplicationPath("GreedyRegistration");
+  std::vector< std::string > movingFiles, outputFiles, matrixFiles;
+  std::vector< typename TImageType::Pointer * > registeredImages;
+  auto addRegistration = [&](const std::string &movingFile, const std::string &name, typename TImageType::Pointer &image)
+  {
+    movingFiles.push_back(movingFile);
+    outputFiles.push_back(outputDirectory + "/" + name + "ToT1gd.nii.gz");
+    matrixFiles.push_back(outputDirectory + "/" + name + "ToT1gd.mat");
+    registeredImages.push_back(&image);
+  };
   if (!cbica::ImageSanityCheck< TImageType >(t1cImg, maskImage))
   {
     auto tempFile_input = outputDirectory + "/maskToT1gd_input.nii.gz";
-    auto tempFile = outputDirectory + "/maskToT1gd.nii.gz";
     cbica::WriteImage< TImageType >(maskImage, tempFile_input);
-    auto greedyCommand = greedyExe +
-      " -i " + tempFile_input +
-      " -f " + inputT1ce +
-      " -t " + outputDirectory + "/tempMatrix.mat" +
-      " -o " + tempFile + " -reg -trf -a -m MI -n 100x50x5"
-      ;
-
-    std::cout << "== Starting per-subject registration of Mask to T1-Ce using Greedy.\n";
-    std::system(greedyCommand.c_str());
-    maskImage = cbica::ReadImage< TImageType >(tempFile);
-    std::cout << "== Done.\n";
+    addRegistration(tempFile_input, "mask", maskImage);
   }
   if (!cbica::ImageSanityCheck< TImageType >(t1cImg, t1Img))
   {
-    auto tempFile = outputDirectory + "/T1ToT1gd.nii.gz";
-    auto greedyCommand = greedyExe +
-      " -i " + inputT1 +
-      " -f " + inputT1ce +
-      " -t " + outputDirectory + "/tempMatrix.mat" +
-      " -o " + tempFile + " -reg -trf -a -m MI -n 100x50x5"
-      ;
-
-    std::cout << "== Starting per-subject registration of T1 to T1-Ce using Greedy.\n";
-    std::system(greedyCommand.c_str());
-    t1Img = cbica::ReadImage< TImageType >(tempFile);
-    std::cout << "== Done.\n";
+    addRegistration(inputT1, "T1", t1Img);
   }
   if (!cbica::ImageSanityCheck< TImageType >(t1cImg, t2Img))
   {
-    auto tempFile = outputDirectory + "/T2ToT1gd.nii.gz";
-    auto greedyCommand = greedyExe +
-      " -i " + inputT2 +
-      " -f " + inputT1ce +
-      " -t " + outputDirectory + "/tempMatrix.mat" +
-      " -o " + tempFile + " -reg -trf -a -m MI -n 100x50x5"
-      ;
-
-    std::cout << "== Starting per-subject registration of T2 to T1-Ce using Greedy.\n";
-    std::system(greedyCommand.c_str());
-    t2Img = cbica::ReadImage< TImageType >(tempFile);
-    std::cout << "== Done.\n";
+    addRegistration(inputT2, "T2", t2Img);
   }
   if (!cbica::ImageSanityCheck< TImageType >(t1cImg, flImg))
   {
-    auto tempFile = outputDirectory + "/FLToT1gd.nii.gz";
+    addRegistration(inputFlair, "FL", flImg);
+  }
+  if (!movingFiles.empty())
+  {
+    std::string movingList, outputList, matrixList;
+    for (size_t i = 0; i < movingFiles.size(); i++)
+    {
+      const std::string separator = (i == 0) ? "" : ",";
+      movingList += separator + movingFiles[i];
+      outputList += separator + outputFiles[i];
+      matrixList += separator + matrixFiles[i];
+    }
     auto greedyCommand = greedyExe +
-      " -i " + inputFlair +
+      " -i " + movingList +
       " -f " + inputT1ce +
-      " -t " + outputDirectory + "/tempMatrix.mat" +
-      " -o " + tempFile + " -reg -trf -a -m MI -n 100x50x5"
+      " -t " + matrixList +
+      " -o " + outputList + " -reg -trf -a -m MI -n 100x50x5 -b 0"
       ;
 
-    std::cout << "== Starting per-subject registration of T2-Flair to T1-Ce using Greedy.\n";
-    std::system(greedyCommand.c_str());
-    flImg = cbica::ReadImage< TImageType >(tempFile);
+    std::cout << "== Starting per-subject registration of " << movingFiles.size() << " image(s) to T1-Ce using Greedy.\n";
+    if (std::system(greedyCommand.c_str()) != 0)
+    {
+      std::cerr << "Registration to T1-Ce failed, please check the input images.\n";
+      return;
+    }
+    for (size_t i = 0; i < outputFiles.size(); i++)
+    {
+      *registeredImages[i] = cbica::ReadImage< TImageType >(outputFiles[i]);
+    }
     std::cout << "== Done.\n";
   }
 
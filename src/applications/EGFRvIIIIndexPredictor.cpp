@@ -255,29 +255,11 @@ int EGFRvIIIIndexPredictor::PrepareNewEGFRvIIIPredictionModel(const std::string
   VariableSizeMatrixType EighteenModelFeatures;
   mFeatureExtractionLocalPtr.FormulateSurvivalTrainingData(scaledFeatureSet, AllSurvival, SixModelFeatures, EighteenModelFeatures);*/
   //MatrixType data;
-  try
-  {
-    data.set_size(448, 1); // TOCHECK - are these hard coded sizes fine?
-    for (unsigned int i = 0; i < meanVector.Size(); i++)
-      data(i, 0) = meanVector[i];
-    typedef itk::CSVNumericObjectFileWriter<double, 448, 1> WriterTypeVector;
-    WriterTypeVector::Pointer writerv = WriterTypeVector::New();
-    writerv->SetFileName(outputdirectory + "/EGFRvIII_ZScore_Mean.csv");
-    writerv->SetInput(&data);
-    writerv->Write();
-
-    for (unsigned int i = 0; i < stdVector.Size(); i++)
-      data(i, 0) = stdVector[i];
-    writerv->SetFileName(outputdirectory + "/EGFRvIII_ZScore_Std.csv");
-    writerv->SetInput(&data);
-    writerv->Write();
-  }
-  catch (const std::exception& e1)
-  {
-    std::cout << "scaling writing error" << std::endl;
-    logger.WriteError("Error in writing output files to the output directory = " + outputdirectory + "Error code : " + std::string(e1.what()));
-    return false;
-  }
+  // the z-scores and the SVM are written to a single model container once the SVM is trained
+  mModelContainer.Clear();
+  mModelContainer.SetMetadata("Application", "EGFRvIIIIndexPredictor");
+  mModelContainer.AddVector("EGFRvIII_ZScore_Mean", meanVector);
+  mModelContainer.AddVector("EGFRvIII_ZScore_Std", stdVector);
   std::cout << std::endl << "Building model....." << std::endl;
   //  //---------------------------------------------------------------------------
   VariableSizeMatrixType ModelSelectedFeatures = SelectModelFeatures(ModelFeatures);
@@ -349,35 +331,34 @@ int EGFRvIIIIndexPredictor::PrepareNewEGFRvIIIPredictionModel(const std::string
     logger.WriteError("Training on the given subjects failed. Error code : " + std::string(e1.what()));
     return false;
   }
+  if (!mModelContainer.AddMetadataFromFile(mTrainedFile, outputdirectory + "/" + mTrainedFile) ||
+    !mModelContainer.Write(outputdirectory + "/" + mTrainedModelNameContainer))
+  {
+    logger.WriteError("Error in writing model container: " + mModelContainer.GetLastEncounteredError());
+    return false;
+  }
+  mModelContainer.Clear();
   std::cout << std::endl << "Model saved to the output directory." << std::endl;
 
   return true;
 }
 
-VariableLengthVectorType EGFRvIIIIndexPredictor::DistanceFunctionLinear(const VariableSizeMatrixType &testData, const std::string &filename, const double &rho, const double &bestg)
+VariableLengthVectorType EGFRvIIIIndexPredictor::DistanceFunctionLinear(const VariableSizeMatrixType &testData, const ModelContainer::ArrayEntry &model, const double &rho, const double &bestg)
 {
-  CSVFileReaderType::Pointer readerMean = CSVFileReaderType::New();
-  readerMean->SetFileName(filename);
-  readerMean->SetFieldDelimiterCharacter(',');
-  readerMean->HasColumnHeadersOff();
-  readerMean->HasRowHeadersOff();
-  readerMean->Parse();
-  MatrixType dataMatrix = readerMean->GetArray2DDataObject()->GetMatrix();
-
   VariableSizeMatrixType SupportVectors;
   VariableLengthVectorType Coefficients;
   VariableLengthVectorType Distances;
 
-  SupportVectors.SetSize(dataMatrix.rows(), dataMatrix.cols() - 1);
-  Coefficients.SetSize(dataMatrix.rows(), 1);
+  SupportVectors.SetSize(model.rows, model.cols - 1);
+  Coefficients.SetSize(model.rows, 1);
   Distances.SetSize(testData.Rows(), 1);
 
-  for (unsigned int i = 0; i < dataMatrix.rows(); i++)
+  for (unsigned int i = 0; i < model.rows; i++)
   {
     unsigned int j = 0;
-    for (j = 0; j < dataMatrix.cols() - 1; j++)
-      SupportVectors(i, j) = dataMatrix(i, j);
-    Coefficients[i] = dataMatrix(i, j);
+    for (j = 0; j < model.cols - 1; j++)
+      SupportVectors(i, j) = model.data[i * model.cols + j];
+    Coefficients[i] = model.data[i * model.cols + j];
   }
   VariableSizeMatrixType TransposedSupportVectors= MatrixTranspose(SupportVectors);
   VariableSizeMatrixType w;
@@ -577,46 +558,12 @@ VectorDouble EGFRvIIIIndexPredictor::EGFRvIIIPredictionOnExistingModel(const std
     return results;
   }
 
-  MatrixType meanMatrix;
-  VariableLengthVectorType mean;
-  VariableLengthVectorType stddevition;
-  try
-  {
-    reader->SetFileName(modeldirectory + "/EGFRvIII_ZScore_Mean.csv");
-    reader->SetFieldDelimiterCharacter(',');
-    reader->HasColumnHeadersOff();
-    reader->HasRowHeadersOff();
-    reader->Parse();
-    meanMatrix = reader->GetArray2DDataObject()->GetMatrix();
-
-    mean.SetSize(meanMatrix.size());
-    for (unsigned int i = 0; i < meanMatrix.size(); i++)
-      mean[i] = meanMatrix(0,i);
-  }
-  catch (const std::exception& e1)
+  if (!LoadModelContainer(modeldirectory))
   {
-    logger.WriteError("Error in reading the file: " + modeldirectory + "/EGFRvIII_ZScore_Mean.csv. Error code : " + std::string(e1.what()));
-    return results;
-  }
-  MatrixType stdMatrix;
-  try
-  {
-    reader->SetFileName(modeldirectory + "/EGFRvIII_ZScore_Std.csv");
-    reader->SetFieldDelimiterCharacter(',');
-    reader->HasColumnHeadersOff();
-    reader->HasRowHeadersOff();
-    reader->Parse();
-    stdMatrix = reader->GetArray2DDataObject()->GetMatrix();
-
-    stddevition.SetSize(stdMatrix.size());
-    for (unsigned int i = 0; i < stdMatrix.size(); i++)
-      stddevition[i] = stdMatrix(0,i);
-  }
-  catch (const std::exception& e1)
-  {
-    logger.WriteError("Error in reading the file: " + modeldirectory + "/EGFRvIII_ZScore_Std.csv. Error code : " + std::string(e1.what()));
     return results;
   }
+  const VariableLengthVectorType mean = mModelContainer.GetVector("EGFRvIII_ZScore_Mean");
+  const VariableLengthVectorType stddevition = mModelContainer.GetVector("EGFRvIII_ZScore_Std");
   //----------------------------------------------------
   ImageType::Pointer NEGAtlasImagePointer = ReadNiftiImage<ImageType>(getCaPTkDataDir() + "egfrv3/EGFRneg.nii.gz");
   ImageType::Pointer POSAtlasImagePointer = ReadNiftiImage<ImageType>(getCaPTkDataDir() + "egfrv3/EGFRpos.nii.gz");
@@ -726,10 +673,12 @@ VectorDouble EGFRvIIIIndexPredictor::EGFRvIIIPredictionOnExistingModel(const std
     std::ofstream myfile;
     myfile.open(outputdirectory + "/results.csv");
     myfile << "SubjectName,Result \n";
-    if (cbica::fileExists(modeldirectory + "/EGFRvIII_SVM_Model.csv") == true)
+    const auto linearModel = mModelContainer.GetArray("EGFRvIII_SVM_Model");
+    const auto serializedModel = mModelContainer.GetMetadata(mTrainedFile);
+    if (linearModel.data != nullptr)
     {
       VariableLengthVectorType result;
-      result = DistanceFunctionLinear(ModelSelectedFeatures, modeldirectory + "/EGFRvIII_SVM_Model.csv", -0.9925,2);
+      result = DistanceFunctionLinear(ModelSelectedFeatures, linearModel, -0.9925,2);
       for (size_t i = 0; i < result.Size(); i++)
       {
         std::map<CAPTK::ImageModalityType, std::string> currentsubject = qualifiedsubjects[i];
@@ -740,10 +689,10 @@ VectorDouble EGFRvIIIIndexPredictor::EGFRvIIIPredictionOnExistingModel(const std
         results.push_back(result[i]);
       }
     }
-    else if (cbica::fileExists(modeldirectory + "/EGFRvIII_SVM_Model.xml") == true)
+    else if (!serializedModel.empty())
     {
       VectorDouble result;
-      result = testOpenCVSVM(ModelSelectedFeatures, modeldirectory + "/EGFRvIII_SVM_Model.xml");
+      result = testLoadedOpenCVSVM(ModelSelectedFeatures, cv::Algorithm::loadFromString< cv::ml::SVM >(serializedModel));
       results = result;
       for (size_t i = 0; i < result.size(); i++)
       {
@@ -765,6 +714,22 @@ VectorDouble EGFRvIIIIndexPredictor::EGFRvIIIPredictionOnExistingModel(const std
 
 }
 
+bool EGFRvIIIIndexPredictor::LoadModelContainer(const std::string &modeldirectory)
+{
+  std::vector< std::string > modelFiles = { "EGFRvIII_ZScore_Mean.csv", "EGFRvIII_ZScore_Std.csv" };
+  modelFiles.push_back(cbica::isFile(modeldirectory + "/EGFRvIII_SVM_Model.csv") ? "EGFRvIII_SVM_Model.csv" : mTrainedFile);
+  if (!mModelContainer.ReadModelDirectory(modeldirectory, mTrainedModelNameContainer, modelFiles, "EGFRvIIIIndexPredictor"))
+  {
+    logger.WriteError("Model files could not be read: " + mModelContainer.GetLastEncounteredError());
+    return false;
+  }
+  if (!mModelContainer.GetLastEncounteredError().empty())
+  {
+    logger.Write("Model container could not be written: " + mModelContainer.GetLastEncounteredError());
+  }
+  return true;
+}
+
 VariableSizeMatrixType EGFRvIIIIndexPredictor::SelectModelFeatures(const VariableSizeMatrixType &ModelFeatures)
 {
   int selectedFeatures[7] = { 1,2,3,4,54,420,421};
@@ -23,6 +23,7 @@ See COPYING file or https://www.med.upenn.edu/sbia/software/license.html
 #include "FeatureExtractionClass.h"
 #include "cbicaLogging.h"
 #include "CaPTkEnums.h"
+#include "ModelContainer.h"
 #include "itkCSVArray2DFileReader.h"
 #include "itkImageFileReader.h"
 #include "itkRescaleIntensityImageFilter.h"
@@ -76,6 +77,7 @@ public:
   EGFRvIIIIndexPredictor()
   {
     mTrainedFile = "EGFRvIII_SVM_Model.xml";
+    mTrainedModelNameContainer = std::string("EGFRvIII_Model") + MODEL_CONTAINER_EXT;
     logger.UseNewFile(loggerFile);
   }
 
@@ -83,6 +85,8 @@ public:
   ~EGFRvIIIIndexPredictor() {};
 
   std::string mTrainedFile;
+  std::string mTrainedModelNameContainer;
+  ModelContainer mModelContainer;
   FeatureExtractionClass mFeatureExtractionLocalPtr;
   FeatureScalingClass mFeatureScalingLocalPtr;
   cbica::Logging logger;
@@ -272,7 +276,16 @@ public:
   template<class ImageType>
   typename ImageType::Pointer RemoveSmallerComponentsFromTumor(const typename ImageType::Pointer &etumorImage, const typename ImageType::Pointer &ncrImage);
 
-  VariableLengthVectorType DistanceFunctionLinear(const VariableSizeMatrixType &testData, const std::string &filename, const double &rho, const double &bestg);
+  /**
+  \brief Loads the model container (z-scores and SVM) from the model directory
+
+  CSV and XML model files without a container, or newer than it, are converted first.
+  \return True if mModelContainer holds the model after the call
+  */
+  bool LoadModelContainer(const std::string &modeldirectory);
+
+  //! Distances from a linear SVM stored as support vectors with their coefficients in the last column
+  VariableLengthVectorType DistanceFunctionLinear(const VariableSizeMatrixType &testData, const ModelContainer::ArrayEntry &model, const double &rho, const double &bestg);
   VectorDouble CombineEstimates(const VariableLengthVectorType &estimates1, const VariableLengthVectorType &estimates2);
   VectorDouble CombineEstimates(const VectorDouble &estimates1, const VectorDouble &estimates2);
 
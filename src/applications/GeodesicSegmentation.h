@@ -36,13 +36,17 @@ See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
 //#include "fProgressDialog.h"
 
 //#include "PreprocessingPipelineClass.h"
-#ifdef APP_BASE_CAPTK_H
-#include "ApplicationBase.h"
-#endif
 //#include "CAPTk.h"
 #include "CaPTkDefines.h"
 #include "cbicaLogging.h"
 #include "itkNeighborhoodIterator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <vector>
 //#include <vector>
 //#include "cbicaLogging.h"
 //using VectorVectorDouble = std::vector< std::vector < double > >;
@@ -55,6 +59,11 @@ const int MAX_VAL = /*static_cast<int>(_I32_MAX)*/100000; // maximum possible Ge
 
 \brief Applies an adaptive Geodesic filter to image
 
+The forward and backward passes run on the raw image buffers, pipelined over the slices on multiple threads
+(a slice processes a row once the previous slice has finished the next row, so the result is the same as the sequential sweeps).
+The class has no GUI dependency: progress is reported through GetProgress() (safe to poll from another thread while Run() executes)
+and through an optional callback, called by the thread that runs Run().
+
 Reference:
 
 @inproceedings{gaonkar2014adaptive,
@@ -67,15 +76,15 @@ organization={International Society for Optics and Photonics}
 }
 */
 template< class ImageTypeGeodesic = ImageTypeShort3D >
-class GeodesicSegmentation 
-#ifdef APP_BASE_CAPTK_H
-  : public ApplicationBase
-#endif
+class GeodesicSegmentation
 {
 public:
+  typedef typename ImageTypeGeodesic::PixelType PixelType;
+
   explicit GeodesicSegmentation()
   {
     m_maxVal = /*std::numeric_limits< typename ImageTypeGeodesic::PixelType >::max()*/100000;
+    m_progress = 0;
   }
 
   virtual ~GeodesicSegmentation()
@@ -88,6 +97,34 @@ public:
     
   }
 
+  //! Number of threads for the passes (0 is the hardware concurrency)
+  void SetNumberOfThreads(int numberOfThreads)
+  {
+    m_numberOfThreads = std::max(0, numberOfThreads);
+  }
+
+  /**
+  \brief Stops the propagation early: only the voxels at most 'threshold' voxels away from the points are computed (the rest stay 0)
+
+  Every step of a path costs at least 1, so the voxels closer than the threshold (in geodesic distance) get the same values as without it; 0 disables it
+  */
+  void SetThreshold(double threshold)
+  {
+    m_threshold = std::max(0.0, threshold);
+  }
+
+  //! Called with the progress (0-100) at the end of every stage, by the thread that runs Run()
+  void SetProgressCallback(std::function< void(int) > callback)
+  {
+    m_progressCallback = callback;
+  }
+
+  //! Current progress (0-100), can be polled from another thread
+  int GetProgress() const
+  {
+    return m_progress.load();
+  }
+
   //template<class ImageTypeGeodesic = ImageTypeShort3D >
   typename ImageTypeGeodesic::Pointer Run(typename ImageTypeGeodesic::Pointer Inp, VectorVectorDouble &tumorPoints)
   {
@@ -105,17 +142,7 @@ public:
   typename ImageTypeGeodesic::Pointer Run(typename ImageTypeGeodesic::Pointer Inp, typename ImageTypeGeodesic::Pointer MaskImage, VectorVectorDouble &tumorPoints)
   {
     //--------------allocate a few images ------------------------
-#ifdef APP_BASE_CAPTK_H
-    messageUpdate("Geodesic Segmentation");
-    progressUpdate(0);
-#endif
-
-    //typename ImageTypeGeodesic::Pointer Init = ImageTypeGeodesic::New();
-    //Init->CopyInformation(Inp);
-    //Init->SetRequestedRegion(Inp->GetLargestPossibleRegion());
-    //Init->SetBufferedRegion(Inp->GetBufferedRegion());
-    //Init->Allocate();
-    //Init->FillBuffer(0);
+    setProgress(0);
 
     typename ImageTypeGeodesic::Pointer Geos = ImageTypeGeodesic::New();
     Geos->CopyInformation(Inp);
@@ -124,28 +151,35 @@ public:
     Geos->Allocate();
     Geos->FillBuffer(0);
 
-    typename ImageTypeGeodesic::Pointer Gamma = ImageTypeGeodesic::New();
-    Gamma->CopyInformation(Inp);
-    Gamma->SetRequestedRegion(Inp->GetLargestPossibleRegion());
-    Gamma->SetBufferedRegion(Inp->GetBufferedRegion());
-    Gamma->Allocate();
-    Gamma->FillBuffer(1);
-
-    typename ImageTypeGeodesic::Pointer tumorMask = ImageTypeGeodesic::New();
-    tumorMask->CopyInformation(Inp);
-    tumorMask->SetRequestedRegion(Inp->GetLargestPossibleRegion());
-    tumorMask->SetBufferedRegion(Inp->GetBufferedRegion());
-    tumorMask->Allocate();
-    tumorMask->FillBuffer(0);
-
-#ifdef APP_BASE_CAPTK_H
-    progressUpdate(10);
-    qApp->processEvents();
-#endif
-
+    setProgress(10);
 
     //---------------calculation of initial mask--------------------------
-    typedef itk::ImageRegionIteratorWithIndex <ImageTypeGeodesic> IteratorType;
+    auto size = Inp->GetLargestPossibleRegion().GetSize();
+    int box[3][2]; // region that is computed, [axis][first, last]
+    for (unsigned int d = 0; d < 3; d++)
+    {
+      box[d][0] = 0;
+      box[d][1] = static_cast<int>(size[d]) - 1;
+    }
+    if (m_threshold > 0 && !tumorPoints.empty())
+    {
+      const int reach = static_cast<int>(std::ceil(m_threshold));
+      for (unsigned int d = 0; d < 3; d++)
+      {
+        box[d][0] = box[d][1];
+        box[d][1] = 0;
+      }
+      for (unsigned int i = 0; i < tumorPoints.size(); i++)
+      {
+        for (unsigned int d = 0; d < 3; d++)
+        {
+          const int coordinate = static_cast<int>(tumorPoints[i][d]);
+          box[d][0] = std::min(box[d][0], std::max(coordinate - reach, 0));
+          box[d][1] = std::max(box[d][1], std::min(coordinate + reach, static_cast<int>(size[d]) - 1));
+        }
+      }
+    }
+
     for (unsigned int i = 0; i < tumorPoints.size(); i++)
     {
       // get index from the input points
@@ -154,141 +188,20 @@ public:
       index[1] = tumorPoints[i][1];
       index[2] = tumorPoints[i][2];
 
-      // initialize the mask and geodesic images 
-      //Init->SetPixel(index, static_cast<typename ImageTypeGeodesic::PixelType>(255));
+      // initialize the geodesic image
       Geos->SetPixel(index, static_cast<typename ImageTypeGeodesic::PixelType>(m_maxVal));
     }
-#ifdef APP_BASE_CAPTK_H
-    progressUpdate(20);
-    qApp->processEvents();
-#endif
+    setProgress(20);
 
     //---------------------------actual geodesic segmentation--------------------------
-    typedef itk::ImageRegionIteratorWithIndex <ImageTypeGeodesic> IteratorType;
-    IteratorType GeosIt(Geos, Geos->GetLargestPossibleRegion());
-    IteratorType GamIt(Gamma, Gamma->GetLargestPossibleRegion());
-    IteratorType MaskIt(MaskImage, MaskImage->GetLargestPossibleRegion());
-
-#ifdef APP_BASE_CAPTK_H
-    progressUpdate(22);
-    qApp->processEvents();
-#endif
-
-    //Setting up the neighborhood iterator
-    typename ImageTypeGeodesic::SizeType radius;
-    radius[0] = 1;
-    radius[1] = 1;
-    radius[2] = 1;
-    itk::NeighborhoodIterator<ImageTypeGeodesic> ResNIt(radius, Geos, Geos->GetLargestPossibleRegion());
-    itk::NeighborhoodIterator<ImageTypeGeodesic> InpNIt(radius, Inp, Inp->GetLargestPossibleRegion());
-
-    //The main loops
     cbica::Logging(loggerFile, "Main loops execution : Forward pass");
+    sweep(Inp->GetBufferPointer(), MaskImage->GetBufferPointer(), Geos->GetBufferPointer(), size, box, true, 20, 55);
+    setProgress(55);
 
-    MaskIt.GoToBegin();
-
-#ifdef APP_BASE_CAPTK_H
-    progressUpdate(25);
-    qApp->processEvents();
-#endif
-
-    while (!MaskIt.IsAtEnd())
-    {
-      if (MaskIt.Get() > 1)
-      {
-        GamIt.SetIndex(MaskIt.GetIndex());
-        GeosIt.SetIndex(MaskIt.GetIndex());
-
-        double C_f_arr[14];
-
-        // forward pass
-        C_f_arr[13] = GeosIt.Get();
-        C_f_arr[0] = ResNIt.GetPixel(4) + sqrt(1.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(4))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(4))));
-        C_f_arr[1] = ResNIt.GetPixel(10) + sqrt(1.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(10))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(10))));
-        C_f_arr[2] = ResNIt.GetPixel(12) + sqrt(1.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(12))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(12))));
-        C_f_arr[3] = ResNIt.GetPixel(1) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(1))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(1))));
-        C_f_arr[4] = ResNIt.GetPixel(3) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(3))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(3))));
-        C_f_arr[5] = ResNIt.GetPixel(9) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(9))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(9))));
-        C_f_arr[6] = ResNIt.GetPixel(0) + sqrt(3.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(0))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(0))));
-        C_f_arr[7] = ResNIt.GetPixel(7) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(7))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(7))));
-        C_f_arr[8] = ResNIt.GetPixel(6) + sqrt(3.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(6))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(6))));
-        C_f_arr[9] = ResNIt.GetPixel(15) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(15))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(15))));
-        C_f_arr[10] = ResNIt.GetPixel(24) + sqrt(3.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(24))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(24))));
-        C_f_arr[11] = ResNIt.GetPixel(21) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(21))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(21))));
-        C_f_arr[12] = ResNIt.GetPixel(18) + sqrt(3.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(18))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(18))));
-
-        double minval = m_maxVal * 200;
-        for (int i = 0; i < 14; ++i)
-        {
-          if (C_f_arr[i] < minval)
-            minval = C_f_arr[i];
-        }
-
-        GeosIt.Set(minval);
-      }
-      ++MaskIt;
-      ++ResNIt;
-      ++InpNIt;
-    }
-#ifdef APP_BASE_CAPTK_H
-    progressUpdate(55);
-    qApp->processEvents();
-#endif
-
-    MaskIt.GoToReverseBegin();
-    ResNIt.GoToEnd();
-    InpNIt.GoToEnd();
-    --ResNIt;
-    --InpNIt;
     cbica::Logging(loggerFile, "Main loops execution : Backward pass");
+    sweep(Inp->GetBufferPointer(), MaskImage->GetBufferPointer(), Geos->GetBufferPointer(), size, box, false, 55, 90);
+    setProgress(90);
 
-    while (!MaskIt.IsAtReverseEnd())
-    {
-      if (MaskIt.Get() > 1)
-      {
-        GamIt.SetIndex(MaskIt.GetIndex());
-        GeosIt.SetIndex(MaskIt.GetIndex());
-
-        double C_b_arr[14];
-        C_b_arr[13] = GeosIt.Get();
-        C_b_arr[0] = ResNIt.GetPixel(22) + sqrt(1.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(22))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(22))));
-        C_b_arr[1] = ResNIt.GetPixel(16) + sqrt(1.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(16))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(16))));
-        C_b_arr[2] = ResNIt.GetPixel(14) + sqrt(1.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(14))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(14))));
-        C_b_arr[3] = ResNIt.GetPixel(25) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(25))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(25))));
-        C_b_arr[4] = ResNIt.GetPixel(23) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(23))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(23))));
-        C_b_arr[5] = ResNIt.GetPixel(17) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(17))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(17))));
-        C_b_arr[6] = ResNIt.GetPixel(26) + sqrt(3.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(26))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(26))));
-        C_b_arr[7] = ResNIt.GetPixel(19) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(19))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(19))));
-        C_b_arr[8] = ResNIt.GetPixel(20) + sqrt(3.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(20))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(20))));
-        C_b_arr[9] = ResNIt.GetPixel(11) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(11))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(11))));
-        C_b_arr[10] = ResNIt.GetPixel(2) + sqrt(3.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(2))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(2))));
-        C_b_arr[11] = ResNIt.GetPixel(5) + sqrt(2.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(5))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(5))));
-        C_b_arr[12] = ResNIt.GetPixel(8) + sqrt(3.0 + GamIt.Get()*((InpNIt.GetPixel(13) - InpNIt.GetPixel(8))*(InpNIt.GetPixel(13) - InpNIt.GetPixel(8))));
-        double minval = m_maxVal * 200;
-        for (int i = 0; i < 14; ++i)
-        {
-          if (C_b_arr[i] < minval)
-            minval = C_b_arr[i];
-        }
-
-        if (minval >= m_maxVal)
-        {
-          GeosIt.Set(0);
-        }
-        else
-        {
-          GeosIt.Set(minval);
-        }
-      }
-      --MaskIt;
-      --ResNIt;
-      --InpNIt;
-    }
-
-#ifdef APP_BASE_CAPTK_H
-    progressUpdate(90);
-    qApp->processEvents();
-#endif
     //------------------------------geodesic thresholding-----------------------------
     //typedef itk::MinimumMaximumImageCalculator <ImageTypeGeodesic> ImageCalculatorFilterType;
     //typename ImageCalculatorFilterType::Pointer imageCalculatorFilter = ImageCalculatorFilterType::New();
@@ -334,10 +247,7 @@ public:
     //connected->SetInput(binaryThresholdFilter->GetOutput());
     //connected->Update();
 
-#ifdef APP_BASE_CAPTK_H
-    progressUpdate(100);
-    qApp->processEvents();
-#endif
+    setProgress(100);
 
     cleanUp();
     return Geos;
@@ -350,7 +260,159 @@ private:
 
   }
 
+  //! Neighbour of the forward pass mask (the backward pass uses the mirrored ones) and its squared spatial distance
+  typedef struct Neighbour
+  {
+    int dx, dy, dz;
+    double squaredDistance;
+  } Neighbour;
+
+  //! Type of the difference of two pixels (int for integer pixel types, as in the original per-voxel expressions)
+  typedef decltype(PixelType() - PixelType()) DifferenceType;
+
+  void setProgress(int progress)
+  {
+    m_progress = progress;
+    if (m_progressCallback)
+    {
+      m_progressCallback(progress);
+    }
+  }
+
+  /**
+  \brief One pass over the box (updates Geos in place)
+
+  \param forward forward or backward pass
+  \param progressStart, progressEnd range of GetProgress() during the pass
+  */
+  void sweep(const PixelType* input, const PixelType* mask, PixelType* geos, const typename ImageTypeGeodesic::SizeType &size,
+    const int box[3][2], bool forward, int progressStart, int progressEnd)
+  {
+    const Neighbour forwardMask[13] = {
+      {  0,  0, -1, 1.0 }, {  0, -1,  0, 1.0 }, { -1,  0,  0, 1.0 }, {  0, -1, -1, 2.0 },
+      { -1,  0, -1, 2.0 }, { -1, -1,  0, 2.0 }, { -1, -1, -1, 3.0 }, {  0,  1, -1, 2.0 },
+      { -1,  1, -1, 3.0 }, { -1,  1,  0, 2.0 }, { -1,  1,  1, 3.0 }, { -1,  0,  1, 2.0 },
+      { -1, -1,  1, 3.0 }
+    };
+    const int sign = forward ? 1 : -1;
+    const int sizeX = static_cast<int>(size[0]), sizeY = static_cast<int>(size[1]), sizeZ = static_cast<int>(size[2]);
+    const size_t sliceStride = static_cast<size_t>(sizeX) * sizeY;
+
+    Neighbour neighbours[13];
+    std::ptrdiff_t offsets[13];
+    for (int i = 0; i < 13; i++)
+    {
+      neighbours[i] = { sign * forwardMask[i].dx, sign * forwardMask[i].dy, sign * forwardMask[i].dz, forwardMask[i].squaredDistance };
+      offsets[i] = neighbours[i].dx + static_cast<std::ptrdiff_t>(neighbours[i].dy) * sizeX + static_cast<std::ptrdiff_t>(neighbours[i].dz) * sliceStride;
+    }
+
+    const int slices = box[2][1] - box[2][0] + 1, rows = box[1][1] - box[1][0] + 1;
+    if (slices <= 0 || rows <= 0 || box[0][1] < box[0][0])
+    {
+      return;
+    }
+
+    int numberOfThreads = (m_numberOfThreads > 0) ? m_numberOfThreads : static_cast<int>(std::thread::hardware_concurrency());
+    numberOfThreads = std::max(1, std::min(numberOfThreads, slices));
+
+    // Rows finished for each slice (in sweep order)
+    std::vector< std::atomic< int > > rowsDone(slices);
+    for (int s = 0; s < slices; s++)
+    {
+      rowsDone[s].store(0);
+    }
+    std::atomic< int > slicesDone(0);
+
+    auto sweepRow = [&](int y, int z)
+    {
+      const bool interiorRow = (y > 0 && y < sizeY - 1 && z > 0 && z < sizeZ - 1);
+
+      for (int c = box[0][0]; c <= box[0][1]; c++)
+      {
+        const int x = forward ? c : box[0][0] + box[0][1] - c;
+        const size_t idx = z * sliceStride + static_cast<size_t>(y) * sizeX + x;
+
+        if (!(mask[idx] > 1))
+        {
+          continue;
+        }
+
+        const PixelType center = input[idx];
+        double minval = m_maxVal * 200;
+        minval = std::min(minval, static_cast<double>(geos[idx]));
+
+        for (int i = 0; i < 13; i++)
+        {
+          size_t n = idx + offsets[i];
+          if (!interiorRow || x == 0 || x == sizeX - 1)
+          {
+            // Clamped to the image, as the zero flux boundary condition of the neighborhood iterators
+            const int nx = std::min(std::max(x + neighbours[i].dx, 0), sizeX - 1);
+            const int ny = std::min(std::max(y + neighbours[i].dy, 0), sizeY - 1);
+            const int nz = std::min(std::max(z + neighbours[i].dz, 0), sizeZ - 1);
+            n = nz * sliceStride + static_cast<size_t>(ny) * sizeX + nx;
+          }
+          const DifferenceType difference = center - input[n];
+          const double candidate = geos[n] + sqrt(neighbours[i].squaredDistance + difference * difference);
+          if (candidate < minval)
+          {
+            minval = candidate;
+          }
+        }
+
+        if (!forward && minval >= m_maxVal)
+        {
+          geos[idx] = 0;
+        }
+        else
+        {
+          geos[idx] = static_cast<PixelType>(minval);
+        }
+      }
+    };
+
+    auto sweepSlices = [&](int firstSlice)
+    {
+      for (int s = firstSlice; s < slices; s += numberOfThreads)
+      {
+        const int z = forward ? box[2][0] + s : box[2][1] - s;
+
+        for (int r = 0; r < rows; r++)
+        {
+          if (s > 0)
+          {
+            // The previous slice must be done with the rows up to (and including) the next one
+            const int needed = std::min(r + 2, rows);
+            while (rowsDone[s - 1].load(std::memory_order_acquire) < needed)
+            {
+              std::this_thread::yield();
+            }
+          }
+          sweepRow(forward ? box[1][0] + r : box[1][1] - r, z);
+          rowsDone[s].store(r + 1, std::memory_order_release);
+        }
+
+        m_progress = progressStart + (progressEnd - progressStart) * (++slicesDone) / slices;
+      }
+    };
+
+    std::vector< std::thread > threads;
+    for (int t = 1; t < numberOfThreads; t++)
+    {
+      threads.push_back(std::thread(sweepSlices, t));
+    }
+    sweepSlices(0);
+    for (auto &thread : threads)
+    {
+      thread.join();
+    }
+  }
+
   double m_maxVal;
+  double m_threshold = 0;
+  int m_numberOfThreads = 0;
+  std::atomic< int > m_progress;
+  std::function< void(int) > m_progressCallback;
 
   //typename ImageTypeGeodesic::Pointer Init, Geos, Gamma, tumorMask
 
@@ -17,14 +17,16 @@ std::string    loggerFile;
 bool           loggerRequested = false;
 
 bool        timerEnabled = false, closeWindow = true, includeDateTime = true, maxThreads = false, loiSet = false, subsample = true, 
-            balancedSubsample = GeodesicTrainingSegmentation::DEFAULT_BALANCED_SUBSAMPLE;
+            balancedSubsample = GeodesicTrainingSegmentation::DEFAULT_BALANCED_SUBSAMPLE, rfUseOpenCV = false;
 short       imageDimensions = 3;
 float       threshold = GeodesicTrainingSegmentation::DEFAULT_THRESHOLD, 
-            inputImagesToAgdMapsRatio = GeodesicTrainingSegmentation::DEFAULT_INPUT_IMAGES_TO_AGD_MAPS_RATIO;
+            inputImagesToAgdMapsRatio = GeodesicTrainingSegmentation::DEFAULT_INPUT_IMAGES_TO_AGD_MAPS_RATIO,
+            agdMaximumDistance = 0;
 int         tempPosition, numberOfThreads = 16, maxSamplesForSubsample = GeodesicTrainingSegmentation::DEFAULT_MAX_SAMPLES_SVM_SUBSAMPLE,
             labelOfInterest = GeodesicTrainingSegmentation::DEFAULT_LABEL_OF_INTEREST,
             labelTC = GeodesicTrainingSegmentation::DEFAULT_LABEL_TC, labelET = GeodesicTrainingSegmentation::DEFAULT_LABEL_ET,
-            labelED = GeodesicTrainingSegmentation::DEFAULT_LABEL_ED, labelHT = GeodesicTrainingSegmentation::DEFAULT_LABEL_HT;
+            labelED = GeodesicTrainingSegmentation::DEFAULT_LABEL_ED, labelHT = GeodesicTrainingSegmentation::DEFAULT_LABEL_HT,
+            coarseToFineFactor = GeodesicTrainingSegmentation::DEFAULT_COARSE_TO_FINE_FACTOR, coarseToFineBandRadius = 0;
 std::string labelsPath = "", mode = DEFAULT_MODE, outputDir = "./", configFilePath = "", rfConfigFilePath = "",
             datasetName = "", tag = "", pixelType = "float", groundTruthPath = "",
             flairPath = "", t1Path = "", t1cePath = "", t2Path = "";
@@ -108,12 +110,19 @@ int main(int argc, char *argv[])
 	parser.addOptionalParameter("lht", "labelht", cbica::Parameter::STRING, "int", "Label for healthy tissue (For MRI images only)");
 	parser.addOptionalParameter("loi", "labelofinterest", cbica::Parameter::STRING, "int", "Label of interest.",
 		"Default is 1.", "Any other non-zero label can be used for areas that are not of interest.");
+	parser.addOptionalParameter("rcv", "rfopencv", cbica::Parameter::STRING, "-", "Use the OpenCV random forest instead of the parallel one (RF modes)");
 	parser.addOptionalParameter("ns", "nosubsample", cbica::Parameter::STRING, "-", "Option to not subsample if the number of samples is high (SVM)");
 	//parser.addOptionalParameter("ir", "imagestoagdratio", cbica::Parameter::STRING, "int", "Input images to AGD maps ratio (default is 6)",
 	//	"The bigger the value, the bigger the effect of", "the input images compared to the AGD maps");
-	parser.addOptionalParameter("ms", "maxsamples", cbica::Parameter::STRING, "int", "Max samples to use (SVM Subsampling)");
+	parser.addOptionalParameter("ms", "maxsamples", cbica::Parameter::STRING, "int", "Max samples to use (SVM Subsampling)", "0 uses every labeled voxel.");
 	parser.addOptionalParameter("nb", "nobalancesamples", cbica::Parameter::STRING, "int", "Don't balance the subsampling (SVM Subsampling)");
 	//parser.addOptionalParameter("pt", "pixeltype", cbica::Parameter::STRING, "string", "Input image(s) pixel type (int or float) [default is float]");
+	parser.addOptionalParameter("cf", "coarsetofine", cbica::Parameter::STRING, "int", "Segment at this downsampling factor first (reversegeotrain)",
+		"and then only the boundaries between the classes at full resolution.", "Default is 1 (disabled).");
+	parser.addOptionalParameter("cfr", "coarsetofineradius", cbica::Parameter::STRING, "int", "Width in voxels of the band around the boundaries",
+		"that is segmented at full resolution (coarse to fine).", "Default is the downsampling factor.");
+	parser.addOptionalParameter("amd", "agdmaxdistance", cbica::Parameter::STRING, "float", "Propagate the AGD maps from the seeds only up to this geodesic distance",
+		"Voxels further away keep the maximum distance.", "Default is 0 (full volume).");
 	parser.addOptionalParameter("id", "imagedimensions", cbica::Parameter::STRING, "int", "Input image(s) dimensions [only 3D supported for now]");
 
 	// Parameters parsing
@@ -258,6 +267,10 @@ int main(int argc, char *argv[])
 		loiSet = true;
 		labelOfInterest = std::stoi(argv[tempPosition + 1]);
 	}
+	if (parser.compareParameter("rcv", tempPosition)) {
+		// OpenCV random forest
+		rfUseOpenCV = true;
+	}
 	if (parser.compareParameter("ns", tempPosition)) {
 		// No subsample
 		subsample = false;
@@ -278,6 +291,18 @@ int main(int argc, char *argv[])
 	//	// Input image(s) pixel type (short, float or int)
 	//	pixelType = argv[tempPosition + 1];
 	//}
+	if (parser.compareParameter("cf", tempPosition)) {
+		// Coarse to fine downsampling factor
+		coarseToFineFactor = std::stoi(argv[tempPosition + 1]);
+	}
+	if (parser.compareParameter("cfr", tempPosition)) {
+		// Coarse to fine band radius
+		coarseToFineBandRadius = std::stoi(argv[tempPosition + 1]);
+	}
+	if (parser.compareParameter("amd", tempPosition)) {
+		// AGD maximum propagation distance
+		agdMaximumDistance = std::stof(argv[tempPosition + 1]);
+	}
 	if (parser.compareParameter("id", tempPosition)) {
 		// Input image(s) dimensions
 		imageDimensions = std::stoi(argv[tempPosition + 1]);
@@ -412,6 +437,7 @@ void RunGeodesicTraining()
 	geodesicTraining.SetLabels(labelsPath);
 	geodesicTraining.SetConfigFile(configFilePath);     // For modes that use SVMs
 	geodesicTraining.SetRfConfigFile(rfConfigFilePath); // For modes that use RFs
+	geodesicTraining.SetRfUseOpenCV(rfUseOpenCV);       // For modes that use RFs
 	geodesicTraining.SetGroundTruth(groundTruthPath, groundTruthSkip);
 	geodesicTraining.SetChangeLabelsMap(changeLabelsMap);
 	geodesicTraining.SetThreshold(threshold);
@@ -422,6 +448,9 @@ void RunGeodesicTraining()
 	geodesicTraining.SetNumberOfThreads(numberOfThreads);
 	geodesicTraining.SetNumberOfThreadsMax(maxThreads);
 	geodesicTraining.SetSubsampling(subsample, maxSamplesForSubsample);
+	geodesicTraining.SetBalancedSubsampling(balancedSubsample);
+	geodesicTraining.SetCoarseToFine(coarseToFineFactor, coarseToFineBandRadius); // For mode "reversegeotrain"
+	geodesicTraining.SetAgdMaximumDistance(agdMaximumDistance);
 	geodesicTraining.SetPretrainedModelsPaths(inputModels); // For mode "generateconfig"
 	geodesicTraining.SetImportanceValues(importanceValues); // For mode "generateconfig"
 
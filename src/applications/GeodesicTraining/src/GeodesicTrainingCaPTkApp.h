@@ -7,6 +7,7 @@
 #include <string>
 
 #include "GeodesicTrainingSegmentation.h"
+#include "GeodesicTrainingSession.h"
 
 //#include "ApplicationBase.h"
 #include <QObject>
@@ -39,7 +40,7 @@ protected:
 template<unsigned int Dimensions = 3>
 class GeodesicTrainingCaPTkApp :
 	public GeodesicTrainingApplicationBase,
-	public GeodesicTrainingSegmentation::Coordinator<float, Dimensions>
+	public GeodesicTrainingSegmentation::Session<float, Dimensions>
 {
 public:
     typedef itk::Image<float, Dimensions>     InputImageType;
@@ -51,11 +52,15 @@ public:
 
 	virtual ~GeodesicTrainingCaPTkApp() {}
 
-    /** Executes the algorithm in a background thread */
-    void Run(std::vector<InputImagePointer> inputImages, LabelsImagePointer labelsImage)
+    /**
+    Executes the algorithm in a background thread.
+    Runs on the same image set (same sessionKey) continue the session: labelsImage is the last
+    segmentation with the corrections of the user, and the maps/models in memory are reused.
+    */
+    void Run(std::vector<InputImagePointer> inputImages, LabelsImagePointer labelsImage, std::string sessionKey = "")
     {
         this->Cancel(); // In case it was already running
-		m_Thread = std::thread(&GeodesicTrainingCaPTkApp<Dimensions>::worker, this, inputImages, labelsImage);
+		m_Thread = std::thread(&GeodesicTrainingCaPTkApp<Dimensions>::worker, this, inputImages, labelsImage, sessionKey);
     }
 
 	/** Overriden from GeodesicTrainingSegmentation class */
@@ -67,14 +72,19 @@ public:
 private:
 
     /** The actual background thread */
-    void worker(std::vector<InputImagePointer> inputImages, LabelsImagePointer labelsImage)
+    void worker(std::vector<InputImagePointer> inputImages, LabelsImagePointer labelsImage, std::string sessionKey)
     {
-        this->SetInputImages(inputImages);
-        this->SetLabels(labelsImage);
-		this->SetSaveAll(true);
-        auto executeResult = this->Execute();
+		this->Open(inputImages, sessionKey);
+		this->SetSaveAll(false); // The intermediate images stay in memory
+        auto executeResult = this->Update(labelsImage);
+
+        if (!executeResult) {
+            emit GeodesicTrainingFinishedWithError(QString("Geodesic Training Segmentation failed"));
+        }
+        else if (executeResult->ok) {
+			// Only the segmentation is needed (for loading it as a ROI)
+			cbica::WriteImage<LabelsImageType>(executeResult->labelsImage, this->GetOutputPath() + "/labels_res.nii.gz");
 
-        if (executeResult->ok) {
             /*if (Dimensions == 3) { emit GeodesicTrainingFinished3D( executeResult->labelsImage ); }
             else {                 emit GeodesicTrainingFinished2D( executeResult->labelsImage ); }*/
         
@@ -13,6 +13,11 @@ See COPYING file or https://www.med.upenn.edu/sbia/software/license.html
 
 #include <iostream>
 #include <limits.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
 
 #include "itkImage.h"
 #include "itkConnectedThresholdImageFilter.h"
@@ -57,19 +62,542 @@ namespace AdaptiveGeodesicDistance
 		return static_cast<double>(x) * x;
 	}
 
+	/*For internal use: one neighbour of the chamfer mask and its (squared) spatial distance*/
+	typedef struct ChamferNeighbour {
+		int dx, dy, dz;
+		double squaredDistance;
+	} ChamferNeighbour;
+
+	/*For internal use: the neighbours used by the forward pass (the backward pass uses the mirrored ones)*/
+	inline std::vector<ChamferNeighbour> ForwardChamferMask(unsigned int dimensions)
+	{
+		if (dimensions == 2) {
+			return { { -1, -1, 0, 2.0 }, { 0, -1, 0, 1.0 }, { 1, -1, 0, 2.0 }, { -1, 0, 0, 1.0 } };
+		}
+		return {
+			{  0,  0, -1, 1.0 }, {  0, -1,  0, 1.0 }, { -1,  0,  0, 1.0 }, {  0, -1, -1, 2.0 },
+			{ -1,  0, -1, 2.0 }, { -1, -1,  0, 2.0 }, { -1, -1, -1, 3.0 }, {  0,  1, -1, 2.0 },
+			{ -1,  1, -1, 3.0 }, { -1,  1,  0, 2.0 }, { -1,  1,  1, 3.0 }, { -1,  0,  1, 2.0 },
+			{ -1, -1,  1, 3.0 }
+		};
+	}
+
+	/**
+	Runs the forward and the backward chamfer sweeps of AGD on raw buffers (x fastest, then y, then z).
+	The neighbour offsets are precomputed, and out of bounds neighbours are clamped to the image
+	(the same as the zero flux boundary condition of itk::NeighborhoodIterator).
+	Each sweep is pipelined over the slices: a slice can process a row once the previous slice (in sweep order)
+	has finished the next row, so every voxel reads exactly the values the sequential raster sweep would read.
+	@param input the input image buffer
+	@param skipZeros buffer with the same size as input, for the pixels that are zero no calculation will be done
+	@param output initialized distances (0 at the seeds), updated in place
+	@param size the size of the image in x, y, z (z is 1 for 2D images)
+	@param numberOfThreads how many threads to use for each sweep (0 is the hardware concurrency)
+	*/
+	template <class TImageType>
+	void ChamferSweeps(const typename TImageType::PixelType* input, const typename TImageType::PixelType* skipZeros,
+		typename TImageType::PixelType* output, const int size[3], int numberOfThreads = 0, const bool verbose = false)
+	{
+		typedef typename TImageType::PixelType PixelType;
+
+		const std::vector<ChamferNeighbour> forwardMask = ForwardChamferMask(TImageType::ImageDimension);
+		const int    neighboursCount = static_cast<int>(forwardMask.size());
+		const int    sizeX = size[0], sizeY = size[1], sizeZ = size[2];
+		const size_t sliceStride = static_cast<size_t>(sizeX) * sizeY;
+
+		if (numberOfThreads <= 0) {
+			numberOfThreads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		numberOfThreads = std::max(1, std::min(numberOfThreads, sizeZ));
+
+		for (int pass = 0; pass < 2; pass++)
+		{
+			const int sign = (pass == 0) ? 1 : -1; // Backward pass mirrors the mask and the traversal
+
+			if (verbose) {
+				std::cout << "AdaptiveGeodesicDistance: \t" << ((pass == 0) ? "Forward" : "Backward") << " pass\n";
+			}
+
+			std::vector<ChamferNeighbour> mask(forwardMask);
+			std::vector<std::ptrdiff_t>   offsets(neighboursCount);
+			for (int i = 0; i < neighboursCount; i++) {
+				mask[i].dx *= sign;
+				mask[i].dy *= sign;
+				mask[i].dz *= sign;
+				offsets[i] = mask[i].dx + static_cast<std::ptrdiff_t>(mask[i].dy) * sizeX + static_cast<std::ptrdiff_t>(mask[i].dz) * sliceStride;
+			}
+
+			// Rows finished for each slice (in sweep order)
+			std::vector< std::atomic<int> > rowsDone(sizeZ);
+			for (int s = 0; s < sizeZ; s++) {
+				rowsDone[s].store(0);
+			}
+
+			auto sweepRow = [&](int y, int z)
+			{
+				const bool interiorRow = (y > 0 && y < sizeY - 1 && (sizeZ == 1 || (z > 0 && z < sizeZ - 1)));
+				double candidates[13];
+
+				for (int c = 0; c < sizeX; c++)
+				{
+					const int    x   = (sign > 0) ? c : sizeX - 1 - c;
+					const size_t idx = z * sliceStride + static_cast<size_t>(y) * sizeX + x;
+
+					if (skipZeros[idx] == 0) {
+						continue;
+					}
+
+					const PixelType inpCenterPixel = input[idx];
+
+					if (interiorRow && x > 0 && x < sizeX - 1)
+					{
+						for (int i = 0; i < neighboursCount; i++) {
+							const size_t n = idx + offsets[i];
+							candidates[i] = output[n] + std::sqrt(mask[i].squaredDistance + square<TImageType>(inpCenterPixel - input[n]));
+						}
+					}
+					else
+					{
+						for (int i = 0; i < neighboursCount; i++) {
+							const int nx = std::min(std::max(x + mask[i].dx, 0), sizeX - 1);
+							const int ny = std::min(std::max(y + mask[i].dy, 0), sizeY - 1);
+							const int nz = std::min(std::max(z + mask[i].dz, 0), sizeZ - 1);
+							const size_t n = nz * sliceStride + static_cast<size_t>(ny) * sizeX + nx;
+							candidates[i] = output[n] + std::sqrt(mask[i].squaredDistance + square<TImageType>(inpCenterPixel - input[n]));
+						}
+					}
+
+					double minVal = output[idx];
+					for (int i = 0; i < neighboursCount; i++) {
+						minVal = std::min(minVal, candidates[i]);
+					}
+					output[idx] = static_cast<PixelType>(minVal);
+				}
+			};
+
+			auto sweepSlices = [&](int firstSlice)
+			{
+				for (int s = firstSlice; s < sizeZ; s += numberOfThreads)
+				{
+					const int z = (sign > 0) ? s : sizeZ - 1 - s;
+
+					for (int r = 0; r < sizeY; r++)
+					{
+						if (s > 0) {
+							// The previous slice must be done with the rows up to (and including) the next one
+							const int needed = std::min(r + 2, sizeY);
+							while (rowsDone[s - 1].load(std::memory_order_acquire) < needed) {
+								std::this_thread::yield();
+							}
+						}
+						sweepRow((sign > 0) ? r : sizeY - 1 - r, z);
+						rowsDone[s].store(r + 1, std::memory_order_release);
+					}
+				}
+			};
+
+			std::vector<std::thread> threads;
+			for (int t = 1; t < numberOfThreads; t++) {
+				threads.push_back(std::thread(sweepSlices, t));
+			}
+			sweepSlices(0);
+			for (auto& thread : threads) {
+				thread.join();
+			}
+		}
+	}
+
+	/**
+	Same as the single map ChamferSweeps, for several distance maps at once.
+	Every channel is a (input image, seeds) pair; the distances of all the channels of a voxel are stored next to each other,
+	so one traversal updates all of them, and the edge costs (which only depend on the input image)
+	are computed once per input and shared by all of its channels.
+	@param inputs the input image buffers
+	@param skipZeros one buffer per input, for the pixels that are zero no calculation will be done for the channels of that input
+	@param channelInputs for each channel, the index of its input
+	@param output initialized distances (0 at the seeds), voxel-major (output[voxel * channels + channel]), updated in place
+	@param size the size of the image in x, y, z (z is 1 for 2D images)
+	@param numberOfThreads how many threads to use for each sweep (0 is the hardware concurrency)
+	*/
+	template <class TImageType>
+	void ChamferSweeps(const std::vector<const typename TImageType::PixelType*>& inputs,
+		const std::vector<const typename TImageType::PixelType*>& skipZeros, const std::vector<int>& channelInputs,
+		typename TImageType::PixelType* output, const int size[3], int numberOfThreads = 0, const bool verbose = false)
+	{
+		typedef typename TImageType::PixelType PixelType;
+
+		const std::vector<ChamferNeighbour> forwardMask = ForwardChamferMask(TImageType::ImageDimension);
+		const int    neighboursCount = static_cast<int>(forwardMask.size());
+		const int    inputsCount = static_cast<int>(inputs.size());
+		const int    channelsCount = static_cast<int>(channelInputs.size());
+		const int    sizeX = size[0], sizeY = size[1], sizeZ = size[2];
+		const size_t sliceStride = static_cast<size_t>(sizeX) * sizeY;
+
+		if (inputsCount == 0 || channelsCount == 0) {
+			return;
+		}
+
+		if (numberOfThreads <= 0) {
+			numberOfThreads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		numberOfThreads = std::max(1, std::min(numberOfThreads, sizeZ));
+
+		std::vector< std::vector<int> > inputChannels(inputsCount);
+		for (int ch = 0; ch < channelsCount; ch++) {
+			inputChannels[channelInputs[ch]].push_back(ch);
+		}
+
+		for (int pass = 0; pass < 2; pass++)
+		{
+			const int sign = (pass == 0) ? 1 : -1; // Backward pass mirrors the mask and the traversal
+
+			if (verbose) {
+				std::cout << "AdaptiveGeodesicDistance: \t" << ((pass == 0) ? "Forward" : "Backward") << " pass\n";
+			}
+
+			std::vector<ChamferNeighbour> mask(forwardMask);
+			std::vector<std::ptrdiff_t>   offsets(neighboursCount);
+			for (int i = 0; i < neighboursCount; i++) {
+				mask[i].dx *= sign;
+				mask[i].dy *= sign;
+				mask[i].dz *= sign;
+				offsets[i] = mask[i].dx + static_cast<std::ptrdiff_t>(mask[i].dy) * sizeX + static_cast<std::ptrdiff_t>(mask[i].dz) * sliceStride;
+			}
+
+			// Rows finished for each slice (in sweep order)
+			std::vector< std::atomic<int> > rowsDone(sizeZ);
+			for (int s = 0; s < sizeZ; s++) {
+				rowsDone[s].store(0);
+			}
+
+			auto sweepRow = [&](int y, int z)
+			{
+				const bool interiorRow = (y > 0 && y < sizeY - 1 && (sizeZ == 1 || (z > 0 && z < sizeZ - 1)));
+				size_t neighbours[13];
+				double costs[13];
+
+				for (int c = 0; c < sizeX; c++)
+				{
+					const int    x   = (sign > 0) ? c : sizeX - 1 - c;
+					const size_t idx = z * sliceStride + static_cast<size_t>(y) * sizeX + x;
+					bool neighboursSet = false;
+
+					for (int m = 0; m < inputsCount; m++)
+					{
+						if (skipZeros[m][idx] == 0 || inputChannels[m].empty()) {
+							continue;
+						}
+
+						if (!neighboursSet)
+						{
+							if (interiorRow && x > 0 && x < sizeX - 1)
+							{
+								for (int i = 0; i < neighboursCount; i++) {
+									neighbours[i] = idx + offsets[i];
+								}
+							}
+							else
+							{
+								for (int i = 0; i < neighboursCount; i++) {
+									const int nx = std::min(std::max(x + mask[i].dx, 0), sizeX - 1);
+									const int ny = std::min(std::max(y + mask[i].dy, 0), sizeY - 1);
+									const int nz = std::min(std::max(z + mask[i].dz, 0), sizeZ - 1);
+									neighbours[i] = nz * sliceStride + static_cast<size_t>(ny) * sizeX + nx;
+								}
+							}
+							neighboursSet = true;
+						}
+
+						// Edge costs only depend on the input, so they are shared by all the channels of the input
+						const PixelType* input = inputs[m];
+						const PixelType  inpCenterPixel = input[idx];
+						for (int i = 0; i < neighboursCount; i++) {
+							costs[i] = std::sqrt(mask[i].squaredDistance + square<TImageType>(inpCenterPixel - input[neighbours[i]]));
+						}
+
+						for (int ch : inputChannels[m])
+						{
+							PixelType* channelOutput = output + ch;
+							double minVal = channelOutput[idx * channelsCount];
+							for (int i = 0; i < neighboursCount; i++) {
+								const double candidate = channelOutput[neighbours[i] * channelsCount] + costs[i];
+								minVal = (candidate < minVal) ? candidate : minVal;
+							}
+							channelOutput[idx * channelsCount] = static_cast<PixelType>(minVal);
+						}
+					}
+				}
+			};
+
+			auto sweepSlices = [&](int firstSlice)
+			{
+				for (int s = firstSlice; s < sizeZ; s += numberOfThreads)
+				{
+					const int z = (sign > 0) ? s : sizeZ - 1 - s;
+
+					for (int r = 0; r < sizeY; r++)
+					{
+						if (s > 0) {
+							// The previous slice must be done with the rows up to (and including) the next one
+							const int needed = std::min(r + 2, sizeY);
+							while (rowsDone[s - 1].load(std::memory_order_acquire) < needed) {
+								std::this_thread::yield();
+							}
+						}
+						sweepRow((sign > 0) ? r : sizeY - 1 - r, z);
+						rowsDone[s].store(r + 1, std::memory_order_release);
+					}
+				}
+			};
+
+			std::vector<std::thread> threads;
+			for (int t = 1; t < numberOfThreads; t++) {
+				threads.push_back(std::thread(sweepSlices, t));
+			}
+			sweepSlices(0);
+			for (auto& thread : threads) {
+				thread.join();
+			}
+		}
+	}
+
+	/**
+	Exact geodesic propagation (Dijkstra) on raw buffers, over the full neighbourhood (8 neighbours in 2D, 26 in 3D)
+	with the same edge cost as the chamfer sweeps: sqrt(squared spatial distance + squared intensity difference).
+	Every edge costs at least 1, so a bucket queue with buckets of width 1 is exact: a voxel can't be improved
+	by another voxel of the same bucket, and the buckets are processed in increasing order.
+	Only the voxels that are reached are visited, so the cost depends on the region within maximumDistance of the sources.
+	@param input the input image buffer
+	@param skipZeros buffer with the same size as input, the pixels that are zero are not updated (and not propagated through)
+	@param output initialized distances, updated in place; values are only ever decreased
+	@param size the size of the image in x, y, z (z is 1 for 2D images)
+	@param sources indices of the voxels to propagate from (their output value is their distance)
+	@param maximumDistance propagation stops at this geodesic distance from the sources (0 for no limit)
+	@return the number of voxels that were finalized
+	*/
+	template <class TImageType>
+	size_t DijkstraPropagation(const typename TImageType::PixelType* input, const typename TImageType::PixelType* skipZeros,
+		typename TImageType::PixelType* output, const int size[3], const std::vector<size_t>& sources, const double maximumDistance = 0)
+	{
+		typedef typename TImageType::PixelType PixelType;
+
+		const int    sizeX = size[0], sizeY = size[1], sizeZ = size[2];
+		const size_t sliceStride = static_cast<size_t>(sizeX) * sizeY;
+		const size_t voxelsCount = sliceStride * sizeZ;
+
+		// Full neighbourhood
+		std::vector<ChamferNeighbour> mask;
+		std::vector<std::ptrdiff_t>   offsets;
+		const int zRadius = (TImageType::ImageDimension == 3) ? 1 : 0;
+		for (int dz = -zRadius; dz <= zRadius; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					if (dx == 0 && dy == 0 && dz == 0) {
+						continue;
+					}
+					mask.push_back({ dx, dy, dz, static_cast<double>(dx * dx + dy * dy + dz * dz) });
+					offsets.push_back(dx + static_cast<std::ptrdiff_t>(dy) * sizeX + static_cast<std::ptrdiff_t>(dz) * sliceStride);
+				}
+			}
+		}
+
+		std::vector<double>        distance(output, output + voxelsCount);
+		std::vector<unsigned char> finalized(voxelsCount, 0);
+		std::vector< std::vector<size_t> > buckets;
+
+		auto push = [&](size_t idx)
+		{
+			const size_t bucket = static_cast<size_t>(distance[idx]);
+			if (bucket >= buckets.size()) {
+				buckets.resize(bucket + 1);
+			}
+			buckets[bucket].push_back(idx);
+		};
+
+		for (size_t idx : sources) {
+			push(idx);
+		}
+
+		size_t finalizedCount = 0;
+
+		for (size_t bucket = 0; bucket < buckets.size(); bucket++)
+		{
+			// Relaxations only push to later buckets, but they can reallocate the bucket list (so no references are kept)
+			for (size_t k = 0; k < buckets[bucket].size(); k++)
+			{
+				const size_t idx = buckets[bucket][k];
+				if (finalized[idx] || static_cast<size_t>(distance[idx]) != bucket) {
+					continue; // Already done, or an outdated entry
+				}
+				finalized[idx] = 1;
+				finalizedCount++;
+				output[idx] = static_cast<PixelType>(distance[idx]);
+
+				const int x = static_cast<int>(idx % sizeX);
+				const int y = static_cast<int>((idx / sizeX) % sizeY);
+				const int z = static_cast<int>(idx / sliceStride);
+				const bool interior = (x > 0 && x < sizeX - 1 && y > 0 && y < sizeY - 1 && (sizeZ == 1 || (z > 0 && z < sizeZ - 1)));
+
+				for (size_t i = 0; i < mask.size(); i++)
+				{
+					if (!interior &&
+						(x + mask[i].dx < 0 || x + mask[i].dx >= sizeX || y + mask[i].dy < 0 || y + mask[i].dy >= sizeY ||
+						 z + mask[i].dz < 0 || z + mask[i].dz >= sizeZ))
+					{
+						continue;
+					}
+
+					const size_t n = idx + offsets[i];
+					if (finalized[n] || skipZeros[n] == 0) {
+						continue;
+					}
+
+					const double candidate = distance[idx] + std::sqrt(mask[i].squaredDistance + square<TImageType>(input[n] - input[idx]));
+					if (candidate < distance[n] && (maximumDistance <= 0 || candidate <= maximumDistance)) {
+						distance[n] = candidate;
+						push(n);
+					}
+				}
+			}
+			std::vector<size_t>().swap(buckets[bucket]);
+		}
+
+		return finalizedCount;
+	}
+
+	/**
+	Adds sources to a distance map that was computed by DijkstraPropagation (e.g. by RunDijkstra), without recomputing it.
+	The new sources are propagated on their own, and the map becomes the element-wise minimum of the two.
+	Distances from a union of sources are the minimum of the distances from each part,
+	so the map is the same as a propagation from all the sources, in whatever order they were added.
+	@param input the input image buffer
+	@param skipZeros buffer with the same size as input, the pixels that are zero are not updated (and not propagated through)
+	@param output the distance map, updated in place
+	@param size the size of the image in x, y, z (z is 1 for 2D images)
+	@param sources indices of the voxels to add as sources
+	@param unreachedValue the value of the voxels that no source reaches (see UnreachedValue)
+	@param maximumDistance the maximum distance the map was computed with (0 for no limit)
+	@return the number of voxels that the new sources reached
+	*/
+	template <class TImageType>
+	size_t AddDijkstraSources(const typename TImageType::PixelType* input, const typename TImageType::PixelType* skipZeros,
+		typename TImageType::PixelType* output, const int size[3], const std::vector<size_t>& sources,
+		const typename TImageType::PixelType unreachedValue, const double maximumDistance = 0)
+	{
+		typedef typename TImageType::PixelType PixelType;
+
+		const size_t voxelsCount = static_cast<size_t>(size[0]) * size[1] * size[2];
+
+		std::vector<PixelType> added(voxelsCount, unreachedValue);
+		for (size_t idx : sources) {
+			added[idx] = 0;
+		}
+		size_t reached = DijkstraPropagation<TImageType>(input, skipZeros, added.data(), size, sources, maximumDistance);
+
+		for (size_t i = 0; i < voxelsCount; i++) {
+			output[i] = std::min(output[i], added[i]);
+		}
+		return reached;
+	}
+
+	/**
+	Adds sources to a distance map that was computed by ChamferSweeps (e.g. by Run or RunMulti), without recomputing it.
+	Each chamfer update is a minimum of neighbour distances plus a cost, so the sweeps of a minimum of two initializations
+	are the minimum of the sweeps of each: the new sources are swept on their own and the map becomes the element-wise
+	minimum of the two, which is the same as the sweeps from all the sources.
+	@param input the input image buffer
+	@param skipZeros buffer with the same size as input, for the pixels that are zero no calculation will be done
+	@param output the distance map, updated in place
+	@param size the size of the image in x, y, z (z is 1 for 2D images)
+	@param sources indices of the voxels to add as sources
+	@param unreachedValue the value the map was initialized with away from the seeds (see UnreachedValue)
+	@param numberOfThreads how many threads to use for each sweep (0 is the hardware concurrency)
+	*/
+	template <class TImageType>
+	void AddChamferSources(const typename TImageType::PixelType* input, const typename TImageType::PixelType* skipZeros,
+		typename TImageType::PixelType* output, const int size[3], const std::vector<size_t>& sources,
+		const typename TImageType::PixelType unreachedValue, int numberOfThreads = 0)
+	{
+		typedef typename TImageType::PixelType PixelType;
+
+		const size_t voxelsCount = static_cast<size_t>(size[0]) * size[1] * size[2];
+
+		std::vector<PixelType> added(voxelsCount, unreachedValue);
+		for (size_t idx : sources) {
+			added[idx] = 0;
+		}
+		ChamferSweeps<TImageType>(input, skipZeros, added.data(), size, numberOfThreads);
+
+		for (size_t i = 0; i < voxelsCount; i++) {
+			output[i] = std::min(output[i], added[i]);
+		}
+	}
+
+	/*For internal use: the initial value of the voxels that are not seeds (max, or 255)*/
+	template<typename PixelType>
+	PixelType UnreachedValue(const bool limitAt255)
+	{
+		const double pixelTypeMaxVal = itk::NumericTraits< PixelType >::max();
+		return (limitAt255) ? 255 : static_cast<PixelType>(pixelTypeMaxVal - 1);
+	}
+
+	/*For internal use: allocates the output image, 0 at pixels of label of interest, max (or 255) elsewhere*/
+	template<typename PixelType, unsigned int Dimensions>
+	ImagePointer< itk::Image<PixelType, Dimensions> >
+	InitializeOutput(const ImagePointer< itk::Image<PixelType, Dimensions> >       input,
+                     const ImagePointer< itk::Image<LabelsPixelType, Dimensions> > labels,
+                     const int labelOfInterest, const bool limitAt255)
+	{
+		typedef itk::Image<PixelType, Dimensions>                    ImageTypeGeodesic;
+		typedef itk::Image<LabelsPixelType, Dimensions>              LabelsImageType;
+		typedef itk::ImageRegionIteratorWithIndex<ImageTypeGeodesic> NormalIteratorIndexedGeo;
+		typedef itk::ImageRegionIteratorWithIndex<LabelsImageType>   NormalIteratorIndexedLabels;
+
+		//-------------- Allocate output image ------------------------
+
+		typename ImageTypeGeodesic::Pointer output = ImageTypeGeodesic::New();
+		output->SetRegions(input->GetLargestPossibleRegion());
+		output->SetRequestedRegion(input->GetLargestPossibleRegion());
+		//output->SetBufferedRegion(input->GetBufferedRegion());
+		output->Allocate();
+		output->FillBuffer(UnreachedValue<typename ImageTypeGeodesic::PixelType>(limitAt255));
+		output->SetDirection(input->GetDirection());
+		output->SetOrigin(input->GetOrigin());
+		output->SetSpacing(input->GetSpacing());
+
+		//-------------- Initialize values for output image (0 at pixels of label of interest, max elsewhere [set above]) ------------------------
+
+		NormalIteratorIndexedLabels labIter(labels, labels->GetLargestPossibleRegion());
+		NormalIteratorIndexedGeo    outIter(output, output->GetLargestPossibleRegion());
+		labIter.GoToBegin();
+		outIter.GoToBegin();
+
+		while (!labIter.IsAtEnd()) {
+			if (labIter.Get() == labelOfInterest) {
+				outIter.Set(0);
+			}
+			++labIter;
+			++outIter;
+		}
+
+		return output;
+	}
+
 	/**
 	Runs the Adaptive Geodesic Distance algorithm on a single image
 	@param input the input image.
 	@param labels an image the same size as input. A sample of labels for the input image. Only the pixels with value=labelOfInterest will be used.
 	@param labelOfInterest For which label (of the possibly many) from the labels image to perform AGD
 	@param limitAt255 if set to true the return image will be [0-255]
+	@param numberOfThreads how many threads to use (0 is the hardware concurrency)
 	@return the AGD result
 	*/
 	template<typename PixelType = int, unsigned int Dimensions = 3>
 	ImagePointer< itk::Image<PixelType, Dimensions> >
 	Run(const ImagePointer< itk::Image<PixelType, Dimensions> >       input,
         const ImagePointer< itk::Image<LabelsPixelType, Dimensions> > labels, 
-        const int labelOfInterest = 1, const bool verbose = false, const bool limitAt255 = false)
+        const int labelOfInterest = 1, const bool verbose = false, const bool limitAt255 = false,
+        const int numberOfThreads = 0)
 	{
 		typedef itk::Image<PixelType, Dimensions> ImageTypeGeodesic;
 
@@ -80,7 +608,7 @@ namespace AdaptiveGeodesicDistance
 		skipZerosGuideImage->Allocate();
 		skipZerosGuideImage->FillBuffer(1);
 
-		return Run<ImageTypeGeodesic>(input, skipZerosGuideImage, labels, labelOfInterest, verbose, limitAt255);
+		return Run<ImageTypeGeodesic>(input, skipZerosGuideImage, labels, labelOfInterest, verbose, limitAt255, numberOfThreads);
 	}
 
 	/**
@@ -90,6 +618,7 @@ namespace AdaptiveGeodesicDistance
 	@param labels an image the same size as input. A sample of labels for the input image. Only the pixels with value=labelOfInterest will be used.
 	@param labelOfInterest For which label (of the possibly many) from the labels image to perform AGD
 	@param limitAt255 if set to true the return image will be [0-255]
+	@param numberOfThreads how many threads to use (0 is the hardware concurrency)
 	@return the AGD result
 	*/
 	template<typename PixelType = int, unsigned int Dimensions = 3>
@@ -97,235 +626,143 @@ namespace AdaptiveGeodesicDistance
 	Run(const ImagePointer< itk::Image<PixelType, Dimensions> >       input,
 		const ImagePointer< itk::Image<PixelType, Dimensions> >       skipZerosGuideImage,
         const ImagePointer< itk::Image<LabelsPixelType, Dimensions> > labels,
-        const int labelOfInterest = 1, const bool verbose = false, const bool limitAt255 = false)
+        const int labelOfInterest = 1, const bool verbose = false, const bool limitAt255 = false,
+        const int numberOfThreads = 0)
 	{
 		static_assert((Dimensions == 2 || Dimensions == 3), "2D or 3D Images supported");
 
-		typedef itk::Image<PixelType, Dimensions>                    ImageTypeGeodesic;
-		typedef itk::Image<LabelsPixelType, Dimensions>              LabelsImageType;
-		typedef ImagePointer<ImageTypeGeodesic>                      ImageGeodesicPointer;
-		typedef ImagePointer<LabelsImageType>                        LabelsImagePointer;
-		typedef itk::ImageRegionIteratorWithIndex<ImageTypeGeodesic> NormalIteratorIndexedGeo;
-		typedef itk::ImageRegionIteratorWithIndex<LabelsImageType>   NormalIteratorIndexedLabels;
-		typedef itk::NeighborhoodIterator<ImageTypeGeodesic>         NeighborhoodIteratorGeo;
+		typedef itk::Image<PixelType, Dimensions> ImageTypeGeodesic;
 
-		const double pixelTypeMaxVal = itk::NumericTraits< typename ImageTypeGeodesic::PixelType >::max();
+		ImagePointer<ImageTypeGeodesic> output = InitializeOutput<PixelType, Dimensions>(input, labels, labelOfInterest, limitAt255);
 
-		//-------------- Allocate output image ------------------------
+		//--------------------------- For actual AGD --------------------------
 
-		typename ImageTypeGeodesic::Pointer output = ImageTypeGeodesic::New();
-		output->SetRegions(input->GetLargestPossibleRegion());
-		output->SetRequestedRegion(input->GetLargestPossibleRegion());
-		//output->SetBufferedRegion(input->GetBufferedRegion());
-		output->Allocate();
-		output->FillBuffer((limitAt255) ? 255 : static_cast<typename ImageTypeGeodesic::PixelType>(pixelTypeMaxVal - 1));
-		output->SetDirection(input->GetDirection());
-		output->SetOrigin(input->GetOrigin());
-		output->SetSpacing(input->GetSpacing());
+		int size[3] = { 1, 1, 1 };
+		for (unsigned int i = 0; i < Dimensions; i++) {
+			size[i] = static_cast<int>(output->GetLargestPossibleRegion().GetSize()[i]);
+		}
 
-		//-------------- Initialize values for output image (0 at pixels of label of interest, max elsewhere [set above]) ------------------------
+		ChamferSweeps<ImageTypeGeodesic>(input->GetBufferPointer(), skipZerosGuideImage->GetBufferPointer(),
+			output->GetBufferPointer(), size, numberOfThreads, verbose);
 
-		NormalIteratorIndexedLabels labIter(labels, labels->GetLargestPossibleRegion());
-		NormalIteratorIndexedGeo    outIter(output, output->GetLargestPossibleRegion());
-		labIter.GoToBegin();
-		outIter.GoToBegin();
+		return output;
+	}
 
-		while (!labIter.IsAtEnd()) {
-			if (labIter.Get() == labelOfInterest) {
-				outIter.Set(0);
-			}
-			++labIter;
-			++outIter;
-		}
+	/**
+	Runs the Adaptive Geodesic Distance algorithm on a single image, using exact propagation from the seeds (see DijkstraPropagation)
+	instead of the chamfer sweeps. Useful when only the region close to the seeds matters.
+	@param input the input image.
+	@param skipZerosGuideImage an image the same size as input. For the pixels that are zero no calculation will be done. (can be the input image itself)
+	@param labels an image the same size as input. A sample of labels for the input image. Only the pixels with value=labelOfInterest will be used.
+	@param labelOfInterest For which label (of the possibly many) from the labels image to perform AGD
+	@param maximumDistance voxels further than this (geodesic distance) from the seeds keep the max value (0 for no limit)
+	@param limitAt255 if set to true the return image will be [0-255]
+	@return the AGD result
+	*/
+	template<typename PixelType = int, unsigned int Dimensions = 3>
+	ImagePointer< itk::Image<PixelType, Dimensions> >
+	RunDijkstra(const ImagePointer< itk::Image<PixelType, Dimensions> >       input,
+		const ImagePointer< itk::Image<PixelType, Dimensions> >               skipZerosGuideImage,
+		const ImagePointer< itk::Image<LabelsPixelType, Dimensions> >         labels,
+		const int labelOfInterest = 1, const double maximumDistance = 0, const bool verbose = false, const bool limitAt255 = false)
+	{
+		static_assert((Dimensions == 2 || Dimensions == 3), "2D or 3D Images supported");
 
-		//-------------- If there is need to use gamma ------------------------
+		typedef itk::Image<PixelType, Dimensions> ImageTypeGeodesic;
 
-		//typename ImageTypeGeodesic::Pointer Gamma = ImageTypeGeodesic::New();
-		//Gamma->CopyInformation(input);
-		//Gamma->SetRequestedRegion(input->GetLargestPossibleRegion());
-		//Gamma->SetBufferedRegion(input->GetBufferedRegion());
-		//Gamma->Allocate();
-		//Gamma->FillBuffer(1);
+		ImagePointer<ImageTypeGeodesic> output = InitializeOutput<PixelType, Dimensions>(input, labels, labelOfInterest, limitAt255);
 
-		//--------------------------- For actual AGD --------------------------
+		int size[3] = { 1, 1, 1 };
+		for (unsigned int i = 0; i < Dimensions; i++) {
+			size[i] = static_cast<int>(output->GetLargestPossibleRegion().GetSize()[i]);
+		}
+
+		// The seeds
+		const LabelsPixelType* labelsBuffer = labels->GetBufferPointer();
+		const size_t voxelsCount = static_cast<size_t>(size[0]) * size[1] * size[2];
+		std::vector<size_t> sources;
+		for (size_t i = 0; i < voxelsCount; i++) {
+			if (labelsBuffer[i] == labelOfInterest) {
+				sources.push_back(i);
+			}
+		}
 
-		// Iterators that are used in the loops
-		NormalIteratorIndexedGeo iterSkipZeros(skipZerosGuideImage, skipZerosGuideImage->GetLargestPossibleRegion());
-		//NormalIteratorIndexedGeo iterGamma(Gamma, Gamma->GetLargestPossibleRegion());
+		size_t reached = DijkstraPropagation<ImageTypeGeodesic>(input->GetBufferPointer(), skipZerosGuideImage->GetBufferPointer(),
+			output->GetBufferPointer(), size, sources, maximumDistance);
 
-		typename ImageTypeGeodesic::SizeType radius;
-		
-		for (int i = 0; i < ImageTypeGeodesic::ImageDimension; i++) {
-			radius[i] = 1;
+		if (verbose) {
+			std::cout << "AdaptiveGeodesicDistance: \tReached " << reached << " of " << voxelsCount << " voxels\n";
 		}
 
-		NeighborhoodIteratorGeo outNIter(radius, output, output->GetLargestPossibleRegion());
-		NeighborhoodIteratorGeo inputNIter(radius, input, input->GetLargestPossibleRegion());
+		return output;
+	}
 
-		// Variables that are used in the loops
-		typename ImageTypeGeodesic::PixelType inpCenterPixel;
-		//ImageTypeGeodesic::PixelType gamPixel;
-		double arr[14];
-		double minVal;
+	/**
+	Runs the Adaptive Geodesic Distance algorithm for several (input image, label of interest) pairs in one pass over the volume
+	(see the multi-channel ChamferSweeps). The result is the same as running Run() separately for each pair.
+	@param inputs the input images (all the same size)
+	@param skipZerosGuideImages one image per input. For the pixels that are zero no calculation will be done for that input. (can be the inputs themselves)
+	@param labels an image the same size as the inputs. A sample of labels for the input images.
+	@param channels (index of input, label of interest) for every distance map to compute
+	@param limitAt255 if set to true the returned images will be [0-255]
+	@param numberOfThreads how many threads to use (0 is the hardware concurrency)
+	@return the AGD results, one per channel
+	*/
+	template<typename PixelType = int, unsigned int Dimensions = 3>
+	std::vector< ImagePointer< itk::Image<PixelType, Dimensions> > >
+	RunMulti(const std::vector< ImagePointer< itk::Image<PixelType, Dimensions> > > inputs,
+		const std::vector< ImagePointer< itk::Image<PixelType, Dimensions> > >      skipZerosGuideImages,
+		const ImagePointer< itk::Image<LabelsPixelType, Dimensions> >               labels,
+		const std::vector< std::pair<int, int> >& channels, const bool verbose = false, const bool limitAt255 = false,
+		const int numberOfThreads = 0)
+	{
+		static_assert((Dimensions == 2 || Dimensions == 3), "2D or 3D Images supported");
 
-		//----- Backward pass -----
+		typedef itk::Image<PixelType, Dimensions> ImageTypeGeodesic;
 
-		if (verbose) {
-			std::cout << "AdaptiveGeodesicDistance: \tForward pass\n";
+		std::vector< ImagePointer<ImageTypeGeodesic> > outputs;
+		if (inputs.empty() || channels.empty()) {
+			return outputs;
 		}
-		//cbica::Logging(loggerFile, "AGD Main loops execution : Forward pass");
 
-		outNIter.GoToBegin();
-		inputNIter.GoToBegin();
-		iterSkipZeros.GoToBegin();
-		//iterGamma.GoToBegin();
+		int size[3] = { 1, 1, 1 };
+		for (unsigned int i = 0; i < Dimensions; i++) {
+			size[i] = static_cast<int>(inputs[0]->GetLargestPossibleRegion().GetSize()[i]);
+		}
+		const size_t voxelsCount = static_cast<size_t>(size[0]) * size[1] * size[2];
+		const size_t channelsCount = channels.size();
 
-		while (!iterSkipZeros.IsAtEnd())
+		// Initialize every channel the same way Run() does, then interleave
+		std::vector<PixelType> distances(voxelsCount * channelsCount);
+		std::vector<int>       channelInputs(channelsCount);
+		for (size_t ch = 0; ch < channelsCount; ch++)
 		{
-			if (iterSkipZeros.Get() != 0)
-			{
-				// Forward pass
-				
-				if (ImageTypeGeodesic::ImageDimension == 2)
-				{
-					// 2D
-
-					inpCenterPixel = inputNIter.GetPixel(4);
-					//gamPixel = iterGamma.Get();
-
-					arr[4] = outNIter.GetCenterPixel();
-					arr[0] = outNIter.GetPixel(0) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(0)));
-					arr[1] = outNIter.GetPixel(1) + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(1)));
-					arr[2] = outNIter.GetPixel(2) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(2)));
-					arr[3] = outNIter.GetPixel(3) + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(3)));
-					
-					minVal = arr[4];
-					for (int i = 0; i < 4; i++)
-					{
-						if (arr[i] < minVal) {
-							minVal = arr[i];
-						}
-					}
-				}
-				else {
-					// 3D
-					
-					inpCenterPixel = inputNIter.GetPixel(13);
-					//gamPixel = iterGamma.Get();
-
-					arr[13] = outNIter.GetCenterPixel();
-					arr[0]  = outNIter.GetPixel(4)  + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(4)));
-					arr[1]  = outNIter.GetPixel(10) + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(10)));
-					arr[2]  = outNIter.GetPixel(12) + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(12)));
-					arr[3]  = outNIter.GetPixel(1)  + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(1)));
-					arr[4]  = outNIter.GetPixel(3)  + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(3)));
-					arr[5]  = outNIter.GetPixel(9)  + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(9)));
-					arr[6]  = outNIter.GetPixel(0)  + sqrt(3.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(0)));
-					arr[7]  = outNIter.GetPixel(7)  + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(7)));
-					arr[8]  = outNIter.GetPixel(6)  + sqrt(3.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(6)));
-					arr[9]  = outNIter.GetPixel(15) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(15)));
-					arr[10] = outNIter.GetPixel(24) + sqrt(3.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(24)));
-					arr[11] = outNIter.GetPixel(21) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(21)));
-					arr[12] = outNIter.GetPixel(18) + sqrt(3.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(18)));
-
-					minVal = arr[13];
-					for (int i = 0; i < 13; i++)
-					{
-						if (arr[i] < minVal) {
-							minVal = arr[i];
-						}
-					}
-				}
+			outputs.push_back(InitializeOutput<PixelType, Dimensions>(inputs[channels[ch].first], labels, channels[ch].second, limitAt255));
+			channelInputs[ch] = channels[ch].first;
 
-				outNIter.SetCenterPixel(minVal);
+			const PixelType* initial = outputs[ch]->GetBufferPointer();
+			for (size_t i = 0; i < voxelsCount; i++) {
+				distances[i * channelsCount + ch] = initial[i];
 			}
-			++outNIter;
-			++inputNIter;
-			++iterSkipZeros;
-			//++iterGamma;
 		}
 
-		//----- Backward pass -----
-
-		if (verbose) {
-			std::cout << "AdaptiveGeodesicDistance: \tBackward pass\n";
+		std::vector<const PixelType*> inputBuffers, skipZerosBuffers;
+		for (size_t m = 0; m < inputs.size(); m++) {
+			inputBuffers.push_back(inputs[m]->GetBufferPointer());
+			skipZerosBuffers.push_back(skipZerosGuideImages[m]->GetBufferPointer());
 		}
-		//cbica::Logging(loggerFile, "AGD Main loops execution : Backward pass");
 
-		outNIter.GoToEnd();
-		inputNIter.GoToEnd();
-		--outNIter;
-		--inputNIter;
-		iterSkipZeros.GoToReverseBegin();
-		//iterGamma.GoToReverseBegin();
+		ChamferSweeps<ImageTypeGeodesic>(inputBuffers, skipZerosBuffers, channelInputs, distances.data(), size, numberOfThreads, verbose);
 
-		while (!iterSkipZeros.IsAtReverseEnd())
+		for (size_t ch = 0; ch < channelsCount; ch++)
 		{
-			if (iterSkipZeros.Get() != 0)
-			{
-				// Backward pass
-
-				if (ImageTypeGeodesic::ImageDimension == 2) 
-				{
-					// 2D
-
-					inpCenterPixel = inputNIter.GetPixel(4);
-					//gamPixelB = iterGamma.Get();
-
-					arr[4] = outNIter.GetCenterPixel();
-					arr[0] = outNIter.GetPixel(5) + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(5)));
-					arr[1] = outNIter.GetPixel(6) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(6)));
-					arr[2] = outNIter.GetPixel(7) + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(7)));
-					arr[3] = outNIter.GetPixel(8) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(8)));
-					
-					minVal = arr[4];
-					for (int i = 0; i < 4; i++)
-					{
-						if (arr[i] < minVal) {
-							minVal = arr[i];
-						}
-					}
-				}
-				else
-				{
-					// 3D
-
-					inpCenterPixel = inputNIter.GetPixel(13);
-					//gamPixelB = iterGamma.Get();
-
-					arr[13] = outNIter.GetCenterPixel();
-					arr[0] = outNIter.GetPixel(22) + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(22)));
-					arr[1] = outNIter.GetPixel(16) + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(16)));
-					arr[2] = outNIter.GetPixel(14) + sqrt(1.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(14)));
-					arr[3] = outNIter.GetPixel(25) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(25)));
-					arr[4] = outNIter.GetPixel(23) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(23)));
-					arr[5] = outNIter.GetPixel(17) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(17)));
-					arr[6] = outNIter.GetPixel(26) + sqrt(3.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(26)));
-					arr[7] = outNIter.GetPixel(19) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(19)));
-					arr[8] = outNIter.GetPixel(20) + sqrt(3.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(20)));
-					arr[9] = outNIter.GetPixel(11) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(11)));
-					arr[10] = outNIter.GetPixel(2) + sqrt(3.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(2)));
-					arr[11] = outNIter.GetPixel(5) + sqrt(2.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(5)));
-					arr[12] = outNIter.GetPixel(8) + sqrt(3.0 + /*gamPixel * */ square<ImageTypeGeodesic>(inpCenterPixel - inputNIter.GetPixel(8)));
-				
-					minVal = arr[13];
-					for (int i = 0; i < 13; i++)
-					{
-						if (arr[i] < minVal) {
-							minVal = arr[i];
-						}
-					}
-				}
-
-				outNIter.SetCenterPixel(minVal);
+			PixelType* result = outputs[ch]->GetBufferPointer();
+			for (size_t i = 0; i < voxelsCount; i++) {
+				result[i] = distances[i * channelsCount + ch];
 			}
-			--outNIter;
-			--inputNIter;
-			--iterSkipZeros;
-			//--iterGamma;
 		}
 
-		return output;
+		return outputs;
 	}
 }
 
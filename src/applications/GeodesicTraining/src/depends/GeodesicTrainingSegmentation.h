@@ -27,12 +27,16 @@
 #include <algorithm>
 #include <unordered_map>
 #include <map>
+#include <memory>
+#include <iterator>
 #include <thread>
 #include <mutex>
 
 #include "UtilGTS.h"
 #include "UtilItkGTS.h"
 #include "UtilImageToCvMatGTS.h"
+#include "UtilSamplingGTS.h"
+#include "UtilMultiResolutionGTS.h"
 #include "UtilCvMatToImageGTS.h"
 #include "OperationsSvmGTS.h"
 
@@ -89,6 +93,30 @@ namespace GeodesicTrainingSegmentation
 	const int           DEFAULT_MAX_SAMPLES_SVM_SUBSAMPLE      = 3000;
 	const bool          DEFAULT_BALANCED_SUBSAMPLE             = true;
 	const float         DEFAULT_INPUT_IMAGES_TO_AGD_MAPS_RATIO = 6;
+	const int           DEFAULT_COARSE_TO_FINE_FACTOR          = 1; // Coarse to fine disabled
+
+	/**
+	AGD maps kept between executions (see Coordinator::SetAgdCache), so that when the user only adds seeds
+	the maps are updated by propagating from the new seeds instead of being recomputed
+	*/
+	template<unsigned int Dimensions = 3>
+	struct AgdCache
+	{
+		typedef itk::Image< AgdPixelType, Dimensions > AgdImageType;
+		typedef typename AgdImageType::Pointer         AgdImagePointer;
+
+		std::map< std::string, AgdImagePointer >                           inputs;  // normalized AGD input, by image name
+		std::map< std::pair<std::string, LabelsPixelType>, AgdImagePointer > rawMaps; // raw (not normalized) map, by (image name, label)
+		std::map< std::pair<std::string, LabelsPixelType>, std::vector<size_t> > seeds; // sorted seed indices each map was computed from
+		double maximumDistance = 0; // AGD maximum distance the maps were computed with (0 is chamfer sweeps, otherwise Dijkstra)
+
+		void Clear() {
+			inputs.clear();
+			rawMaps.clear();
+			seeds.clear();
+			maximumDistance = 0;
+		}
+	};
 
 	/**Class for all the Geodesic Training Segmentation Operations*/
 	template<typename PixelType = float, unsigned int Dimensions = 3>
@@ -136,6 +164,20 @@ namespace GeodesicTrainingSegmentation
 		
 		/** Main execution function */
 		std::shared_ptr< Result > Execute()
+		{
+			// The modes append the AGD maps (and the MRI images) to the input images,
+			// they are restored afterwards so that the same coordinator can execute again
+			std::vector< InputImagePointer > inputImages = m_input_images;
+			m_agd_maps_count = 0;
+
+			std::shared_ptr< Result > gtsResult = execute();
+
+			m_input_images = inputImages;
+			return gtsResult;
+		}
+
+		/** Executes the mode (see Execute) */
+		std::shared_ptr< Result > execute()
 		{
 			std::shared_ptr< Result > gtsResult(new Result());
 
@@ -248,6 +290,19 @@ namespace GeodesicTrainingSegmentation
 
 				if (!validLabels(gtsResult, labelsCountMap)) { return nullptr; }
 
+				if (m_coarse_to_fine_factor > 1 && m_input_images_MRI.size() == 0)
+				{
+					// Segment at low resolution, and only the boundaries between the classes at full resolution
+					if (!reverseGeoTrainCoarseToFine(gtsResult)) { return gtsResult; }
+
+					changeLabels(gtsResult->labelsImage, m_change_labels_map);
+
+					if (m_ground_truth_set) {
+						checkAccuracyInRelationToGroundTruth(gtsResult->labelsImage, gtsResult);
+					}
+					break;
+				}
+
 				// Construct agd maps for each input image and input input images and agd maps to a SVM that produces labels
 				std::vector< AgdImagePointer > agdImages;
 
@@ -619,6 +674,9 @@ namespace GeodesicTrainingSegmentation
 		void SetSaveAll(bool saveAll) {
 			m_save_all = saveAll;
 		}
+		std::string GetOutputPath() const {
+			return m_output_folder;
+		}
 		void SetTimerEnabled(bool timerEnabled) {
 			m_timer_enabled = timerEnabled;
 		}
@@ -632,6 +690,10 @@ namespace GeodesicTrainingSegmentation
 				m_rf_config_file_path = rfConfigFilePath;
 			}
 		}
+		/** Use cv::ml::RTrees for the RF modes instead of the in-tree (parallel) forest */
+		void SetRfUseOpenCV(bool useOpenCV) {
+			m_rf_use_opencv = useOpenCV;
+		}
 		void SetThreshold(float threshold) {
 			m_threshold = threshold;
 		}
@@ -654,6 +716,35 @@ namespace GeodesicTrainingSegmentation
 		void SetNumberOfThreadsMax(bool maxThreads) {
 			m_max_threads = maxThreads;
 		}
+		/**
+		Keep the AGD maps in the given cache, and reuse them in the next executions:
+		if an input image and the seeds of a label are the same, the map is reused. If seeds were only added, the new
+		seeds are propagated on their own (chamfer sweeps, or Dijkstra if SetAgdMaximumDistance is set) and merged into
+		the map with an element-wise minimum. Both backends give a minimum over the seeds, so this is the same map as a
+		full run. If seeds were removed (or the backend changed) the map is recomputed.
+		*/
+		void SetAgdCache(std::shared_ptr< AgdCache<Dimensions> > agdCache) {
+			m_agd_cache = agdCache;
+			m_coarse_agd_cache = (agdCache) ? std::make_shared< AgdCache<Dimensions> >() : nullptr; // For the coarse to fine mode
+		}
+		/**
+		Keep the trained svm descriptions in the given cache. If it is not empty the next executions train
+		at the parameters it holds instead of searching for them (the models are retrained on the new samples)
+		*/
+		void SetSvmDescriptionsCache(std::shared_ptr< std::vector< SvmSuite::SvmDescription > > svmDescriptionsCache) {
+			m_svm_descriptions_cache = svmDescriptionsCache;
+		}
+		/**
+		Keep the feature matrix (one row per voxel) between executions, so that SVM and RF modes
+		only gather the images that changed and rebuild the training rows
+		*/
+		void SetResidentFeatureMatrix(bool resident) {
+			m_feature_matrix_builder.SetResident(resident);
+		}
+		/** Computes AGD by propagating from the seeds up to this geodesic distance (0 is full volume chamfer sweeps) */
+		void SetAgdMaximumDistance(double maximumDistance) {
+			m_agd_maximum_distance = std::max(0.0, maximumDistance);
+		}
 		void SetGroundTruth(std::string groundTruthPath, std::vector<LabelsPixelType> groundTruthSkip = std::vector<LabelsPixelType>())
 		{
 			if (groundTruthPath != "") {
@@ -710,6 +801,7 @@ namespace GeodesicTrainingSegmentation
 		void SetVerbose(bool verbose) {
 			m_verbose = verbose;
 		}
+		/** Draw at most maxSamples training samples for the SVM modes (0 keeps every labeled voxel), see SamplingGTS::StratifiedSampler */
 		void SetSubsampling(bool subsample, int maxSamples = 3000) {
 			m_subsample = subsample;
 			m_max_samples_svm_subsample = maxSamples;
@@ -720,6 +812,22 @@ namespace GeodesicTrainingSegmentation
 		void SetInputImageToAgdMapsRatio(float ratio) {
 			m_image_to_agd_maps_ratio = ratio;
 		}
+		/**
+		Coarse to fine mode for REVERSE_GEOTRAIN (not for the special MRI modalities).
+		The images and the scribbles are downsampled by downsamplingFactor and segmented, the result is upsampled,
+		and only a band around the boundaries between the classes is segmented again at full resolution:
+		AGD and the SVMs run on the bounding box of the band (and a ring around it, of the same width),
+		the voxels outside of the band and the ring are skipped, and the coarse labels of the ring are used as seeds
+		and training samples together with the scribbles. The SVMs of the full resolution stage are trained
+		at the parameters found by the coarse stage. Everything outside of the band keeps the upsampled coarse labels.
+		The coarse stage writes its files in the output folder, the full resolution stage in its "fine" subfolder.
+		@param downsamplingFactor 1 disables the mode (for 1mm isotropic images, 2 or 3 is a good choice)
+		@param bandRadius voxels (at full resolution) further than this from a boundary keep the coarse labels (0 is downsamplingFactor)
+		*/
+		void SetCoarseToFine(int downsamplingFactor, int bandRadius = 0) {
+			m_coarse_to_fine_factor      = std::max(1, downsamplingFactor);
+			m_coarse_to_fine_band_radius = std::max(0, bandRadius);
+		}
 
 	private:
 		LabelsImagePointer                                     m_labels_image;
@@ -729,24 +837,55 @@ namespace GeodesicTrainingSegmentation
 		std::vector< double >                                  m_importance_values;       // For mode:  generateconfig
 		std::unordered_map< LabelsPixelType, LabelsPixelType > m_change_labels_map;
 		std::vector< std::string >                             m_pretrained_models_paths; // For mode:  generateconfig
-		std::mutex                                             m_agd_mutex;
 		LabelsImagePointer                                     m_ground_truth;
 		std::vector<LabelsPixelType>                           m_ground_truth_skip = std::vector<LabelsPixelType>();
 		std::map< MODALITY_MRI, InputImagePointer >            m_input_images_MRI;        // For MRI
 		SvmSuiteUtil::Timer                                    m_timer;                   // For timer
 		int                                                    m_number_of_threads = 16, m_agd_maps_count = 0,
-                                                               m_max_samples_svm_subsample = DEFAULT_MAX_SAMPLES_SVM_SUBSAMPLE;
+                                                               m_max_samples_svm_subsample = DEFAULT_MAX_SAMPLES_SVM_SUBSAMPLE,
+                                                               m_coarse_to_fine_factor = DEFAULT_COARSE_TO_FINE_FACTOR,
+                                                               m_coarse_to_fine_band_radius = 0;
+		double                                                 m_agd_maximum_distance = 0;
+		std::shared_ptr< AgdCache<Dimensions> >                m_agd_cache;
+		ParserGTS::FeatureMatrixBuilder<PixelType, Dimensions> m_feature_matrix_builder;
+		std::shared_ptr< SamplingGTS::StratifiedSampler >       m_sampler = std::make_shared< SamplingGTS::StratifiedSampler >();
+		std::shared_ptr< std::vector< SvmSuite::SvmDescription > > m_svm_descriptions_cache;
+		std::shared_ptr< Coordinator >                         m_coarse_coordinator;      // For the coarse to fine mode
+		std::shared_ptr< AgdCache<Dimensions> >                m_coarse_agd_cache;        // For the coarse to fine mode
 		float                                                  m_threshold = DEFAULT_THRESHOLD,
                                                                m_image_to_agd_maps_ratio = DEFAULT_INPUT_IMAGES_TO_AGD_MAPS_RATIO;
 		bool            m_save_all = false, m_timer_enabled = false, m_subsample = true, m_balanced_subsample = DEFAULT_BALANCED_SUBSAMPLE,
                         m_file_extension_set_manually = false, m_verbose = false, m_were_images_shrunk = false,
-                        m_ground_truth_set = false, m_max_threads = false, m_changed_labels_map_manually_set = false;
+                        m_ground_truth_set = false, m_max_threads = false, m_changed_labels_map_manually_set = false,
+                        m_rf_use_opencv = false;
 		std::string     m_config_file_path = "", m_rf_config_file_path = "",
                         m_file_extension = DEFAULT_FILE_EXTENSION, m_output_folder = cbica::getExecutablePath();
 		LabelsPixelType m_label_TC = DEFAULT_LABEL_TC, m_label_ET = DEFAULT_LABEL_ET,
                         m_label_ED = DEFAULT_LABEL_ED, m_label_HT = DEFAULT_LABEL_HT,
                         m_label_of_interest = DEFAULT_LABEL_OF_INTEREST;
 
+		/**
+		Converts the images to the feature matrices used by SVM and RF (see ParserGTS::FeatureMatrixBuilder)
+		@param subsample draw at most m_max_samples_svm_subsample training samples (if subsampling is enabled).
+		The sampler lives as long as the coordinator, so the samples stay mostly the same between executions.
+		*/
+		std::shared_ptr<ParserGTS::Result> parseFeatureMatrix(const std::vector< InputImagePointer >& images, LabelsImagePointer labels,
+			bool subsample = false)
+		{
+			m_feature_matrix_builder.SetNumberOfThreads((m_max_threads) ? 0 : m_number_of_threads);
+
+			if (subsample && m_subsample) {
+				m_sampler->SetMaxSamples(m_max_samples_svm_subsample);
+				m_sampler->SetBalanced(m_balanced_subsample);
+				m_feature_matrix_builder.SetSampler(m_sampler);
+			}
+			else {
+				m_feature_matrix_builder.SetSampler(nullptr);
+			}
+
+			return m_feature_matrix_builder.Build(images, labels, false);
+		}
+
 		// For SVM
 
 		template<typename TPixelType>
@@ -755,7 +894,22 @@ namespace GeodesicTrainingSegmentation
 		{
 			SvmManagerGTS<TPixelType, Dimensions> svmManagerGTS;
 
-			if (m_config_file_path != "") {
+			if (m_svm_descriptions_cache && !m_svm_descriptions_cache->empty()) {
+				// Parameters found by a previous execution, the models have to be retrained
+				// (starting from the previous solutions, the trainers are shared with the cache)
+				for (SvmSuite::SvmDescription& svmDescription : *m_svm_descriptions_cache) {
+					if (!svmDescription.GetWarmStartTrainer()) {
+						svmDescription.SetWarmStartTrainer(std::make_shared< SvmSuite::WarmStartTrainer >());
+					}
+				}
+				std::vector< SvmSuite::SvmDescription > svmDescriptions = *m_svm_descriptions_cache;
+				for (SvmSuite::SvmDescription& svmDescription : svmDescriptions) {
+					svmDescription.SetModel(cv::Ptr<cv::ml::SVM>());
+					svmDescription.SetModelPath("");
+				}
+				svmManagerGTS.AddSvmDescriptions(svmDescriptions);
+			}
+			else if (m_config_file_path != "") {
 				svmManagerGTS.AddSvmsFromConfig(m_config_file_path);
 			}
 			else {
@@ -777,18 +931,11 @@ namespace GeodesicTrainingSegmentation
 			//	data->trainingMat.cols - 1, 
 			//	1 / m_image_to_agd_maps_ratio
 			//);
-			auto data = ParserGTS::Parse<TPixelType, Dimensions>(images, labels, false);
+			auto data = parseFeatureMatrix(images, labels, true); // Subsampled here (balanced or not), see SamplingGTS::StratifiedSampler
 			std::cout << "finished\n";
-			
-			//cv::Mat sampleIdx;
-
-			if (!m_balanced_subsample) {
-				svmManagerGTS.SetSubsampling(m_subsample, m_max_samples_svm_subsample);
-			}
-			else {
-				if (m_subsample && data->trainingMat.rows > m_max_samples_svm_subsample) {
-					/*sampleIdx = */CreateBalancedSubsample(data, labelsCountMap, m_max_samples_svm_subsample);
-				}
+			if (m_subsample) {
+				message("Training samples: " + std::to_string(data->trainingMat.rows) + " (" +
+					std::to_string(m_sampler->GetNumberOfKeptSamples()) + " also used by the previous execution)\n");
 			}
 
 			message("", "SVM Operations");
@@ -797,6 +944,10 @@ namespace GeodesicTrainingSegmentation
 
 			svmManagerGTS.GenerateConfigFromBestValues();
 
+			if (m_svm_descriptions_cache) {
+				*m_svm_descriptions_cache = svmManagerGTS.GetSvmDescriptions();
+			}
+
 			if (predictFlags) {
 				// Swap so that label of interest is always the pos
 				if (result->negLabel == m_label_of_interest) {
@@ -822,6 +973,233 @@ namespace GeodesicTrainingSegmentation
 			gtsResult->labelsImage = result->labelsImage;
 		}
 
+		// For coarse to fine
+
+		/**
+		REVERSE_GEOTRAIN in three stages (see SetCoarseToFine)
+		@return false if the coarse stage failed (the error is in gtsResult)
+		*/
+		bool reverseGeoTrainCoarseToFine(const std::shared_ptr<Result>& gtsResult)
+		{
+			const int factor = m_coarse_to_fine_factor;
+			const int radius = (m_coarse_to_fine_band_radius > 0) ? m_coarse_to_fine_band_radius : factor;
+
+			int size[3] = { 1, 1, 1 };
+			for (unsigned int d = 0; d < Dimensions; d++) {
+				size[d] = static_cast<int>(m_labels_image->GetLargestPossibleRegion().GetSize()[d]);
+			}
+			const size_t           voxelsCount = m_labels_image->GetLargestPossibleRegion().GetNumberOfPixels();
+			const LabelsPixelType* labels      = m_labels_image->GetBufferPointer();
+			const PixelType*       firstImage  = m_input_images[0]->GetBufferPointer();
+
+			// Coarse stage
+
+			message("Coarse to fine: segmenting at 1/" + std::to_string(factor) + " of the resolution\n", "Coarse segmentation");
+
+			int coarseSize[3];
+			MultiResolutionGTS::CoarseSize(size, factor, coarseSize);
+			const double coarseFirstVoxel[3] = { (factor - 1) / 2.0, (factor - 1) / 2.0, (factor - 1) / 2.0 }; // Center of the first block
+
+			std::vector< InputImagePointer > coarseImages;
+			std::vector< const PixelType* >  inputBuffers;
+			std::vector< PixelType* >        coarseBuffers;
+			for (const InputImagePointer& image : m_input_images) {
+				coarseImages.push_back(createImageOnGrid<InputImageType>(image.GetPointer(), coarseSize, coarseFirstVoxel, factor));
+				inputBuffers.push_back(image->GetBufferPointer());
+				coarseBuffers.push_back(coarseImages.back()->GetBufferPointer());
+			}
+			MultiResolutionGTS::DownsampleImages<PixelType>(inputBuffers, size, factor, coarseBuffers);
+
+			LabelsImagePointer coarseLabels = createImageOnGrid<LabelsImageType>(m_labels_image.GetPointer(), coarseSize, coarseFirstVoxel, factor);
+			MultiResolutionGTS::DownsampleLabels(labels, size, factor, coarseLabels->GetBufferPointer());
+
+			// The coarse coordinator is kept, so that the caches (if set) work for the coarse stage too
+			if (!m_coarse_coordinator) {
+				m_coarse_coordinator = std::make_shared< Coordinator >();
+			}
+			std::shared_ptr< std::vector< SvmSuite::SvmDescription > > svmDescriptions = (m_svm_descriptions_cache) ?
+				m_svm_descriptions_cache : std::make_shared< std::vector< SvmSuite::SvmDescription > >();
+
+			configureStage(*m_coarse_coordinator, m_output_folder);
+			m_coarse_coordinator->SetAgdCache(m_coarse_agd_cache);
+			m_coarse_coordinator->SetSvmDescriptionsCache(svmDescriptions);
+			m_coarse_coordinator->SetInputImages(coarseImages);
+			m_coarse_coordinator->SetLabels(coarseLabels);
+
+			std::shared_ptr< Result > coarseResult = m_coarse_coordinator->Execute();
+			if (!coarseResult || !coarseResult->ok || !coarseResult->labelsImage) {
+				std::string errorMessage = "The coarse segmentation failed";
+				if (coarseResult && coarseResult->errorMessage != "") {
+					errorMessage += ": " + coarseResult->errorMessage;
+				}
+				errorOccured(errorMessage);
+				gtsResult->errorMessage = errorMessage;
+				gtsResult->ok = false;
+				return false;
+			}
+
+			// Upsampling, and the band around the boundaries between the classes
+
+			LabelsImagePointer result = ItkUtilGTS::initializeOutputImageBasedOn<LabelsImageType>(m_labels_image);
+			LabelsPixelType*   resultBuffer = result->GetBufferPointer();
+			MultiResolutionGTS::UpsampleLabels(coarseResult->labelsImage->GetBufferPointer(), size, factor, resultBuffer);
+
+			std::vector< unsigned char > band(voxelsCount);
+			MultiResolutionGTS::BoundaryBand(resultBuffer, size, radius, band.data());
+
+			size_t bandCount = 0;
+			for (size_t i = 0; i < voxelsCount; i++)
+			{
+				if (firstImage[i] == 0) {
+					// Skipped at full resolution too
+					resultBuffer[i] = 0;
+					band[i] = 0;
+				}
+				else if (resultBuffer[i] == 0) {
+					band[i] = 1; // Skipped by the coarse stage (partial blocks at the edges of the images)
+				}
+				bandCount += band[i];
+			}
+			writeImage< LabelsImageType >(result, "labels_res_coarse");
+
+			message("Coarse to fine: " + std::to_string(bandCount) + " of " + std::to_string(voxelsCount) +
+				" voxels are close to a boundary\n", "Fine segmentation");
+
+			gtsResult->labelsImage = result;
+			if (bandCount == 0) {
+				writeImage< LabelsImageType >(result, "labels_res");
+				return true;
+			}
+
+			// Fine stage, on the bounding box of the band and the ring around it
+
+			std::vector< unsigned char > domain(band);
+			MultiResolutionGTS::DilateMask(domain.data(), size, radius);
+
+			int start[3], end[3];
+			MultiResolutionGTS::BoundingBox(domain.data(), size, start, end);
+			const int    fineSize[3]      = { end[0] - start[0], end[1] - start[1], end[2] - start[2] };
+			const double fineFirstVoxel[3] = { static_cast<double>(start[0]), static_cast<double>(start[1]), static_cast<double>(start[2]) };
+
+			std::vector< InputImagePointer > fineImages;
+			for (const InputImagePointer& image : m_input_images) {
+				fineImages.push_back(createImageOnGrid<InputImageType>(image.GetPointer(), fineSize, fineFirstVoxel, 1));
+			}
+			LabelsImagePointer fineLabels = createImageOnGrid<LabelsImageType>(m_labels_image.GetPointer(), fineSize, fineFirstVoxel, 1);
+			LabelsPixelType*   fineLabelsBuffer = fineLabels->GetBufferPointer();
+
+			size_t fineIndex = 0;
+			for (int z = start[2]; z < end[2]; z++) {
+				for (int y = start[1]; y < end[1]; y++) {
+					for (int x = start[0]; x < end[0]; x++, fineIndex++)
+					{
+						const size_t index = (static_cast<size_t>(z) * size[1] + y) * size[0] + x;
+						if (!domain[index]) {
+							continue; // Zero, skipped
+						}
+						for (size_t i = 0; i < fineImages.size(); i++) {
+							fineImages[i]->GetBufferPointer()[fineIndex] = inputBuffers[i][index];
+						}
+						// The scribbles, and the coarse labels of the ring
+						fineLabelsBuffer[fineIndex] = (labels[index] != 0 || band[index]) ? labels[index] : resultBuffer[index];
+					}
+				}
+			}
+
+			// The parameters found by the coarse stage are used (the samples are different, so no warm start)
+			std::shared_ptr< std::vector< SvmSuite::SvmDescription > > fineSvmDescriptions =
+				std::make_shared< std::vector< SvmSuite::SvmDescription > >(*svmDescriptions);
+			for (SvmSuite::SvmDescription& svmDescription : *fineSvmDescriptions) {
+				svmDescription.SetWarmStartTrainer(nullptr);
+			}
+
+			Coordinator fineCoordinator;
+			configureStage(fineCoordinator, m_output_folder + "/fine");
+			fineCoordinator.SetSvmDescriptionsCache(fineSvmDescriptions);
+			fineCoordinator.SetInputImages(fineImages);
+			fineCoordinator.SetLabels(fineLabels);
+
+			std::shared_ptr< Result > fineResult = fineCoordinator.Execute();
+			if (!fineResult || !fineResult->ok || !fineResult->labelsImage) {
+				message("Coarse to fine: the full resolution stage failed, the coarse labels are kept\n");
+				writeImage< LabelsImageType >(result, "labels_res");
+				return true;
+			}
+
+			// Only the band is replaced
+			const LabelsPixelType* fineResultBuffer = fineResult->labelsImage->GetBufferPointer();
+			fineIndex = 0;
+			for (int z = start[2]; z < end[2]; z++) {
+				for (int y = start[1]; y < end[1]; y++) {
+					for (int x = start[0]; x < end[0]; x++, fineIndex++)
+					{
+						const size_t index = (static_cast<size_t>(z) * size[1] + y) * size[0] + x;
+						if (band[index]) {
+							resultBuffer[index] = fineResultBuffer[fineIndex];
+						}
+					}
+				}
+			}
+			writeImage< LabelsImageType >(result, "labels_res");
+
+			return true;
+		}
+
+		/**
+		Passes the settings of this coordinator to a stage of the coarse to fine mode
+		@param outputFolder where the stage writes its files (config.yaml, and everything else if save all is enabled)
+		*/
+		void configureStage(Coordinator& stage, std::string outputFolder)
+		{
+			stage.SetMode(REVERSE_GEOTRAIN);
+			stage.SetOutputPath(outputFolder);
+			stage.SetOutputImageFileExtension(m_file_extension);
+			stage.SetSaveAll(m_save_all);
+			stage.SetTimerEnabled(m_timer_enabled);
+			stage.SetConfigFile(m_config_file_path);
+			stage.SetInputImageToAgdMapsRatio(m_image_to_agd_maps_ratio);
+			stage.SetNumberOfThreads(m_number_of_threads);
+			stage.SetNumberOfThreadsMax(m_max_threads);
+			stage.SetSubsampling(m_subsample, m_max_samples_svm_subsample);
+			stage.SetBalancedSubsampling(m_balanced_subsample);
+			stage.SetAgdMaximumDistance(m_agd_maximum_distance);
+			stage.SetLabelOfInterest(m_label_of_interest);
+			stage.SetVerbose(m_verbose);
+		}
+
+		/**
+		Allocates an image (filled with zeros) on a grid derived from the grid of reference
+		@param size size of the new image
+		@param firstVoxel continuous index (in reference) of the first voxel of the new image
+		@param spacingFactor the spacing of reference is multiplied by it
+		*/
+		template<class TImageType>
+		typename TImageType::Pointer createImageOnGrid(const itk::ImageBase<Dimensions>* reference, const int size[3],
+			const double firstVoxel[3], double spacingFactor)
+		{
+			typename TImageType::RegionType  region;
+			typename TImageType::SpacingType spacing = reference->GetSpacing();
+			itk::ContinuousIndex<double, Dimensions> first;
+			for (unsigned int d = 0; d < Dimensions; d++) {
+				region.SetIndex(d, 0);
+				region.SetSize(d, size[d]);
+				spacing[d] *= spacingFactor;
+				first[d] = firstVoxel[d];
+			}
+			typename TImageType::PointType origin;
+			reference->TransformContinuousIndexToPhysicalPoint(first, origin);
+
+			typename TImageType::Pointer image = TImageType::New();
+			image->SetRegions(region);
+			image->Allocate();
+			image->FillBuffer(0);
+			image->SetDirection(reference->GetDirection());
+			image->SetOrigin(origin);
+			image->SetSpacing(spacing);
+
+			return image;
+		}
+
 		// For AGD
 
 		template<typename TPixelType>
@@ -839,38 +1217,16 @@ namespace GeodesicTrainingSegmentation
 			std::vector< LabelsPixelType> agdLabels, bool saveResults = false)
 		{
 			message("AGD...", "AGD Operations");
-			typedef itk::Image<TPixelType, Dimensions> AgdOriginalImageType;
-			typedef itk::Image<AgdPixelType, 3> AgdImage3DType; // The algorithm implementation needs this type
-			typedef AgdImage3DType::Pointer AgdImage3DPointer;
 
-			std::vector< AgdImagePointer > agdResults;
+			std::vector< std::string > imageNames;
+			std::vector< std::vector< LabelsPixelType > > labelsForEachImage;
 
-			//int counterForFileName = 1;
-			int counterForThreadsVec = 0;
-			std::vector<std::thread> threads(inputImages.size() * agdLabels.size());
-			int numberOfOpenThreads = 0;
-			int oldestOpenThread = 0;
-
-			for (int i = 0; i < inputImages.size(); i++)
-			{
-				for (int j = 0; j < agdLabels.size(); j++)
-				{
-					if (!m_max_threads && numberOfOpenThreads == m_number_of_threads) {
-						threads[oldestOpenThread].join();
-						oldestOpenThread++;
-						numberOfOpenThreads--;
-					}
-					//std::cout << "Starting new thread for agd.\n";
-					numberOfOpenThreads++;
-					threads[counterForThreadsVec++] = std::thread(&Coordinator<PixelType, Dimensions>::agdThreadJob<TPixelType>, this,
-						std::ref(agdResults), std::to_string(i + 1), inputImages[i], agdLabels[j], saveResults
-					);
-				}
+			for (int i = 0; i < inputImages.size(); i++) {
+				imageNames.push_back(std::to_string(i + 1));
+				labelsForEachImage.push_back(agdLabels);
 			}
 
-			for (int i = oldestOpenThread; i < inputImages.size() * agdLabels.size(); i++) {
-				threads[i].join();
-			}
+			std::vector< AgdImagePointer > agdResults = agdMulti<TPixelType>(inputImages, imageNames, labelsForEachImage, saveResults);
 
 			message("AGD...", "AGD Operations", 100);
 			return agdResults;
@@ -880,39 +1236,7 @@ namespace GeodesicTrainingSegmentation
 		std::vector< AgdImagePointer > agd(std::vector< typename itk::Image< TPixelType, Dimensions >::Pointer > inputImages,
 			LabelsPixelType agdLabel, bool saveResults = false)
 		{
-			message("AGD...", "AGD Operations");
-			typedef itk::Image<TPixelType, Dimensions> AgdOriginalImageType;
-			typedef itk::Image<AgdPixelType, 3> AgdImage3DType; // The algorithm implementation needs this type
-			typedef AgdImage3DType::Pointer AgdImage3DPointer;
-
-			std::vector< AgdImagePointer > agdResults;
-
-			//int counterForFileName = 1;
-			int counterForThreadsVec = 0;
-			std::vector<std::thread> threads(inputImages.size());
-			int numberOfOpenThreads = 0;
-			int oldestOpenThread = 0;
-
-			for (int i = 0; i < inputImages.size(); i++)
-			{
-				if (!m_max_threads && numberOfOpenThreads == m_number_of_threads) {
-					threads[oldestOpenThread].join();
-					oldestOpenThread++;
-					numberOfOpenThreads--;
-				}
-				//std::cout << "Starting new thread for agd.\n";
-				numberOfOpenThreads++;
-				threads[counterForThreadsVec++] = std::thread(&Coordinator<PixelType, Dimensions>::agdThreadJob<TPixelType>, this,
-					std::ref(agdResults), std::to_string(i + 1), inputImages[i], agdLabel, saveResults
-				);
-			}
-
-			for (int i = oldestOpenThread; i < inputImages.size(); i++) {
-				threads[i].join();
-			}
-
-			message("AGD...", "AGD Operations", 100);
-			return agdResults;
+			return agd<TPixelType>(inputImages, std::vector< LabelsPixelType >(1, agdLabel), saveResults);
 		}
 
 		template<typename TPixelType>
@@ -1013,108 +1337,256 @@ namespace GeodesicTrainingSegmentation
 				return agdResults;
 			}
 			
-			auto keys = getMapKeyset(inputImagesMRI);
-			int threadsNumber = 0;
+			std::vector< typename itk::Image< TPixelType, Dimensions >::Pointer > images;
+			std::vector< std::string > imageNames;
+			std::vector< std::vector< LabelsPixelType > > labelsForEachImage;
 
-			for (auto key : keys) {
-				threadsNumber += epicenterForEachModality[key].size();
+			for (auto key : getMapKeyset(inputImagesMRI)) {
+				images.push_back(inputImagesMRI[key]);
+				imageNames.push_back(getModalityName(key));
+				labelsForEachImage.push_back(epicenterForEachModality[key]);
 			}
 
-			//int counterForFileName = 1;
-			int counterForThreadsVec = 0;
-			std::vector<std::thread> threads(threadsNumber);
-			int numberOfOpenThreads = 0;
-			int oldestOpenThread = 0;
+			agdResults = agdMulti<TPixelType>(images, imageNames, labelsForEachImage, saveResults);
 
-			for (auto key : keys)
-			{
-				for (LabelsPixelType epicenter : epicenterForEachModality[key])
-				{
-					if (!m_max_threads && numberOfOpenThreads == m_number_of_threads) {
-						threads[oldestOpenThread].join();
-						oldestOpenThread++;
-						numberOfOpenThreads--;
+			message("AGD (MRI)...", "AGD Operations", 100);
+			return agdResults;
+		}
+
+		/**
+		Computes the AGD maps of every (image, label) pair.
+		The preprocessing of the images and the postprocessing of the maps run as tasks on a pool of m_number_of_threads,
+		and all the maps are computed together by a single multi-channel AdaptiveGeodesicDistance::RunMulti
+		(or one Dijkstra propagation task per map if m_agd_maximum_distance is set).
+		Maps in m_agd_cache that are unchanged are reused, and maps whose seeds were only added are updated
+		in place from the new seeds instead (see SetAgdCache).
+		@return the maps in the order of the images and then the labels (label 0 is skipped)
+		*/
+		template<typename TPixelType>
+		std::vector< AgdImagePointer > agdMulti(std::vector< typename itk::Image< TPixelType, Dimensions >::Pointer > inputImages,
+			std::vector< std::string > imageNames, std::vector< std::vector< LabelsPixelType > > labelsForEachImage, bool saveResults)
+		{
+			typedef itk::Image<TPixelType, Dimensions> AgdOriginalImageType;
+
+			// Every (image, label) pair is a channel
+			std::vector< std::pair<int, int> > channels;
+			for (int i = 0; i < inputImages.size(); i++) {
+				for (LabelsPixelType agdLabel : labelsForEachImage[i]) {
+					if (agdLabel != 0) {
+						channels.push_back(std::make_pair(i, agdLabel));
 					}
-					//std::cout << "Starting new thread for agd MRI.\n";
-					numberOfOpenThreads++;
-					threads[counterForThreadsVec++] = std::thread(&Coordinator<PixelType, Dimensions>::agdThreadJob<TPixelType>, this,
-						std::ref(agdResults), getModalityName(key), inputImagesMRI[key], epicenter, saveResults
-					);
 				}
 			}
 
-			for (int i = oldestOpenThread; i < threadsNumber; i++) {
-				threads[i].join();
+			std::vector< AgdImagePointer > agdResults(channels.size());
+			if (channels.empty()) {
+				return agdResults;
 			}
 
-			message("AGD (MRI)...", "AGD Operations", 100);
-			return agdResults;
-		}
+			UtilGTS::TaskPool pool((m_max_threads) ? 0 : m_number_of_threads);
 
-		template<typename TPixelType>
-		void agdThreadJob(std::vector< AgdImagePointer > &outputVec, std::string imageName,
-			typename itk::Image< TPixelType, Dimensions >::Pointer inputImage, LabelsPixelType agdLabel, bool saveResults = true)
-		{
-			if (agdLabel == 0) {
-				return;
+			// Normalize inputs to [0,255] (pseudoprob maps will be in [0,1], converting them to int would have been bad)
+			std::vector< AgdImagePointer > agdInputs(inputImages.size());
+			for (int i = 0; i < inputImages.size(); i++)
+			{
+				pool.Submit([i, &inputImages, &agdInputs]() {
+					auto agdNormInputImage = ItkUtilGTS::normalizeImage<AgdOriginalImageType>(inputImages[i]);
+					agdInputs[i] = ItkUtilGTS::castAndRescaleImage< AgdOriginalImageType, AgdImageType >(agdNormInputImage);
+				});
 			}
+			pool.Wait();
 
-			typedef itk::Image<TPixelType, Dimensions> AgdOriginalImageType;
-			typedef itk::Image<AgdPixelType, Dimensions> AgdImageType; // The algorithm implementation needs this type
-			typedef typename AgdImageType::Pointer AgdImagePointer;
+			// Get raw results of AGD algorithm (not in [0,255])
+			std::vector< AgdImagePointer > agdOutRaw(channels.size());
 
-			// Normalize input to [0,255] (pseudoprob maps will be in [0,1], converting them to int would have been bad
-			auto agdNormInputImage = ItkUtilGTS::normalizeImage<AgdOriginalImageType>(inputImage);
+			// Maps that can be updated from the cache
+			std::map< LabelsPixelType, std::vector<size_t> > seeds;
+			std::vector< std::vector<size_t> > newSeeds(channels.size());
+			std::vector< bool > incremental;
+			if (m_agd_cache) {
+				seeds = findSeeds(channels);
+				incremental = findIncrementalAgdChannels(agdInputs, imageNames, channels, seeds, newSeeds);
+			}
+			else {
+				incremental.resize(channels.size(), false);
+			}
+			std::vector< std::pair<int, int> > fullChannels;
+			std::vector< size_t >              fullChannelsIndices;
 
-			/*std::cout << "Saving agd norm input image...";
-			writeImage<AgdOriginalImageType>(agdNormInputImage, "agd" + std::to_string(counterForFileName)
-				+ "_l" + std::to_string(agdLabels[i]) + "_normoriginput.nii.gz"
-				);
-			std::cout << "finished\n";*/
+			for (size_t c = 0; c < channels.size(); c++)
+			{
+				if (!incremental[c]) {
+					fullChannels.push_back(channels[c]);
+					fullChannelsIndices.push_back(c);
+					continue;
+				}
 
-			// Convert input to AgdImageType
-			//AgdImage3DPointer agdInput;
-			//if (Dimensions < 3) {
-			//	auto temp = castImage< AgdOriginalImageType, AgdImageType >(agdNormInputImage);
-			//	
-			//	typedef itk::JoinImageFilter<AgdImageType, AgdImageType3DType> JoinImageFilterType;
-			//	
-			//	JoinImageFilterType::Pointer joinFilter = JoinImageFilterType::New();
-			//	joinFilter->SetInput(agdNormInputImage, agdInput);
-			//	agdInput = joinFilter->GetOutput();
-			//}
-			//else {
-			AgdImagePointer agdInput = ItkUtilGTS::castAndRescaleImage< AgdOriginalImageType, AgdImageType >(agdNormInputImage);
-			//}
+				AgdImagePointer agdRaw = m_agd_cache->rawMaps.at(std::make_pair(imageNames[channels[c].first], channels[c].second));
+				agdOutRaw[c] = agdRaw;
+				if (newSeeds[c].empty()) {
+					continue;
+				}
+
+				pool.Submit([this, c, agdRaw, &channels, &agdInputs, &newSeeds]() {
+					AgdImagePointer agdInput = agdInputs[channels[c].first];
+
+					int size[3] = { 1, 1, 1 };
+					for (unsigned int d = 0; d < Dimensions; d++) {
+						size[d] = static_cast<int>(agdRaw->GetLargestPossibleRegion().GetSize()[d]);
+					}
+
+					// Same initialization as the full run (limited at 255)
+					const AgdPixelType unreachedValue = AdaptiveGeodesicDistance::UnreachedValue<AgdPixelType>(true);
+					if (m_agd_maximum_distance > 0) {
+						AdaptiveGeodesicDistance::AddDijkstraSources<AgdImageType>(agdInput->GetBufferPointer(), agdInput->GetBufferPointer(),
+							agdRaw->GetBufferPointer(), size, newSeeds[c], unreachedValue, m_agd_maximum_distance);
+					}
+					else { // A single sweep thread, the pool runs the maps in parallel
+						AdaptiveGeodesicDistance::AddChamferSources<AgdImageType>(agdInput->GetBufferPointer(), agdInput->GetBufferPointer(),
+							agdRaw->GetBufferPointer(), size, newSeeds[c], unreachedValue, 1);
+					}
+				});
+			}
+
+			if (fullChannels.size() < channels.size()) {
+				message("AGD: reusing " + std::to_string(channels.size() - fullChannels.size()) + " of " +
+					std::to_string(channels.size()) + " maps (updated from the new seeds, if any)\n", "");
+			}
 
-			/*std::cout << "Saving agd input image...";
-			writeImage<AgdImageType>(agdInput, "agd" + std::to_string(counterForFileName)
-				+ "_l" + std::to_string(agdLabels[i]) + "_input.nii.gz"
+			if (fullChannels.empty()) {
+				pool.Wait();
+			}
+			else if (m_agd_maximum_distance > 0)
+			{
+				for (size_t c : fullChannelsIndices)
+				{
+					pool.Submit([this, c, &channels, &agdInputs, &agdOutRaw]() {
+						AgdImagePointer agdInput = agdInputs[channels[c].first];
+						agdOutRaw[c] = AdaptiveGeodesicDistance::RunDijkstra<AgdPixelType, Dimensions>(
+							agdInput, agdInput, m_labels_image, channels[c].second, m_agd_maximum_distance, false, true
+						);
+					});
+				}
+				pool.Wait();
+			}
+			else {
+				std::vector< AgdImagePointer > fullOutRaw = AdaptiveGeodesicDistance::RunMulti<AgdPixelType, Dimensions>(
+					agdInputs, agdInputs, m_labels_image, fullChannels, false, true, pool.GetNumberOfThreads()
 				);
-			std::cout << "finished\n";*/
+				pool.Wait(); // Incremental updates
 
-			// Get raw result of AGD algorithm (not in [0,255])
-			AgdImagePointer agdOutRaw = AdaptiveGeodesicDistance::Run<AgdPixelType, Dimensions>(
-				agdInput, agdInput, m_labels_image, agdLabel, false, true
-			);
+				for (size_t i = 0; i < fullChannelsIndices.size(); i++) {
+					agdOutRaw[fullChannelsIndices[i]] = fullOutRaw[i];
+				}
+			}
+
+			if (m_agd_cache)
+			{
+				// Keep the raw maps for the next execution
+				for (int i = 0; i < inputImages.size(); i++) {
+					m_agd_cache->inputs[imageNames[i]] = agdInputs[i];
+				}
+				m_agd_cache->maximumDistance = m_agd_maximum_distance;
+				for (size_t c = 0; c < channels.size(); c++) {
+					const auto key = std::make_pair(imageNames[channels[c].first], channels[c].second);
+					m_agd_cache->rawMaps[key] = agdOutRaw[c];
+					m_agd_cache->seeds[key]   = seeds[channels[c].second];
+				}
+			}
 
 			// Normalize results to [0,255]
-			//AgdImage3DPointer agdOutNorm = normalizeImage<AgdImage3DType>(agdOutRaw);
+			for (size_t c = 0; c < channels.size(); c++)
+			{
+				pool.Submit([this, c, saveResults, &channels, &imageNames, &agdOutRaw, &agdResults]() {
+					agdResults[c] = ItkUtilGTS::normalizeImage<AgdImageType>(agdOutRaw[c]);
+					if (!m_agd_cache) {
+						agdOutRaw[c] = nullptr;
+					}
+
+					if (saveResults) {
+						// Write results to file
+						this->template writeImage<AgdImageType>(agdResults[c],
+							"agd_" + imageNames[channels[c].first] + "_class" + std::to_string(channels[c].second));
+					}
+				});
+			}
+			pool.Wait();
+
+			return agdResults;
+		}
 
-			// Convert output to correct dimensions
-			//AgdImagePointer agdOut = castImage< AgdImage3DType, AgdImageType >(agdOutNorm);
-			//AgdImagePointer agdOut = agdOutNorm;
-			AgdImagePointer agdOut = ItkUtilGTS::normalizeImage<AgdImageType>(agdOutRaw);
+		/** The (sorted) indices of the voxels of each label that appears in channels */
+		std::map< LabelsPixelType, std::vector<size_t> > findSeeds(const std::vector< std::pair<int, int> >& channels)
+		{
+			std::map< LabelsPixelType, std::vector<size_t> > seeds;
+			for (const auto& channel : channels) {
+				seeds[channel.second];
+			}
+
+			const size_t voxelsCount = m_labels_image->GetLargestPossibleRegion().GetNumberOfPixels();
+			const LabelsPixelType* labels = m_labels_image->GetBufferPointer();
+			for (size_t v = 0; v < voxelsCount; v++)
+			{
+				auto it = seeds.find(labels[v]);
+				if (it != seeds.end()) {
+					it->second.push_back(v);
+				}
+			}
+			return seeds;
+		}
 
-			if (saveResults) {
-				// Write results to file
-				//std::cout << "Saving agd image...";
-				writeImage<AgdImageType>(agdOut, "agd_" + imageName + "_class" + std::to_string(agdLabel));
-				//std::cout << "finished\n";
+		/**
+		Finds which AGD maps can be updated from m_agd_cache: the normalized input image is the same as the cached one,
+		and the seeds of the label were only added since (removed seeds would need a full recomputation)
+		@param seeds the current seeds of each label (see findSeeds)
+		@param newSeeds output, the added seeds for each channel that can be updated
+		@return for each channel, whether it can be updated from the cache
+		*/
+		std::vector< bool > findIncrementalAgdChannels(const std::vector< AgdImagePointer >& agdInputs, const std::vector< std::string >& imageNames,
+			const std::vector< std::pair<int, int> >& channels, std::map< LabelsPixelType, std::vector<size_t> >& seeds,
+			std::vector< std::vector<size_t> >& newSeeds)
+		{
+			std::vector< bool > incremental(channels.size(), false);
+			if (m_agd_cache->maximumDistance != m_agd_maximum_distance) {
+				return incremental; // The maps were computed with another backend (or limit)
+			}
+
+			// Inputs that are the same as the cached ones
+			std::vector< bool > sameInput(agdInputs.size(), false);
+			for (size_t i = 0; i < agdInputs.size(); i++)
+			{
+				auto cached = m_agd_cache->inputs.find(imageNames[i]);
+				if (cached != m_agd_cache->inputs.end() &&
+					cached->second->GetLargestPossibleRegion() == agdInputs[i]->GetLargestPossibleRegion())
+				{
+					const AgdPixelType* cachedBuffer = cached->second->GetBufferPointer();
+					sameInput[i] = std::equal(cachedBuffer, cachedBuffer + agdInputs[i]->GetLargestPossibleRegion().GetNumberOfPixels(),
+						agdInputs[i]->GetBufferPointer());
+				}
 			}
 
-			std::lock_guard<std::mutex> lg(m_agd_mutex);
-			outputVec.push_back(agdOut);
+			for (size_t c = 0; c < channels.size(); c++)
+			{
+				const auto key = std::make_pair(imageNames[channels[c].first], channels[c].second);
+				auto cachedSeeds = m_agd_cache->seeds.find(key);
+				if (!sameInput[channels[c].first] || cachedSeeds == m_agd_cache->seeds.end() ||
+					m_agd_cache->rawMaps.find(key) == m_agd_cache->rawMaps.end())
+				{
+					continue;
+				}
+
+				const std::vector<size_t>& currentSeeds = seeds[channels[c].second];
+				if (!std::includes(currentSeeds.begin(), currentSeeds.end(), cachedSeeds->second.begin(), cachedSeeds->second.end())) {
+					continue; // Seeds were removed
+				}
+
+				std::set_difference(currentSeeds.begin(), currentSeeds.end(), cachedSeeds->second.begin(), cachedSeeds->second.end(),
+					std::back_inserter(newSeeds[c]));
+
+				incremental[c] = true;
+			}
+
+			return incremental;
 		}
 
 		// For LABELSTHRES
@@ -1215,7 +1687,7 @@ namespace GeodesicTrainingSegmentation
 		LabelsImagePointer rf(bool trainAutoFlag)
 		{
 			message("Converting input images to matrices...", "Converting");
-			auto data = ParserGTS::Parse<PixelType, Dimensions>(m_input_images, m_labels_image, false);
+			auto data = parseFeatureMatrix(m_input_images, m_labels_image);
 			message("Converting input images to matrices...", "Converting", 100);
 			
 			RFSuite::Manager rfManager;
@@ -1223,6 +1695,8 @@ namespace GeodesicTrainingSegmentation
 			rfManager.SetOutputPath(m_output_folder);
 			rfManager.SetSaveAll(m_save_all);
 			rfManager.SetVerbose(true);
+			rfManager.SetUseOpenCV(m_rf_use_opencv);
+			rfManager.SetNumberOfThreads((m_max_threads) ? 0 : m_number_of_threads);
 
 			if (m_rf_config_file_path != "") {
 				rfManager.SetParametersFromConfig(m_rf_config_file_path);
@@ -1236,6 +1710,10 @@ namespace GeodesicTrainingSegmentation
 				rfManager.TrainAuto();
 			}
 			message("", "Training", 100);
+
+			if (m_save_all) {
+				rfManager.SaveModel(m_output_folder + ((m_rf_use_opencv) ? "/rf_model.xml" : "/rf_model.bin"));
+			}
 			
 			auto resMatPtr = rfManager.Test(data->testingMat, data->testingMat);
 
@@ -0,0 +1,188 @@
+#ifndef H_CBICA_GEODESIC_TRAINING_SESSION
+#define H_CBICA_GEODESIC_TRAINING_SESSION
+
+#include "GeodesicTrainingSegmentation.h"
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace GeodesicTrainingSegmentation
+{
+	/**
+	Long-lived segmentation of one image set, for the interactive workflow of drawing scribbles,
+	looking at the result, correcting it and running again.
+	Between updates the session keeps in memory the images, the labels drawn so far, the last segmentation,
+	the AGD maps (only the new seeds are propagated, see AgdCache), the feature matrix
+	(only the AGD columns are gathered again) and the trained svm descriptions
+	(the models are retrained at the parameters found by the first update, without searching for them again,
+	starting from the solution of the previous update, see SvmSuite::WarmStartTrainer).
+	*/
+	template<typename PixelType = float, unsigned int Dimensions = 3>
+	class Session : public Coordinator<PixelType, Dimensions>
+	{
+	public:
+		typedef Coordinator<PixelType, Dimensions>        CoordinatorType;
+		typedef typename CoordinatorType::Result          Result;
+		typedef itk::Image<PixelType, Dimensions>         InputImageType;
+		typedef typename InputImageType::Pointer          InputImagePointer;
+		typedef itk::Image<LabelsPixelType, Dimensions>   LabelsImageType;
+		typedef typename LabelsImageType::Pointer         LabelsImagePointer;
+
+		explicit Session() {
+			this->SetResidentFeatureMatrix(true);
+		}
+
+		virtual ~Session() {}
+
+		/**
+		Opens the session for an image set. If it is the same set as the open one, everything kept in memory is reused.
+		The set is the same if the key matches and the images are the same objects, not modified since the last Open
+		(so an image that was edited in place, or replaced under the same file name, starts a new session).
+		@param inputImages the images
+		@param key identifies the image set (for example the file names). If empty, the image objects identify it.
+		@return true if the open session continues
+		*/
+		bool Open(const std::vector< InputImagePointer >& inputImages, std::string key = "")
+		{
+			if (key == "")
+			{
+				std::stringstream keyStream;
+				for (const InputImagePointer& image : inputImages) {
+					keyStream << image.GetPointer() << ";";
+				}
+				key = keyStream.str();
+			}
+
+			std::vector< itk::ModifiedTimeType > inputTimes;
+			for (const InputImagePointer& image : inputImages) {
+				inputTimes.push_back(modifiedTime(image));
+			}
+
+			if (m_open && key == m_key && inputImages == m_input_images && inputTimes == m_input_times) {
+				return true;
+			}
+
+			Close();
+
+			m_open = true;
+			m_key  = key;
+			m_input_images = inputImages;
+			m_input_times  = inputTimes;
+			m_agd_cache = std::make_shared< AgdCache<Dimensions> >();
+			m_svm_descriptions_cache = std::make_shared< std::vector< SvmSuite::SvmDescription > >();
+
+			this->SetAgdCache(m_agd_cache);
+			this->SetSvmDescriptionsCache(m_svm_descriptions_cache);
+			this->SetResidentFeatureMatrix(true);
+			return false;
+		}
+
+		/** Releases everything kept in memory */
+		void Close()
+		{
+			m_open = false;
+			m_key  = "";
+			m_input_images.clear();
+			m_input_times.clear();
+			m_labels = nullptr;
+			m_segmentation = nullptr;
+			m_agd_cache = nullptr;
+			m_svm_descriptions_cache = nullptr;
+
+			this->SetAgdCache(nullptr);
+			this->SetSvmDescriptionsCache(nullptr);
+			this->SetResidentFeatureMatrix(false); // Releases the matrix
+		}
+
+		/**
+		Adds scribbles and segments the images again.
+		On the first update the scribbles are the labels. Afterwards, the voxels where the scribbles differ from
+		the last segmentation are the corrections of the user and are added to the labels
+		(so the scribbles can be the last segmentation with some voxels drawn over).
+		@param scribbles labels image the size of the images
+		@return the result of the execution, labelsImage is the segmentation
+		*/
+		std::shared_ptr< Result > Update(LabelsImagePointer scribbles)
+		{
+			if (!m_open)
+			{
+				std::shared_ptr< Result > result(new Result());
+				result->ok = false;
+				result->errorMessage = "The session is not open";
+				return result;
+			}
+
+			if (m_labels == nullptr || m_segmentation == nullptr ||
+				m_labels->GetLargestPossibleRegion() != scribbles->GetLargestPossibleRegion())
+			{
+				m_labels = ItkUtilGTS::initializeOutputImageBasedOn<LabelsImageType>(scribbles);
+				std::copy(scribbles->GetBufferPointer(),
+					scribbles->GetBufferPointer() + scribbles->GetLargestPossibleRegion().GetNumberOfPixels(),
+					m_labels->GetBufferPointer());
+			}
+			else {
+				const size_t voxelsCount = scribbles->GetLargestPossibleRegion().GetNumberOfPixels();
+				const LabelsPixelType* newLabels    = scribbles->GetBufferPointer();
+				const LabelsPixelType* segmentation = m_segmentation->GetBufferPointer();
+				LabelsPixelType* labels = m_labels->GetBufferPointer();
+
+				for (size_t i = 0; i < voxelsCount; i++) {
+					if (newLabels[i] != segmentation[i]) {
+						labels[i] = newLabels[i];
+					}
+				}
+				m_labels->Modified();
+			}
+
+			this->SetInputImages(m_input_images);
+			this->SetLabels(m_labels);
+			std::shared_ptr< Result > result = this->Execute();
+
+			if (result && result->ok && result->labelsImage) {
+				m_segmentation = result->labelsImage;
+			}
+			return result;
+		}
+
+		bool IsOpen() const {
+			return m_open;
+		}
+
+		/** The labels used in the last update (the first scribbles and all the corrections) */
+		LabelsImagePointer GetLabels() const {
+			return m_labels;
+		}
+
+		/** The segmentation of the last update */
+		LabelsImagePointer GetSegmentation() const {
+			return m_segmentation;
+		}
+
+	private:
+		bool                                                       m_open = false;
+		std::string                                                m_key = "";
+		std::vector< InputImagePointer >                           m_input_images;
+		std::vector< itk::ModifiedTimeType >                       m_input_times;
+		LabelsImagePointer                                         m_labels, m_segmentation;
+		std::shared_ptr< AgdCache<Dimensions> >                    m_agd_cache;
+		std::shared_ptr< std::vector< SvmSuite::SvmDescription > > m_svm_descriptions_cache;
+
+		/** Last modification of the image or of its buffer */
+		static itk::ModifiedTimeType modifiedTime(const InputImagePointer& image)
+		{
+			if (!image) {
+				return 0;
+			}
+			itk::ModifiedTimeType time = image->GetMTime();
+			if (image->GetPixelContainer()) {
+				time = std::max(time, image->GetPixelContainer()->GetMTime());
+			}
+			return time;
+		}
+	};
+}
+
+#endif // !H_CBICA_GEODESIC_TRAINING_SESSION
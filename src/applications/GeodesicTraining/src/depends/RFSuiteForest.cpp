@@ -0,0 +1,437 @@
+#include "RFSuiteForest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <thread>
+
+namespace
+{
+	const size_t PREDICT_BLOCK_ROWS = 256; // rows that go through a tree before moving to the next one
+
+	/** Training data after binning, shared (read-only) by all tree builders */
+	typedef struct BinnedSet
+	{
+		size_t rows = 0, features = 0, classes = 0;
+		std::vector<uint8_t> bins;               // column-major: bins[feature * rows + row]
+		std::vector<std::vector<float>> cuts;    // bin b of feature f holds values in (cuts[f][b-1], cuts[f][b]]
+		std::vector<int> classOfRow;
+		std::vector<double> classWeight;
+	} BinnedSet;
+
+	typedef struct TreeResult
+	{
+		std::vector<RFSuite::Forest::Node> nodes;
+		std::vector<double> importance;
+	} TreeResult;
+
+	/** Runs job on threadsNumber threads (including the calling one) */
+	template<typename TJob>
+	void runOnThreads(int threadsNumber, TJob& job)
+	{
+		std::vector<std::thread> threads;
+		for (int i = 1; i < threadsNumber; i++) {
+			threads.push_back(std::thread(std::ref(job)));
+		}
+		job();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	template<typename TElement>
+	bool readVector(std::ifstream& file, std::vector<TElement>& vector)
+	{
+		uint64_t count = 0;
+		if (!file.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+			return false;
+		}
+		vector.resize(count);
+		return static_cast<bool>(file.read(reinterpret_cast<char*>(vector.data()), count * sizeof(TElement)));
+	}
+
+	/** Quantile cut points of a feature; values <= cuts[b] (and > cuts[b-1]) fall in bin b */
+	std::vector<float> computeCuts(std::vector<float>& values, int numberOfBins)
+	{
+		std::sort(values.begin(), values.end());
+		std::vector<float> cuts;
+		for (int b = 1; b < numberOfBins; b++)
+		{
+			float cut = values[(values.size() - 1) * b / numberOfBins];
+			if (cuts.empty() || cut > cuts.back()) {
+				cuts.push_back(cut);
+			}
+		}
+		if (cuts.empty() || cuts.back() < values.back()) {
+			cuts.push_back(values.back());
+		}
+		return cuts;
+	}
+
+	/** Grows one tree from a bootstrap sample */
+	TreeResult growTree(const BinnedSet& set, const RFSuite::Forest::Parameters& parameters, int activeVarCount, unsigned int seed)
+	{
+		TreeResult result;
+		result.importance.assign(set.features, 0);
+
+		std::mt19937 generator(seed);
+		std::uniform_int_distribution<size_t> drawRow(0, set.rows - 1);
+		std::vector<int> samples(set.rows);
+		for (auto& s : samples) {
+			s = static_cast<int>(drawRow(generator));
+		}
+
+		std::vector<int> featureOrder(set.features);
+		std::iota(featureOrder.begin(), featureOrder.end(), 0);
+
+		const size_t classes = set.classes;
+		std::vector<double> histogram(256 * classes), parentWeights(classes), leftWeights(classes);
+
+		typedef struct Pending { int32_t node; size_t begin, end; int depth; } Pending;
+		std::vector<Pending> stack;
+		result.nodes.push_back(RFSuite::Forest::Node());
+		stack.push_back({ 0, 0, samples.size(), 0 });
+
+		while (!stack.empty())
+		{
+			Pending current = stack.back();
+			stack.pop_back();
+
+			std::fill(parentWeights.begin(), parentWeights.end(), 0.0);
+			for (size_t i = current.begin; i < current.end; i++) {
+				parentWeights[set.classOfRow[samples[i]]] += set.classWeight[set.classOfRow[samples[i]]];
+			}
+			const int32_t majority = static_cast<int32_t>(
+				std::max_element(parentWeights.begin(), parentWeights.end()) - parentWeights.begin());
+			const double parentTotal = std::accumulate(parentWeights.begin(), parentWeights.end(), 0.0);
+			double parentScore = 0; // sum of squared class weights over total; higher is purer
+			size_t nonEmptyClasses = 0;
+			for (double w : parentWeights) {
+				parentScore += w * w;
+				nonEmptyClasses += (w > 0);
+			}
+			parentScore /= parentTotal;
+
+			RFSuite::Forest::Node& node = result.nodes[current.node];
+			node.feature = -1;
+			node.threshold = 0;
+			node.value = majority;
+
+			const size_t count = current.end - current.begin;
+			if (nonEmptyClasses < 2 || current.depth >= parameters.maxDepth ||
+				count < static_cast<size_t>(std::max(parameters.minSampleCount, 2)))
+			{
+				continue;
+			}
+
+			// Random subset of features (partial Fisher-Yates)
+			for (int i = 0; i < activeVarCount; i++) {
+				std::uniform_int_distribution<size_t> pick(i, set.features - 1);
+				std::swap(featureOrder[i], featureOrder[pick(generator)]);
+			}
+
+			double bestGain = 1e-12;
+			int bestFeature = -1, bestBin = 0;
+
+			for (int i = 0; i < activeVarCount; i++)
+			{
+				const int f = featureOrder[i];
+				const uint8_t* column = &set.bins[f * set.rows];
+				const size_t binsOfFeature = set.cuts[f].size();
+
+				std::fill(histogram.begin(), histogram.begin() + binsOfFeature * classes, 0.0);
+				for (size_t s = current.begin; s < current.end; s++) {
+					const int row = samples[s];
+					const int c = set.classOfRow[row];
+					histogram[column[row] * classes + c] += set.classWeight[c];
+				}
+
+				std::fill(leftWeights.begin(), leftWeights.end(), 0.0);
+				double leftTotal = 0;
+				for (size_t b = 0; b + 1 < binsOfFeature; b++)
+				{
+					for (size_t c = 0; c < classes; c++) {
+						leftWeights[c] += histogram[b * classes + c];
+						leftTotal += histogram[b * classes + c];
+					}
+					const double rightTotal = parentTotal - leftTotal;
+					if (leftTotal <= 0 || rightTotal <= 0) {
+						continue;
+					}
+
+					double leftScore = 0, rightScore = 0;
+					for (size_t c = 0; c < classes; c++) {
+						const double r = parentWeights[c] - leftWeights[c];
+						leftScore  += leftWeights[c] * leftWeights[c];
+						rightScore += r * r;
+					}
+					const double gain = leftScore / leftTotal + rightScore / rightTotal - parentScore;
+					if (gain > bestGain) {
+						bestGain = gain;
+						bestFeature = f;
+						bestBin = static_cast<int>(b);
+					}
+				}
+			}
+
+			if (bestFeature == -1) {
+				continue;
+			}
+
+			const uint8_t* column = &set.bins[bestFeature * set.rows];
+			const size_t middle = std::partition(samples.begin() + current.begin, samples.begin() + current.end,
+				[&](int row) { return column[row] <= bestBin; }) - samples.begin();
+
+			const int32_t left = static_cast<int32_t>(result.nodes.size());
+			node.feature = bestFeature;
+			node.threshold = set.cuts[bestFeature][bestBin];
+			node.value = left;
+			result.importance[bestFeature] += bestGain;
+
+			result.nodes.push_back(RFSuite::Forest::Node()); // invalidates node
+			result.nodes.push_back(RFSuite::Forest::Node());
+			stack.push_back({ left + 1, middle, current.end, current.depth + 1 });
+			stack.push_back({ left,     current.begin, middle, current.depth + 1 });
+		}
+
+		return result;
+	}
+}
+
+int RFSuite::Forest::numberOfThreads(size_t jobs) const
+{
+	int threads = (m_parameters.numberOfThreads > 0) ? m_parameters.numberOfThreads :
+		static_cast<int>(std::thread::hardware_concurrency());
+	threads = std::max(threads, 1);
+	return static_cast<int>(std::min<size_t>(threads, std::max<size_t>(jobs, 1)));
+}
+
+bool RFSuite::Forest::Train(const float* samples, size_t rowStride, const int* labels, const std::vector<int>& rows,
+	size_t features, const Parameters& parameters)
+{
+	m_nodes.clear();
+	m_roots.clear();
+	m_classes.clear();
+	m_variable_importance.assign(features, 0);
+	m_parameters = parameters;
+	m_parameters.numberOfBins = std::min(std::max(m_parameters.numberOfBins, 2), 256);
+	m_features = features;
+
+	if (rows.empty() || features == 0 || m_parameters.numberOfTrees <= 0) {
+		return false;
+	}
+
+	// Classes and per-class weights
+	BinnedSet set;
+	set.rows = rows.size();
+	set.features = features;
+	for (int r : rows) {
+		m_classes.push_back(labels[r]);
+	}
+	std::sort(m_classes.begin(), m_classes.end());
+	m_classes.erase(std::unique(m_classes.begin(), m_classes.end()), m_classes.end());
+	set.classes = m_classes.size();
+	set.classWeight.assign(set.classes, 1.0);
+	for (size_t c = 0; c < set.classes && c < m_parameters.priors.size(); c++) {
+		set.classWeight[c] = m_parameters.priors[c];
+	}
+	set.classOfRow.resize(set.rows);
+	for (size_t i = 0; i < set.rows; i++) {
+		set.classOfRow[i] = static_cast<int>(
+			std::lower_bound(m_classes.begin(), m_classes.end(), labels[rows[i]]) - m_classes.begin());
+	}
+
+	// Bin features (in parallel, one feature per task)
+	set.cuts.resize(features);
+	set.bins.resize(features * set.rows);
+	std::atomic<size_t> nextFeature(0);
+	auto binJob = [&]()
+	{
+		std::vector<float> values(set.rows);
+		for (size_t f = nextFeature++; f < features; f = nextFeature++)
+		{
+			for (size_t i = 0; i < set.rows; i++) {
+				values[i] = samples[rows[i] * rowStride + f];
+			}
+			set.cuts[f] = computeCuts(values, m_parameters.numberOfBins);
+			const std::vector<float>& cuts = set.cuts[f];
+			uint8_t* column = &set.bins[f * set.rows];
+			for (size_t i = 0; i < set.rows; i++) {
+				column[i] = static_cast<uint8_t>(std::lower_bound(cuts.begin(), cuts.end(),
+					samples[rows[i] * rowStride + f]) - cuts.begin());
+			}
+		}
+	};
+
+	// Grow trees (in parallel, one tree per task)
+	const int activeVarCount = (m_parameters.activeVarCount > 0) ?
+		std::min(m_parameters.activeVarCount, static_cast<int>(features)) :
+		std::max(1, static_cast<int>(std::lround(std::sqrt(static_cast<double>(features)))));
+	std::vector<TreeResult> trees(m_parameters.numberOfTrees);
+	std::atomic<int> nextTree(0);
+	auto treeJob = [&]()
+	{
+		for (int t = nextTree++; t < m_parameters.numberOfTrees; t = nextTree++) {
+			trees[t] = growTree(set, m_parameters, activeVarCount, m_parameters.seed + static_cast<unsigned int>(t));
+		}
+	};
+
+	runOnThreads(numberOfThreads(features), binJob);
+	runOnThreads(numberOfThreads(trees.size()), treeJob);
+
+	// Flatten
+	size_t totalNodes = 0;
+	for (const auto& tree : trees) {
+		totalNodes += tree.nodes.size();
+	}
+	m_nodes.reserve(totalNodes);
+	double importanceSum = 0;
+	for (const auto& tree : trees)
+	{
+		const int32_t offset = static_cast<int32_t>(m_nodes.size());
+		m_roots.push_back(offset);
+		for (Node node : tree.nodes) {
+			if (node.feature >= 0) {
+				node.value += offset;
+			}
+			m_nodes.push_back(node);
+		}
+		for (size_t f = 0; f < features; f++) {
+			m_variable_importance[f] += static_cast<float>(tree.importance[f]);
+			importanceSum += tree.importance[f];
+		}
+	}
+	if (importanceSum > 0) {
+		for (auto& v : m_variable_importance) {
+			v = static_cast<float>(v / importanceSum);
+		}
+	}
+
+	return true;
+}
+
+void RFSuite::Forest::Predict(const float* samples, size_t numberOfRows, size_t rowStride, int* resLabels,
+	float* resConfidence, const float* skipZeros, size_t skipZerosStride) const
+{
+	if (numberOfRows == 0) {
+		return;
+	}
+	if (Empty()) {
+		std::fill(resLabels, resLabels + numberOfRows, 0);
+		if (resConfidence) {
+			std::fill(resConfidence, resConfidence + numberOfRows, 0.0f);
+		}
+		return;
+	}
+
+	const size_t classes = m_classes.size();
+	const size_t blocks = (numberOfRows + PREDICT_BLOCK_ROWS - 1) / PREDICT_BLOCK_ROWS;
+	const Node* nodes = m_nodes.data();
+	std::atomic<size_t> nextBlock(0);
+
+	auto job = [&]()
+	{
+		std::vector<uint32_t> votes(PREDICT_BLOCK_ROWS * classes);
+		std::vector<uint8_t>  active(PREDICT_BLOCK_ROWS);
+
+		for (size_t block = nextBlock++; block < blocks; block = nextBlock++)
+		{
+			const size_t begin = block * PREDICT_BLOCK_ROWS;
+			const size_t end = std::min(begin + PREDICT_BLOCK_ROWS, numberOfRows);
+			std::fill(votes.begin(), votes.end(), 0);
+			for (size_t r = begin; r < end; r++) {
+				active[r - begin] = (!skipZeros || skipZeros[r * skipZerosStride] != 0);
+			}
+
+			for (int32_t root : m_roots)
+			{
+				for (size_t r = begin; r < end; r++)
+				{
+					if (!active[r - begin]) {
+						continue;
+					}
+					const float* sample = samples + r * rowStride;
+					const Node* node = nodes + root;
+					while (node->feature >= 0) {
+						node = nodes + node->value + (sample[node->feature] > node->threshold);
+					}
+					votes[(r - begin) * classes + node->value]++;
+				}
+			}
+
+			for (size_t r = begin; r < end; r++)
+			{
+				if (!active[r - begin]) {
+					resLabels[r] = 0;
+					if (resConfidence) {
+						resConfidence[r] = 0;
+					}
+					continue;
+				}
+				const uint32_t* rowVotes = &votes[(r - begin) * classes];
+				const size_t best = std::max_element(rowVotes, rowVotes + classes) - rowVotes;
+				resLabels[r] = m_classes[best];
+				if (resConfidence) {
+					resConfidence[r] = static_cast<float>(rowVotes[best]) / m_roots.size();
+				}
+			}
+		}
+	};
+
+	runOnThreads(numberOfThreads(blocks), job);
+}
+
+void RFSuite::Forest::Predict(const float* samples, size_t rowStride, const std::vector<int>& rows, std::vector<int>& resLabels) const
+{
+	// Gather to a contiguous block so that the batched path can be used
+	std::vector<float> gathered(rows.size() * m_features);
+	for (size_t i = 0; i < rows.size(); i++) {
+		std::memcpy(&gathered[i * m_features], samples + rows[i] * rowStride, m_features * sizeof(float));
+	}
+	resLabels.resize(rows.size());
+	Predict(gathered.data(), rows.size(), m_features, resLabels.data());
+}
+
+bool RFSuite::Forest::Save(const std::string& filename) const
+{
+	std::ofstream file(filename, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+
+	auto writeVector = [&file](const void* data, uint64_t count, size_t elementSize) {
+		file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		file.write(reinterpret_cast<const char*>(data), count * elementSize);
+	};
+
+	const char magic[8] = { 'R','F','S','F','O','R','S','T' };
+	const uint64_t features = m_features;
+	file.write(magic, sizeof(magic));
+	file.write(reinterpret_cast<const char*>(&features), sizeof(features));
+	writeVector(m_classes.data(), m_classes.size(), sizeof(int));
+	writeVector(m_roots.data(), m_roots.size(), sizeof(int32_t));
+	writeVector(m_nodes.data(), m_nodes.size(), sizeof(Node));
+	writeVector(m_variable_importance.data(), m_variable_importance.size(), sizeof(float));
+	return static_cast<bool>(file);
+}
+
+bool RFSuite::Forest::Load(const std::string& filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	char magic[8];
+	uint64_t features = 0;
+	if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, "RFSFORST", 8) != 0 ||
+		!file.read(reinterpret_cast<char*>(&features), sizeof(features)))
+	{
+		return false;
+	}
+
+	m_features = features;
+	return readVector(file, m_classes) && readVector(file, m_roots) &&
+		readVector(file, m_nodes) && readVector(file, m_variable_importance);
+}
@@ -0,0 +1,130 @@
+#ifndef H_CBICA_RF_SUITE_FOREST
+#define H_CBICA_RF_SUITE_FOREST
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace RFSuite
+{
+	/**
+	Random forest classifier with parallel training and batched inference
+
+	Training bins every feature into (at most 256) quantile bins, stored column-major as bytes,
+	so that finding the best split of a node is a histogram pass instead of a sort.
+	Trees are grown from bootstrap samples in parallel (one tree per task; every tree has its own seed,
+	so the forest does not depend on the number of threads).
+	After training the trees are flattened into one contiguous node array, and inference
+	runs every tree over blocks of rows while the tree is hot in cache.
+	*/
+	class Forest
+	{
+	public:
+		typedef struct Parameters
+		{
+			int maxDepth        = 10;
+			int minSampleCount  = 2;   // nodes with fewer samples are not split
+			int activeVarCount  = 0;   // features tried per split; 0 is sqrt(# of features)
+			int numberOfTrees   = 150;
+			int numberOfBins    = 256; // max 256
+			int numberOfThreads = 0;   // 0 is the hardware concurrency
+			unsigned int seed   = 0;
+			std::vector<float> priors; // weight per class (in increasing label order); empty is uniform
+		} Parameters;
+
+		/** Node of the flattened forest; the right child always follows the left one */
+		typedef struct Node
+		{
+			int32_t feature;   // -1 for leaves
+			float   threshold; // samples with value <= threshold go left
+			int32_t value;     // index of left child for splits, class index for leaves
+		} Node;
+
+		explicit Forest() {}
+
+		virtual ~Forest() {}
+
+		/**
+		Trains the forest
+		@param samples row-major samples (one sample per row)
+		@param rowStride number of floats between consecutive rows
+		@param labels one label per row
+		@param rows the rows of samples/labels to train on
+		@param features number of features (columns)
+		@param parameters the forest parameters
+		@return false if there is nothing to train on
+		*/
+		bool Train(const float* samples, size_t rowStride, const int* labels, const std::vector<int>& rows,
+			size_t features, const Parameters& parameters);
+
+		/**
+		Predicts a batch of rows
+		@param samples row-major samples
+		@param numberOfRows how many rows to predict
+		@param rowStride number of floats between consecutive rows
+		@param resLabels output, one label per row
+		@param resConfidence optional output, fraction of trees that voted for the label
+		@param skipZeros optional, rows where (*skipZeros == 0) are not predicted and get label 0
+		@param skipZerosStride number of floats between consecutive skipZeros values
+		*/
+		void Predict(const float* samples, size_t numberOfRows, size_t rowStride, int* resLabels,
+			float* resConfidence = nullptr, const float* skipZeros = nullptr, size_t skipZerosStride = 1) const;
+
+		/** Predicts the rows given by indices, used for error estimation */
+		void Predict(const float* samples, size_t rowStride, const std::vector<int>& rows, std::vector<int>& resLabels) const;
+
+		/** Mean decrease in (gini) impurity per feature, normalized to sum to 1 */
+		std::vector<float> GetVariableImportance() const {
+			return m_variable_importance;
+		}
+
+		/** The flattened nodes of all trees */
+		const std::vector<Node>& GetNodes() const {
+			return m_nodes;
+		}
+
+		/** Offset of every tree's root in GetNodes() */
+		const std::vector<int32_t>& GetRoots() const {
+			return m_roots;
+		}
+
+		/** Distinct labels in increasing order (leaves store indices into this) */
+		const std::vector<int>& GetClasses() const {
+			return m_classes;
+		}
+
+		const Parameters& GetParameters() const {
+			return m_parameters;
+		}
+
+		bool Empty() const {
+			return m_roots.empty();
+		}
+
+		/**
+		Writes the forest as a flat binary file
+		@param filename full path to desired save location
+		@return false if the file can't be written
+		*/
+		bool Save(const std::string& filename) const;
+
+		/**
+		Reads a forest written by Save()
+		@param filename full path to the file
+		@return false if the file can't be read or is not a forest
+		*/
+		bool Load(const std::string& filename);
+
+	private:
+		std::vector<Node>    m_nodes;
+		std::vector<int32_t> m_roots;
+		std::vector<int>     m_classes;
+		std::vector<float>   m_variable_importance;
+		Parameters           m_parameters;
+		size_t               m_features = 0;
+
+		int numberOfThreads(size_t jobs) const;
+	};
+}
+
+#endif // !H_CBICA_RF_SUITE_FOREST
@@ -26,6 +26,8 @@ float RFSuite::Manager::TrainAuto(cv::ml::ParamGrid maxDepthGrid, cv::ml::ParamG
 
 	float minError = 100;
 	cv::Ptr<cv::ml::RTrees> best_rforest; // = cv::ml::RTrees::create();
+	std::shared_ptr<Forest> best_forest;
+	int bestMaxDepth = 0, bestMinSampleCount = 0, bestMaxCategories = 0, bestActiveVarCount = 0;
 
 	int i_maxDepth = 0;
 
@@ -72,15 +74,21 @@ float RFSuite::Manager::TrainAuto(cv::ml::ParamGrid maxDepthGrid, cv::ml::ParamG
 					}
 
 					m_rtrees = cv::ml::RTrees::create();
+					m_forest = std::make_shared<Forest>();
 					float val = Train(static_cast<int>(std::floor(maxDepth)),
 						minSampleCountPercentage,
 						static_cast<int>(std::floor(maxCategories)),
 						static_cast<int>(std::floor(activeVarCount)),
 						static_cast<int>(std::floor(m_number_of_trees)));
 
-					if (val < minError) {
+					if (val >= 0 && val < minError) {
 						minError = val;
 						best_rforest = m_rtrees;
+						best_forest  = m_forest;
+						bestMaxDepth       = static_cast<int>(std::floor(maxDepth));
+						bestMinSampleCount = std::lround((minSampleCountPercentage / 100) * m_traindata->getTrainSamples().rows);
+						bestMaxCategories  = static_cast<int>(std::floor(maxCategories));
+						bestActiveVarCount = static_cast<int>(std::floor(activeVarCount));
 
 						if (m_verbose) {
 							std::cout << "Last model is current best with error: " << minError << "\n";
@@ -127,22 +135,25 @@ float RFSuite::Manager::TrainAuto(cv::ml::ParamGrid maxDepthGrid, cv::ml::ParamG
 
 	if (m_verbose) {
 		std::cout << "Best model has error: " << minError;
-		std::cout << "\n\t MAX DEPTH          = " << best_rforest->getMaxDepth();
-		std::cout << "\n\t MIN SAMPLE COUNT % = " << 100 * best_rforest->getMinSampleCount() / m_traindata->getTrainSamples().rows;
-		std::cout << "\n\t MAX CATEGORIES     = " << best_rforest->getMaxCategories();
-		std::cout << "\n\t ACTIVE VAR COUNT   = " << best_rforest->getActiveVarCount() << "\n";
+		std::cout << "\n\t MAX DEPTH          = " << bestMaxDepth;
+		std::cout << "\n\t MIN SAMPLE COUNT % = " << 100 * bestMinSampleCount / m_traindata->getTrainSamples().rows;
+		std::cout << "\n\t MAX CATEGORIES     = " << bestMaxCategories;
+		std::cout << "\n\t ACTIVE VAR COUNT   = " << bestActiveVarCount << "\n";
 	}
 	if (m_save_all) {
 		std::ofstream rfReportFile;
 		rfReportFile.open(m_output_path + "/rf_report.txt", std::ios_base::app); //append file
 
 		rfReportFile << "\n[Best model has error: " << minError << "]";
-		rfReportFile << "\n\t MAX DEPTH          = " << best_rforest->getMaxDepth();
-		rfReportFile << "\n\t MIN SAMPLE COUNT % = " << 100 * best_rforest->getMinSampleCount() / m_traindata->getTrainSamples().rows;
-		rfReportFile << "\n\t MAX CATEGORIES     = " << best_rforest->getMaxCategories();
-		rfReportFile << "\n\t ACTIVE VAR COUNT   = " << best_rforest->getActiveVarCount() << "\n";
+		rfReportFile << "\n\t MAX DEPTH          = " << bestMaxDepth;
+		rfReportFile << "\n\t MIN SAMPLE COUNT % = " << 100 * bestMinSampleCount / m_traindata->getTrainSamples().rows;
+		rfReportFile << "\n\t MAX CATEGORIES     = " << bestMaxCategories;
+		rfReportFile << "\n\t ACTIVE VAR COUNT   = " << bestActiveVarCount << "\n";
+	}
+	if (best_rforest) {
+		m_rtrees = best_rforest;
+		m_forest = best_forest;
 	}
-	m_rtrees = best_rforest;
 
 	return minError;
 }
@@ -159,6 +170,12 @@ float RFSuite::Manager::Train(int maxDepth, double minSampleCountPercentage, int
 			maxCategories, m_active_var_count, m_number_of_trees, m_priors_mat);
 	}*/
 
+	if (!m_use_opencv) {
+		return train_forest_and_print_errs((maxDepth != 0) ? maxDepth : DEFAULT_MAX_DEPTH,
+			std::lround((minSampleCountPercentage / 100) * m_traindata->getTrainSamples().rows),
+			activeVarCount, numberOfTrees);
+	}
+
 	if (maxDepth != 0) {
 		m_rtrees->setMaxDepth(maxDepth);
 	}
@@ -194,15 +211,42 @@ std::shared_ptr<cv::Mat> RFSuite::Manager::Test(cv::Mat &testingMat, cv::Mat &sk
 	int realProgress;
 	int val;
 
+	cv::Mat samples = testingMat;
+	if (samples.type() != CV_32F) {
+		testingMat.convertTo(samples, CV_32F);
+	}
+	cv::Mat skip = skipZerosMat;
+	if (skipZeros && skip.type() != CV_32F) {
+		skipZerosMat.convertTo(skip, CV_32F);
+	}
+
+	if (!m_use_opencv)
+	{
+		if (m_verbose) {
+			std::cout << "RF Manager:\t Testing...";
+		}
+		if (testSize > 0) {
+			m_forest->Predict(samples.ptr<float>(0), testSize, samples.step1(), res->ptr<int>(0), nullptr,
+				skipZeros ? skip.ptr<float>(0) : nullptr, skipZeros ? skip.step1() : 1);
+		}
+		if (m_verbose) {
+			std::cout << "finished\n";
+		}
+		if (m_verbose || m_save_all) {
+			print_variable_importance(m_forest->GetVariableImportance());
+		}
+		return res;
+	}
+
 	if (m_verbose) {
 		std::cout << "RF Manager:\t Testing...0%";
 	}
 	for (int i = 0; i < testSize; i++)
 	{
-		if (skipZeros && skipZerosMat.ptr<float>(i)[0] != 0)
+		if (!skipZeros || skip.ptr<float>(i)[0] != 0)
 		{
 			//val = m_rtrees->predict(testingMat.row(i), predictLabels);
-			val = std::lround(m_rtrees->predict(testingMat.row(i)));
+			val = std::lround(m_rtrees->predict(samples.row(i)));
 			res->ptr< int >(i)[0] = val;
 		}
 
@@ -223,33 +267,126 @@ std::shared_ptr<cv::Mat> RFSuite::Manager::Test(cv::Mat &testingMat, cv::Mat &sk
 
 	if (m_verbose || m_save_all) {
 		cv::Mat variable_importance = m_rtrees->getVarImportance();
+		print_variable_importance(std::vector<float>(variable_importance.begin<float>(), variable_importance.end<float>()));
+	}
 
-		if (m_verbose) {
-			std::cout << "RF Manager:\t \tEstimated variable importance:\n";
+	return res;
+}
 
-			for (int i = 0; i < variable_importance.rows; i++) {
-				std::cout << "RF Manager:\t \t\tVariable " << i + 1 << ": " << variable_importance.at<float>(i, 0) << "\n";
-			}
-		}
-		if (m_save_all) {
-			std::ofstream rfReportFile;
-			rfReportFile.open(m_output_path + "/rf_report.txt", std::ios_base::app); //append file
+void RFSuite::Manager::SaveModel(const std::string filename)
+{
+	if (m_use_opencv) {
+		m_rtrees->save(filename);
+	}
+	else if (!m_forest->Save(filename)) {
+		std::cerr << "RF Manager:\t Could not write model to " << filename << "\n";
+	}
+}
 
-			rfReportFile << "Estimated variable importance:\n";
+void RFSuite::Manager::print_variable_importance(const std::vector<float>& variableImportance)
+{
+	if (m_verbose) {
+		std::cout << "RF Manager:\t \tEstimated variable importance:\n";
 
-			for (int i = 0; i < variable_importance.rows; i++) {
-				rfReportFile << "\tVariable " << i + 1 << ": " << variable_importance.at<float>(i, 0) << "\n";
-			}
-			rfReportFile << "\n";
+		for (size_t i = 0; i < variableImportance.size(); i++) {
+			std::cout << "RF Manager:\t \t\tVariable " << i + 1 << ": " << variableImportance[i] << "\n";
 		}
 	}
+	if (m_save_all) {
+		std::ofstream rfReportFile;
+		rfReportFile.open(m_output_path + "/rf_report.txt", std::ios_base::app); //append file
 
-	return res;
+		rfReportFile << "Estimated variable importance:\n";
+
+		for (size_t i = 0; i < variableImportance.size(); i++) {
+			rfReportFile << "\tVariable " << i + 1 << ": " << variableImportance[i] << "\n";
+		}
+		rfReportFile << "\n";
+	}
 }
 
-void RFSuite::Manager::SaveModel(const std::string filename)
+float RFSuite::Manager::train_forest_and_print_errs(int maxDepth, int minSampleCount, int activeVarCount, int numberOfTrees)
 {
-	m_rtrees->save(filename);
+	if (m_verbose) {
+		std::cout << "RF Manager:\t Training...";
+	}
+
+	cv::Mat samples = m_traindata->getSamples(), labels;
+	if (samples.type() != CV_32F) {
+		m_traindata->getSamples().convertTo(samples, CV_32F);
+	}
+	m_traindata->getResponses().convertTo(labels, CV_32S);
+
+	// Empty index mats mean "all samples"
+	auto toIndices = [](const cv::Mat& idx, int allRows) {
+		std::vector<int> indices;
+		if (idx.empty()) {
+			indices.resize(allRows);
+			for (int i = 0; i < allRows; i++) { indices[i] = i; }
+		}
+		else {
+			cv::Mat idx32;
+			idx.convertTo(idx32, CV_32S);
+			indices.assign(idx32.begin<int>(), idx32.end<int>());
+		}
+		return indices;
+	};
+	std::vector<int> trainRows = toIndices(m_traindata->getTrainSampleIdx(), samples.rows);
+	cv::Mat testIdx = m_traindata->getTestSampleIdx();
+	std::vector<int> testRows = testIdx.empty() ? std::vector<int>() : toIndices(testIdx, samples.rows);
+
+	Forest::Parameters parameters;
+	parameters.maxDepth        = maxDepth;
+	parameters.minSampleCount  = minSampleCount;
+	parameters.activeVarCount  = activeVarCount;
+	parameters.numberOfTrees   = numberOfTrees;
+	parameters.numberOfThreads = m_number_of_threads;
+	if (!m_priors_mat.empty()) {
+		// The priors can come as any (single channel) numeric type and might not be continuous
+		cv::Mat priors;
+		m_priors_mat.convertTo(priors, CV_32F);
+		parameters.priors.assign(priors.begin<float>(), priors.end<float>());
+	}
+
+	if (!m_forest->Train(samples.ptr<float>(0), samples.step1(), labels.ptr<int>(0), trainRows, samples.cols, parameters))
+	{
+		if (m_verbose) {
+			std::cout << "FAILED\n";
+		}
+		return -1;
+	}
+	if (m_verbose) {
+		std::cout << "finished\n";
+	}
+
+	auto errorOn = [&](const std::vector<int>& rows) {
+		std::vector<int> predicted;
+		m_forest->Predict(samples.ptr<float>(0), samples.step1(), rows, predicted);
+		size_t wrong = 0;
+		for (size_t i = 0; i < rows.size(); i++) {
+			wrong += (predicted[i] != labels.ptr<int>(0)[rows[i]]);
+		}
+		return rows.empty() ? 0.0f : static_cast<float>(100.0 * wrong / rows.size());
+	};
+
+	float calcErrorTest = errorOn(testRows.empty() ? trainRows : testRows);
+
+	if (m_verbose || m_save_all) {
+		float calcErrorTrain = errorOn(trainRows);
+
+		if (m_verbose) {
+			printf("RF Manager:\t \tTrain error (train part): %f\n", calcErrorTrain);
+			printf("RF Manager:\t \tTrain error (test part):  %f\n", calcErrorTest);
+		}
+		if (m_save_all) {
+			std::ofstream rfReportFile;
+			rfReportFile.open(m_output_path + "/rf_report.txt", std::ios_base::app); //append file
+			rfReportFile << "Train error (train part): " << calcErrorTrain << "\n";
+			rfReportFile << "Train error (test part):  " << calcErrorTest << "\n\n";
+		}
+	}
+
+	return calcErrorTest;
 }
 
 float RFSuite::Manager::train_and_print_errs(cv::Ptr<cv::ml::StatModel> model, const cv::Ptr<cv::ml::TrainData>& data)
@@ -376,4 +513,10 @@ void RFSuite::Manager::SetActiveVarCount(int activeVarCount) {
 }
 void RFSuite::Manager::SetNumberOfTrees(int numberOfTrees) {
 	m_number_of_trees = numberOfTrees;
+}
+void RFSuite::Manager::SetUseOpenCV(bool useOpenCV) {
+	m_use_opencv = useOpenCV;
+}
+void RFSuite::Manager::SetNumberOfThreads(int numberOfThreads) {
+	m_number_of_threads = numberOfThreads;
 }
\ No newline at end of file
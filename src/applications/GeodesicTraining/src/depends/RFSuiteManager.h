@@ -10,6 +10,7 @@
 
 #include "ConfigParserRF.h"
 #include "RFPrepareTrainData.h"
+#include "RFSuiteForest.h"
 
 namespace RFSuite
 {
@@ -117,8 +118,20 @@ namespace RFSuite
 
 		void SetNumberOfTrees(int numberOfTrees);
 
+		/**
+		Use cv::ml::RTrees instead of the in-tree RFSuite::Forest
+		(the in-tree forest trains trees in parallel and predicts in batches; max categories is ignored)
+		*/
+		void SetUseOpenCV(bool useOpenCV);
+
+		/** Threads used for training and testing with the in-tree forest (0 is the hardware concurrency) */
+		void SetNumberOfThreads(int numberOfThreads);
+
 	private:
 		cv::Ptr<cv::ml::RTrees> m_rtrees = cv::ml::RTrees::create();
+		std::shared_ptr<Forest> m_forest = std::make_shared<Forest>();
+		bool m_use_opencv = false;
+		int  m_number_of_threads = 0;
 		cv::Mat m_priors_mat = cv::Mat();
 		cv::Ptr<cv::ml::TrainData> m_traindata;
 		std::string m_output_path = "./", m_rf_config_file_path = "";
@@ -140,5 +153,14 @@ namespace RFSuite
 		@return training error
 		*/
 		float train_and_print_errs(cv::Ptr<cv::ml::StatModel> model, const cv::Ptr<cv::ml::TrainData>& data);
+
+		/**
+		Trains m_forest on the train part of m_traindata
+		@return error (%) on the test part (or on the train part if there is no test part)
+		*/
+		float train_forest_and_print_errs(int maxDepth, int minSampleCount, int activeVarCount, int numberOfTrees);
+
+		/** Writes the variable importance to the console and/or report */
+		void print_variable_importance(const std::vector<float>& variableImportance);
 	};
 }
@@ -2,6 +2,8 @@
 
 #include "ConvertionsOpenCV.h"
 
+#include <algorithm>
+
 SvmSuite::SvmDescription::SvmDescription()
 {
 	// Initialize the ParamGrid for each parameter
@@ -103,6 +105,11 @@ cv::Ptr<cv::ml::SVM> SvmSuite::SvmDescription::GetModel()
 	return this->model;
 }
 
+std::shared_ptr<SvmSuite::WarmStartTrainer> SvmSuite::SvmDescription::GetWarmStartTrainer()
+{
+	return this->warmStartTrainer;
+}
+
 double SvmSuite::SvmDescription::GetC()
 {
 	return c;
@@ -177,6 +184,12 @@ bool SvmSuite::SvmDescription::isParameterSetToSpecificValue(std::string param)
 	return isParameterSetToSpecificValueVector[SvmSuiteConvertions::ParamTypeFromString(param)];
 }
 
+bool SvmSuite::SvmDescription::areAllParametersSetToSpecificValues()
+{
+	return std::find(isParameterSetToSpecificValueVector.begin(), isParameterSetToSpecificValueVector.end(), false) ==
+		isParameterSetToSpecificValueVector.end();
+}
+
 cv::ml::ParamGrid SvmSuite::SvmDescription::GetParamGridForParameter(cv::ml::SVM::ParamTypes param)
 {
 	return parametersRanges[param];
@@ -265,6 +278,11 @@ void SvmSuite::SvmDescription::SetModel(cv::Ptr<cv::ml::SVM> model)
 	this->model = model;
 }
 
+void SvmSuite::SvmDescription::SetWarmStartTrainer(std::shared_ptr<WarmStartTrainer> trainer)
+{
+	this->warmStartTrainer = trainer;
+}
+
 void SvmSuite::SvmDescription::SetParameter(cv::ml::SVM::ParamTypes param, double val)
 {
 	this->isParameterSetToSpecificValueVector[param] = true;
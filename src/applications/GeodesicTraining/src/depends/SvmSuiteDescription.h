@@ -5,8 +5,11 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include <memory>
 #include <string>
 
+#include "SvmSuiteWarmStart.h"
+
 namespace SvmSuite 
 {
 	// Each SVM in the configuration (there might be more than one) gets stored in one instance of SvmDescription
@@ -36,6 +39,8 @@ namespace SvmSuite
 		void SetImportance(std::string importance);
 		void SetModelPath(std::string modelPath);
 		void SetModel(cv::Ptr<cv::ml::SVM> model);
+		/** When all the parameters are set to specific values, the svm is trained by this trainer (starting from its previous solution) */
+		void SetWarmStartTrainer(std::shared_ptr<WarmStartTrainer> trainer);
 
 		// Note: setting a parameters to value X will also change the paramgrid to {X, X+1, 2} (that way only value X is tried in OpenCV's trainAuto)
 		
@@ -78,6 +83,7 @@ namespace SvmSuite
 		double GetImportance();
 		std::string GetModelPath();
 		cv::Ptr<cv::ml::SVM> GetModel();
+		std::shared_ptr<WarmStartTrainer> GetWarmStartTrainer();
 
 		double GetC();
 		double GetGamma();
@@ -90,6 +96,8 @@ namespace SvmSuite
 		double GetParameter(std::string param);
 		bool isParameterSetToSpecificValue(cv::ml::SVM::ParamTypes param);
 		bool isParameterSetToSpecificValue(std::string param);
+		/** Whether every parameter is set to a specific value (so there is nothing to search for) */
+		bool areAllParametersSetToSpecificValues();
 
 		cv::ml::ParamGrid GetParamGridForParameter(cv::ml::SVM::ParamTypes param);
 		cv::ml::ParamGrid GetParamGridForParameter(std::string param);
@@ -116,6 +124,7 @@ namespace SvmSuite
 		double importance = 1.0;
 		std::string modelPath = "";
 		cv::Ptr<cv::ml::SVM> model;
+		std::shared_ptr<WarmStartTrainer> warmStartTrainer;
 		double c = 1.0;
 		double gamma = 1.0;
 		double p = 0.0;
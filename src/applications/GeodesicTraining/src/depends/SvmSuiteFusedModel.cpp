@@ -0,0 +1,149 @@
+#include "SvmSuiteFusedModel.h"
+
+#include <algorithm>
+#include <cmath>
+
+bool SvmSuite::FusedModel::Build(const cv::Ptr<cv::ml::SVM>& model, const std::vector<int>& classLabels)
+{
+	if (model == nullptr || !model->isTrained() || classLabels.size() < 2) {
+		return false;
+	}
+	if (model->getType() != cv::ml::SVM::C_SVC && model->getType() != cv::ml::SVM::NU_SVC) {
+		return false;
+	}
+
+	cv::Mat supportVectorsMat = model->getSupportVectors();
+	if (supportVectorsMat.empty() || supportVectorsMat.type() != CV_32F) {
+		return false;
+	}
+	const size_t supportVectorsCount = supportVectorsMat.rows;
+	const size_t featuresCount = supportVectorsMat.cols;
+	std::vector<float> supportVectors(supportVectorsCount * featuresCount);
+	for (size_t i = 0; i < supportVectorsCount; i++) {
+		std::copy(supportVectorsMat.ptr<float>(i), supportVectorsMat.ptr<float>(i) + featuresCount, &supportVectors[i * featuresCount]);
+	}
+
+	// One-vs-one: k*(k-1)/2 decision functions
+	const size_t decisionFunctionsCount = classLabels.size() * (classLabels.size() - 1) / 2;
+	std::vector<double> alpha(supportVectorsCount * decisionFunctionsCount, 0), rho(decisionFunctionsCount);
+	try
+	{
+		for (size_t df = 0; df < decisionFunctionsCount; df++)
+		{
+			cv::Mat dfAlpha, dfIndex;
+			rho[df] = model->getDecisionFunction(static_cast<int>(df), dfAlpha, dfIndex);
+			dfAlpha.convertTo(dfAlpha, CV_64F);
+			dfIndex.convertTo(dfIndex, CV_32S);
+			for (int k = 0; k < static_cast<int>(dfAlpha.total()); k++) {
+				alpha[dfIndex.ptr<int>(0)[k] * decisionFunctionsCount + df] += dfAlpha.ptr<double>(0)[k];
+			}
+		}
+	}
+	catch (const cv::Exception&) {
+		return false; // the model has a different number of classes
+	}
+
+	return Build(model->getKernelType(), model->getGamma(), model->getCoef0(), model->getDegree(),
+		supportVectors, featuresCount, alpha, rho, classLabels);
+}
+
+bool SvmSuite::FusedModel::Build(int kernelType, double gamma, double coef0, double degree,
+	const std::vector<float>& supportVectors, size_t featuresCount,
+	const std::vector<double>& alpha, const std::vector<double>& rho, const std::vector<int>& classLabels)
+{
+	if (kernelType != cv::ml::SVM::LINEAR && kernelType != cv::ml::SVM::POLY &&
+		kernelType != cv::ml::SVM::RBF && kernelType != cv::ml::SVM::SIGMOID)
+	{
+		return false;
+	}
+	if (featuresCount == 0 || rho.empty() || supportVectors.size() % featuresCount != 0) {
+		return false;
+	}
+
+	m_kernel_type = kernelType;
+	m_gamma  = gamma;
+	m_coef0  = coef0;
+	m_degree = degree;
+	m_features_count = featuresCount;
+	m_support_vectors_count = supportVectors.size() / featuresCount;
+	m_decision_functions_count = rho.size();
+	m_support_vectors = supportVectors;
+	m_alpha = alpha;
+	m_rho = rho;
+	m_class_labels = classLabels;
+
+	return m_alpha.size() == m_support_vectors_count * m_decision_functions_count;
+}
+
+void SvmSuite::FusedModel::Predict(const float* samples, size_t rows, float* resDecision, int* resLabels,
+	std::vector<double>& kernelBuffer) const
+{
+	const size_t svCount = m_support_vectors_count, dfCount = m_decision_functions_count, classes = m_class_labels.size();
+	kernelBuffer.resize(svCount + dfCount + classes);
+	double* kernel   = kernelBuffer.data();
+	double* decision = kernel + svCount;
+	double* votes    = decision + dfCount;
+
+	for (size_t r = 0; r < rows; r++)
+	{
+		const float* x = samples + r * m_features_count;
+
+		// Kernel values against all support vectors (shared by all decision functions)
+		for (size_t j = 0; j < svCount; j++)
+		{
+			const float* sv = &m_support_vectors[j * m_features_count];
+			float acc = 0;
+			if (m_kernel_type == cv::ml::SVM::RBF) {
+				for (size_t f = 0; f < m_features_count; f++) {
+					const float d = x[f] - sv[f];
+					acc += d * d;
+				}
+				kernel[j] = std::exp(-m_gamma * acc);
+				continue;
+			}
+			for (size_t f = 0; f < m_features_count; f++) {
+				acc += x[f] * sv[f];
+			}
+			switch (m_kernel_type)
+			{
+			case cv::ml::SVM::POLY:
+				kernel[j] = std::pow(m_gamma * acc + m_coef0, m_degree);
+				break;
+			case cv::ml::SVM::SIGMOID:
+				// same sign as cv::ml::SVM: tanh(-gamma * <x, sv> - coef0)
+				kernel[j] = -std::tanh(m_gamma * acc + m_coef0);
+				break;
+			default:
+				kernel[j] = acc;
+				break;
+			}
+		}
+
+		// Decision functions
+		for (size_t df = 0; df < dfCount; df++) {
+			decision[df] = -m_rho[df];
+		}
+		for (size_t j = 0; j < svCount; j++)
+		{
+			const double* a = &m_alpha[j * dfCount];
+			for (size_t df = 0; df < dfCount; df++) {
+				decision[df] += a[df] * kernel[j];
+			}
+		}
+
+		if (resDecision) {
+			resDecision[r] = static_cast<float>(decision[0]);
+		}
+		if (resLabels)
+		{
+			std::fill(votes, votes + classes, 0.0);
+			size_t df = 0;
+			for (size_t i = 0; i < classes; i++) {
+				for (size_t j = i + 1; j < classes; j++, df++) {
+					votes[(decision[df] > 0) ? i : j]++;
+				}
+			}
+			resLabels[r] = m_class_labels[std::max_element(votes, votes + classes) - votes];
+		}
+	}
+}
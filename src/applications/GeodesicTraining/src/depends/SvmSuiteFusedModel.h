@@ -0,0 +1,72 @@
+#ifndef H_CBICA_SVM_SUITE_FUSED_MODEL
+#define H_CBICA_SVM_SUITE_FUSED_MODEL
+
+#include <opencv2/ml.hpp>
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+namespace SvmSuite
+{
+	/**
+	Flat copy of a trained (C_SVC or NU_SVC) cv::ml::SVM that evaluates blocks of samples directly.
+	All kernel values of a sample against the support vectors are computed once and shared
+	by all the one-vs-one decision functions, and the loops run over contiguous float arrays.
+	Decision values and votes follow cv::ml::SVM::predict (positive decision -> first class of the pair).
+	*/
+	class FusedModel
+	{
+	public:
+		explicit FusedModel() {}
+
+		virtual ~FusedModel() {}
+
+		/**
+		Copies the support vectors and decision functions of a model
+		@param model the trained svm
+		@param classLabels the distinct training labels in increasing order (the order cv::ml::SVM uses)
+		@return false if the model can't be evaluated here (untrained, regression/one-class, custom/chi2/inter kernels)
+		*/
+		bool Build(const cv::Ptr<cv::ml::SVM>& model, const std::vector<int>& classLabels);
+
+		/**
+		Builds directly from arrays (used by Build)
+		@param supportVectors row-major, supportVectorsCount x featuresCount
+		@param alpha dense decision function coefficients, supportVectorsCount x decisionFunctionsCount (row-major)
+		@param rho one per decision function
+		*/
+		bool Build(int kernelType, double gamma, double coef0, double degree,
+			const std::vector<float>& supportVectors, size_t featuresCount,
+			const std::vector<double>& alpha, const std::vector<double>& rho, const std::vector<int>& classLabels);
+
+		/**
+		Evaluates a block of samples
+		@param samples row-major, rows x featuresCount, contiguous
+		@param rows number of samples
+		@param resDecision optional, raw value of the first decision function for each sample (the 2-class distance)
+		@param resLabels optional, predicted label for each sample
+		@param kernelBuffer scratch space, reused between calls
+		*/
+		void Predict(const float* samples, size_t rows, float* resDecision, int* resLabels, std::vector<double>& kernelBuffer) const;
+
+		size_t GetFeaturesCount() const {
+			return m_features_count;
+		}
+
+		const std::vector<int>& GetClassLabels() const {
+			return m_class_labels;
+		}
+
+	private:
+		int    m_kernel_type = cv::ml::SVM::RBF;
+		double m_gamma = 1, m_coef0 = 0, m_degree = 1;
+		size_t m_features_count = 0, m_support_vectors_count = 0, m_decision_functions_count = 0;
+
+		std::vector<float>  m_support_vectors;      // row-major
+		std::vector<double> m_alpha;                // row-major: support vector x decision function
+		std::vector<double> m_rho;
+		std::vector<int>    m_class_labels;
+	};
+}
+
+#endif // !H_CBICA_SVM_SUITE_FUSED_MODEL
@@ -19,12 +19,8 @@ void SvmSuite::Manager::Train()
 		stopTimerAndReport("Normalizing SVM input (Training)");
 	}
 
-	// Subsampling
-
-	if (m_subsample && m_traindata->getTrainSamples().rows > m_max_samples) {
-		m_traindata->setTrainTestSplit(m_max_samples);
-		message("Number of samples after subsampling: " + std::to_string(m_traindata->getTrainSamples().rows) + "\n");
-	}
+	// The sample keys identify the rows of the whole training data
+	const bool sampleKeysUsable = (static_cast<int>(m_sample_keys.size()) == m_traindata->getTrainSamples().rows);
 
 	// Training
 	
@@ -55,20 +51,57 @@ void SvmSuite::Manager::Train()
 			bool res = false;
 			try
 			{
-				message("Training " + svm_desc.GetKernelTypeAsString() + std::string(" kernel..."));
-
-				res = svm->trainAuto(
-					m_traindata,
-					svm_desc.GetKfold(),
-					svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::C),
-					svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::GAMMA),
-					svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::P),
-					svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::NU),
-					svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::COEF),
-					svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::DEGREE),
-					false
-				);
-				message("", false, true);
+				std::shared_ptr<WarmStartTrainer> trainer = svm_desc.GetWarmStartTrainer();
+
+				if (svm_desc.areAllParametersSetToSpecificValues() && trainer &&
+					WarmStartTrainer::IsSupported(svm_desc.GetType(), svm_desc.GetKernelType()))
+				{
+					// Nothing to search for, retrain starting from the previous solution
+					message("Training " + svm_desc.GetKernelTypeAsString() + std::string(" kernel (warm start)..."));
+
+					trainer->SetNumberOfThreads(m_number_of_threads);
+					res = trainer->Train(m_traindata->getTrainSamples(), m_traindata->getTrainResponses(),
+						(sampleKeysUsable) ? m_sample_keys : std::vector<size_t>(),
+						svm_desc.GetKernelType(), svm_desc.GetC(), svm_desc.GetGamma(), svm_desc.GetCoef(), svm_desc.GetDegree(),
+						(svm_desc.GetConsiderWeights()) ? m_weights_mat : cv::Mat(), svm_desc.GetTermCriteria());
+					message("", false, true);
+					if (res) {
+						svm = trainer->GetModel();
+						message(std::to_string(trainer->GetNumberOfIterations()) + " iterations" +
+							std::string((trainer->WasWarmStarted()) ? " (from the previous solution)\n" : "\n"));
+					}
+				}
+				if (!res && svm_desc.areAllParametersSetToSpecificValues())
+				{
+					// Nothing to search for, so no cross validation
+					message("Training " + svm_desc.GetKernelTypeAsString() + std::string(" kernel..."));
+
+					svm->setC(svm_desc.GetC());
+					svm->setGamma(svm_desc.GetGamma());
+					svm->setP(svm_desc.GetP());
+					svm->setNu(svm_desc.GetNu());
+					svm->setCoef0(svm_desc.GetCoef());
+					svm->setDegree(svm_desc.GetDegree());
+					res = svm->train(m_traindata);
+					message("", false, true);
+				}
+				else if (!res)
+				{
+					message("Training " + svm_desc.GetKernelTypeAsString() + std::string(" kernel..."));
+
+					res = svm->trainAuto(
+						m_traindata,
+						svm_desc.GetKfold(),
+						svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::C),
+						svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::GAMMA),
+						svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::P),
+						svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::NU),
+						svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::COEF),
+						svm_desc.GetParamGridForParameter(cv::ml::SVM::ParamTypes::DEGREE),
+						false
+					);
+					message("", false, true);
+				}
 			}
 			catch (cv::Exception ex) {
 				errorOccured(ex.what());
@@ -122,20 +155,58 @@ std::shared_ptr<SvmSuite::Manager::Result> SvmSuite::Manager::Test(cv::Mat &test
 }
 
 std::shared_ptr<SvmSuite::Manager::Result> SvmSuite::Manager::Test(cv::Mat &testingMat, cv::Mat &skipZerosMat, bool pseudoProbMapResult, bool skipZeros)
+{
+	// Initialize output
+	std::shared_ptr<Result> res(new Result());
+
+	// pseudoProbMapResult==true -> Pseudoprobability maps for 2-class, false -> n-class classification
+
+	if (pseudoProbMapResult) {
+		res->posMat = cv::Mat::zeros(testingMat.rows, 1, CV_32F);
+		res->negMat = cv::Mat::zeros(testingMat.rows, 1, CV_32F);
+
+		TestToBuffers(testingMat, skipZerosMat, skipZeros, nullptr,
+			res->posMat.ptr<PseudoProbType>(0), res->negMat.ptr<PseudoProbType>(0), res->posLabel, res->negLabel);
+	}
+	else {
+		//Create output image with the same dimensions as the input images for this subject
+		res->labelsMat = cv::Mat::zeros(testingMat.rows, 1, CV_32S);
+
+		TestToBuffers(testingMat, skipZerosMat, skipZeros, res->labelsMat.ptr<LabelsType>(0),
+			nullptr, nullptr, res->posLabel, res->negLabel);
+	}
+
+	return res;
+}
+
+bool SvmSuite::Manager::TestToBuffers(cv::Mat &testingMat, cv::Mat &skipZerosMat, bool skipZeros,
+	LabelsType* labelsOut, PseudoProbType* posOut, PseudoProbType* negOut, LabelsType &posLabel, LabelsType &negLabel)
 {
 	message("Testing...");
 
+	for (SvmDescription& svm_desc : m_svm_descriptions)
+	{
+		if (svm_desc.GetModel() == nullptr) {
+			errorOccured("Trying to make predictions on untrained SVM");
+			return false;
+		}
+	}
 
 	// Normalize
 
 	if (m_normalize) {
 		startTimer();
+		testingMat = testingMat.clone(); // The data can be shared with skipZerosMat (see ParserGTS::FeatureMatrixBuilder)
 		NormalizeInput(testingMat);
 		stopTimerAndReport("Normalizing SVM input (Testing)");
 	}
 	
 	startTimer();
 
+	const bool pseudoProbMapResult = (posOut != nullptr && negOut != nullptr);
+	const int  rows = testingMat.rows, cols = testingMat.cols;
+	const size_t svmsCount = m_svm_descriptions.size();
+
 	// Save importance values for each svm used and the sum
 	double importanceSum = 0;
 	std::vector< double > importanceValues;
@@ -147,102 +218,161 @@ std::shared_ptr<SvmSuite::Manager::Result> SvmSuite::Manager::Test(cv::Mat &test
 		importanceValues.push_back(importance);
 	}
 
-	// Initialize output
-	std::shared_ptr<Result> res(new Result());
-
-	// pseudoProbMapResult==true -> Pseudoprobability maps for 2-class, false -> n-class classification
-
-	if (pseudoProbMapResult) {
-		res->posMat = cv::Mat::zeros(testingMat.rows, 1, CV_32F);
-		res->negMat = cv::Mat::zeros(testingMat.rows, 1, CV_32F);
-
-		bool posLabelSet = false, negLabelSet = false;
+	std::vector< LabelsType > differentLabels(m_different_labels.begin(), m_different_labels.end());
+	std::vector< std::shared_ptr<FusedModel> > fusedModels = buildFusedModels(testingMat, skipZerosMat, skipZeros);
+
+	// Scratch space of each worker, reused between blocks
+	typedef struct WorkerState {
+		std::vector< float >       samples;   // gathered rows of the block, contiguous
+		std::vector< int >         rowsIndex; // row of testingMat for each gathered row
+		std::vector< float >       decisions; // svm x row
+		std::vector< LabelsType >  labels;    // svm x row
+		std::vector< double >      kernelBuffer, votes;
+		int64_t firstPos = -1, firstNeg = -1; // (row * svmsCount + svm) of the first positive/negative distance
+	} WorkerState;
+
+	const int blockSize = 1024;
+	const size_t numberOfBlocks = (rows + blockSize - 1) / blockSize;
+	const int numberOfWorkers = std::max(1, std::min(m_number_of_threads, static_cast<int>(numberOfBlocks)));
+	std::vector< WorkerState > workers(numberOfWorkers);
+
+	auto testBlock = [&](size_t block, int worker)
+	{
+		WorkerState& state = workers[worker];
+		const int iBegin = static_cast<int>(block) * blockSize;
+		const int iEnd   = std::min(rows, iBegin + blockSize);
+
+		// Gather the rows that are not skipped
+		state.samples.resize(static_cast<size_t>(blockSize) * cols);
+		state.rowsIndex.clear();
+		for (int iTest = iBegin; iTest < iEnd; iTest++)
+		{
+			if (skipZeros && (skipZerosMat.ptr<float>(iTest)[0] == 0)) {
+				if (labelsOut) { labelsOut[iTest] = 0; }
+				if (pseudoProbMapResult) { posOut[iTest] = 0; negOut[iTest] = 0; }
+				continue;
+			}
+			const float* row = testingMat.ptr<float>(iTest);
+			std::copy(row, row + cols, &state.samples[state.rowsIndex.size() * cols]);
+			state.rowsIndex.push_back(iTest);
+		}
+		const int n = static_cast<int>(state.rowsIndex.size());
+		if (n == 0) {
+			return;
+		}
 
-		cv::Mat predicted(1, 1, CV_32F);
-		std::vector<PseudoProbType> outputPseudo(m_svm_descriptions.size());
+		// All the svms on the whole block
+		state.decisions.resize(svmsCount * blockSize);
+		state.labels.resize(svmsCount * blockSize);
+		cv::Mat gathered(n, cols, CV_32F, state.samples.data());
 
-		PseudoProbType decisionAccu, decision, pos, neg;
-		float dist;
+		for (size_t isvm = 0; isvm < svmsCount; isvm++)
+		{
+			float*      decisions = &state.decisions[isvm * blockSize];
+			LabelsType* labels    = &state.labels[isvm * blockSize];
 
-		// Iterate through the images and make predictions for each pixel/voxel
-		int isvm;
+			if (fusedModels[isvm]) {
+				fusedModels[isvm]->Predict(state.samples.data(), n,
+					(pseudoProbMapResult) ? decisions : nullptr, (pseudoProbMapResult) ? nullptr : labels, state.kernelBuffer);
+			}
+			else {
+				cv::Mat predicted;
+				m_svm_descriptions[isvm].GetModel()->predict(gathered, predicted,
+					(pseudoProbMapResult) ? cv::ml::StatModel::RAW_OUTPUT : 0);
+				for (int i = 0; i < n; i++) {
+					if (pseudoProbMapResult) {
+						decisions[i] = predicted.at<float>(i, 0);
+					}
+					else {
+						labels[i] = std::lround(predicted.at<float>(i, 0));
+					}
+				}
+			}
+		}
 
-		for (int iTest = 0; iTest < testingMat.rows; iTest++)
+		// Combine the decisions of the svms
+		for (int i = 0; i < n; i++)
 		{
-			if (skipZeros && (skipZerosMat.row(iTest).at<float>(0, 0) == 0)) {
-				continue;
-			}
+			const int iTest = state.rowsIndex[i];
 
-			isvm = 0;
-			// For each svm
-			for (SvmDescription& svm_desc : m_svm_descriptions)
+			if (pseudoProbMapResult)
 			{
-				// Predict
-				if (svm_desc.GetModel() == nullptr) {
-					errorOccured("Trying to make predictions on untrained SVM");
-					return res;
-				}
-				else {
-					svm_desc.GetModel()->predict(testingMat.row(iTest), predicted, pseudoProbMapResult);
-
-					dist = predicted.at<float>(0, 0);
-					if ((!posLabelSet) && (dist > 0)) {
-						// The label hasn't been set for pos image
-						svm_desc.GetModel()->predict(testingMat.row(iTest), predicted, false);
-						res->posLabel = std::lround(predicted.at<float>(0, 0));
-						posLabelSet = true;
-					}
-					else if ((!negLabelSet) && (dist < 0)) {
-						// The label hasn't been set for neg image
-						svm_desc.GetModel()->predict(testingMat.row(iTest), predicted, false);
-						res->negLabel = std::lround(predicted.at<float>(0, 0));
-						negLabelSet = true;
-					}
+				double decisionAccu = 0, decision = 0;
 
+				for (size_t isvm = 0; isvm < svmsCount; isvm++)
+				{
 					// The value is distance to the hyperplane (signed positive for one label, negative for the other)
-					outputPseudo[isvm++] = dist;
-				}
+					const float dist = state.decisions[isvm * blockSize + i];
+					decisionAccu += dist * importanceValues[isvm];
 
-				decisionAccu = 0;
-				decision = 0;
-
-				for (int i = 0; i < outputPseudo.size(); i++) {
-					decisionAccu += static_cast<float>(outputPseudo[i] * importanceValues[i]);
+					if (state.firstPos == -1 && dist > 0) {
+						state.firstPos = static_cast<int64_t>(iTest) * svmsCount + isvm;
+					}
+					else if (state.firstNeg == -1 && dist < 0) {
+						state.firstNeg = static_cast<int64_t>(iTest) * svmsCount + isvm;
+					}
 				}
 
 				if (importanceSum != 0) {
 					// Average of the each different svm's decision
-					decision = static_cast<float>(decisionAccu / importanceSum);
+					decision = decisionAccu / importanceSum;
 				}
 
 				// By using the sigmoid function: f(x) = 1 / (1+e^(-x)) the values are normalized to be doubles between [0,1]
-				pos = static_cast<float>(1.0 / (1.0 + std::exp(-decision))); // Accounts for the distances for one label  (the one with pos distances)
-				neg = static_cast<float>(1.0 / (1.0 + std::exp(decision))); // Accounts for the distances for the other label (the one with neg distances)
+				posOut[iTest] = static_cast<PseudoProbType>(1.0 / (1.0 + std::exp(-decision))); // Accounts for the distances for one label  (the one with pos distances)
+				negOut[iTest] = static_cast<PseudoProbType>(1.0 / (1.0 + std::exp(decision)));  // Accounts for the distances for the other label (the one with neg distances)
+			}
+			else if (labelsOut)
+			{
+				// In case of different svms predicting a different label
+				// then the prediction with the most accumulated importance will be used
+				// In case of a draw the smallest label is used (draws should be avoided in the configuration)
+				state.votes.assign(differentLabels.size(), 0);
+
+				for (size_t isvm = 0; isvm < svmsCount; isvm++)
+				{
+					auto it = std::lower_bound(differentLabels.begin(), differentLabels.end(), state.labels[isvm * blockSize + i]);
+					if (it != differentLabels.end() && *it == state.labels[isvm * blockSize + i]) {
+						state.votes[it - differentLabels.begin()] += importanceValues[isvm];
+					}
+				}
 
-				// Set values to output
-				res->posMat.ptr<PseudoProbType>(iTest)[0] = pos;
-				res->negMat.ptr<PseudoProbType>(iTest)[0] = neg;
+				LabelsType decision = 0;
+				double bestDecisionImportance = 0;
+
+				for (size_t l = 0; l < differentLabels.size(); l++)
+				{
+					if (state.votes[l] > bestDecisionImportance) {
+						decision = differentLabels[l];
+						bestDecisionImportance = state.votes[l];
+					}
+				}
+
+				// Set value to output
+				labelsOut[iTest] = decision;
 			}
 		}
-	}
-	else {
-		//Create output image with the same dimensions as the input images for this subject
-		res->labelsMat = cv::Mat::zeros(testingMat.rows, 1, CV_32S);
+	};
 
-		int totalThreadsNumber = (m_number_of_threads > testingMat.rows) ? 1 : m_number_of_threads;
-		int counterForThreadsVec = 0;
-		std::vector<std::thread> threads(totalThreadsNumber);
+	SvmSuiteUtil::RunWorkStealing(numberOfBlocks, numberOfWorkers, testBlock);
 
-		for (int iStart = 0; iStart < totalThreadsNumber; iStart++)
-		{
-			threads[counterForThreadsVec++] = std::thread(&SvmSuite::Manager::testingLabelsThreadJob, this,
-				std::ref(testingMat), iStart, totalThreadsNumber,
-				std::ref(res->labelsMat), skipZeros, std::ref(skipZerosMat), std::ref(importanceValues)
-			);
+	if (pseudoProbMapResult)
+	{
+		// The labels of the pos and neg images are the labels predicted for the first positive/negative distance
+		int64_t firstPos = -1, firstNeg = -1;
+		for (const WorkerState& state : workers) {
+			if (state.firstPos != -1 && (firstPos == -1 || state.firstPos < firstPos)) { firstPos = state.firstPos; }
+			if (state.firstNeg != -1 && (firstNeg == -1 || state.firstNeg < firstNeg)) { firstNeg = state.firstNeg; }
 		}
 
-		for (int i = 0; i < totalThreadsNumber; i++) {
-			threads[i].join();
+		cv::Mat predicted(1, 1, CV_32F);
+		if (firstPos != -1) {
+			m_svm_descriptions[firstPos % svmsCount].GetModel()->predict(testingMat.row(static_cast<int>(firstPos / svmsCount)), predicted, false);
+			posLabel = std::lround(predicted.at<float>(0, 0));
+		}
+		if (firstNeg != -1) {
+			m_svm_descriptions[firstNeg % svmsCount].GetModel()->predict(testingMat.row(static_cast<int>(firstNeg / svmsCount)), predicted, false);
+			negLabel = std::lround(predicted.at<float>(0, 0));
 		}
 	}
 
@@ -250,7 +380,7 @@ std::shared_ptr<SvmSuite::Manager::Result> SvmSuite::Manager::Test(cv::Mat &test
 
 	message("", false, true);
 
-	return res;
+	return true;
 }
 
 void SvmSuite::Manager::AddSvmDescriptionToList(SvmDescription svmDesc) {
@@ -263,6 +393,10 @@ void SvmSuite::Manager::AddSvmDescriptions(std::vector< SvmDescription > svmDesc
 	}
 }
 
+std::vector< SvmSuite::SvmDescription > SvmSuite::Manager::GetSvmDescriptions() {
+	return m_svm_descriptions;
+}
+
 void SvmSuite::Manager::AddPretrainedModel(std::string pretrainedModelPath, int neighborhoodRadius) {
 	SvmDescription svm_desc;
 	svm_desc.SetModelPath(pretrainedModelPath);
@@ -288,6 +422,10 @@ void SvmSuite::Manager::SetTrainData(cv::Mat &trainingMat, cv::Mat &labelsMat, c
 	}
 }
 
+void SvmSuite::Manager::SetSampleKeys(const std::vector<size_t>& sampleKeys) {
+	m_sample_keys = sampleKeys;
+}
+
 void SvmSuite::Manager::SetVerbose(bool verbose) {
 	m_verbose = verbose;
 }
@@ -308,87 +446,68 @@ void SvmSuite::Manager::SetNumberOfThreads(int numberOfThreads) {
 	m_number_of_threads = numberOfThreads;
 }
 
-void SvmSuite::Manager::SetSubsampling(bool subsample, int maxSamples) {
-	m_subsample = subsample;
-	m_max_samples = maxSamples;
-}
-
 void SvmSuite::Manager::SetInputNormalization(bool normalize) {
 	m_normalize = normalize;
 }
 
-void SvmSuite::Manager::testingLabelsThreadJob(cv::Mat &testingMat, int iStart, int interval, cv::Mat &resultLabelsMat,
-	bool skipZeros, cv::Mat &skipZerosMat, std::vector< double > &importanceValues)
+std::vector< std::shared_ptr<SvmSuite::FusedModel> > SvmSuite::Manager::buildFusedModels(cv::Mat &testingMat,
+	cv::Mat &skipZerosMat, bool skipZeros)
 {
-	std::map< LabelsType, double > decisionImportanceValues;
+	std::vector< std::shared_ptr<FusedModel> > fusedModels(m_svm_descriptions.size());
+	std::vector< LabelsType > differentLabels(m_different_labels.begin(), m_different_labels.end());
 
-	cv::Mat predicted(1, 1, CV_32F);
-	std::vector<LabelsType> outputLabels(m_svm_descriptions.size());
-	int isvm;
-
-	// Iterate through the images and make predictions for each pixel/voxel
-	for (int iTest = iStart; iTest < testingMat.rows; iTest += interval)
+	// A few rows to check the fused models against OpenCV
+	cv::Mat checkMat;
+	for (int iTest = 0; iTest < testingMat.rows && checkMat.rows < 32; iTest++)
 	{
-		if (skipZeros && (skipZerosMat.row(iTest).at<float>(0, 0) == 0)) {
-			continue;
+		if (!skipZeros || (skipZerosMat.ptr<float>(iTest)[0] != 0)) {
+			checkMat.push_back(testingMat.row(iTest));
 		}
+	}
 
-		isvm = 0;
+	for (size_t isvm = 0; isvm < m_svm_descriptions.size(); isvm++)
+	{
+		cv::Ptr<cv::ml::SVM> svm = m_svm_descriptions[isvm].GetModel();
 
-		// For each svm
-		for (SvmDescription& svm_desc : m_svm_descriptions)
+		std::shared_ptr<FusedModel> fused(new FusedModel());
+		if (testingMat.type() != CV_32F || !fused->Build(svm, differentLabels) ||
+			fused->GetFeaturesCount() != static_cast<size_t>(testingMat.cols))
 		{
-			// Predict
-			if (svm_desc.GetModel() == nullptr) {
-				errorOccured("Trying to make predictions on untrained SVM");
-				//return res;
-			}
-			else {
-				svm_desc.GetModel()->predict(testingMat.row(iTest), predicted, false);
-
-				// The value is the predicted label
-				outputLabels[isvm++] = std::lround(predicted.at<float>(0, 0));
-				//outputLabels[isvm++] = std::round(predicted.at<float>(0, 0));
-			}
-		}
-
-		// The values are the predicted labels
-		// In case of different svms predicting a different label
-		// then the prediction with the most accumulated importance will be used
-		// In case of a draw the decision from the first in order svm is used (draws should be avoided in the configuration)
-		for (LabelsType label : m_different_labels) {
-			// This is done for time optimization (not creating a new object each time)
-			decisionImportanceValues[label] = 0;
+			continue;
 		}
 
-		// For each different label in the predictions, find the sum of the importance values of the svms that predicted it
-		for (int i = 0; i < outputLabels.size(); i++) {
-			//if (decisionImportanceValues.find(outputLabels[i]) == decisionImportanceValues.end())
-			//{
-			//	decisionImportanceValues[outputLabels[i]] = importanceValues[i];
-			//}
-			//else {
-			decisionImportanceValues[outputLabels[i]] += importanceValues[i];
-			//}
-		}
+		bool agrees = true;
+		if (checkMat.rows > 0)
+		{
+			cv::Mat predictedLabels, predictedRaw;
+			svm->predict(checkMat, predictedLabels, 0);
+			svm->predict(checkMat, predictedRaw, cv::ml::StatModel::RAW_OUTPUT);
 
-		// Find the label with the most importance value
-		//std::vector< int > keys = getMapKeyset(decisionImportanceValues);
-		int    decision = 0;
-		double bestDecisionImportance = 0;
+			std::vector< float > decisions(checkMat.rows);
+			std::vector< int >   labels(checkMat.rows);
+			std::vector< double > kernelBuffer;
+			checkMat = checkMat.isContinuous() ? checkMat : checkMat.clone();
+			fused->Predict(checkMat.ptr<float>(0), checkMat.rows, decisions.data(), labels.data(), kernelBuffer);
 
-		for (int decisionCandidate : m_different_labels)
-		{
-			if (decisionImportanceValues[decisionCandidate] > bestDecisionImportance)
+			for (int i = 0; i < checkMat.rows && agrees; i++)
 			{
-				decision = decisionCandidate;
-				bestDecisionImportance = decisionImportanceValues[decisionCandidate];
+				agrees = (labels[i] == std::lround(predictedLabels.at<float>(i, 0)));
+				if (differentLabels.size() == 2) {
+					const float expected = predictedRaw.at<float>(i, 0);
+					agrees = agrees && (std::fabs(decisions[i] - expected) <= 1e-3f * (1.0f + std::fabs(expected)));
+				}
 			}
 		}
 
-		// Set value to output
-		resultLabelsMat.ptr<LabelsType>(iTest)[0] = decision;
+		if (agrees) {
+			fusedModels[isvm] = fused;
+		}
+		else {
+			message("Fused evaluation disagrees with OpenCV for svm #" + std::to_string(isvm) + ", using OpenCV\n");
+		}
 	}
+
+	return fusedModels;
 }
 
 void SvmSuite::Manager::startTimer() {
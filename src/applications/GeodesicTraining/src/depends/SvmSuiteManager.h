@@ -5,6 +5,8 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <math.h>
@@ -14,6 +16,7 @@
 #include <thread>
 
 #include "SvmSuiteDescription.h"
+#include "SvmSuiteFusedModel.h"
 #include "SvmSuiteOperations.h"
 #include "SvmSuiteUtil.h"
 
@@ -68,6 +71,23 @@ namespace SvmSuite
 		*/
 		std::shared_ptr<Result> Test(cv::Mat &testingMat, cv::Mat &skipZerosMat, bool pseudoProbMapResult = false, bool skipZeros = true);
 
+		/**
+		Test using the ensemble of trained svm models, writing the results directly to the given buffers
+		The rows are processed in contiguous blocks (scheduled with work stealing between m_number_of_threads threads),
+		and for each block all the svms are evaluated one after the other on the gathered (not skipped) rows.
+		@param testingMat cv::Mat (CV_32F) where the rows are the samples to test and columns are the features
+		@param skipZerosMat see Test(...)
+		@param skipZeros whether to user skipZerosMat
+		@param labelsOut if not nullptr, testingMat.rows predicted labels are written here (0 for skipped rows)
+		@param posOut if not nullptr (together with negOut), testingMat.rows pos pseudoprobabilities are written here (0 for skipped rows)
+		@param negOut same as posOut, for the neg pseudoprobabilities
+		@param posLabel output, the label that the pos pseudoprobabilities correspond to
+		@param negLabel output, the label that the neg pseudoprobabilities correspond to
+		@return false if an svm is not trained
+		*/
+		bool TestToBuffers(cv::Mat &testingMat, cv::Mat &skipZerosMat, bool skipZeros,
+			LabelsType* labelsOut, PseudoProbType* posOut, PseudoProbType* negOut, LabelsType &posLabel, LabelsType &negLabel);
+
 		// Adders and Setters
 
 		void AddSvmDescriptionToList(SvmDescription svmDesc);
@@ -75,26 +95,37 @@ namespace SvmSuite
 		void AddPretrainedModel(std::string pretrainedModelPath, int neighborhoodRadius = 0);
 		void AddSvmsFromConfig(std::string configPath);
 		void SetTrainData(cv::Mat &trainingMat, cv::Mat &labelsMat, cv::Mat &weightsMat/*, cv::Mat sampleIdx = cv::Mat()*/);
+		/** Identifies each training sample between trainings (for the warm start of the svms that have a WarmStartTrainer) */
+		void SetSampleKeys(const std::vector<size_t>& sampleKeys);
 		void SetVerbose(bool verbose);
 		void SetOutputPath(std::string path);
 		void SetSavingModelsEnabled(bool modelsEnabled);
 		void SetTimerEnabled(bool timerEnabled);
 		void SetNumberOfThreads(int numberOfThreads);
-		void SetSubsampling(bool subsample, int maxSamples = 3000);
 		void SetInputNormalization(bool normalize);
+
+		// Getters
+
+		/** The svm descriptions, after Train() they hold the trained models and the parameters that were found */
+		std::vector< SvmDescription > GetSvmDescriptions();
 		
 	private:
 		std::vector< SvmDescription > m_svm_descriptions;
 		cv::Ptr<cv::ml::TrainData>    m_traindata;
 		cv::Mat                       m_weights_mat;
+		std::vector<size_t>           m_sample_keys;
 		std::set<LabelsType>          m_different_labels;
 		std::string                   m_output_path = "./";
 		SvmSuiteUtil::Timer           m_timer;
-		int                           m_number_of_threads = 32, m_max_samples = 3000;
-		bool m_timer_enabled = false, m_save_models = false, m_verbose = false, m_subsample = false, m_normalize = false;
+		int                           m_number_of_threads = 32;
+		bool m_timer_enabled = false, m_save_models = false, m_verbose = false, m_normalize = false;
 		
-		void testingLabelsThreadJob(cv::Mat &testingMat, int iStart, int interval, cv::Mat &resultLabelsMat,
-		                            bool skipZeros, cv::Mat &skipZerosMat, std::vector< double > &importanceValues);
+		/**
+		Builds a FusedModel for every svm, or nullptr where the svm has to be evaluated by OpenCV
+		(unsupported model, or the labels are unknown because the model is pretrained).
+		Every fused model is checked against cv::ml::SVM::predict on a few rows of testingMat before being used.
+		*/
+		std::vector< std::shared_ptr<FusedModel> > buildFusedModels(cv::Mat &testingMat, cv::Mat &skipZerosMat, bool skipZeros);
 
 		// For timer
 
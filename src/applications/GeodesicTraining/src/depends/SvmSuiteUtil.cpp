@@ -1,5 +1,11 @@
 #include "SvmSuiteUtil.h"
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 SvmSuiteUtil::Timer::Timer() {
 	Reset();
 }
@@ -11,4 +17,80 @@ void SvmSuiteUtil::Timer::Reset() {
 float SvmSuiteUtil::Timer::Diff() {
 	std::chrono::duration<float> fs = std::chrono::high_resolution_clock::now() - m_timestamp;
 	return fs.count();
+}
+
+namespace
+{
+	typedef struct BlockRange
+	{
+		std::mutex mutex;
+		size_t begin = 0, end = 0;
+	} BlockRange;
+}
+
+void SvmSuiteUtil::RunWorkStealing(size_t numberOfBlocks, int numberOfWorkers, const std::function<void(size_t, int)>& job)
+{
+	if (numberOfBlocks == 0) {
+		return;
+	}
+	const size_t workers = std::max<size_t>(1, std::min<size_t>(numberOfBlocks, std::max(numberOfWorkers, 1)));
+
+	std::vector< std::unique_ptr<BlockRange> > ranges(workers);
+	for (size_t w = 0; w < workers; w++) {
+		ranges[w].reset(new BlockRange());
+		ranges[w]->begin = numberOfBlocks * w / workers;
+		ranges[w]->end   = numberOfBlocks * (w + 1) / workers;
+	}
+
+	auto worker = [&](size_t w)
+	{
+		while (true)
+		{
+			size_t block = numberOfBlocks;
+			{
+				std::lock_guard<std::mutex> lock(ranges[w]->mutex);
+				if (ranges[w]->begin < ranges[w]->end) {
+					block = ranges[w]->begin++;
+				}
+			}
+			if (block == numberOfBlocks)
+			{
+				// Steal the back half of the largest remaining range
+				size_t victim = workers, largest = 0;
+				for (size_t v = 0; v < workers; v++) {
+					std::lock_guard<std::mutex> lock(ranges[v]->mutex);
+					if (ranges[v]->end - ranges[v]->begin > largest) {
+						largest = ranges[v]->end - ranges[v]->begin;
+						victim = v;
+					}
+				}
+				if (victim == workers) {
+					return; // nothing left anywhere
+				}
+
+				std::lock(ranges[w]->mutex, ranges[victim]->mutex);
+				std::lock_guard<std::mutex> lockOwn(ranges[w]->mutex, std::adopt_lock);
+				std::lock_guard<std::mutex> lockVictim(ranges[victim]->mutex, std::adopt_lock);
+				const size_t remaining = ranges[victim]->end - ranges[victim]->begin;
+				if (remaining == 0) {
+					continue; // taken by someone else meanwhile
+				}
+				const size_t middle = ranges[victim]->end - (remaining + 1) / 2;
+				ranges[w]->begin = middle;
+				ranges[w]->end   = ranges[victim]->end;
+				ranges[victim]->end = middle;
+				continue;
+			}
+			job(block, static_cast<int>(w));
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t w = 1; w < workers; w++) {
+		threads.push_back(std::thread(worker, w));
+	}
+	worker(0);
+	for (auto& thread : threads) {
+		thread.join();
+	}
 }
\ No newline at end of file
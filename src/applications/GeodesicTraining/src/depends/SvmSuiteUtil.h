@@ -3,6 +3,7 @@
 
 #include <chrono>
 #include <ctime>
+#include <functional>
 
 namespace SvmSuiteUtil
 {
@@ -29,6 +30,17 @@ namespace SvmSuiteUtil
 		std::chrono::high_resolution_clock::time_point m_timestamp;
 	};
 
+	/**
+	Runs job(block, worker) for every block in [0, numberOfBlocks) using a work-stealing scheduler.
+	Every worker starts with a contiguous range of blocks and takes them from the front;
+	a worker that runs out steals the back half of the range of another worker,
+	so neighbouring blocks (and rows) mostly stay on the same thread.
+	@param numberOfBlocks how many blocks there are
+	@param numberOfWorkers how many threads to use (the calling thread is one of them)
+	@param job the function to run for each block
+	*/
+	void RunWorkStealing(size_t numberOfBlocks, int numberOfWorkers, const std::function<void(size_t, int)>& job);
+
 }
 
 #endif
\ No newline at end of file
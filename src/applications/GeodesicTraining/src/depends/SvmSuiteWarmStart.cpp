@@ -0,0 +1,600 @@
+#include "SvmSuiteWarmStart.h"
+
+#include "SvmSuiteUtil.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <string>
+
+bool SvmSuite::WarmStartTrainer::IsSupported(int svmType, int kernelType)
+{
+	return svmType == cv::ml::SVM::C_SVC &&
+		(kernelType == cv::ml::SVM::LINEAR || kernelType == cv::ml::SVM::POLY || kernelType == cv::ml::SVM::RBF ||
+		 kernelType == cv::ml::SVM::SIGMOID || kernelType == cv::ml::SVM::CHI2 || kernelType == cv::ml::SVM::INTER);
+}
+
+void SvmSuite::WarmStartTrainer::Clear()
+{
+	m_samples.release();
+	m_labels.clear();
+	m_keys.clear();
+	m_alpha.clear();
+	m_model.release();
+	m_kernel_rows.clear();
+	m_cached_rows.clear();
+	m_cache_bytes = 0;
+	m_warm_started = false;
+	m_iterations = 0;
+}
+
+bool SvmSuite::WarmStartTrainer::Train(const cv::Mat& samples, const cv::Mat& labels, const std::vector<size_t>& sampleKeys,
+	int kernelType, double C, double gamma, double coef0, double degree,
+	const cv::Mat& classWeights, cv::TermCriteria termCriteria)
+{
+	const int n = samples.rows;
+	if (n == 0 || samples.type() != CV_32F || static_cast<int>(labels.total()) != n || C <= 0) {
+		return false;
+	}
+
+	std::vector<int> sampleLabels(n);
+	cv::Mat labelsInt;
+	labels.reshape(1, n).convertTo(labelsInt, CV_32S);
+	for (int i = 0; i < n; i++) {
+		sampleLabels[i] = labelsInt.at<int>(i, 0);
+	}
+	std::set<int> differentLabels(sampleLabels.begin(), sampleLabels.end());
+	std::vector<int> classLabels(differentLabels.begin(), differentLabels.end());
+	if (classLabels.size() < 2) {
+		return false;
+	}
+
+	cv::Mat weights;
+	if (!classWeights.empty())
+	{
+		if (static_cast<int>(classWeights.total()) != static_cast<int>(classLabels.size())) {
+			return false;
+		}
+		classWeights.reshape(1, static_cast<int>(classLabels.size())).convertTo(weights, CV_64F);
+	}
+
+	KernelParameters kernelParameters;
+	kernelParameters.kernelType = kernelType;
+	kernelParameters.gamma  = gamma;
+	kernelParameters.coef0  = coef0;
+	kernelParameters.degree = degree;
+
+	// The same samples in the previous training
+	std::vector<int> previousIndex(n, -1), unchangedIndex(n, -1);
+	const bool keysUsable = (static_cast<int>(sampleKeys.size()) == n);
+	if (keysUsable && !m_keys.empty())
+	{
+		std::unordered_map<size_t, int> indexOfKey;
+		for (size_t o = 0; o < m_keys.size(); o++) {
+			indexOfKey[m_keys[o]] = static_cast<int>(o);
+		}
+		const bool sameFeatures = (m_samples.cols == samples.cols) && (kernelParameters == m_kernel);
+		for (int i = 0; i < n; i++)
+		{
+			auto it = indexOfKey.find(sampleKeys[i]);
+			if (it == indexOfKey.end()) {
+				continue;
+			}
+			previousIndex[i] = it->second;
+			if (sameFeatures && std::memcmp(samples.ptr<float>(i), m_samples.ptr<float>(it->second), samples.cols * sizeof(float)) == 0) {
+				unchangedIndex[i] = it->second;
+			}
+		}
+	}
+
+	std::vector< std::vector<float> > oldRows;
+	oldRows.swap(m_kernel_rows);
+	m_samples = samples.clone();
+	m_kernel = kernelParameters;
+	translateKernelCache(oldRows, unchangedIndex);
+	oldRows.clear();
+
+	// OpenCV's defaults for the criteria
+	const double eps = (termCriteria.type & cv::TermCriteria::EPS) ? std::max(termCriteria.epsilon, DBL_EPSILON) : DBL_EPSILON;
+	const int maxIterations = (termCriteria.type & cv::TermCriteria::COUNT) ? std::max(termCriteria.maxCount, 1) : INT_MAX;
+
+	// One-vs-one, positive decision -> first class of the pair
+	std::map< LabelsPair, std::vector<double> > newAlpha;
+	std::vector< std::vector<double> > pairAlpha;
+	std::vector<double> pairRho;
+	m_warm_started = false;
+	m_iterations = 0;
+
+	for (size_t ci = 0; ci < classLabels.size(); ci++)
+	{
+		for (size_t cj = ci + 1; cj < classLabels.size(); cj++)
+		{
+			const LabelsPair labelsPair(classLabels[ci], classLabels[cj]);
+			const double Cp = C * ((weights.empty()) ? 1.0 : weights.at<double>(static_cast<int>(ci), 0));
+			const double Cn = C * ((weights.empty()) ? 1.0 : weights.at<double>(static_cast<int>(cj), 0));
+
+			std::vector<int> indices;
+			std::vector<signed char> y;
+			std::vector<double> upperBound, alpha;
+			auto previousAlpha = m_alpha.find(labelsPair);
+
+			for (int i = 0; i < n; i++)
+			{
+				if (sampleLabels[i] != labelsPair.first && sampleLabels[i] != labelsPair.second) {
+					continue;
+				}
+				const bool positive = (sampleLabels[i] == labelsPair.first);
+				indices.push_back(i);
+				y.push_back((positive) ? 1 : -1);
+				upperBound.push_back((positive) ? Cp : Cn);
+
+				// Starting point: the previous alpha, if the sample kept its label
+				double a = 0;
+				const int o = previousIndex[i];
+				if (previousAlpha != m_alpha.end() && o != -1 && m_labels[o] == sampleLabels[i]) {
+					a = std::min(std::fabs(previousAlpha->second[o]), upperBound.back());
+				}
+				alpha.push_back(a);
+			}
+
+			// The starting point has to satisfy sum(y*alpha) = 0, the larger side is scaled down
+			double sumPositive = 0, sumNegative = 0;
+			for (size_t t = 0; t < alpha.size(); t++) {
+				((y[t] > 0) ? sumPositive : sumNegative) += alpha[t];
+			}
+			if (sumPositive != sumNegative)
+			{
+				const double scale = (sumPositive > sumNegative) ? sumNegative / sumPositive : sumPositive / sumNegative;
+				for (size_t t = 0; t < alpha.size(); t++) {
+					if ((y[t] > 0) == (sumPositive > sumNegative)) {
+						alpha[t] *= scale;
+					}
+				}
+			}
+			if (sumPositive > 0 && sumNegative > 0) {
+				m_warm_started = true;
+			}
+
+			double rho = 0;
+			m_iterations += solve(indices, y, upperBound, alpha, rho, eps, maxIterations);
+
+			std::vector<double> signedAlpha(n, 0);
+			for (size_t t = 0; t < indices.size(); t++) {
+				signedAlpha[indices[t]] = y[t] * alpha[t];
+			}
+			newAlpha[labelsPair] = signedAlpha;
+			pairAlpha.push_back(signedAlpha);
+			pairRho.push_back(rho);
+		}
+	}
+
+	m_labels = sampleLabels;
+	m_keys   = (keysUsable) ? sampleKeys : std::vector<size_t>();
+	m_alpha.swap(newAlpha);
+
+	m_model = buildModel(classLabels, pairAlpha, pairRho, C, weights, termCriteria);
+	return !m_model.empty();
+}
+
+double SvmSuite::WarmStartTrainer::kernel(const float* a, const float* b, int featuresCount) const
+{
+	// The same kernels as cv::ml::SVM
+	double s = 0;
+	switch (m_kernel.kernelType)
+	{
+	case cv::ml::SVM::RBF:
+		for (int k = 0; k < featuresCount; k++) {
+			const double d = a[k] - b[k];
+			s += d * d;
+		}
+		return std::exp(-m_kernel.gamma * s);
+	case cv::ml::SVM::CHI2:
+		for (int k = 0; k < featuresCount; k++) {
+			const double d = a[k] - b[k], divisor = a[k] + b[k];
+			if (divisor != 0) {
+				s += d * d / divisor;
+			}
+		}
+		return std::exp(-m_kernel.gamma * s);
+	case cv::ml::SVM::INTER:
+		for (int k = 0; k < featuresCount; k++) {
+			s += std::min(a[k], b[k]);
+		}
+		return s;
+	default:
+		break;
+	}
+
+	for (int k = 0; k < featuresCount; k++) {
+		s += static_cast<double>(a[k]) * b[k];
+	}
+	switch (m_kernel.kernelType)
+	{
+	case cv::ml::SVM::POLY:
+		return std::pow(m_kernel.gamma * s + m_kernel.coef0, m_kernel.degree);
+	case cv::ml::SVM::SIGMOID:
+		// OpenCV computes tanh(-gamma * s - coef0)
+		return -std::tanh(m_kernel.gamma * s + m_kernel.coef0);
+	default:
+		return s;
+	}
+}
+
+void SvmSuite::WarmStartTrainer::computeKernelRow(int i, std::vector<float>& row) const
+{
+	const int n = m_samples.rows, featuresCount = m_samples.cols;
+	const float* a = m_samples.ptr<float>(i);
+	row.resize(n);
+	for (int j = 0; j < n; j++) {
+		row[j] = static_cast<float>(kernel(a, m_samples.ptr<float>(j), featuresCount));
+	}
+}
+
+const float* SvmSuite::WarmStartTrainer::kernelRow(int i)
+{
+	if (m_kernel_rows[i].empty())
+	{
+		std::vector<float> row;
+		computeKernelRow(i, row);
+		cacheRow(i, row);
+	}
+	return m_kernel_rows[i].data();
+}
+
+void SvmSuite::WarmStartTrainer::cacheRow(int i, std::vector<float>& row)
+{
+	m_cache_bytes += row.size() * sizeof(float);
+	m_kernel_rows[i].swap(row);
+	m_cached_rows.push_back(i);
+
+	// The oldest rows are dropped (the newest is always kept)
+	while (m_cache_bytes > m_cache_limit && m_cached_rows.size() > 1)
+	{
+		std::vector<float>& oldest = m_kernel_rows[m_cached_rows.front()];
+		m_cache_bytes -= oldest.size() * sizeof(float);
+		std::vector<float>().swap(oldest);
+		m_cached_rows.pop_front();
+	}
+}
+
+void SvmSuite::WarmStartTrainer::prepareKernelRows(const std::vector<int>& rows)
+{
+	std::vector<int> missing;
+	for (int i : rows) {
+		if (m_kernel_rows[i].empty()) {
+			missing.push_back(i);
+		}
+	}
+	if (missing.empty()) {
+		return;
+	}
+
+	std::vector< std::vector<float> > computed(missing.size());
+	const int numberOfWorkers = std::max(1, std::min(m_number_of_threads, static_cast<int>(missing.size())));
+	SvmSuiteUtil::RunWorkStealing(missing.size(), numberOfWorkers, [&](size_t block, int worker)
+	{
+		computeKernelRow(missing[block], computed[block]);
+	});
+
+	for (size_t r = 0; r < missing.size(); r++) {
+		cacheRow(missing[r], computed[r]);
+	}
+}
+
+void SvmSuite::WarmStartTrainer::translateKernelCache(std::vector< std::vector<float> >& oldRows, const std::vector<int>& oldIndex)
+{
+	const int n = m_samples.rows, featuresCount = m_samples.cols;
+	m_kernel_rows.assign(n, std::vector<float>());
+	m_cached_rows.clear();
+	m_cache_bytes = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		const int o = oldIndex[i];
+		if (o == -1 || o >= static_cast<int>(oldRows.size()) || oldRows[o].empty()) {
+			continue;
+		}
+
+		// Only the columns of the new (or changed) samples are computed
+		std::vector<float> row(n);
+		const float* a = m_samples.ptr<float>(i);
+		for (int j = 0; j < n; j++) {
+			row[j] = (oldIndex[j] != -1) ? oldRows[o][oldIndex[j]] : static_cast<float>(kernel(a, m_samples.ptr<float>(j), featuresCount));
+		}
+		std::vector<float>().swap(oldRows[o]);
+		cacheRow(i, row);
+	}
+}
+
+int SvmSuite::WarmStartTrainer::solve(const std::vector<int>& indices, const std::vector<signed char>& y, const std::vector<double>& upperBound,
+	std::vector<double>& alpha, double& rho, double eps, int maxIterations)
+{
+	const double TAU = 1e-12, INF = std::numeric_limits<double>::infinity();
+	const int l = static_cast<int>(indices.size());
+	const int featuresCount = m_samples.cols;
+
+	// Gradient of the starting point
+	std::vector<double> G(l, -1.0), QD(l);
+	for (int t = 0; t < l; t++) {
+		const float* sample = m_samples.ptr<float>(indices[t]);
+		QD[t] = static_cast<float>(kernel(sample, sample, featuresCount));
+	}
+
+	std::vector<int> activeRows;
+	for (int t = 0; t < l; t++) {
+		if (alpha[t] > 0) {
+			activeRows.push_back(indices[t]);
+		}
+	}
+	prepareKernelRows(activeRows);
+	for (int t = 0; t < l; t++)
+	{
+		if (alpha[t] <= 0) {
+			continue;
+		}
+		const float* Kt = kernelRow(indices[t]);
+		const double f = y[t] * alpha[t];
+		for (int s = 0; s < l; s++) {
+			G[s] += y[s] * f * Kt[indices[s]];
+		}
+	}
+
+	auto isUpperBound = [&](int t) { return alpha[t] >= upperBound[t]; };
+	auto isLowerBound = [&](int t) { return alpha[t] <= 0; };
+
+	int iterations = 0;
+	while (iterations < maxIterations)
+	{
+		// Working set selection (second order, as libsvm)
+		double Gmax = -INF;
+		int i = -1;
+		for (int t = 0; t < l; t++)
+		{
+			if ((y[t] > 0) ? !isUpperBound(t) : !isLowerBound(t)) {
+				const double v = -y[t] * G[t];
+				if (v >= Gmax) {
+					Gmax = v;
+					i = t;
+				}
+			}
+		}
+		if (i == -1) {
+			break;
+		}
+
+		const float* Ki = kernelRow(indices[i]);
+		m_row_buffer.assign(Ki, Ki + m_samples.rows); // The cache can drop the row when the second one is computed
+		Ki = m_row_buffer.data();
+
+		double Gmax2 = -INF, objectiveMin = INF;
+		int j = -1;
+		for (int t = 0; t < l; t++)
+		{
+			if ((y[t] > 0) ? !isLowerBound(t) : !isUpperBound(t))
+			{
+				const double yG = y[t] * G[t];
+				Gmax2 = std::max(Gmax2, yG);
+				const double gradientDifference = Gmax + yG;
+				if (gradientDifference > 0)
+				{
+					double quadratic = QD[i] + QD[t] - 2.0 * Ki[indices[t]];
+					if (quadratic <= 0) {
+						quadratic = TAU;
+					}
+					const double objective = -(gradientDifference * gradientDifference) / quadratic;
+					if (objective <= objectiveMin) {
+						objectiveMin = objective;
+						j = t;
+					}
+				}
+			}
+		}
+		if (j == -1 || Gmax + Gmax2 < eps) {
+			break;
+		}
+		iterations++;
+
+		const float* Kj = kernelRow(indices[j]);
+
+		// Update alpha[i] and alpha[j]
+		const double Ci = upperBound[i], Cj = upperBound[j];
+		const double oldAlphaI = alpha[i], oldAlphaJ = alpha[j];
+		double quadratic = QD[i] + QD[j] - 2.0 * Ki[indices[j]];
+		if (quadratic <= 0) {
+			quadratic = TAU;
+		}
+
+		if (y[i] != y[j])
+		{
+			const double delta = (-G[i] - G[j]) / quadratic;
+			const double diff = alpha[i] - alpha[j];
+			alpha[i] += delta;
+			alpha[j] += delta;
+
+			if (diff > 0) {
+				if (alpha[j] < 0) { alpha[j] = 0; alpha[i] = diff; }
+			}
+			else {
+				if (alpha[i] < 0) { alpha[i] = 0; alpha[j] = -diff; }
+			}
+			if (diff > Ci - Cj) {
+				if (alpha[i] > Ci) { alpha[i] = Ci; alpha[j] = Ci - diff; }
+			}
+			else {
+				if (alpha[j] > Cj) { alpha[j] = Cj; alpha[i] = Cj + diff; }
+			}
+		}
+		else
+		{
+			const double delta = (G[i] - G[j]) / quadratic;
+			const double sum = alpha[i] + alpha[j];
+			alpha[i] -= delta;
+			alpha[j] += delta;
+
+			if (sum > Ci) {
+				if (alpha[i] > Ci) { alpha[i] = Ci; alpha[j] = sum - Ci; }
+			}
+			else {
+				if (alpha[j] < 0) { alpha[j] = 0; alpha[i] = sum; }
+			}
+			if (sum > Cj) {
+				if (alpha[j] > Cj) { alpha[j] = Cj; alpha[i] = sum - Cj; }
+			}
+			else {
+				if (alpha[i] < 0) { alpha[i] = 0; alpha[j] = sum; }
+			}
+		}
+
+		// Update the gradient
+		const double deltaI = y[i] * (alpha[i] - oldAlphaI), deltaJ = y[j] * (alpha[j] - oldAlphaJ);
+		for (int s = 0; s < l; s++) {
+			G[s] += y[s] * (deltaI * Ki[indices[s]] + deltaJ * Kj[indices[s]]);
+		}
+	}
+
+	// rho (average over the free samples, or the middle of the feasible interval)
+	int freeCount = 0;
+	double upper = INF, lower = -INF, freeSum = 0;
+	for (int t = 0; t < l; t++)
+	{
+		const double yG = y[t] * G[t];
+		if (isUpperBound(t)) {
+			if (y[t] < 0) { upper = std::min(upper, yG); }
+			else          { lower = std::max(lower, yG); }
+		}
+		else if (isLowerBound(t)) {
+			if (y[t] > 0) { upper = std::min(upper, yG); }
+			else          { lower = std::max(lower, yG); }
+		}
+		else {
+			freeCount++;
+			freeSum += yG;
+		}
+	}
+	rho = (freeCount > 0) ? freeSum / freeCount : (upper + lower) / 2;
+
+	return iterations;
+}
+
+cv::Ptr<cv::ml::SVM> SvmSuite::WarmStartTrainer::buildModel(const std::vector<int>& classLabels,
+	const std::vector< std::vector<double> >& pairAlpha, const std::vector<double>& pairRho,
+	double C, const cv::Mat& classWeights, cv::TermCriteria termCriteria) const
+{
+	// Support vectors of all the decision functions
+	const int n = m_samples.rows, featuresCount = m_samples.cols;
+	std::vector<int> supportVectorIndex(n, -1), supportVectors;
+	for (int i = 0; i < n; i++)
+	{
+		for (const std::vector<double>& alpha : pairAlpha) {
+			if (alpha[i] != 0) {
+				supportVectorIndex[i] = static_cast<int>(supportVectors.size());
+				supportVectors.push_back(i);
+				break;
+			}
+		}
+	}
+	if (supportVectors.empty()) {
+		return cv::Ptr<cv::ml::SVM>();
+	}
+
+	std::string kernelTypeString;
+	switch (m_kernel.kernelType)
+	{
+	case cv::ml::SVM::LINEAR:  kernelTypeString = "LINEAR";  break;
+	case cv::ml::SVM::POLY:    kernelTypeString = "POLY";    break;
+	case cv::ml::SVM::SIGMOID: kernelTypeString = "SIGMOID"; break;
+	case cv::ml::SVM::CHI2:    kernelTypeString = "CHI2";    break;
+	case cv::ml::SVM::INTER:   kernelTypeString = "INTER";   break;
+	default:                   kernelTypeString = "RBF";     break;
+	}
+
+	try
+	{
+		// The same layout as cv::ml::SVM::write
+		cv::FileStorage fs(".xml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+		fs << "format" << 3;
+		fs << "svmType" << "C_SVC";
+		fs << "kernel" << "{" << "type" << kernelTypeString;
+		if (m_kernel.kernelType == cv::ml::SVM::POLY) {
+			fs << "degree" << m_kernel.degree;
+		}
+		if (m_kernel.kernelType != cv::ml::SVM::LINEAR) {
+			fs << "gamma" << m_kernel.gamma;
+		}
+		if (m_kernel.kernelType == cv::ml::SVM::POLY || m_kernel.kernelType == cv::ml::SVM::SIGMOID) {
+			fs << "coef0" << m_kernel.coef0;
+		}
+		fs << "}";
+		fs << "C" << C;
+		fs << "term_criteria" << "{:";
+		if (termCriteria.type & cv::TermCriteria::EPS) {
+			fs << "epsilon" << termCriteria.epsilon;
+		}
+		if (termCriteria.type & cv::TermCriteria::COUNT) {
+			fs << "iterations" << termCriteria.maxCount;
+		}
+		fs << "}";
+		fs << "var_count" << featuresCount;
+		fs << "class_count" << static_cast<int>(classLabels.size());
+		fs << "class_labels" << cv::Mat(classLabels, true);
+		if (!classWeights.empty()) {
+			fs << "class_weights" << classWeights;
+		}
+
+		fs << "sv_total" << static_cast<int>(supportVectors.size());
+		fs << "support_vectors" << "[";
+		for (int i : supportVectors)
+		{
+			const float* sample = m_samples.ptr<float>(i);
+			fs << "[:";
+			for (int k = 0; k < featuresCount; k++) {
+				fs << sample[k];
+			}
+			fs << "]";
+		}
+		fs << "]";
+
+		fs << "decision_functions" << "[";
+		for (size_t df = 0; df < pairAlpha.size(); df++)
+		{
+			std::vector<double> alpha;
+			std::vector<int> index;
+			for (int i = 0; i < n; i++) {
+				if (pairAlpha[df][i] != 0) {
+					alpha.push_back(pairAlpha[df][i]);
+					index.push_back(supportVectorIndex[i]);
+				}
+			}
+
+			fs << "{" << "sv_count" << static_cast<int>(alpha.size()) << "rho" << pairRho[df];
+			fs << "alpha" << "[:";
+			for (double a : alpha) {
+				fs << a;
+			}
+			fs << "]";
+			fs << "index" << "[:";
+			for (int i : index) {
+				fs << i;
+			}
+			fs << "]" << "}";
+		}
+		fs << "]";
+
+		const std::string serialized = fs.releaseAndGetString();
+		cv::FileStorage reader(serialized, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+		cv::Ptr<cv::ml::SVM> model = cv::ml::SVM::create();
+		model->read(reader.root());
+
+		if (!model->isTrained() || model->getVarCount() != featuresCount) {
+			return cv::Ptr<cv::ml::SVM>();
+		}
+		return model;
+	}
+	catch (const cv::Exception&) {
+		return cv::Ptr<cv::ml::SVM>();
+	}
+}
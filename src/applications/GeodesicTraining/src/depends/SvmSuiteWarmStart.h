@@ -0,0 +1,141 @@
+#ifndef H_CBICA_SVM_SUITE_WARM_START
+#define H_CBICA_SVM_SUITE_WARM_START
+
+#include <opencv2/ml.hpp>
+#include <opencv2/opencv.hpp>
+
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace SvmSuite
+{
+	/**
+	C_SVC trainer (SMO with second order working set selection, as libsvm) for fixed parameters,
+	that starts from the solution of its previous training.
+	The samples are identified between trainings by keys (for example the voxel index), so when the training set
+	is mostly the same as the previous one (a few scribbles were added), the previous alphas
+	(of the samples that kept their label) are the starting point and only a few iterations are needed.
+	The kernel rows computed in the previous training are also reused for the samples whose features didn't change.
+	The trained model is given as a regular cv::ml::SVM.
+	*/
+	class WarmStartTrainer
+	{
+	public:
+		explicit WarmStartTrainer() {}
+
+		virtual ~WarmStartTrainer() {}
+
+		/** Whether Train(...) can train this svm (C_SVC with any kernel except custom) */
+		static bool IsSupported(int svmType, int kernelType);
+
+		/** Maximum size of the kernel cache */
+		void SetCacheSize(size_t megabytes) {
+			m_cache_limit = megabytes * 1024 * 1024;
+		}
+
+		/** Threads used for computing the kernel rows needed by the warm start */
+		void SetNumberOfThreads(int numberOfThreads) {
+			m_number_of_threads = numberOfThreads;
+		}
+
+		/**
+		Trains (one-vs-one for more than 2 classes, like OpenCV)
+		@param samples CV_32F, one row per sample
+		@param labels one label per sample (integer)
+		@param sampleKeys one per sample, identifies the sample between trainings. If empty there is no warm start.
+		@param classWeights optional, one per class (in increasing order of label), the C of each class is multiplied by it
+		@param termCriteria same meaning as for cv::ml::SVM
+		@return false if the model couldn't be trained
+		*/
+		bool Train(const cv::Mat& samples, const cv::Mat& labels, const std::vector<size_t>& sampleKeys,
+			int kernelType, double C, double gamma, double coef0, double degree,
+			const cv::Mat& classWeights, cv::TermCriteria termCriteria);
+
+		/** The model trained by the last Train(...) */
+		cv::Ptr<cv::ml::SVM> GetModel() const {
+			return m_model;
+		}
+
+		/** Whether the last training started from the previous solution */
+		bool WasWarmStarted() const {
+			return m_warm_started;
+		}
+
+		/** SMO iterations of the last training (all the pairs of classes) */
+		int GetNumberOfIterations() const {
+			return m_iterations;
+		}
+
+		/** Forgets the previous training */
+		void Clear();
+
+	private:
+		typedef std::pair<int, int> LabelsPair;
+
+		typedef struct KernelParameters {
+			int    kernelType = cv::ml::SVM::RBF;
+			double gamma = 1, coef0 = 0, degree = 1;
+
+			bool operator==(const KernelParameters& other) const {
+				return kernelType == other.kernelType && gamma == other.gamma && coef0 == other.coef0 && degree == other.degree;
+			}
+		} KernelParameters;
+
+		// Last training
+		KernelParameters                            m_kernel;
+		cv::Mat                                     m_samples;
+		std::vector<int>                            m_labels;
+		std::vector<size_t>                         m_keys;
+		std::map< LabelsPair, std::vector<double> > m_alpha; // For each pair of labels, y*alpha of each sample (0 if not in the pair)
+		cv::Ptr<cv::ml::SVM>                        m_model;
+		bool                                        m_warm_started = false;
+		int                                         m_iterations = 0;
+
+		// Kernel cache, one (possibly empty) row for each sample
+		std::vector< std::vector<float> > m_kernel_rows;
+		std::deque<int>                   m_cached_rows; // In the order they were cached
+		size_t                            m_cache_bytes = 0, m_cache_limit = 256 * 1024 * 1024;
+		std::vector<float>                m_row_buffer;
+		int                               m_number_of_threads = 1;
+
+		double kernel(const float* a, const float* b, int featuresCount) const;
+
+		/** Computes kernel(sample i, every sample) */
+		void computeKernelRow(int i, std::vector<float>& row) const;
+
+		/** Row i of the kernel matrix (from the cache if possible) */
+		const float* kernelRow(int i);
+
+		void cacheRow(int i, std::vector<float>& row);
+
+		/** Computes (in parallel) the rows that are not cached */
+		void prepareKernelRows(const std::vector<int>& rows);
+
+		/**
+		Fills the kernel cache with the rows of the previous training, for the samples (and the columns) that didn't change
+		@param oldRows the kernel rows of the previous training
+		@param oldIndex index of each sample in the previous training if its features didn't change, -1 otherwise
+		*/
+		void translateKernelCache(std::vector< std::vector<float> >& oldRows, const std::vector<int>& oldIndex);
+
+		/**
+		Solves the subproblem of a pair of classes
+		@param indices the samples of the pair
+		@param y +1 for the first class, -1 for the second
+		@param upperBound C for each sample
+		@param alpha input the starting point (must be feasible), output the solution
+		@param rho output
+		*/
+		int solve(const std::vector<int>& indices, const std::vector<signed char>& y, const std::vector<double>& upperBound,
+			std::vector<double>& alpha, double& rho, double eps, int maxIterations);
+
+		/** Builds the cv::ml::SVM of the solution (through its serialized form) */
+		cv::Ptr<cv::ml::SVM> buildModel(const std::vector<int>& classLabels, const std::vector< std::vector<double> >& pairAlpha,
+			const std::vector<double>& pairRho, double C, const cv::Mat& classWeights, cv::TermCriteria termCriteria) const;
+	};
+}
+
+#endif // !H_CBICA_SVM_SUITE_WARM_START
@@ -1,5 +1,7 @@
 #include "UtilGTS.h"
 
+#include <algorithm>
+
 std::string GeodesicTrainingSegmentation::UtilGTS::currentDateTime()
 {
 	// Get current time
@@ -15,4 +17,70 @@ std::string GeodesicTrainingSegmentation::UtilGTS::currentDateTime()
 	std::string dateTime(buf);
 
 	return dateTime;
-}
\ No newline at end of file
+}
+
+GeodesicTrainingSegmentation::UtilGTS::TaskPool::TaskPool(int numberOfThreads)
+{
+	if (numberOfThreads <= 0) {
+		numberOfThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+	for (int i = 0; i < numberOfThreads; i++) {
+		m_workers.push_back(std::thread(&TaskPool::workerLoop, this));
+	}
+}
+
+GeodesicTrainingSegmentation::UtilGTS::TaskPool::~TaskPool()
+{
+	Wait();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_task_available.notify_all();
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+}
+
+void GeodesicTrainingSegmentation::UtilGTS::TaskPool::Submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(std::move(task));
+	}
+	m_task_available.notify_one();
+}
+
+void GeodesicTrainingSegmentation::UtilGTS::TaskPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_all_done.wait(lock, [this]() { return m_tasks.empty() && m_running == 0; });
+}
+
+void GeodesicTrainingSegmentation::UtilGTS::TaskPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_task_available.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+			if (m_tasks.empty()) {
+				return; // Stopping
+			}
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+			m_running++;
+		}
+
+		task();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_running--;
+			if (m_tasks.empty() && m_running == 0) {
+				m_all_done.notify_all();
+			}
+		}
+	}
+}
@@ -3,7 +3,13 @@
 
 #include <ctime>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace GeodesicTrainingSegmentation 
 {
@@ -14,6 +20,48 @@ namespace GeodesicTrainingSegmentation
 		@return current date and time as %Y-%m-%d %H.%M.%S
 		*/
 		std::string currentDateTime();
+
+		/**
+		Fixed number of worker threads that run submitted tasks in submission order
+		*/
+		class TaskPool
+		{
+		public:
+			/**
+			Starts the workers
+			@param numberOfThreads how many workers (0 is the hardware concurrency)
+			*/
+			explicit TaskPool(int numberOfThreads = 0);
+
+			/**
+			Waits for the submitted tasks and stops the workers
+			*/
+			virtual ~TaskPool();
+
+			/**
+			Queues a task, it runs as soon as a worker is free
+			*/
+			void Submit(std::function<void()> task);
+
+			/**
+			Blocks until all the submitted tasks are finished
+			*/
+			void Wait();
+
+			int GetNumberOfThreads() const {
+				return static_cast<int>(m_workers.size());
+			}
+
+		private:
+			std::vector<std::thread>            m_workers;
+			std::deque< std::function<void()> > m_tasks;
+			std::mutex                          m_mutex;
+			std::condition_variable             m_task_available, m_all_done;
+			size_t                              m_running = 0;
+			bool                                m_stopping = false;
+
+			void workerLoop();
+		};
 	}
 
 }
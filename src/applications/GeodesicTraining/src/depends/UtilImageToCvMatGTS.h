@@ -14,10 +14,17 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <thread>
 #include <vector>
 #include <map>
 #include <unordered_map>
 
+#include "UtilGTS.h"
+#include "UtilSamplingGTS.h"
+
 namespace GeodesicTrainingSegmentation 
 {
 	namespace ParserGTS
@@ -31,6 +38,7 @@ namespace GeodesicTrainingSegmentation
 			cv::Mat testingMat;
 			cv::Mat skipZerosMat;
 			std::set<LabelsPixelType> differentLabels;
+			std::vector<size_t> trainingRows; // Row of testingMat (voxel index) of each row of trainingMat
 		} Result;
 
 		template <class TImageType>
@@ -108,202 +116,250 @@ namespace GeodesicTrainingSegmentation
 			return labelsCountMap;
 		}
 
+		/**
+		Builds the feature matrices of Result directly from the raw buffers of the input images
+		(one row per voxel in buffer order, one column per image).
+		The testing matrix is gathered in parallel by slab, and if the builder is resident
+		it is kept between builds: only the columns whose image changed are gathered again,
+		so consecutive SVM/RF executions on the same images only rebuild the training rows.
+		Images modified in place through their buffer should call Modified() to be gathered again.
+		The testingMat and skipZerosMat of the results share the same data and should be treated as read-only.
+		*/
 		template <typename TPixelType, unsigned int TDimensions>
-		std::shared_ptr<Result> Parse(const std::vector< typename itk::Image<TPixelType, TDimensions>::Pointer > &input_images,
-			const typename itk::Image<LabelsPixelType, TDimensions>::Pointer &input_labels, bool considerZeros = false)
+		class FeatureMatrixBuilder
 		{
+		public:
 			typedef itk::Image<TPixelType, TDimensions>                        InputImageType;
 			typedef typename itk::Image<TPixelType, TDimensions>::Pointer      InputImagePointer;
 			typedef itk::Image<LabelsPixelType, TDimensions>                   LabelsImageType;
 			typedef typename LabelsImageType::Pointer                          LabelsImagePointer;
 
-			std::shared_ptr<Result> res(new Result());
-
-			// Initialize the labels iterator
-			itk::ImageRegionIteratorWithIndex<LabelsImageType> iter_labels(input_labels, input_labels->GetRequestedRegion());
-
-			// Get number of pixels of the images
-			int numberOfPixels = getNumberOfPixels<InputImageType>(input_images[0]);
-
-			// Number of voxels in the labels image that are not zero (and are usable labels)
-			int labelsNumber = getNumberOfNotZerosFromLabels<TPixelType, TDimensions>(input_labels, input_images[0], considerZeros);
-
-			// Initialize result
-			res->testingMat   = cv::Mat::zeros(numberOfPixels, input_images.size(), CV_32F);
-			res->skipZerosMat = cv::Mat::zeros(numberOfPixels, input_images.size(), CV_32F);
-			res->trainingMat  = cv::Mat::zeros(labelsNumber, input_images.size(), CV_32F);
-			res->labelsMat    = cv::Mat::zeros(labelsNumber, 1, CV_32S);
-
-			// If there is a label for this voxel (use 1,2,... for labels, not zero)
-			cv::Mat features = cv::Mat::zeros(1, input_images.size(), CV_32F);
-			std::unordered_map< LabelsPixelType, int > weightSums;
-			unsigned long allWeightsSum = 0;
-
-			float val;
-			LabelsPixelType label;
-			bool isInputInt = (typeid(TPixelType).name() == typeid(int).name()) ? true : false;
-			int inputImagesSize = input_images.size();
-			bool skipPixel;
-			int row_i = 0, row_testing_i = 0;
-			size_t fi;
-
-			for (iter_labels.GoToBegin(); !iter_labels.IsAtEnd(); ++iter_labels)
-			{
-				skipPixel = false;
+			explicit FeatureMatrixBuilder() {}
 
-				// Set the values of the feature vector
-				for (fi = 0; fi < inputImagesSize; fi++) {
-					val = input_images[fi]->GetPixel(iter_labels.GetIndex());
+			virtual ~FeatureMatrixBuilder() {}
 
-					// Only the first image is used to skip zeros
-					if ((fi == 0) && (val == 0) && (!considerZeros)) {
-						skipPixel = true;
-						break;
-					}
+			/** Number of threads for gathering (0 is the hardware concurrency) */
+			void SetNumberOfThreads(int numberOfThreads) {
+				m_number_of_threads = std::max(0, numberOfThreads);
+			}
 
-					features.ptr< TPixelType >(0)[fi] = (isInputInt) ? std::lround(val) : val;
+			/** Keep the testing matrix between builds */
+			void SetResident(bool resident) {
+				m_resident = resident;
+				if (!resident) {
+					Clear();
 				}
+			}
 
-				// Populate matrices
-				if (!skipPixel || considerZeros) {
-					features.copyTo(res->testingMat.row(row_i++));
+			/**
+			Draw the training samples with a sampler instead of using all the labeled voxels
+			(the weights are still computed from all of them). nullptr uses all.
+			*/
+			void SetSampler(std::shared_ptr<SamplingGTS::StratifiedSampler> sampler) {
+				m_sampler = sampler;
+			}
 
-					label = iter_labels.Get();
-					if (label != 0) {
-						// Set training and labels data
+			/** Releases the resident matrix */
+			void Clear() {
+				m_testing_mat.release();
+				m_sources.clear();
+			}
 
-						res->labelsMat.ptr< LabelsPixelType >(row_testing_i)[0] = label;
-						res->differentLabels.insert(label);
+			/**
+			Builds the matrices
+			@param input_images the feature images (all the same size)
+			@param input_labels the labels image, voxels with non zero labels become training samples
+			@param considerZeros if false the voxels where the first image is zero are all zeros and not used for training
+			*/
+			std::shared_ptr<Result> Build(const std::vector< InputImagePointer > &input_images,
+				const LabelsImagePointer &input_labels, bool considerZeros = false)
+			{
+				std::shared_ptr<Result> res(new Result());
 
-						features.copyTo(res->trainingMat.row(row_testing_i++));
+				const size_t numberOfPixels = input_images[0]->GetLargestPossibleRegion().GetNumberOfPixels();
+				const int    columns = static_cast<int>(input_images.size());
 
-						// For weights calculation
-						if (weightSums.find(label) == weightSums.end()) {
-							weightSums[label] = 1;
-						}
-						else {
-							weightSums[label] += 1;
-						}
-						allWeightsSum++;
+				// Columns that need gathering
+				std::vector<ColumnSource> sources(columns);
+				for (int fi = 0; fi < columns; fi++) {
+					sources[fi] = { input_images[fi].GetPointer(), input_images[fi]->GetBufferPointer(), input_images[fi]->GetMTime() };
+				}
+
+				std::vector<int> columnsToGather;
+				if (!m_resident || m_testing_mat.rows != static_cast<int>(numberOfPixels) || m_testing_mat.cols != columns ||
+					m_considered_zeros != considerZeros || m_sources.empty() || !(m_sources[0] == sources[0]))
+				{
+					// Everything (the first image decides which rows are skipped)
+					m_testing_mat.create(static_cast<int>(numberOfPixels), columns, CV_32F);
+					for (int fi = 0; fi < columns; fi++) {
+						columnsToGather.push_back(fi);
 					}
 				}
 				else {
-					row_i++;
+					for (int fi = 1; fi < columns; fi++) {
+						if (!(m_sources[fi] == sources[fi])) {
+							columnsToGather.push_back(fi);
+						}
+					}
 				}
-			}
+				m_sources = sources;
+				m_considered_zeros = considerZeros;
 
-			// Extra for weights
-			res->weightsMat = cv::Mat::zeros(res->differentLabels.size(), 1, CV_32F);
+				gather(sources, columnsToGather, considerZeros);
 
-			int wi = 0;
-			for (LabelsPixelType label : res->differentLabels)
-			{
-				if (allWeightsSum != 0) {
-					res->weightsMat.at< float >(wi++, 0) = static_cast<float>(allWeightsSum - weightSums[label]) / allWeightsSum;
+				res->testingMat   = m_testing_mat;
+				res->skipZerosMat = m_testing_mat; // Only the first column is used
+				if (!m_resident) {
+					Clear();
 				}
-			}
 
-			res->testingMat.copyTo(res->skipZerosMat);
+				buildTrainingMats(res, input_labels, considerZeros);
 
-			return res;
-		}
+				return res;
+			}
 
-		template <typename TPixelType, unsigned int TDimensions>
-		std::shared_ptr<Result> NormalizedParse(const std::vector< typename itk::Image<TPixelType, TDimensions>::Pointer > &input_images,
-			const typename itk::Image<LabelsPixelType, TDimensions>::Pointer &input_labels, bool considerZeros = false)
-		{
-			typedef itk::Image<TPixelType, TDimensions>                        InputImageType;
-			typedef typename itk::Image<TPixelType, TDimensions>::Pointer      InputImagePointer;
-			typedef itk::Image<LabelsPixelType, TDimensions>                   LabelsImageType;
-			typedef typename LabelsImageType::Pointer                          LabelsImagePointer;
+		private:
+			typedef struct ColumnSource {
+				const void*           image;
+				const TPixelType*     buffer;
+				itk::ModifiedTimeType mtime;
 
-			std::shared_ptr<Result> res(new Result());
+				bool operator==(const ColumnSource& other) const {
+					return image == other.image && buffer == other.buffer && mtime == other.mtime;
+				}
+			} ColumnSource;
 
-			// Initialize the labels iterator
-			itk::ImageRegionIteratorWithIndex<LabelsImageType> iter_labels(input_labels, input_labels->GetRequestedRegion());
+			cv::Mat                   m_testing_mat;
+			std::vector<ColumnSource> m_sources;
+			int                       m_number_of_threads = 0;
+			bool                      m_resident = false, m_considered_zeros = false;
+			std::shared_ptr<SamplingGTS::StratifiedSampler> m_sampler;
 
-			// Get number of pixels of the images
-			int numberOfPixels = getNumberOfPixels<InputImageType>(input_images[0]);
-
-			// Number of voxels in the labels image that are not zero (and are usable labels)
-			int labelsNumber = getNumberOfNotZerosFromLabels<TPixelType, TDimensions>(input_labels, input_images[0], considerZeros);
-
-			// Initialize result
-			res->testingMat   = cv::Mat::zeros(numberOfPixels, input_images.size(), CV_32F);
-			res->skipZerosMat = cv::Mat::zeros(numberOfPixels, input_images.size(), CV_32F);
-			res->trainingMat  = cv::Mat::zeros(labelsNumber, input_images.size(), CV_32F);
-			res->labelsMat    = cv::Mat::zeros(labelsNumber, 1, CV_32S);
-
-			// If there is a label for this voxel (use 1,2,... for labels, not zero)
-			cv::Mat features = cv::Mat::zeros(1, input_images.size(), CV_32F);
-			std::unordered_map< LabelsPixelType, int > weightSums;
-			unsigned long allWeightsSum = 0;
-
-			float val;
-			LabelsPixelType label;
-			bool isInputInt = (typeid(TPixelType).name() == typeid(int).name()) ? true : false;
-			int inputImagesSize = input_images.size();
-			bool skipPixel;
-			int row_i = 0, row_testing_i = 0;
-			size_t fi;
-
-			for (iter_labels.GoToBegin(); !iter_labels.IsAtEnd(); ++iter_labels)
+			/** Gathers the given columns of m_testing_mat, in parallel by slab */
+			void gather(const std::vector<ColumnSource>& sources, const std::vector<int>& columnsToGather, bool considerZeros)
 			{
-				skipPixel = false;
+				if (columnsToGather.empty()) {
+					return;
+				}
 
-				// Set the values of the feature vector
-				for (fi = 0; fi < inputImagesSize; fi++) {
-					val = input_images[fi]->GetPixel(iter_labels.GetIndex());
+				const size_t rows = m_testing_mat.rows, columns = m_testing_mat.cols;
+				const TPixelType* first = sources[0].buffer;
+				float* mat = m_testing_mat.ptr<float>(0);
 
-					// Only the first image is used to skip zeros
-					if ((fi == 0) && (val == 0) && (!considerZeros)) {
-						skipPixel = true;
-						break;
+				auto gatherSlab = [&](size_t rowStart, size_t rowEnd)
+				{
+					for (size_t r = rowStart; r < rowEnd; r++)
+					{
+						float* row = mat + r * columns;
+						if (!considerZeros && first[r] == 0) {
+							// Skipped voxels are all zeros
+							for (int fi : columnsToGather) {
+								row[fi] = 0;
+							}
+							continue;
+						}
+						for (int fi : columnsToGather) {
+							row[fi] = static_cast<float>(sources[fi].buffer[r]);
+						}
 					}
+				};
+
+				int numberOfThreads = (m_number_of_threads > 0) ? m_number_of_threads : static_cast<int>(std::thread::hardware_concurrency());
+				numberOfThreads = std::max(1, std::min(numberOfThreads, static_cast<int>(rows / 65536) + 1));
 
-					features.ptr< TPixelType >(0)[fi] = (isInputInt) ? std::lround(val) : val;
+				if (numberOfThreads == 1) {
+					gatherSlab(0, rows);
+					return;
 				}
 
-				// Populate matrices
-				if (!skipPixel || considerZeros) {
-					features.copyTo(res->testingMat.row(row_i++));
+				// A few slabs per thread, so that uneven slabs (mostly skipped voxels) balance out
+				const size_t numberOfSlabs = static_cast<size_t>(numberOfThreads) * 4;
+				const size_t slabRows = (rows + numberOfSlabs - 1) / numberOfSlabs;
 
-					label = iter_labels.Get();
-					if (label != 0) {
-						// Set training and labels data
+				UtilGTS::TaskPool pool(numberOfThreads);
+				for (size_t rowStart = 0; rowStart < rows; rowStart += slabRows) {
+					const size_t rowEnd = std::min(rows, rowStart + slabRows);
+					pool.Submit([&gatherSlab, rowStart, rowEnd]() {
+						gatherSlab(rowStart, rowEnd);
+					});
+				}
+				pool.Wait();
+			}
 
-						res->labelsMat.ptr< LabelsPixelType >(row_testing_i)[0] = label;
-						res->differentLabels.insert(label);
+			/** Copies the labeled rows of the testing matrix to the training matrix, and computes the labels and weights */
+			void buildTrainingMats(std::shared_ptr<Result>& res, const LabelsImagePointer &input_labels, bool considerZeros)
+			{
+				const size_t numberOfPixels = res->testingMat.rows, columns = res->testingMat.cols;
+				const LabelsPixelType* labels = input_labels->GetBufferPointer();
+				const float* testing = res->testingMat.ptr<float>(0);
 
-						features.copyTo(res->trainingMat.row(row_testing_i++));
+				// Voxels in the labels image that are not zero (and are usable labels)
+				std::vector<size_t> labeledRows;
+				std::unordered_map< LabelsPixelType, int > weightSums;
+				unsigned long allWeightsSum = 0;
 
-						// For weights calculation
-						if (weightSums.find(label) == weightSums.end()) {
-							weightSums[label] = 1;
-						}
-						else {
-							weightSums[label] += 1;
+				if (m_sampler)
+				{
+					labeledRows = m_sampler->Sample(labels, numberOfPixels, (considerZeros) ? nullptr : testing, columns);
+					for (size_t r : labeledRows) {
+						res->differentLabels.insert(labels[r]);
+					}
+					for (const auto& labelCount : m_sampler->GetLabelCounts()) {
+						weightSums[labelCount.first] = static_cast<int>(labelCount.second);
+						allWeightsSum += labelCount.second;
+					}
+				}
+				else
+				{
+					for (size_t r = 0; r < numberOfPixels; r++) {
+						if (labels[r] != 0 && (considerZeros || testing[r * columns] != 0)) {
+							labeledRows.push_back(r);
 						}
-						allWeightsSum++;
 					}
+					for (size_t r : labeledRows) {
+						res->differentLabels.insert(labels[r]);
+						weightSums[labels[r]] += 1;
+					}
+					allWeightsSum = labeledRows.size();
 				}
-				else {
-					row_i++;
+
+				res->trainingMat  = cv::Mat(static_cast<int>(labeledRows.size()), static_cast<int>(columns), CV_32F);
+				res->labelsMat    = cv::Mat(static_cast<int>(labeledRows.size()), 1, CV_32S);
+				res->trainingRows = labeledRows;
+
+				for (size_t i = 0; i < labeledRows.size(); i++)
+				{
+					std::copy(testing + labeledRows[i] * columns, testing + (labeledRows[i] + 1) * columns, res->trainingMat.ptr<float>(static_cast<int>(i)));
+					res->labelsMat.ptr< LabelsPixelType >(static_cast<int>(i))[0] = labels[labeledRows[i]];
 				}
-			}
 
-			// Extra for weights
-			res->weightsMat = cv::Mat::zeros(res->differentLabels.size(), 1, CV_32F);
+				// Extra for weights
+				res->weightsMat = cv::Mat::zeros(res->differentLabels.size(), 1, CV_32F);
 
-			int wi = 0;
-			for (LabelsPixelType label : res->differentLabels)
-			{
-				if (allWeightsSum != 0) {
-					res->weightsMat.at< float >(wi++, 0) = static_cast<float>(allWeightsSum - weightSums[label]) / allWeightsSum;
+				int wi = 0;
+				for (LabelsPixelType label : res->differentLabels)
+				{
+					if (allWeightsSum != 0) {
+						res->weightsMat.at< float >(wi++, 0) = static_cast<float>(allWeightsSum - weightSums[label]) / allWeightsSum;
+					}
 				}
 			}
+		};
 
-			res->testingMat.copyTo(res->skipZerosMat);
+		template <typename TPixelType, unsigned int TDimensions>
+		std::shared_ptr<Result> Parse(const std::vector< typename itk::Image<TPixelType, TDimensions>::Pointer > &input_images,
+			const typename itk::Image<LabelsPixelType, TDimensions>::Pointer &input_labels, bool considerZeros = false)
+		{
+			FeatureMatrixBuilder<TPixelType, TDimensions> builder;
+			return builder.Build(input_images, input_labels, considerZeros);
+		}
+
+		template <typename TPixelType, unsigned int TDimensions>
+		std::shared_ptr<Result> NormalizedParse(const std::vector< typename itk::Image<TPixelType, TDimensions>::Pointer > &input_images,
+			const typename itk::Image<LabelsPixelType, TDimensions>::Pointer &input_labels, bool considerZeros = false)
+		{
+			std::shared_ptr<Result> res = Parse<TPixelType, TDimensions>(input_images, input_labels, considerZeros);
+			res->skipZerosMat = res->testingMat.clone(); // testingMat is normalized in place below
 
 			// Normalization
 
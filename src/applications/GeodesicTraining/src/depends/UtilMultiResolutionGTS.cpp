@@ -0,0 +1,182 @@
+#include "UtilMultiResolutionGTS.h"
+
+#include <map>
+
+void GeodesicTrainingSegmentation::MultiResolutionGTS::CoarseSize(const int size[3], int factor, int coarseSize[3])
+{
+	for (int d = 0; d < 3; d++) {
+		coarseSize[d] = (size[d] + factor - 1) / factor;
+	}
+}
+
+void GeodesicTrainingSegmentation::MultiResolutionGTS::DownsampleLabels(const LabelsPixelType* labels, const int size[3], int factor,
+	LabelsPixelType* coarseLabels)
+{
+	int coarseSize[3];
+	CoarseSize(size, factor, coarseSize);
+
+	std::map<LabelsPixelType, int> counts;
+
+	size_t coarseIndex = 0;
+	for (int cz = 0; cz < coarseSize[2]; cz++) {
+		for (int cy = 0; cy < coarseSize[1]; cy++) {
+			for (int cx = 0; cx < coarseSize[0]; cx++, coarseIndex++)
+			{
+				counts.clear();
+
+				for (int z = cz * factor; z < std::min(size[2], (cz + 1) * factor); z++) {
+					for (int y = cy * factor; y < std::min(size[1], (cy + 1) * factor); y++) {
+						const size_t rowStart = (static_cast<size_t>(z) * size[1] + y) * size[0];
+						for (int x = cx * factor; x < std::min(size[0], (cx + 1) * factor); x++) {
+							if (labels[rowStart + x] != 0) {
+								counts[labels[rowStart + x]]++;
+							}
+						}
+					}
+				}
+
+				// The map is ordered, so ties keep the smallest label
+				LabelsPixelType best = 0;
+				int bestCount = 0;
+				for (const auto& labelCount : counts) {
+					if (labelCount.second > bestCount) {
+						best = labelCount.first;
+						bestCount = labelCount.second;
+					}
+				}
+				coarseLabels[coarseIndex] = best;
+			}
+		}
+	}
+}
+
+void GeodesicTrainingSegmentation::MultiResolutionGTS::UpsampleLabels(const LabelsPixelType* coarseLabels, const int size[3], int factor,
+	LabelsPixelType* labels)
+{
+	int coarseSize[3];
+	CoarseSize(size, factor, coarseSize);
+
+	size_t index = 0;
+	for (int z = 0; z < size[2]; z++) {
+		for (int y = 0; y < size[1]; y++)
+		{
+			const LabelsPixelType* coarseRow = coarseLabels + (static_cast<size_t>(z / factor) * coarseSize[1] + y / factor) * coarseSize[0];
+			for (int x = 0; x < size[0]; x++, index++) {
+				labels[index] = coarseRow[x / factor];
+			}
+		}
+	}
+}
+
+size_t GeodesicTrainingSegmentation::MultiResolutionGTS::BoundaryBand(const LabelsPixelType* labels, const int size[3], int radius,
+	unsigned char* band)
+{
+	const size_t strides[3] = { 1, static_cast<size_t>(size[0]), static_cast<size_t>(size[0]) * size[1] };
+
+	// Voxels on a boundary (compared with the next voxel of each axis, both sides are marked)
+	const size_t voxelsCount = strides[2] * size[2];
+	std::fill(band, band + voxelsCount, 0);
+
+	size_t index = 0;
+	for (int z = 0; z < size[2]; z++) {
+		for (int y = 0; y < size[1]; y++) {
+			for (int x = 0; x < size[0]; x++, index++)
+			{
+				const LabelsPixelType label = labels[index];
+				if (label == 0) {
+					continue;
+				}
+
+				const int position[3] = { x, y, z };
+				for (int d = 0; d < 3; d++)
+				{
+					if (position[d] + 1 >= size[d]) {
+						continue;
+					}
+					const LabelsPixelType next = labels[index + strides[d]];
+					if (next != 0 && next != label) {
+						band[index] = 1;
+						band[index + strides[d]] = 1;
+					}
+				}
+			}
+		}
+	}
+
+	DilateMask(band, size, radius);
+
+	return static_cast<size_t>(std::count(band, band + voxelsCount, static_cast<unsigned char>(1)));
+}
+
+void GeodesicTrainingSegmentation::MultiResolutionGTS::DilateMask(unsigned char* mask, const int size[3], int radius)
+{
+	if (radius <= 0) {
+		return;
+	}
+
+	const size_t strides[3] = { 1, static_cast<size_t>(size[0]), static_cast<size_t>(size[0]) * size[1] };
+
+	std::vector<unsigned char> line;
+	std::vector<int>           prefix; // Number of set voxels before each position of the line
+
+	for (int d = 0; d < 3; d++)
+	{
+		if (size[d] == 1) {
+			continue;
+		}
+
+		const int length = size[d];
+		line.resize(length);
+		prefix.resize(length + 1);
+
+		// Every line along axis d starts at a voxel whose index in d is 0
+		const int other1 = (d == 0) ? 1 : 0, other2 = (d == 2) ? 1 : 2;
+		for (int b = 0; b < size[other2]; b++) {
+			for (int a = 0; a < size[other1]; a++)
+			{
+				unsigned char* start = mask + a * strides[other1] + b * strides[other2];
+
+				prefix[0] = 0;
+				for (int i = 0; i < length; i++) {
+					line[i] = start[i * strides[d]];
+					prefix[i + 1] = prefix[i] + (line[i] != 0);
+				}
+				if (prefix[length] == 0) {
+					continue;
+				}
+
+				for (int i = 0; i < length; i++) {
+					const int from = std::max(0, i - radius), to = std::min(length, i + radius + 1);
+					start[i * strides[d]] = (prefix[to] - prefix[from] > 0) ? 1 : 0;
+				}
+			}
+		}
+	}
+}
+
+bool GeodesicTrainingSegmentation::MultiResolutionGTS::BoundingBox(const unsigned char* mask, const int size[3], int start[3], int end[3])
+{
+	for (int d = 0; d < 3; d++) {
+		start[d] = size[d];
+		end[d]   = 0;
+	}
+
+	size_t index = 0;
+	for (int z = 0; z < size[2]; z++) {
+		for (int y = 0; y < size[1]; y++) {
+			for (int x = 0; x < size[0]; x++, index++)
+			{
+				if (mask[index] == 0) {
+					continue;
+				}
+				const int position[3] = { x, y, z };
+				for (int d = 0; d < 3; d++) {
+					start[d] = std::min(start[d], position[d]);
+					end[d]   = std::max(end[d], position[d] + 1);
+				}
+			}
+		}
+	}
+
+	return end[0] > start[0];
+}
@@ -0,0 +1,103 @@
+#ifndef H_CBICA_UTIL_MULTI_RESOLUTION_GTS
+#define H_CBICA_UTIL_MULTI_RESOLUTION_GTS
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace GeodesicTrainingSegmentation
+{
+	/**
+	Raw buffer operations for the coarse to fine mode (see Coordinator::SetCoarseToFine).
+	The buffers are in ITK order (x fastest, then y, then z), size is { x, y, z } (z is 1 for 2D images).
+	The coarse grid has one voxel per factor x factor x factor block of the full resolution grid.
+	*/
+	namespace MultiResolutionGTS
+	{
+		typedef int LabelsPixelType;
+
+		/** Size of the coarse grid (the last block of each axis can be partial) */
+		void CoarseSize(const int size[3], int factor, int coarseSize[3]);
+
+		/**
+		Downsamples images by averaging each block. The first image decides which voxels are skipped (zero):
+		only the voxels where it is not zero are averaged, and blocks without any are zero in every output.
+		@param inputs the full resolution buffers (all the same size)
+		@param size size of the inputs
+		@param outputs one buffer per input, the size of the coarse grid
+		*/
+		template<typename TPixelType>
+		void DownsampleImages(const std::vector<const TPixelType*>& inputs, const int size[3], int factor,
+			const std::vector<TPixelType*>& outputs)
+		{
+			int coarseSize[3];
+			CoarseSize(size, factor, coarseSize);
+
+			std::vector<double> sums(inputs.size());
+
+			size_t coarseIndex = 0;
+			for (int cz = 0; cz < coarseSize[2]; cz++) {
+				for (int cy = 0; cy < coarseSize[1]; cy++) {
+					for (int cx = 0; cx < coarseSize[0]; cx++, coarseIndex++)
+					{
+						std::fill(sums.begin(), sums.end(), 0.0);
+						size_t count = 0;
+
+						for (int z = cz * factor; z < std::min(size[2], (cz + 1) * factor); z++) {
+							for (int y = cy * factor; y < std::min(size[1], (cy + 1) * factor); y++) {
+								const size_t rowStart = (static_cast<size_t>(z) * size[1] + y) * size[0];
+								for (int x = cx * factor; x < std::min(size[0], (cx + 1) * factor); x++)
+								{
+									if (inputs[0][rowStart + x] == 0) {
+										continue;
+									}
+									for (size_t i = 0; i < inputs.size(); i++) {
+										sums[i] += inputs[i][rowStart + x];
+									}
+									count++;
+								}
+							}
+						}
+
+						for (size_t i = 0; i < inputs.size(); i++) {
+							outputs[i][coarseIndex] = (count == 0) ? 0 : static_cast<TPixelType>(sums[i] / count);
+						}
+						if (count != 0 && outputs[0][coarseIndex] == 0) {
+							outputs[0][coarseIndex] = 1; // Still not skipped (rounding of integer types)
+						}
+					}
+				}
+			}
+		}
+
+		/**
+		Downsamples a labels image: each coarse voxel gets the most frequent non zero label of its block
+		(the smallest one on ties), or zero if the block has no labels, so that thin scribbles survive
+		*/
+		void DownsampleLabels(const LabelsPixelType* labels, const int size[3], int factor, LabelsPixelType* coarseLabels);
+
+		/** Upsamples coarse labels (nearest neighbour) to the full resolution grid of the given size */
+		void UpsampleLabels(const LabelsPixelType* coarseLabels, const int size[3], int factor, LabelsPixelType* labels);
+
+		/**
+		Marks the voxels that are close to a boundary between two different non zero labels
+		(boundaries with label zero don't count)
+		@param band output, 1 for the voxels within radius (in every axis) of a voxel that has a face neighbour with a different label
+		@return the number of voxels in the band
+		*/
+		size_t BoundaryBand(const LabelsPixelType* labels, const int size[3], int radius, unsigned char* band);
+
+		/** Dilates a mask by a box of the given radius, in place (separable) */
+		void DilateMask(unsigned char* mask, const int size[3], int radius);
+
+		/**
+		The bounding box of the non zero voxels of a mask
+		@param start output, the first index of each axis
+		@param end output, one past the last index of each axis
+		@return false if the mask is empty
+		*/
+		bool BoundingBox(const unsigned char* mask, const int size[3], int start[3], int end[3]);
+	}
+}
+
+#endif // !H_CBICA_UTIL_MULTI_RESOLUTION_GTS
@@ -0,0 +1,83 @@
+#include "UtilSamplingGTS.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <queue>
+#include <utility>
+
+const std::vector<size_t>& GeodesicTrainingSegmentation::SamplingGTS::StratifiedSampler::Sample(
+	const LabelsPixelType* labels, size_t numberOfPixels, const float* firstColumn, size_t firstColumnStride)
+{
+	typedef std::pair<uint64_t, size_t> KeyedIndex; // (key, voxel index)
+	typedef std::priority_queue<KeyedIndex> Reservoir; // the largest key on top
+
+	// Single pass: each stratum keeps (at most) the m_max_samples voxels with the smallest keys
+	std::map<LabelsPixelType, Reservoir> reservoirs;
+	std::vector<size_t> sampleIndices;
+	m_label_counts.clear();
+
+	for (size_t i = 0; i < numberOfPixels; i++)
+	{
+		const LabelsPixelType label = labels[i];
+		if (label == 0 || (firstColumn && firstColumn[i * firstColumnStride] == 0)) {
+			continue;
+		}
+		m_label_counts[label]++;
+
+		if (m_max_samples == 0) {
+			sampleIndices.push_back(i); // Unlimited
+			continue;
+		}
+		Reservoir& reservoir = reservoirs[m_balanced ? label : 0];
+		const uint64_t k = key(i);
+		if (reservoir.size() < m_max_samples) {
+			reservoir.push(KeyedIndex(k, i));
+		}
+		else if (k < reservoir.top().first) {
+			reservoir.pop();
+			reservoir.push(KeyedIndex(k, i));
+		}
+	}
+
+	// Quotas (proportional to the label counts, at least one per label)
+	size_t totalCount = 0;
+	for (const auto& labelCount : m_label_counts) {
+		totalCount += labelCount.second;
+	}
+
+	for (auto& stratum : reservoirs)
+	{
+		Reservoir& reservoir = stratum.second;
+		size_t quota = m_max_samples;
+		if (m_balanced && totalCount > m_max_samples) {
+			quota = std::max<size_t>(1, static_cast<size_t>(std::lround(
+				static_cast<double>(m_max_samples) * m_label_counts[stratum.first] / totalCount)));
+		}
+		while (reservoir.size() > quota) {
+			reservoir.pop();
+		}
+		while (!reservoir.empty()) {
+			sampleIndices.push_back(reservoir.top().second);
+			reservoir.pop();
+		}
+	}
+	std::sort(sampleIndices.begin(), sampleIndices.end());
+
+	// Stability statistic
+	std::vector<size_t> kept;
+	std::set_intersection(sampleIndices.begin(), sampleIndices.end(),
+		m_sample_indices.begin(), m_sample_indices.end(), std::back_inserter(kept));
+	m_kept_samples = kept.size();
+
+	m_sample_indices.swap(sampleIndices);
+	return m_sample_indices;
+}
+
+uint64_t GeodesicTrainingSegmentation::SamplingGTS::StratifiedSampler::key(size_t index) const
+{
+	uint64_t z = static_cast<uint64_t>(index) + m_seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
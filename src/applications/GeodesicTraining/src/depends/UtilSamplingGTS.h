@@ -0,0 +1,95 @@
+#ifndef H_CBICA_UTIL_SAMPLING_GTS
+#define H_CBICA_UTIL_SAMPLING_GTS
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <vector>
+
+namespace GeodesicTrainingSegmentation
+{
+	namespace SamplingGTS
+	{
+		typedef int LabelsPixelType;
+
+		/**
+		Draws a limited number of training samples from a labels image in a single pass.
+		Every voxel gets a fixed pseudo-random key (a hash of its index), and each stratum keeps the voxels
+		with the smallest keys (bottom-k reservoir sampling). This is a uniform sample without replacement,
+		and since the keys don't change between calls, the sample is stable: when scribbles are added,
+		the samples drawn before are kept and the new voxels only replace the ones their keys displace
+		(how many depends on how much the scribbles grew), so consecutive trainings see mostly the same samples.
+		*/
+		class StratifiedSampler
+		{
+		public:
+			explicit StratifiedSampler() {}
+
+			virtual ~StratifiedSampler() {}
+
+			/** Maximum number of samples to draw (0 or less keeps every candidate) */
+			void SetMaxSamples(int maxSamples) {
+				m_max_samples = (maxSamples > 0) ? static_cast<size_t>(maxSamples) : 0;
+			}
+
+			/**
+			If balanced, each label is a stratum and gets samples proportional to its number of voxels (at least one).
+			Otherwise the samples are drawn uniformly from all the labeled voxels.
+			*/
+			void SetBalanced(bool balanced) {
+				m_balanced = balanced;
+			}
+
+			/** Changes which samples are drawn (and clears the previous sample) */
+			void SetSeed(uint64_t seed) {
+				m_seed = seed;
+				Clear();
+			}
+
+			/** Forgets the previous sample */
+			void Clear() {
+				m_sample_indices.clear();
+				m_kept_samples = 0;
+			}
+
+			/**
+			Draws the samples
+			@param labels the labels buffer, voxels with non zero labels are candidates
+			@param numberOfPixels size of the labels buffer
+			@param firstColumn optional, voxels where it is zero are not candidates (the skipped voxels of the feature matrix)
+			@param firstColumnStride distance between consecutive values of firstColumn
+			@return the indices of the sampled voxels, in increasing order
+			*/
+			const std::vector<size_t>& Sample(const LabelsPixelType* labels, size_t numberOfPixels,
+				const float* firstColumn = nullptr, size_t firstColumnStride = 1);
+
+			/** Indices of the last sample, in increasing order */
+			const std::vector<size_t>& GetSampleIndices() const {
+				return m_sample_indices;
+			}
+
+			/** Number of candidate voxels for each label in the last call (before sampling) */
+			const std::map<LabelsPixelType, size_t>& GetLabelCounts() const {
+				return m_label_counts;
+			}
+
+			/** How many samples of the last call were also in the one before it */
+			size_t GetNumberOfKeptSamples() const {
+				return m_kept_samples;
+			}
+
+		private:
+			size_t   m_max_samples = 3000, m_kept_samples = 0;
+			bool     m_balanced = true;
+			uint64_t m_seed = 0x2545F4914F6CDD1DULL;
+
+			std::vector<size_t>               m_sample_indices;
+			std::map<LabelsPixelType, size_t> m_label_counts;
+
+			/** Key of a voxel (splitmix64 of its index) */
+			uint64_t key(size_t index) const;
+		};
+	}
+}
+
+#endif // !H_CBICA_UTIL_SAMPLING_GTS
@@ -28,16 +28,20 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 #include <iostream>
 #include <sstream>
 #include <cstdio>
+#include <cstdlib>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <cerrno>
+#include <cmath>
+#include <fstream>
 
 #include "lddmm_common.h"
 #include "lddmm_data.h"
 #include "GreedyAPI.h"
 
 #include <itkImageFileReader.h>
+#include <itkVectorImage.h>
 #include <itkAffineTransform.h>
 #include <itkTransformFactory.h>
 #include <itkTimeProbe.h>
@@ -67,8 +71,148 @@ public:
     GreedyApproach<VDim, TReal> greedy;
     return greedy.Run(param);
   }
+
+  static int RunBatch(GreedyParameters &param, const std::vector<BatchJobSpec> &jobs)
+  {
+    GreedyApproach<VDim, TReal> greedy;
+    return greedy.RunBatch(param, jobs);
+  }
 };
 
+// Run greedy with the floating point precision selected in the parameters
+void RunGreedy(GreedyParameters &param, unsigned int dim)
+{
+  if (param.flag_float_math)
+  {
+    switch (dim)
+    {
+    case 2: GreedyRunner<2, float>::Run(param); break;
+    case 3: GreedyRunner<3, float>::Run(param); break;
+    case 4: GreedyRunner<4, float>::Run(param); break;
+    default: throw GreedyException("--> Wrong number of dimensions requested: %d", dim);
+    }
+  }
+  else
+  {
+    switch (dim)
+    {
+    case 2: GreedyRunner<2, double>::Run(param); break;
+    case 3: GreedyRunner<3, double>::Run(param); break;
+    case 4: GreedyRunner<4, double>::Run(param); break;
+    default: throw GreedyException("--> Wrong number of dimensions requested: %d", dim);
+    }
+  }
+}
+
+// Run a batch of registrations to one fixed image, with the precision selected in the parameters.
+// Returns the number of failed registrations
+int RunGreedyBatch(GreedyParameters &param, const std::vector<BatchJobSpec> &jobs, unsigned int dim)
+{
+  if (param.flag_float_math)
+  {
+    switch (dim)
+    {
+    case 2: return GreedyRunner<2, float>::RunBatch(param, jobs);
+    case 3: return GreedyRunner<3, float>::RunBatch(param, jobs);
+    case 4: return GreedyRunner<4, float>::RunBatch(param, jobs);
+    default: throw GreedyException("--> Wrong number of dimensions requested: %d", dim);
+    }
+  }
+  else
+  {
+    switch (dim)
+    {
+    case 2: return GreedyRunner<2, double>::RunBatch(param, jobs);
+    case 3: return GreedyRunner<3, double>::RunBatch(param, jobs);
+    case 4: return GreedyRunner<4, double>::RunBatch(param, jobs);
+    default: throw GreedyException("--> Wrong number of dimensions requested: %d", dim);
+    }
+  }
+}
+
+// Largest difference between the entries of two RAS matrices written by greedy
+double CompareMatrixFiles(const std::string &file1, const std::string &file2, unsigned int dim)
+{
+  std::ifstream fin1(file1.c_str()), fin2(file2.c_str());
+  double maxDifference = 0.0;
+  for (unsigned int i = 0; i < (dim + 1) * (dim + 1); i++)
+  {
+    double value1, value2;
+    if (!(fin1 >> value1) || !(fin2 >> value2))
+    {
+      throw GreedyException("--> Unable to read the matrices '%s' and '%s'", file1.c_str(), file2.c_str());
+    }
+    maxDifference = std::max(maxDifference, std::abs(value1 - value2));
+  }
+  return maxDifference;
+}
+
+// Largest difference between the displacements of two warps written by greedy
+template <unsigned int VDim>
+double CompareWarpFiles(const std::string &file1, const std::string &file2)
+{
+  typedef itk::VectorImage<float, VDim> WarpType;
+  typedef itk::ImageFileReader<WarpType> ReaderType;
+  typename ReaderType::Pointer reader1 = ReaderType::New(), reader2 = ReaderType::New();
+  reader1->SetFileName(file1);
+  reader1->Update();
+  reader2->SetFileName(file2);
+  reader2->Update();
+  typename WarpType::Pointer warp1 = reader1->GetOutput(), warp2 = reader2->GetOutput();
+  if (warp1->GetBufferedRegion() != warp2->GetBufferedRegion()
+    || warp1->GetNumberOfComponentsPerPixel() != warp2->GetNumberOfComponentsPerPixel())
+  {
+    throw GreedyException("--> The warps '%s' and '%s' have different sizes", file1.c_str(), file2.c_str());
+  }
+
+  const float *buffer1 = warp1->GetBufferPointer(), *buffer2 = warp2->GetBufferPointer();
+  size_t n = warp1->GetBufferedRegion().GetNumberOfPixels() * warp1->GetNumberOfComponentsPerPixel();
+  double maxDifference = 0.0;
+  for (size_t i = 0; i < n; i++)
+  {
+    maxDifference = std::max(maxDifference, (double)std::abs(buffer1[i] - buffer2[i]));
+  }
+  return maxDifference;
+}
+
+// Register again in double precision and compare the matrices (or the warps in deformable mode),
+// false if they differ by more than the tolerance
+bool CheckFloatPrecision(const GreedyParameters &param, unsigned int dim, double tolerance, const std::string &tempFile)
+{
+  GreedyParameters paramDouble = param;
+  paramDouble.flag_float_math = false;
+  paramDouble.flag_float_mixed_precision = false;
+  paramDouble.output = tempFile;
+
+  std::cout << "--> Registering again in double precision for the precision check" << std::endl;
+  RunGreedy(paramDouble, dim);
+
+  double difference;
+  if (param.mode == GreedyParameters::GREEDY)
+  {
+    switch (dim)
+    {
+    case 2: difference = CompareWarpFiles<2>(param.output, paramDouble.output); break;
+    case 3: difference = CompareWarpFiles<3>(param.output, paramDouble.output); break;
+    case 4: difference = CompareWarpFiles<4>(param.output, paramDouble.output); break;
+    default: throw GreedyException("--> Wrong number of dimensions requested: %d", dim);
+    }
+  }
+  else
+  {
+    difference = CompareMatrixFiles(param.output, paramDouble.output, dim);
+  }
+  std::remove(paramDouble.output.c_str());
+
+  std::cout << "--> Largest difference from the double precision " << (param.mode == GreedyParameters::GREEDY ? "warp" : "matrix") << ": " << difference << std::endl;
+  if (difference > tolerance)
+  {
+    std::cerr << "--> Precision check failed, the tolerance is " << tolerance << std::endl;
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char** argv)
 {
   cbica::CmdParser parser(argc, argv, "GreedyRegistration");
@@ -83,16 +227,27 @@ int main(int argc, char** argv)
 
   parser.addOptionalParameter("a", "affine", cbica::Parameter::NONE, "N.A", "Affine Registration(Default)");
   parser.addOptionalParameter("r", "rigid", cbica::Parameter::NONE, "N.A", "Rigid Registration");
+  parser.addOptionalParameter("d", "deformable", cbica::Parameter::NONE, "N.A", "Deformable Registration", "The transformation (-t) is then a warp image, Eg: warp.nii.gz");
   parser.addOptionalParameter("m", "metrics", cbica::Parameter::STRING, "none", "MI: mutual information", "NMI(Default): normalized mutual information", "NCC -r 2x2x2: normalized cross-correlation");
   parser.addOptionalParameter("ri", "radius", cbica::Parameter::STRING, "none", "Patch radius for metrics", "Eg: 2x2x2");
+  parser.addOptionalParameter("ns", "nccStream", cbica::Parameter::NONE, "N.A", "Compute the NCC sums slice by slice instead of for the whole image", "Uses much less memory for NCC with several images");
 
   parser.addOptionalParameter("n", "greedyIterations", cbica::Parameter::STRING, "none", "Number of iterations per level of multi-res (Default: 100x50x5)", "Corresponds to low level, Mid Level and High Level resolution", "Pattern: NxNxN");
   parser.addOptionalParameter("th", "threads", cbica::Parameter::INTEGER, "none", "Number of threads for algorithm", "If not suppllied gets set to default 4");
+  parser.addOptionalParameter("p", "precision", cbica::Parameter::STRING, "none", "Floating point precision of the computation", "double (Default)", "float: images and warps in float, half the memory", "mixed: as float, but the NCC sums are accumulated in double");
+  parser.addOptionalParameter("pc", "precisionCheck", cbica::Parameter::FLOAT, "none", "With float or mixed precision, also register in double precision", "and fail if the two matrices differ by more than this value (in any entry)", "Deformable: if the two warps differ by more than this value (in mm, in any displacement)");
+  parser.addOptionalParameter("rs", "rigidSearch", cbica::Parameter::STRING, "N,angle,translation", "Try N random rigid transforms before the rigid/affine registration", "Standard deviations of the rotation angle (degrees) and of the translation (mm)", "Pattern: N,angle,translation, Eg: 1000,10,20");
+  parser.addOptionalParameter("rr", "rigidRefine", cbica::Parameter::INTEGER, "0-N", "Number of the best rigid search tries refined by the optimizer (Default: 3)", "0: the best try is used as is");
+  parser.addOptionalParameter("b", "batch", cbica::Parameter::INTEGER, "none", "Register all the moving images in one process, the fixed image is read once", "Value: number of images registered at the same time (0: one per thread)");
   //parser.exampleUsage("-reg -trf -i moving.nii.gz -f fixed.nii.gz -o output.nii.gz -t matrix.mat -a -m MI -n 100x50x5 -th 4");
 
-  parser.addApplicationDescription("This does affine registration based on Greedy");
+  parser.addApplicationDescription("This does affine, rigid or deformable registration based on Greedy");
   parser.addExampleUsage("-reg -trf -i moving.nii.gz -f fixed.nii.gz -o output.nii.gz -t matrix.mat -a -m MI -n 100x50x5",
     "This registers the moving image 'moving.nii.gz' with fixed image 'fixed.nii.gz.' with output at 'output.nii.gz'");
+  parser.addExampleUsage("-reg -trf -i t1.nii.gz,t2.nii.gz,fl.nii.gz -f t1ce.nii.gz -o t1_r.nii.gz,t2_r.nii.gz,fl_r.nii.gz -t t1.mat,t2.mat,fl.mat -r -b 0",
+    "This registers three images to 't1ce.nii.gz' at the same time, in one process");
+  parser.addExampleUsage("-reg -trf -i moving.nii.gz -f fixed.nii.gz -o output.nii.gz -t warp.nii.gz -d -m NCC -ri 2x2x2 -n 100x50",
+    "This computes the deformable warp 'warp.nii.gz' from 'moving.nii.gz' to 'fixed.nii.gz' and applies it");
 
   
   CommandLineHelper cl(argc, argv);
@@ -135,6 +290,66 @@ int main(int argc, char** argv)
     param.threads = threads;
   }
 
+  if (parser.isPresent("p"))
+  {
+    std::string precision;
+    parser.getParameterValue("p", precision);
+    std::transform(precision.begin(), precision.end(), precision.begin(), ::tolower);
+
+    if (precision == "float" || precision == "mixed")
+    {
+      param.flag_float_math = true;
+      param.flag_float_mixed_precision = (precision == "mixed");
+    }
+    else if (precision != "double")
+    {
+      std::cerr << "--> Unknown precision '" << precision << "', use double, float or mixed" << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << "--> Precision: " << precision << std::endl;
+  }
+
+  float precisionTolerance = -1;
+  if (parser.isPresent("pc"))
+  {
+    parser.getParameterValue("pc", precisionTolerance);
+  }
+
+  if (parser.isPresent("rs"))
+  {
+    std::string search;
+    parser.getParameterValue("rs", search);
+    auto searchValues = cbica::stringSplit(search, ",");
+    if (searchValues.size() != 3)
+    {
+      std::cerr << "--> Rigid search needs 3 values (N,angle,translation), got '" << search << "'" << std::endl;
+      return EXIT_FAILURE;
+    }
+    param.rigid_search.iterations = std::atoi(searchValues[0].c_str());
+    param.rigid_search.sigma_angle = std::atof(searchValues[1].c_str());
+    param.rigid_search.sigma_xyz = std::atof(searchValues[2].c_str());
+    std::cout << "--> Rigid search: " << param.rigid_search.iterations << " tries" << std::endl;
+  }
+
+  if (parser.isPresent("rr"))
+  {
+    parser.getParameterValue("rr", param.rigid_search.refine_count);
+    if (param.rigid_search.refine_count < 0)
+    {
+      std::cerr << "--> The number of refined rigid search tries can't be negative" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  bool batchMode = parser.isPresent("b");
+  if (batchMode)
+  {
+    int batchJobs;
+    parser.getParameterValue("b", batchJobs);
+    param.batch_jobs = batchJobs;
+    std::cout << "--> Batch mode, registering the " << inputImageFiles.size() << " moving images in one process" << std::endl;
+  }
+
   if (inputImageFiles.size() != outputImageFiles.size()
     || inputImageFiles.size() != matrixImageFiles.size() || outputImageFiles.size() != matrixImageFiles.size())
   {
@@ -144,6 +359,7 @@ int main(int argc, char** argv)
 
   std::string tempFolderLocation = cbica::normPath(cbica::getUserHomeDirectory() + "/.CaPTk");
   cbica::createDir(tempFolderLocation);
+  std::string precisionCheckFile = tempFolderLocation + (parser.isPresent("d") ? "/tempPrecisionCheck_double.nii.gz" : "/tempPrecisionCheck_double.mat");
   if (cbica::IsDicom(fixedImage))
   {
     // dicom image detected
@@ -163,6 +379,9 @@ int main(int argc, char** argv)
       bool affineMode = false;
       float current_weight = 1.0;
 
+      // Only the current image pair is registered
+      param.inputs.clear();
+
       ImagePairSpec ip;
       ip.weight = current_weight;
       ip.fixed = fixedImage;
@@ -195,6 +414,12 @@ int main(int argc, char** argv)
         param.affine_dof = GreedyParameters::DOF_RIGID;
       }
 
+      if (parser.isPresent("d")) {
+        std::cout << "--> Registration Mode: Deformable " << std::endl;
+
+        param.mode = GreedyParameters::GREEDY;
+      }
+
       if (parser.isPresent("n")) {
         parser.getParameterValue("n", g_iterations);
         std::cout << "--> Number of iterations: " << g_iterations << std::endl;
@@ -237,6 +462,11 @@ int main(int argc, char** argv)
           std::cout << "--> Patch radius used for metrics: " << val << std::endl;
           param.metric_radius = cl.read_int_vector(val);
         }
+
+        if (parser.isPresent("ns")) {
+          std::cout << "--> NCC sums computed slice by slice" << std::endl;
+          param.flag_ncc_stream_box_sums = true;
+        }
       }
 
       std::cout << "--> Transformation matrix output file name: " << matrixImageFiles[i] << std::endl;
@@ -298,28 +528,81 @@ int main(int argc, char** argv)
         param.dim = fixedImageInfo.GetImageDimensions();
       }
 
-      if (param.flag_float_math)
+      if (!batchMode)
       {
-        switch (fixedImageInfo.GetImageDimensions())
+        RunGreedy(param, fixedImageInfo.GetImageDimensions());
+
+        std::cout << "--> Finished registration.\n";
+
+        // Regression check of the float computation against the double one
+        if (param.flag_float_math && precisionTolerance >= 0
+          && !CheckFloatPrecision(param, fixedImageInfo.GetImageDimensions(), precisionTolerance, precisionCheckFile))
         {
-        case 2: GreedyRunner<2, float>::Run(param); break;
-        case 3: GreedyRunner<3, float>::Run(param); break;
-        case 4: GreedyRunner<4, float>::Run(param); break;
-        default: throw GreedyException("--> Wrong number of dimensions requested: %d", param.dim);
+          return EXIT_FAILURE;
         }
       }
-      else
+      else if (i == 0)
       {
-        switch (fixedImageInfo.GetImageDimensions())
+        // All the images are registered with the first one, sharing the fixed image
+        std::vector<BatchJobSpec> jobs;
+        for (size_t j = 0; j < inputImageFiles.size(); j++)
         {
-        case 2: GreedyRunner<2, double>::Run(param); break;
-        case 3: GreedyRunner<3, double>::Run(param); break;
-        case 4: GreedyRunner<4, double>::Run(param); break;
-        default: throw GreedyException("--> Wrong number of dimensions requested: %d", param.dim);
+          if (!cbica::fileExists(inputImageFiles[j]))
+          {
+            std::cerr << "--> Moving image file not found :'" << inputImageFiles[j] << "'\n";
+            return EXIT_FAILURE;
+          }
+          if (cbica::ImageInfo(inputImageFiles[j]).GetImageDimensions() != fixedImageInfo.GetImageDimensions())
+          {
+            std::cerr << "--> Image dimensions do not match: '" << inputImageFiles[j] << "'" << std::endl;
+            return EXIT_FAILURE;
+          }
+
+          BatchJobSpec job;
+          job.moving = inputImageFiles[j];
+          if (cbica::IsDicom(inputImageFiles[j]))
+          {
+            // dicom image detected, each job needs its own converted image
+            job.moving = tempFolderLocation + "/tempDicomConverted_moving_" + std::to_string(j) + ".nii.gz";
+            cbica::WriteImage< ImageTypeFloat3D >(cbica::ReadImage< ImageTypeFloat3D >(inputImageFiles[j]), job.moving);
+          }
+          job.output = matrixImageFiles[j];
+          jobs.push_back(job);
+        }
+
+        int failedJobs;
+        try
+        {
+          failedJobs = RunGreedyBatch(param, jobs, fixedImageInfo.GetImageDimensions());
+        }
+        catch (const std::exception &e)
+        {
+          std::cerr << "--> Batch registration failed: " << e.what() << std::endl;
+          return EXIT_FAILURE;
+        }
+        if (failedJobs != 0)
+        {
+          std::cerr << "--> " << failedJobs << " of " << jobs.size() << " registrations failed, see above" << std::endl;
+          return EXIT_FAILURE;
         }
-      }
 
-      std::cout << "--> Finished registration.\n";
+        std::cout << "--> Finished batch registration.\n";
+
+        // Regression check of the float computation against the double one, job by job
+        if (param.flag_float_math && precisionTolerance >= 0)
+        {
+          for (size_t j = 0; j < jobs.size(); j++)
+          {
+            GreedyParameters paramJob = param;
+            paramJob.inputs[0].moving = jobs[j].moving;
+            paramJob.output = jobs[j].output;
+            if (!CheckFloatPrecision(paramJob, fixedImageInfo.GetImageDimensions(), precisionTolerance, precisionCheckFile))
+            {
+              return EXIT_FAILURE;
+            }
+          }
+        }
+      }
 
       //GreedyParameters param;
       //GreedyParameters::SetToDefaults(param);
@@ -343,6 +626,7 @@ int main(int argc, char** argv)
         reslice.moving = inputImageFiles[i];
         reslice.output = outputImageFiles[i];
 
+        param.reslice_param.images.clear();
         param.reslice_param.images.push_back(reslice);
 
         param.mode = GreedyParameters::RESLICE;
@@ -356,6 +640,7 @@ int main(int argc, char** argv)
         std::cout << "--> Transformation Matrix found: " + matrixImageFiles[i] << std::endl;
         spec = cl.read_transform_spec(matrixImageFiles[i]);
 
+        param.reslice_param.transforms.clear();
         param.reslice_param.transforms.push_back(spec);
 
 
@@ -398,26 +683,8 @@ int main(int argc, char** argv)
 
         std::cout << "--> Applied transformation to moving image: " << outputImageFiles[i] << std::endl;
 
-        if (param.flag_float_math)
-        {
-          switch (fixedImageInfo.GetImageDimensions())
-          {
-          case 2: GreedyRunner<2, float>::Run(param); continue;
-          case 3: GreedyRunner<3, float>::Run(param); continue;
-          case 4: GreedyRunner<4, float>::Run(param); continue;
-          default: throw GreedyException("--> Wrong number of dimensions requested: %d", param.dim);
-          }
-        }
-        else
-        {
-          switch (fixedImageInfo.GetImageDimensions())
-          {
-          case 2: GreedyRunner<2, double>::Run(param); continue;
-          case 3: GreedyRunner<3, double>::Run(param); continue;
-          case 4: GreedyRunner<4, double>::Run(param); continue;
-          default: throw GreedyException("--> Wrong number of dimensions requested: %d", param.dim);
-          }
-        }
+        RunGreedy(param, fixedImageInfo.GetImageDimensions());
+        continue;
 
         std::cout << "--> Transformation complete " << std::endl;
       }
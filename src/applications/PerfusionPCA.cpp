@@ -102,6 +102,11 @@ PerfusionMapType PerfusionPCA::CombineAndCalculatePerfusionPCAForTestData(Perfus
   }
   FeatureReductionClass m_featureReduction;
   VectorVectorDouble ReducedPCAs = m_featureReduction.ApplyPCAOnTestDataWithGivenTransformations(CombinedPerfusionFeaturesMap, TransformationMatrix, MeanVector);
+  if (ReducedPCAs.empty())
+  {
+    std::cerr << "PCA model could not be applied: " << m_featureReduction.GetLastEncounteredError() << std::endl;
+    return RevisedPerfusionMap;
+  }
 
   int start = 0;
   for (unsigned int index = 0; index<sizes.size(); index++)// for (auto const &mapiterator : PerfusionDataMap) 
@@ -172,6 +177,8 @@ bool PerfusionPCA::ApplyExistingPCAModel(const int number, const std::string inp
   //Apply existing PCA model on the test patient
   //--------------------------------------------------------------------------------------------
   PerfusionMapType perfFeatures = CombineAndCalculatePerfusionPCAForTestData(PerfusionDataMap, PCA_PERF, Mean_PERF);
+  if (perfFeatures.size() != PerfusionDataMap.size())
+    return false;
   std::vector<std::vector<ImageType::Pointer>> RevisedPerfusionImagesOfAllPatients;
 
   for (unsigned int sid = 0; sid < trainingsubjects.size(); sid++)
@@ -32,6 +32,9 @@ bool PseudoProgressionEstimator::TrainNewModelOnGivenData(const std::vector<std:
 {
   //extraction of features and target labels
   std::vector<double> traininglabels;
+  // the PCA models, z-scores and SVMs are collected while training and written to a single model container at the end
+  mModelContainer.Clear();
+  mModelContainer.SetMetadata("Application", "PseudoProgressionEstimator");
   VariableSizeMatrixType TrainingData = LoadPseudoProgressionTrainingData(qualifiedsubjects, traininglabels, outputdirectory);
 
   WriteCSVFiles(TrainingData, outputdirectory + "/combinedfeatures-captk-afterfixed.csv");
@@ -62,17 +65,9 @@ bool PseudoProgressionEstimator::TrainNewModelOnGivenData(const std::vector<std:
     if (std::isnan(stdVector[index1]))
       stdVector[index1] = 0;
   }
-  //writing the parameters of scaling in the output directory
-  try
-  {
-    WriteCSVFiles(meanVector, outputdirectory + "/PSU_ZScore_Mean.csv");
-    WriteCSVFiles(stdVector, outputdirectory + "/PSU_ZScore_Std.csv");
-  }
-  catch (const std::exception& e1)
-  {
-    logger.WriteError("Error in writing output files to the output directory = " + outputdirectory + "Error code : " + std::string(e1.what()));
-    return false;
-  }
+  //parameters of scaling
+  mModelContainer.AddVector("PSU_ZScore_Mean", meanVector);
+  mModelContainer.AddVector("PSU_ZScore_Std", stdVector);
 
   VariableSizeMatrixType PseudoModelFeatures;
   VariableSizeMatrixType RecurrenceModelFeatures;
@@ -120,6 +115,15 @@ bool PseudoProgressionEstimator::TrainNewModelOnGivenData(const std::vector<std:
     logger.WriteError("Training on the given subjects failed. Error code : " + std::string(e1.what()));
     return false;
   }
+  // stored under the names the testing reads
+  if (!mModelContainer.AddMetadataFromFile("PSU_SVM_Model.xml", outputdirectory + "/" + mPseudoTrainedFile) ||
+    !mModelContainer.AddMetadataFromFile("REC_SVM_Model.xml", outputdirectory + "/" + mRecurrenceTrainedFile) ||
+    !mModelContainer.Write(outputdirectory + "/" + mTrainedModelNameContainer))
+  {
+    logger.WriteError("Error in writing model container: " + mModelContainer.GetLastEncounteredError());
+    return false;
+  }
+  mModelContainer.Clear();
   std::cout << std::endl << "Model saved to the output directory." << std::endl;
 
   return true;
@@ -221,8 +225,11 @@ bool PseudoProgressionEstimator::PseudoProgressionEstimateOnExistingModel(std::v
 {
   typedef itk::CSVArray2DFileReader<double> ReaderType;
   VectorDouble results;
-  CSVFileReaderType::Pointer reader = CSVFileReaderType::New();
 
+  if (!LoadModelContainer(modeldirectory))
+  {
+    return false;
+  }
   std::vector<double> traininglabels;
   VariableSizeMatrixType TrainingData = LoadPseudoProgressionTestingData(qualifiedsubjects, traininglabels, outputdirectory, modeldirectory);
   //WriteCSVFiles(TrainingData, outputdirectory + "/testingfeatures.csv");
@@ -231,46 +238,8 @@ bool PseudoProgressionEstimator::PseudoProgressionEstimateOnExistingModel(std::v
 
 
 
-  MatrixType meanMatrix;
-  VariableLengthVectorType mean;
-  VariableLengthVectorType stddevition;
-  try
-  {
-    reader->SetFileName(modeldirectory + "/PSU_ZScore_Mean.csv");
-    reader->SetFieldDelimiterCharacter(',');
-    reader->HasColumnHeadersOff();
-    reader->HasRowHeadersOff();
-    reader->Parse();
-    meanMatrix = reader->GetArray2DDataObject()->GetMatrix();
-
-    mean.SetSize(meanMatrix.size());
-    for (unsigned int i = 0; i < meanMatrix.size(); i++)
-      mean[i] = meanMatrix(0, i);
-  }
-  catch (const std::exception& e1)
-  {
-    logger.WriteError("Error in reading the file: " + modeldirectory + "/PSU_ZScore_Mean.csv. Error code : " + std::string(e1.what()));
-    //return results;
-  }
-  MatrixType stdMatrix;
-  try
-  {
-    reader->SetFileName(modeldirectory + "/PSU_ZScore_Std.csv");
-    reader->SetFieldDelimiterCharacter(',');
-    reader->HasColumnHeadersOff();
-    reader->HasRowHeadersOff();
-    reader->Parse();
-    stdMatrix = reader->GetArray2DDataObject()->GetMatrix();
-
-    stddevition.SetSize(stdMatrix.size());
-    for (unsigned int i = 0; i < stdMatrix.size(); i++)
-      stddevition[i] = stdMatrix(0, i);
-  }
-  catch (const std::exception& e1)
-  {
-    logger.WriteError("Error in reading the file: " + modeldirectory + "/PSU_ZScore_Std.csv. Error code : " + std::string(e1.what()));
-    //return results;
-  }
+  const VariableLengthVectorType mean = mModelContainer.GetVector("PSU_ZScore_Mean");
+  const VariableLengthVectorType stddevition = mModelContainer.GetVector("PSU_ZScore_Std");
   std::cout << "parameters read." << std::endl;
   VariableSizeMatrixType ScaledTestingData = mFeatureScalingLocalPtr.ScaleGivenTestingFeatures(TrainingData, mean, stddevition);
 
@@ -298,46 +267,12 @@ bool PseudoProgressionEstimator::PseudoProgressionEstimateOnExistingModel(std::v
   }
 
   //feature selection process for test data
-  VariableLengthVectorType psuSelectedFeatures;
-  VariableLengthVectorType recSelectedFeatures;
-  MatrixType dataMatrix;
-  try
-  {
-    reader->SetFileName(modeldirectory + "/PSU_SelectedFeatures.csv");
-    reader->SetFieldDelimiterCharacter(',');
-    reader->HasColumnHeadersOff();
-    reader->HasRowHeadersOff();
-    reader->Parse();
-    dataMatrix = reader->GetArray2DDataObject()->GetMatrix();
-
-    psuSelectedFeatures.SetSize(dataMatrix.size());
-    for (unsigned int i = 0; i < dataMatrix.size(); i++)
-      psuSelectedFeatures[i] = dataMatrix(i, 0);
-  }
-  catch (const std::exception& e1)
-  {
-    logger.WriteError("Error in reading the file: " + modeldirectory + "/PSU_SlectedFeatures.csv. Error code : " + std::string(e1.what()));
-    //return results;
-  }
-
-  try
-  {
-    reader->SetFileName(modeldirectory + "/REC_SelectedFeatures.csv");
-    reader->SetFieldDelimiterCharacter(',');
-    reader->HasColumnHeadersOff();
-    reader->HasRowHeadersOff();
-    reader->Parse();
-    dataMatrix = reader->GetArray2DDataObject()->GetMatrix();
-
-    recSelectedFeatures.SetSize(dataMatrix.size());
-    for (unsigned int i = 0; i < dataMatrix.size(); i++)
-      recSelectedFeatures[i] = dataMatrix(i, 0);
-  }
-  catch (const std::exception& e1)
-  {
-    logger.WriteError("Error in reading the file: " + modeldirectory + "/REC_SelectedFeatures.csv. Error code : " + std::string(e1.what()));
-    //return results;
-  }
+  const VariableLengthVectorType psuSelectedFeatures = mModelContainer.GetVector("PSU_SelectedFeatures");
+  const VariableLengthVectorType recSelectedFeatures = mModelContainer.GetVector("REC_SelectedFeatures");
+  if (psuSelectedFeatures.Size() == 0)
+    logger.WriteError("PSU_SelectedFeatures not found in the model container of: " + modeldirectory);
+  if (recSelectedFeatures.Size() == 0)
+    logger.WriteError("REC_SelectedFeatures not found in the model container of: " + modeldirectory);
 
   VariableSizeMatrixType PseudoModelSelectedFeatures = GetModelSelectedFeatures(ScaledFeatureSetAfterAddingLabel, psuSelectedFeatures);
   VariableSizeMatrixType RecurrenceModelSelectedFeatures = GetModelSelectedFeatures(ScaledFeatureSetAfterAddingLabel, recSelectedFeatures);
@@ -350,12 +285,14 @@ bool PseudoProgressionEstimator::PseudoProgressionEstimateOnExistingModel(std::v
     std::ofstream myfile;
     myfile.open(outputdirectory + "/results.csv");
     myfile << "SubjectName,Score (Pseudo), Score (Recurrence)\n";
-    if (cbica::fileExists(modeldirectory + "/PSU_SVM_Model.xml") == true && cbica::fileExists(modeldirectory + "/REC_SVM_Model.xml") == true)
+    const auto pseudoModel = mModelContainer.GetMetadata("PSU_SVM_Model.xml");
+    const auto recurrenceModel = mModelContainer.GetMetadata("REC_SVM_Model.xml");
+    if (!pseudoModel.empty() && !recurrenceModel.empty())
     {
       VectorDouble result_6;
       VectorDouble result_18;
-      result_6 = testOpenCVSVM(PseudoModelSelectedFeatures, modeldirectory + "/PSU_SVM_Model.xml");
-      result_18 = testOpenCVSVM(RecurrenceModelSelectedFeatures, modeldirectory + "/REC_SVM_Model.xml");
+      result_6 = testLoadedOpenCVSVM(PseudoModelSelectedFeatures, cv::Algorithm::loadFromString< cv::ml::SVM >(pseudoModel));
+      result_18 = testLoadedOpenCVSVM(RecurrenceModelSelectedFeatures, cv::Algorithm::loadFromString< cv::ml::SVM >(recurrenceModel));
       for (size_t i = 0; i < result_6.size(); i++)
       {
         std::map<CAPTK::ImageModalityType, std::string> currentsubject = qualifiedsubjects[i];
@@ -744,6 +681,22 @@ VariableLengthVectorType PseudoProgressionEstimator::DistanceFunction(const Vari
   return Distances;
 }
 
+bool PseudoProgressionEstimator::LoadModelContainer(const std::string &modeldirectory)
+{
+  const std::vector< std::string > modelFiles = { "PSU_ZScore_Mean.csv", "PSU_ZScore_Std.csv", "PCA_PERF.csv", "Mean_PERF.csv",
+    "PCA_Others.csv", "Mean_Others.csv", "PSU_SVM_Model.xml", "REC_SVM_Model.xml" };
+  if (!mModelContainer.ReadModelDirectory(modeldirectory, mTrainedModelNameContainer, modelFiles, "PseudoProgressionEstimator"))
+  {
+    logger.WriteError("Model files could not be read: " + mModelContainer.GetLastEncounteredError());
+    return false;
+  }
+  if (!mModelContainer.GetLastEncounteredError().empty())
+  {
+    logger.Write("Model container could not be written: " + mModelContainer.GetLastEncounteredError());
+  }
+  return true;
+}
+
 VariableSizeMatrixType PseudoProgressionEstimator::LoadPseudoProgressionTestingData(const std::vector<std::map<CAPTK::ImageModalityType, std::string>> &testingsubjects, std::vector<double> &testinglabels, std::string outputdirectory, std::string modeldirectory)
 {
   VariableSizeMatrixType FeaturesOfAllSubjects;
@@ -844,7 +797,7 @@ VariableSizeMatrixType PseudoProgressionEstimator::LoadPseudoProgressionTestingD
   VariableLengthVectorType Mean_PC9;
   VariableLengthVectorType Mean_PC10;
 
-  ReadAllTheModelParameters(modeldirectory, PCA_PERF, PCA_T1, PCA_T1CE, PCA_T2, PCA_FL, PCA_T1T1CE, PCA_T2FL,
+  ReadAllTheModelParameters(PCA_PERF, PCA_T1, PCA_T1CE, PCA_T2, PCA_FL, PCA_T1T1CE, PCA_T2FL,
     PCA_AX, PCA_FA, PCA_RAD, PCA_TR, PCA_PH, PCA_PSR, PCA_RCBV, PCA_PC1, PCA_PC2, PCA_PC3, PCA_PC4,
     PCA_PC5, PCA_PC6, PCA_PC7, PCA_PC8, PCA_PC9, PCA_PC10,
     Mean_PERF, Mean_T1, Mean_T1CE, Mean_T2, Mean_FL, Mean_T1T1CE, Mean_T2FL, Mean_AX, Mean_FA,
@@ -1246,25 +1199,8 @@ VariableSizeMatrixType PseudoProgressionEstimator::LoadPseudoProgressionTraining
   VariableLengthVectorType MeanVector;
   PerfusionMapType perfFeatures = CombineAndCalculatePerfusionPCA(PerfusionDataMap, TransformationMatrix, MeanVector);
 
-  std::ofstream myfile;
-  myfile.open(outputdirectory + "/PCA_PERF.csv");
-  for (unsigned int index1 = 0; index1 < TransformationMatrix.Rows(); index1++)
-  {
-    for (unsigned int index2 = 0; index2 < TransformationMatrix.Cols(); index2++)
-    {
-      if (index2 == 0)
-        myfile << std::to_string(TransformationMatrix[index1][index2]);
-      else
-        myfile << "," << std::to_string(TransformationMatrix[index1][index2]);
-    }
-    myfile << "\n";
-  }
-  myfile.close();
-  myfile.open(outputdirectory + "/Mean_PERF.csv");
-  for (unsigned int index1 = 0; index1 < MeanVector.Size(); index1++)
-    myfile << std::to_string(MeanVector[index1]) << ",";
-  myfile << "\n";
-  myfile.close();
+  mModelContainer.AddMatrix("PCA_PERF", TransformationMatrix);
+  mModelContainer.AddVector("Mean_PERF", MeanVector);
 
   //Putting back in images of respective patients
   //---------------------------------------------
@@ -1578,6 +1514,11 @@ PerfusionMapType PseudoProgressionEstimator::CombineAndCalculatePerfusionPCAForT
   }
   FeatureReductionClass m_featureReduction;
   VectorVectorDouble ReducedPCAs = m_featureReduction.ApplyPCAOnTestDataWithGivenTransformations(CombinedPerfusionFeaturesMap, TransformationMatrix, MeanVector);
+  if (ReducedPCAs.empty())
+  {
+    std::cerr << "PCA model could not be applied: " << m_featureReduction.GetLastEncounteredError() << std::endl;
+    return RevisedPerfusionMap;
+  }
 
   int start = 0;
   for (unsigned int index = 0; index<sizes.size(); index++)// for (auto const &mapiterator : PerfusionDataMap) 
@@ -1620,6 +1561,11 @@ PerfusionMapType PseudoProgressionEstimator::CombinePerfusionDataAndApplyExistin
   }
   FeatureReductionClass m_featureReduction;
   VectorVectorDouble ReducedPCAs = m_featureReduction.ApplyPCAOnTestDataWithGivenTransformations(CombinedPerfusionFeaturesMap, TransformationMatrix, MeanVector);
+  if (ReducedPCAs.empty())
+  {
+    std::cerr << "PCA model could not be applied: " << m_featureReduction.GetLastEncounteredError() << std::endl;
+    return RevisedPerfusionMap;
+  }
 
   int start = 0;
   for (unsigned int index = 0; index<sizes.size(); index++)// for (auto const &mapiterator : PerfusionDataMap) 
@@ -2216,8 +2162,8 @@ VectorVectorDouble PseudoProgressionEstimator::CombineAllThePerfusionFeaures(Vec
     AllMeans(21, i) = Mean_PC9[i];
     AllMeans(22, i) = Mean_PC10[i];
   }
-  WriteCSVFiles(AllPCAs, outputdirectory + "/PCA_Others.csv");
-  WriteCSVFiles(AllMeans, outputdirectory + "/Mean_Others.csv");
+  mModelContainer.AddMatrix("PCA_Others", AllPCAs);
+  mModelContainer.AddMatrix("Mean_Others", AllMeans);
 
   std::cout << "pca modalities perfusion components extracted" << std::endl;
 
@@ -2540,8 +2486,7 @@ void PseudoProgressionEstimator::WritePCAOutputs(std::string suffix, std::string
   myfile.close();
 }
 
-void PseudoProgressionEstimator::ReadAllTheModelParameters(std::string modeldirectory,
-  VariableSizeMatrixType &PCA_PERF,
+void PseudoProgressionEstimator::ReadAllTheModelParameters(VariableSizeMatrixType &PCA_PERF,
   VariableSizeMatrixType &PCA_T1,
   VariableSizeMatrixType &PCA_T1CE,
   VariableSizeMatrixType &PCA_T2,
@@ -2590,36 +2535,15 @@ void PseudoProgressionEstimator::ReadAllTheModelParameters(std::string modeldire
   VariableLengthVectorType &Mean_PC9,
   VariableLengthVectorType &Mean_PC10)
 {
-  CSVFileReaderType::Pointer reader = CSVFileReaderType::New();
   MatrixType dataMatrix;
-  VariableLengthVectorType meanMatrix;
-  reader->SetFieldDelimiterCharacter(',');
-  reader->HasColumnHeadersOff();
-  reader->HasRowHeadersOff();
-
 
   //-------------perfusion related data reading------------------
-  reader->SetFileName(modeldirectory + "/PCA_PERF.csv");
-  reader->Parse();
-  dataMatrix = reader->GetArray2DDataObject()->GetMatrix();
-  PCA_PERF.SetSize(dataMatrix.rows(), dataMatrix.cols());
-  for (unsigned int i = 0; i < dataMatrix.rows(); i++)
-    for (unsigned int j = 0; j < dataMatrix.cols(); j++)
-      PCA_PERF(i, j) = dataMatrix(i, j);
-
-
-  reader->SetFileName(modeldirectory + "/Mean_PERF.csv");
-  reader->Parse();
-  dataMatrix = reader->GetArray2DDataObject()->GetMatrix();
-  Mean_PERF.SetSize(dataMatrix.size());
-  for (unsigned int i = 0; i < dataMatrix.size(); i++)
-    Mean_PERF[i] = dataMatrix(0, i);
+  PCA_PERF = mModelContainer.GetMatrix("PCA_PERF");
+  Mean_PERF = mModelContainer.GetVector("Mean_PERF");
 
   //-------------others related data reading------------------
   int PCA_Others_Size = 20;
-  reader->SetFileName(modeldirectory + "/PCA_Others.csv");
-  reader->Parse();
-  dataMatrix = reader->GetArray2DDataObject()->GetMatrix();
+  dataMatrix = mModelContainer.GetMatrix("PCA_Others").GetVnlMatrix();
 
   PCA_T1.SetSize(PCA_Others_Size, PCA_Others_Size);
   PCA_T1CE.SetSize(PCA_Others_Size, PCA_Others_Size);
@@ -2809,9 +2733,7 @@ void PseudoProgressionEstimator::ReadAllTheModelParameters(std::string modeldire
 
 
 
-  reader->SetFileName(modeldirectory + "/Mean_Others.csv");
-  reader->Parse();
-  dataMatrix = reader->GetArray2DDataObject()->GetMatrix();
+  dataMatrix = mModelContainer.GetMatrix("Mean_Others").GetVnlMatrix();
 
   for (unsigned int i = 0; i < dataMatrix.cols(); i++)
   {
@@ -33,6 +33,7 @@ See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
 #include "CaPTkEnums.h"
 #include "CaPTkClassifierUtils.h"
 #include "cbicaLogging.h"
+#include "ModelContainer.h"
 #include "itkEnhancedScalarImageToRunLengthFeaturesFilter.h"
 #include "itkRoundImageFilter.h"
 
@@ -89,6 +90,7 @@ public:
   {
     mPseudoTrainedFile = "Pseudo_SVM_Model.xml";
     mRecurrenceTrainedFile = "Recurrence_SVM_Model.xml";
+    mTrainedModelNameContainer = std::string("PSU_Model") + MODEL_CONTAINER_EXT;
     logger.UseNewFile(loggerFile);
   };
 
@@ -99,6 +101,8 @@ public:
   std::string mLastEncounteredError;
   std::string mPseudoTrainedFile;
   std::string mRecurrenceTrainedFile;
+  std::string mTrainedModelNameContainer;
+  ModelContainer mModelContainer;
   cbica::Logging logger;
 
   void WriteCSVFiles(VariableSizeMatrixType inputdata, std::string filepath);
@@ -165,8 +169,16 @@ public:
 
   PerfusionMapType CombinePerfusionDataAndApplyExistingPerfusionModel(PerfusionMapType PerfusionDataMap, VariableSizeMatrixType TransformationMatrix, VariableLengthVectorType MeanVector);
 
-  void ReadAllTheModelParameters(std::string modeldirectory,
-    VariableSizeMatrixType &PCA_PERF,
+  /**
+  \brief Loads the model container (z-scores, PCA models and SVMs) from the model directory
+
+  CSV and XML model files without a container, or newer than it, are converted first.
+  \return True if mModelContainer holds the model after the call
+  */
+  bool LoadModelContainer(const std::string &modeldirectory);
+
+  //! Reads the PCA models of the perfusion and the other modalities from the loaded model container
+  void ReadAllTheModelParameters(VariableSizeMatrixType &PCA_PERF,
     VariableSizeMatrixType &PCA_T1,
     VariableSizeMatrixType &PCA_T1CE,
     VariableSizeMatrixType &PCA_T2,
@@ -29,73 +29,34 @@ ImageTypeFloat3D::Pointer RecurrenceEstimator::RescaleImageIntensity(ImageTypeFl
 
 bool RecurrenceEstimator::TrainNewModelOnGivenData(const std::vector<std::map<CAPTK::ImageModalityType, std::string>> qualifiedsubjects, const std::string &outputdirectory, bool useConventionalData, bool useDTIData, bool usePerfData, bool useDistData)
 {
-
-	bool useOtherModalities = false;
-	if (useConventionalData || useDTIData)
-		useOtherModalities = true;
-
-	std::vector<std::string> vector;
-	VectorVectorDouble pNearIntensitiesTotal;
-	VectorVectorDouble mNearIntensitiesTotal;
-	VectorDouble tNearIntensitiesTotal;
-
-	VectorVectorDouble pFarIntensitiesTotal;
-	VectorVectorDouble mFarIntensitiesTotal;
-	VectorDouble tFarIntensitiesTotal;
-
-	VectorVectorDouble pIntensitiesTotal;
-	VectorVectorDouble mIntensitiesTotal;
-	VectorDouble tIntensitiesTotal;
-
-
-	for (unsigned int sid = 0; sid < qualifiedsubjects.size(); sid++)
+	// subjects are read on a background thread while the previous one is sampled, so only a couple of them are in memory at once
+	auto readSubject = [&](size_t sid, NiftiDataManager::TrainingSubjectImages &images)
 	{
-		std::cout << "Patient's data laoding:" << sid + 1 << std::endl;
-		VectorVectorDouble mNearIntensities;
-		VectorVectorDouble mFarIntensities;
-		VectorDouble tNearIntensities;
-		VectorDouble tFarIntensities;
-		VectorVectorDouble pNearIntensities;
-		VectorVectorDouble pFarIntensities;
-
 		typedef ImageTypeFloat3D ImageType;
-		typedef ImageTypeFloat4D PerfusionImageType;
-		ImageType::Pointer T1CEImagePointer;
-		ImageType::Pointer T2FlairImagePointer;
-		ImageType::Pointer T1ImagePointer;
-		ImageType::Pointer T2ImagePointer;
-		ImageType::Pointer AXImagePointer;
-		ImageType::Pointer RADImagePointer;
-		ImageType::Pointer FAImagePointer;
-		ImageType::Pointer TRImagePointer;
-
-		PerfusionImageType::Pointer perfImagePointer;
-
 		std::map< CAPTK::ImageModalityType, std::string > currentsubject = qualifiedsubjects[sid];
-		try
-		{
-			ImageType::Pointer LabelImagePointer = ReadNiftiImage<ImageType>(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_SEG]));
-			ImageType::Pointer recurImagePointer = ReadNiftiImage<ImageType>(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_NEAR]));
-			ImageType::Pointer nonrecurImagePointer = ReadNiftiImage<ImageType>(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_FAR]));
+		ImageType::Pointer LabelImagePointer = ReadNiftiImage<ImageType>(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_SEG]));
+		images.nearMask = ReadNiftiImage<ImageType>(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_NEAR]));
+		images.farMask = ReadNiftiImage<ImageType>(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_FAR]));
 
-			if (useConventionalData)
-			{
-				T1CEImagePointer = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_T1CE])));
-				T2FlairImagePointer = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_T2FLAIR])));
-				T1ImagePointer = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_T1])));
-				T2ImagePointer = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_T2])));
-			}
-			if (useDTIData)
-			{
-				AXImagePointer = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_AX])));
-				RADImagePointer = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_RAD])));
-				FAImagePointer = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_FA])));
-				TRImagePointer = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_TR])));
-			}
-			if (usePerfData)
-				perfImagePointer = mNiftiLocalPtr.Read4DNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_PERFUSION]));
+		if (useConventionalData)
+		{
+			images.t1ce = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_T1CE])));
+			images.t2flair = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_T2FLAIR])));
+			images.t1 = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_T1])));
+			images.t2 = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_T2])));
+		}
+		if (useDTIData)
+		{
+			images.ax = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_AX])));
+			images.rad = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_RAD])));
+			images.fa = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_FA])));
+			images.tr = RescaleImageIntensity(mNiftiLocalPtr.ReadNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_TR])));
+		}
+		if (usePerfData)
+			images.perfusion = mNiftiLocalPtr.Read4DNiftiImage(static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_PERFUSION]));
 
-			int imagetype = CAPTK::ImageExtension::NIfTI;
+		if (useDistData)
+		{
 			VectorVectorDouble tumorIndices;
 			typedef itk::ImageRegionIteratorWithIndex <ImageType> IteratorType;
 			IteratorType LabelImageIt(LabelImagePointer, LabelImagePointer->GetLargestPossibleRegion());
@@ -112,98 +73,75 @@ bool RecurrenceEstimator::TrainNewModelOnGivenData(const std::vector<std::map<CA
 				}
 				++LabelImageIt;
 			}
-
 			PreprocessingPipelineClass mPreprocessingObj;
-			ImageType::Pointer tumorMaskFinal = mPreprocessingObj.PrepareTumroImageFromPoints<ImageType>(LabelImagePointer, tumorIndices);
-
-			mNiftiLocalPtr.LoadTrainingData(tumorMaskFinal, recurImagePointer, nonrecurImagePointer,T1CEImagePointer, T2FlairImagePointer, T1ImagePointer,T2ImagePointer, perfImagePointer, AXImagePointer,FAImagePointer, RADImagePointer, TRImagePointer,pNearIntensities, pFarIntensities, mNearIntensities,mFarIntensities, tNearIntensities, tFarIntensities, imagetype,useConventionalData, useDTIData, usePerfData, useDistData);
-			for (size_t i = 0; i < mNearIntensities.size(); i++)
-			{
-				if (usePerfData)
-					pNearIntensitiesTotal.push_back(pNearIntensities[i]);
-				if (useOtherModalities)
-					mNearIntensitiesTotal.push_back(mNearIntensities[i]);
-				if (useDistData)
-					tNearIntensitiesTotal.push_back(tNearIntensities[i]);
-			}
-			for (size_t i = 0; i < mFarIntensities.size(); i++)
-			{
-				if (usePerfData)
-					pFarIntensitiesTotal.push_back(pFarIntensities[i]);
-				if (useOtherModalities)
-					mFarIntensitiesTotal.push_back(mFarIntensities[i]);
-				if (useDistData)
-					tFarIntensitiesTotal.push_back(tFarIntensities[i]);
-			}
+			images.labelImage = mPreprocessingObj.PrepareTumroImageFromPoints<ImageType>(LabelImagePointer, tumorIndices);
 		}
-		catch (const std::exception& e1)
-		{
-			logger.WriteError("Error in calculating the features for patient ID = " + static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_PSR]) + ". Error code : " + std::string(e1.what()));
-			return false;
-		}
-	}
-	int totalNearSize = pNearIntensitiesTotal.size();
-	int totalFarSize = pFarIntensitiesTotal.size();
-	int totalSize = totalNearSize + totalFarSize;
+	};
 
-	for (size_t i = 0; i < pNearIntensitiesTotal.size(); i++)
+	NiftiDataManager::StreamedTrainingSamples samples;
+	if (!mNiftiLocalPtr.StreamTrainingSamples(qualifiedsubjects.size(), readSubject, mMaximumTrainingSamplesPerClass, mMaximumTrainingSamplesPerClass, samples,
+		useConventionalData, useDTIData, usePerfData, useDistData))
 	{
-		pIntensitiesTotal.push_back(pNearIntensitiesTotal[i]);
-		mIntensitiesTotal.push_back(mNearIntensitiesTotal[i]);
-		tIntensitiesTotal.push_back(tNearIntensitiesTotal[i]);
+		logger.WriteError(mNiftiLocalPtr.GetLastEncounteredError());
+		return false;
 	}
-	for (size_t i = 0; i < pFarIntensitiesTotal.size(); i++)
+	if (samples.nearSeen > samples.nearRows || samples.farSeen > samples.farRows)
 	{
-		pIntensitiesTotal.push_back(pFarIntensitiesTotal[i]);
-		mIntensitiesTotal.push_back(mFarIntensitiesTotal[i]);
-		tIntensitiesTotal.push_back(tFarIntensitiesTotal[i]);
+		std::cout << "Sampled " << samples.nearRows << " of " << samples.nearSeen << " near and " << samples.farRows << " of " << samples.farSeen << " far voxels." << std::endl;
 	}
 
+	int totalNearSize = samples.nearRows;
+	int totalFarSize = samples.farRows;
+	int totalSize = totalNearSize + totalFarSize;
+
+	const size_t sampleColumns = samples.Columns();
+
 	VariableLengthVectorType perfMeanVector;
-	vtkSmartPointer<vtkTable> reducedPerfusionFeatures;
+	std::vector<double> reducedPerfusionFeatures; // totalSize x NO_OF_PCS, near rows first
 	//------------------------------------------reduce perfusion intensities------------------------------------------
 	std::cout << "Applying pCA." << std::endl;
 	if (usePerfData)
 	{
-		perfMeanVector = mFeatureReductionLocalPtr.ComputeMeanOfGivenFeatureVectors(pIntensitiesTotal);
-		reducedPerfusionFeatures = mFeatureReductionLocalPtr.GetDiscerningPerfusionTimePoints(pIntensitiesTotal);
-	}
-
-	//-----------------------------------develope final near and far vectors------------------------------------------
+		// the perfusion curves are the leading columns of the sampled matrices, fitted in place
+		mFeatureReductionLocalPtr.BeginStreamedPCA(samples.perfusionColumns);
+		mFeatureReductionLocalPtr.AddStreamedPCASamples(samples.nearSamples.data(), samples.nearRows, sampleColumns);
+		mFeatureReductionLocalPtr.AddStreamedPCASamples(samples.farSamples.data(), samples.farRows, sampleColumns);
+		if (!mFeatureReductionLocalPtr.EndStreamedPCA())
+		{
+			logger.WriteError("PCA of the perfusion signal failed.");
+			return false;
+		}
+		perfMeanVector = mFeatureReductionLocalPtr.GetPerfusionMeanVector();
 
-	VectorVectorDouble fNearIntensities;
-	VectorVectorDouble fFarIntensities;
-	for (int i = 0; i < totalNearSize; i++)
-	{
-		VectorDouble cIntensityVectorPerSub;
-		if (usePerfData)
-			for (int j = 0; j < NO_OF_PCS; j++)
-				cIntensityVectorPerSub.push_back(reducedPerfusionFeatures->GetValue(i, j).ToDouble());
-		if (useOtherModalities)
-			for (unsigned int j = 0; j < mIntensitiesTotal[i].size(); j++)
-				cIntensityVectorPerSub.push_back(mIntensitiesTotal[i][j]);
-		if (useDistData)
-			cIntensityVectorPerSub.push_back(tIntensitiesTotal[i]);
-		fNearIntensities.push_back(cIntensityVectorPerSub);
-	}
-	for (int i = totalNearSize; i < totalSize; i++)
-	{
-		VectorDouble cIntensityVectorPerSub;
-		if (usePerfData)
-			for (int j = 0; j < NO_OF_PCS; j++)
-				cIntensityVectorPerSub.push_back(reducedPerfusionFeatures->GetValue(i, j).ToDouble());
-		if (useOtherModalities)
-			for (unsigned int j = 0; j < mIntensitiesTotal[i].size(); j++)
-				cIntensityVectorPerSub.push_back(mIntensitiesTotal[i][j]);
-		if (useDistData)
-			cIntensityVectorPerSub.push_back(tIntensitiesTotal[i]);
-		fFarIntensities.push_back(cIntensityVectorPerSub);
+		reducedPerfusionFeatures.resize(totalSize * NO_OF_PCS);
+		mFeatureReductionLocalPtr.ProjectSamples(samples.nearSamples.data(), samples.nearRows, sampleColumns, NO_OF_PCS, reducedPerfusionFeatures.data());
+		mFeatureReductionLocalPtr.ProjectSamples(samples.farSamples.data(), samples.farRows, sampleColumns, NO_OF_PCS, reducedPerfusionFeatures.data() + totalNearSize * NO_OF_PCS);
 	}
 
 	//---------------------training data formulation-----------------------------------
+	// the final near and far rows are written straight from the sampled matrices: [reduced perfusion, other modalities, distance, label]
 	std::cout << "Training data formulation. Assigning class labels." << std::endl;
-	mFeatureExtractionLocalPtr.FormulateTrainingData(fNearIntensities, fFarIntensities);
-	VariableSizeMatrixType TrainingData = mFeatureExtractionLocalPtr.GetTrainingData();
+	const size_t perfusionFeatures = usePerfData ? NO_OF_PCS : 0;
+	const size_t numberOfFeatures = perfusionFeatures + samples.otherColumns + samples.distanceColumns;
+	VariableSizeMatrixType TrainingData;
+	TrainingData.SetSize(totalSize, numberOfFeatures + 1);
+	auto appendSamples = [&](const std::vector<double> &data, size_t rows, size_t firstRow, double label)
+	{
+		for (size_t i = 0; i < rows; i++)
+		{
+			const double *row = &data[i * sampleColumns];
+			const size_t outputRow = firstRow + i;
+			for (size_t j = 0; j < perfusionFeatures; j++)
+				TrainingData(outputRow, j) = reducedPerfusionFeatures[outputRow * NO_OF_PCS + j];
+			for (size_t j = 0; j < samples.otherColumns + samples.distanceColumns; j++)
+				TrainingData(outputRow, perfusionFeatures + j) = row[samples.perfusionColumns + j];
+			TrainingData(outputRow, numberOfFeatures) = label;
+		}
+	};
+	appendSamples(samples.nearSamples, samples.nearRows, 0, TRAINING_LABEL_NEAR);
+	appendSamples(samples.farSamples, samples.farRows, totalNearSize, TRAINING_LABEL_FAR);
+	samples = NiftiDataManager::StreamedTrainingSamples();
+	reducedPerfusionFeatures = std::vector<double>();
 
 	//typedef vnl_matrix<double> MatrixType;
 	//MatrixType data;
@@ -274,6 +212,7 @@ bool RecurrenceEstimator::TrainNewModelOnGivenData(const std::vector<std::map<CA
 	try
 	{
 		mOutputLocalPtr.SaveModelResults(ScaledTrainingData, mFeatureScalingLocalPtr.GetMeanVector(), mFeatureScalingLocalPtr.GetStdVector(), perfMeanVector, mFeatureReductionLocalPtr.GetPCATransformationMatrix(),useConventionalData, useDTIData, usePerfData, useDistData, size);
+
 	}
 	catch (const std::exception& e1)
 	{
@@ -291,6 +230,23 @@ bool RecurrenceEstimator::TrainNewModelOnGivenData(const std::vector<std::map<CA
 		logger.WriteError("Training on the subjects failed. Error code : " + std::string(e1.what()));
 		return false;
 	}
+
+	// the whole model (including the SVM) in a single binary file for fast loading; written last so that it is newer than the CSV files
+	mModelContainer.Clear();
+	mModelContainer.SetMetadata("Application", "RecurrenceEstimator");
+	mModelContainer.AddVector("Recurrence_ZScore_Mean", mFeatureScalingLocalPtr.GetMeanVector());
+	mModelContainer.AddVector("Recurrence_ZScore_Std", mFeatureScalingLocalPtr.GetStdVector());
+	if (usePerfData)
+	{
+		mModelContainer.AddMatrix("Recurrence_COEF", mFeatureReductionLocalPtr.GetPCATransformationMatrix());
+		mModelContainer.AddVector("Recurrence_MR", perfMeanVector);
+	}
+	if (!mModelContainer.AddMetadataFromFile(mTrainedModelNameXML, outputdirectory + "/" + mTrainedModelNameXML) ||
+		!mModelContainer.Write(outputdirectory + "/" + mTrainedModelNameContainer))
+	{
+		logger.WriteError("Error in writing model container: " + mModelContainer.GetLastEncounteredError());
+	}
+	mModelContainer.Clear();
 	mFeatureReductionLocalPtr.ResetParameters();
   mFeatureScalingLocalPtr.ResetParameters(); 
   return true;
@@ -383,7 +339,17 @@ bool RecurrenceEstimator::RecurrenceEstimateOnExistingModel(std::vector<std::map
   //  {
   try
   {
-	  mOutputLocalPtr.ReadModelParameters(modeldirectory + "/Recurrence_ZScore_Mean.csv", modeldirectory + "/Recurrence_ZScore_Std.csv", modeldirectory + "/Recurrence_COEF.csv", modeldirectory + "/Recurrence_MR.csv", mean, stds, pca_coefficients, pca_mean);
+	  if (LoadModelContainer(modeldirectory) && mModelContainer.HasArray("Recurrence_COEF"))
+	  {
+		  mean = mModelContainer.GetVector("Recurrence_ZScore_Mean");
+		  stds = mModelContainer.GetVector("Recurrence_ZScore_Std");
+		  pca_coefficients = mModelContainer.GetMatrix("Recurrence_COEF");
+		  pca_mean = mModelContainer.GetVector("Recurrence_MR");
+	  }
+	  else
+	  {
+		  mOutputLocalPtr.ReadModelParameters(modeldirectory + "/Recurrence_ZScore_Mean.csv", modeldirectory + "/Recurrence_ZScore_Std.csv", modeldirectory + "/Recurrence_COEF.csv", modeldirectory + "/Recurrence_MR.csv", mean, stds, pca_coefficients, pca_mean);
+	  }
 	  mFeatureReductionLocalPtr.SetParameters(pca_coefficients, pca_mean);
 	  mFeatureScalingLocalPtr.SetParameters(mean, stds);
 	  //  }
@@ -505,7 +471,14 @@ bool RecurrenceEstimator::RecurrenceEstimateOnExistingModel(std::vector<std::map
 
     VectorVectorDouble reducedPerfusionFeatures;
     if (usePerfData)
+    {
       reducedPerfusionFeatures = mFeatureReductionLocalPtr.ApplyPCAOnTestData(perfusionIntensities);
+      if (reducedPerfusionFeatures.empty())
+      {
+        logger.WriteError("PCA of the perfusion signal failed: " + mFeatureReductionLocalPtr.GetLastEncounteredError());
+        return false;
+      }
+    }
 
     int NumberOfPCs = 5;
     VectorVectorDouble globaltestintensities;
@@ -594,7 +567,7 @@ bool RecurrenceEstimator::RecurrenceEstimateOnExistingModel(std::vector<std::map
     cbica::Logging(loggerFile, "Before testing.");
     try
     {
-      if (cbica::fileExists(modeldirectory + "/" + mTrainedModelNameCSV))
+      if (mModelContainer.HasArray(cbica::getFilenameBase(mTrainedModelNameCSV, false)) || cbica::fileExists(modeldirectory + "/" + mTrainedModelNameCSV))
       {
         cbica::Logging(loggerFile, "Before testing 1.");
         VariableLengthVectorType result;
@@ -610,7 +583,7 @@ bool RecurrenceEstimator::RecurrenceEstimateOnExistingModel(std::vector<std::map
       {
         cbica::Logging(loggerFile, "Before testing 2.");
         VectorDouble result;
-        result = testOpenCVSVM(ScaledTestingData, modeldirectory + "/" + mTrainedModelNameXML);
+        result = TestOpenCVSVMModel(ScaledTestingData, modeldirectory);
         for (unsigned int index = 0; index < result.size(); index++)
           RecProbabilityMap->SetPixel(testindices[index], result[index] * 1);
         result_modified = result;
@@ -660,30 +633,95 @@ bool RecurrenceEstimator::RecurrenceEstimateOnExistingModel(std::vector<std::map
 
 
 
+std::vector< std::string > RecurrenceEstimator::GetModelFiles(const std::string &modeldirectory)
+{
+  std::vector< std::string > modelFiles = { "Recurrence_ZScore_Mean.csv", "Recurrence_ZScore_Std.csv" };
+
+  // PCA parameters are only written for models trained with perfusion data
+  if (cbica::isFile(modeldirectory + "/Recurrence_COEF.csv") || cbica::isFile(modeldirectory + "/Recurrence_MR.csv"))
+  {
+    modelFiles.push_back("Recurrence_COEF.csv");
+    modelFiles.push_back("Recurrence_MR.csv");
+  }
+
+  // same preference as in testing: the CSV model over the OpenCV one
+  if (cbica::isFile(modeldirectory + "/" + mTrainedModelNameCSV))
+  {
+    modelFiles.push_back(mTrainedModelNameCSV);
+  }
+  else
+  {
+    modelFiles.push_back(mTrainedModelNameXML);
+  }
+  return modelFiles;
+}
+
+bool RecurrenceEstimator::LoadModelContainer(const std::string &modeldirectory)
+{
+  if (!mModelContainer.ReadModelDirectory(modeldirectory, mTrainedModelNameContainer, GetModelFiles(modeldirectory), "RecurrenceEstimator"))
+  {
+    logger.WriteError("Model files could not be read: " + mModelContainer.GetLastEncounteredError());
+    return false;
+  }
+  if (!mModelContainer.GetLastEncounteredError().empty())
+  {
+    // e.g., a read-only model directory; the converted model is still usable for this run
+    logger.Write("Model container could not be written: " + mModelContainer.GetLastEncounteredError());
+  }
+  return true;
+}
+
+VectorDouble RecurrenceEstimator::TestOpenCVSVMModel(const VariableSizeMatrixType &testData, const std::string &modeldirectory)
+{
+  const auto serializedModel = mModelContainer.GetMetadata(mTrainedModelNameXML);
+  if (!serializedModel.empty())
+  {
+    return testLoadedOpenCVSVM(testData, cv::Algorithm::loadFromString< cv::ml::SVM >(serializedModel));
+  }
+  return testOpenCVSVM(testData, modeldirectory + "/" + mTrainedModelNameXML);
+}
+
 VariableLengthVectorType RecurrenceEstimator::DistanceFunction(const VariableSizeMatrixType &testData, const std::string &filename, const double &rho, const double &bestg)
 {
-  CSVFileReaderType::Pointer readerMean = CSVFileReaderType::New();
-  readerMean->SetFileName(filename);
-  readerMean->SetFieldDelimiterCharacter(',');
-  readerMean->HasColumnHeadersOff();
-  readerMean->HasRowHeadersOff();
-  readerMean->Parse();
-  MatrixType dataMatrix = readerMean->GetArray2DDataObject()->GetMatrix();
+  // last column of the model holds the coefficients
+  const double *modelData = nullptr;
+  size_t modelRows = 0, modelCols = 0;
+  MatrixType dataMatrix;
+  auto modelArray = mModelContainer.GetArray(cbica::getFilenameBase(filename, false));
+  if (modelArray.data != nullptr)
+  {
+    modelData = modelArray.data;
+    modelRows = modelArray.rows;
+    modelCols = modelArray.cols;
+  }
+  else
+  {
+    CSVFileReaderType::Pointer readerMean = CSVFileReaderType::New();
+    readerMean->SetFileName(filename);
+    readerMean->SetFieldDelimiterCharacter(',');
+    readerMean->HasColumnHeadersOff();
+    readerMean->HasRowHeadersOff();
+    readerMean->Parse();
+    dataMatrix = readerMean->GetArray2DDataObject()->GetMatrix();
+    modelData = dataMatrix.data_block();
+    modelRows = dataMatrix.rows();
+    modelCols = dataMatrix.cols();
+  }
 
   VariableSizeMatrixType SupportVectors;
   VariableLengthVectorType Coefficients;
   VariableLengthVectorType Distances;
 
-  SupportVectors.SetSize(dataMatrix.rows(), dataMatrix.cols() - 1);
-  Coefficients.SetSize(dataMatrix.rows(), 1);
+  SupportVectors.SetSize(modelRows, modelCols - 1);
+  Coefficients.SetSize(modelRows, 1);
   Distances.SetSize(testData.Rows(), 1);
 
-  for (unsigned int i = 0; i < dataMatrix.rows(); i++)
+  for (unsigned int i = 0; i < modelRows; i++)
   {
     unsigned int j = 0;
-    for (j = 0; j < dataMatrix.cols() - 1; j++)
-      SupportVectors(i, j) = dataMatrix(i, j);
-    Coefficients[i] = dataMatrix(i, j);
+    for (j = 0; j < modelCols - 1; j++)
+      SupportVectors(i, j) = modelData[i * modelCols + j];
+    Coefficients[i] = modelData[i * modelCols + j];
   }
   VariableLengthVectorType yyy;
   yyy.SetSize(testData.Rows(), 1);
@@ -154,12 +154,13 @@ int RecurrencePredictionOnExistingModel(const std::string modeldirectory,
   }
   return EXIT_SUCCESS;
 }
-int PrepareNewRecurrencePredictionModel(const std::string inputdirectory, const std::string outputdirectory)
+int PrepareNewRecurrencePredictionModel(const std::string inputdirectory, const std::string outputdirectory, const size_t maximumSamplesPerClass)
 {
   std::cout << "Module loaded: Prepare Recurrence Prediction Model." << std::endl;
   std::vector<double> finalresult;
   std::vector<std::map<CAPTK::ImageModalityType, std::string>> QualifiedSubjects = LoadQualifiedSubjectsFromGivenDirectoryForRecurrence(CAPTK::MachineLearningApplicationSubtype::TRAINING, inputdirectory, true, true, true, true);
   RecurrenceEstimator objRecurrencePredictor;
+  objRecurrencePredictor.SetMaximumTrainingSamplesPerClass(maximumSamplesPerClass);
   std::cout << "Number of subjects with required input: " << QualifiedSubjects.size() << std::endl;
   objRecurrencePredictor.TrainNewModelOnGivenData(QualifiedSubjects, outputdirectory, true, true, true, true);
   return EXIT_SUCCESS;
@@ -171,9 +172,11 @@ int main(int argc, char **argv)
   parser.addRequiredParameter("i", "input", cbica::Parameter::STRING, "", "The input directory having test subjects");
   parser.addOptionalParameter("m", "model", cbica::Parameter::STRING, "", "The directory having SVM models");
   parser.addRequiredParameter("o", "output", cbica::Parameter::STRING, "", "The output direcory to write output");
+  parser.addOptionalParameter("n", "maxSamples", cbica::Parameter::INTEGER, "0 - N", "Maximum number of near (and far) voxels sampled from all subjects for training", "Defaults to 0, which uses every voxel");
   parser.addOptionalParameter("L", "Logger", cbica::Parameter::STRING, "log file which user has write access to", "Full path to log file to store console outputs", "By default, only console output is generated");
   //parser.exampleUsage("RecurrenceEstimator -t 0 -i <input dir> -o <output dir>");
   parser.addExampleUsage("-t 0 -i C:/properly/formatted/inputDir -o C:/outputDir", "Trains a new model based on the samples in inputDir");
+  parser.addExampleUsage("-t 0 -i C:/properly/formatted/inputDir -o C:/outputDir -n 50000", "Trains a new model on at most 50000 near and 50000 far voxels sampled from inputDir");
   parser.addExampleUsage("-t 1 -i C:/input -m C:/model -o C:/output", "Tests an existing model for inputs in 'C:/input' based on 'C:/model' ");
   parser.addApplicationDescription("Recurrence Estimator Training and Prediction application");
 
@@ -190,6 +193,7 @@ int main(int argc, char **argv)
   int tempPosition;
   std::string inputDirectoryName, modelDirectoryName, outputDirectoryName, toWrite;
   int applicationType;
+  size_t maximumSamplesPerClass = 0;
   //int useConventional;
   //int usePerfusion;
   //int useDTI;
@@ -219,6 +223,16 @@ int main(int argc, char **argv)
   {
     applicationType = atoi(argv[tempPosition + 1]);
   }
+  if (parser.compareParameter("n", tempPosition))
+  {
+    const int maxSamples = atoi(argv[tempPosition + 1]);
+    if (maxSamples < 0)
+    {
+      std::cout << "The maximum number of samples cannot be negative." << std::endl;
+      return EXIT_FAILURE;
+    }
+    maximumSamplesPerClass = static_cast< size_t >(maxSamples);
+  }
 
   //if (parser.compareParameter("c", tempPosition))
   //{
@@ -296,7 +310,7 @@ int main(int argc, char **argv)
     RecurrencePredictionOnExistingModel(modelDirectoryName, inputDirectoryName, outputDirectoryName);
   }
   else if (applicationType == CAPTK::MachineLearningApplicationSubtype::TRAINING)
-    PrepareNewRecurrencePredictionModel(inputDirectoryName, outputDirectoryName);
+    PrepareNewRecurrencePredictionModel(inputDirectoryName, outputDirectoryName, maximumSamplesPerClass);
   else
   {
     parser.echoVersion();
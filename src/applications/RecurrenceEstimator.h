@@ -16,6 +16,7 @@ See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
 //#include "CAPTk.h"
 #include "NiftiDataManager.h"
 #include "OutputWritingManager.h"
+#include "ModelContainer.h"
 #include "FeatureReductionClass.h"
 #include "FeatureScalingClass.h"
 #include "FeatureExtractionClass.h"
@@ -83,6 +84,8 @@ public:
 	{
 		mTrainedModelNameXML = "Recurrence_SVM_Model.xml";
 		mTrainedModelNameCSV = "Recurrence_SVM_Model.csv";
+		mTrainedModelNameContainer = std::string("Recurrence_Model") + MODEL_CONTAINER_EXT;
+		mMaximumTrainingSamplesPerClass = 0;
 		logger.UseNewFile(loggerFile);
 	};
 
@@ -93,8 +96,33 @@ public:
 	std::string mLastEncounteredError;
 	std::string mTrainedModelNameXML;
 	std::string mTrainedModelNameCSV;
+	std::string mTrainedModelNameContainer;
 	cbica::Logging logger;
 
+	//! Maximum number of near (and far) voxels sampled from the whole cohort for training; 0 uses every voxel
+	size_t mMaximumTrainingSamplesPerClass;
+
+	//! Sets the maximum number of near (and far) voxels sampled from the whole cohort for training; 0 uses every voxel
+	void SetMaximumTrainingSamplesPerClass(size_t maximumSamples)
+	{
+		mMaximumTrainingSamplesPerClass = maximumSamples;
+	}
+
+	/**
+	\brief Loads the binary model container from the model directory
+
+	If only the CSV model files are present, or if any of them is newer than the container, they are converted to a
+	container (written next to them if the directory is writable). The conversion fails if any model file is missing.
+	\return True if mModelContainer holds the model after the call
+	*/
+	bool LoadModelContainer(const std::string &modeldirectory);
+
+	//! The model files (relative to the model directory) that make up a model, see LoadModelContainer()
+	std::vector< std::string > GetModelFiles(const std::string &modeldirectory);
+
+	//! Distances from the OpenCV SVM model, taken from the container if it holds the model
+	VectorDouble TestOpenCVSVMModel(const VariableSizeMatrixType &testData, const std::string &modeldirectory);
+
 	VariableLengthVectorType DistanceFunction(const VariableSizeMatrixType &testData, const std::string &filename, const double &rho, const double &bestg);
 	/**
 	\brief Get the size of the Feature Vector
@@ -179,6 +207,7 @@ public:
 	FeatureReductionClass mFeatureReductionLocalPtr;
 	FeatureScalingClass mFeatureScalingLocalPtr;
 	FeatureExtractionClass mFeatureExtractionLocalPtr;
+	ModelContainer mModelContainer;
 	//SVMClassificationClass mClassificationLocalPtr;
 
 	void Run(const std::string &modeldirectory, const std::string &inputdirectory, const std::string &outputdirectory, bool useConvData, bool useDTIData, bool usePerfData, bool useDistData)
@@ -687,7 +716,17 @@ void RecurrenceEstimator::RecurrenceEstimateOnGivenSubjectUsingExistingModel(typ
 	}
 	else
 	{
-		mOutputLocalPtr.ReadModelParameters(modeldirectory + "/Recurrence_ZScore_Mean.csv", modeldirectory + "/Recurrence_ZScore_Std.csv", modeldirectory + "/Recurrence_COEF.csv", modeldirectory + "/Recurrence_MR.csv", mean, stds, pca_coefficients, pca_mean);
+		if (LoadModelContainer(modeldirectory) && mModelContainer.HasArray("Recurrence_COEF"))
+		{
+			mean = mModelContainer.GetVector("Recurrence_ZScore_Mean");
+			stds = mModelContainer.GetVector("Recurrence_ZScore_Std");
+			pca_coefficients = mModelContainer.GetMatrix("Recurrence_COEF");
+			pca_mean = mModelContainer.GetVector("Recurrence_MR");
+		}
+		else
+		{
+			mOutputLocalPtr.ReadModelParameters(modeldirectory + "/Recurrence_ZScore_Mean.csv", modeldirectory + "/Recurrence_ZScore_Std.csv", modeldirectory + "/Recurrence_COEF.csv", modeldirectory + "/Recurrence_MR.csv", mean, stds, pca_coefficients, pca_mean);
+		}
 		mFeatureReductionLocalPtr.SetParameters(pca_coefficients, pca_mean);
 		mFeatureScalingLocalPtr.SetParameters(mean, stds);
 	}
@@ -971,7 +1010,7 @@ void RecurrenceEstimator::RecurrenceEstimateOnGivenSubjectUsingExistingModel(typ
 
 	try
 	{
-		if (cbica::fileExists(modeldirectory + "/" + mTrainedModelNameCSV))
+		if (mModelContainer.HasArray(cbica::getFilenameBase(mTrainedModelNameCSV, false)) || cbica::fileExists(modeldirectory + "/" + mTrainedModelNameCSV))
 		{
 			//cbica::Logging(loggerFile, "Before testing 1.");
 			VariableLengthVectorType result;
@@ -987,7 +1026,7 @@ void RecurrenceEstimator::RecurrenceEstimateOnGivenSubjectUsingExistingModel(typ
 		{
 			//cbica::Logging(loggerFile, "Before testing 2.");
 			VectorDouble result;
-			result = testOpenCVSVM(ScaledTestingData, modeldirectory + "/" + mTrainedModelNameXML);
+			result = TestOpenCVSVMModel(ScaledTestingData, modeldirectory);
 			for (unsigned int index = 0; index < result.size(); index++)
 				RecProbabilityMap->SetPixel(testindices[index], result[index] * 1);
 //			result_modified = result;
@@ -221,28 +221,11 @@ int SurvivalPredictor::PrepareNewSurvivalPredictionModel(const std::string &inpu
   VariableSizeMatrixType EighteenModelFeatures;
   mFeatureExtractionLocalPtr.FormulateSurvivalTrainingData(scaledFeatureSet, AllSurvival, SixModelFeatures, EighteenModelFeatures);
 
-  try
-  {
-	  data.set_size(161, 1); // TOCHECK - are these hard coded sizes fine?
-	  for (unsigned int i = 0; i < meanVector.Size(); i++)
-		  data(i, 0) = meanVector[i];
-	  typedef itk::CSVNumericObjectFileWriter<double, 161, 1> WriterTypeVector;
-	  WriterTypeVector::Pointer writerv = WriterTypeVector::New();
-	  writerv->SetFileName(outputdirectory + "/Survival_ZScore_Mean.csv");
-	  writerv->SetInput(&data);
-	  writerv->Write();
-
-	  for (unsigned int i = 0; i < stdVector.Size(); i++)
-		  data(i, 0) = stdVector[i];
-	  writerv->SetFileName(outputdirectory + "/Survival_ZScore_Std.csv");
-	  writerv->SetInput(&data);
-	  writerv->Write();
-  }
-  catch (const std::exception& e1)
-  {
-	  logger.WriteError("Error in writing output files to the output directory = " + outputdirectory + "Error code : " + std::string(e1.what()));
-	  return false;
-  }
+  // the z-scores and both SVMs are written to a single model container once the SVMs are trained
+  mModelContainer.Clear();
+  mModelContainer.SetMetadata("Application", "SurvivalPredictor");
+  mModelContainer.AddVector("Survival_ZScore_Mean", meanVector);
+  mModelContainer.AddVector("Survival_ZScore_Std", stdVector);
 
 //  //---------------------------------------------------------------------------
   VariableSizeMatrixType SixModelSelectedFeatures = SelectSixMonthsModelFeatures(SixModelFeatures);
@@ -265,6 +248,14 @@ int SurvivalPredictor::PrepareNewSurvivalPredictionModel(const std::string &inpu
      logger.WriteError("Training on the given subjects failed. Error code : " + std::string(e1.what()));
      return false;
    }
+   if (!mModelContainer.AddMetadataFromFile(mSixTrainedFile, outputdirectory + "/" + mSixTrainedFile) ||
+     !mModelContainer.AddMetadataFromFile(mEighteenTrainedFile, outputdirectory + "/" + mEighteenTrainedFile) ||
+     !mModelContainer.Write(outputdirectory + "/" + mTrainedModelNameContainer))
+   {
+     logger.WriteError("Error in writing model container: " + mModelContainer.GetLastEncounteredError());
+     return false;
+   }
+   mModelContainer.Clear();
    std::cout << std::endl << "Model saved to the output directory." << std::endl;
    return true;
 }
@@ -297,20 +288,29 @@ VariableLengthVectorType SurvivalPredictor::DistanceFunction(const VariableSizeM
 	readerMean->Parse();
 	MatrixType dataMatrix = readerMean->GetArray2DDataObject()->GetMatrix();
 
+	ModelContainer::ArrayEntry model;
+	model.data = dataMatrix.data_block();
+	model.rows = dataMatrix.rows();
+	model.cols = dataMatrix.cols();
+	return DistanceFunction(testData, model, rho, bestg);
+}
+
+VariableLengthVectorType SurvivalPredictor::DistanceFunction(const VariableSizeMatrixType &testData, const ModelContainer::ArrayEntry &model, const double &rho, const double &bestg)
+{
 	VariableSizeMatrixType SupportVectors;
 	VariableLengthVectorType Coefficients;
 	VariableLengthVectorType Distances;
 
-	SupportVectors.SetSize(dataMatrix.rows(), dataMatrix.cols() - 1);
-	Coefficients.SetSize(dataMatrix.rows(), 1);
+	SupportVectors.SetSize(model.rows, model.cols - 1);
+	Coefficients.SetSize(model.rows, 1);
 	Distances.SetSize(testData.Rows(), 1);
 
-	for (unsigned int i = 0; i < dataMatrix.rows(); i++)
+	for (unsigned int i = 0; i < model.rows; i++)
 	{
 		unsigned int j = 0;
-		for (j = 0; j < dataMatrix.cols() - 1; j++)
-			SupportVectors(i, j) = dataMatrix(i, j);
-		Coefficients[i] = dataMatrix(i, j);
+		for (j = 0; j < model.cols - 1; j++)
+			SupportVectors(i, j) = model.data[i * model.cols + j];
+		Coefficients[i] = model.data[i * model.cols + j];
 	}
 
 	for (unsigned int patID = 0; patID < testData.Rows(); patID++)
@@ -501,44 +501,20 @@ VectorDouble SurvivalPredictor::SurvivalPredictionOnExistingModel(const std::str
 		return results;
 	}
 
-	MatrixType meanMatrix;
-	VariableLengthVectorType mean;
-	VariableLengthVectorType stddevition;
-	try
-	{
-		reader->SetFileName(modeldirectory + "/Survival_ZScore_Mean.csv");
-		reader->SetFieldDelimiterCharacter(',');
-		reader->HasColumnHeadersOff();
-		reader->HasRowHeadersOff();
-		reader->Parse();
-		meanMatrix = reader->GetArray2DDataObject()->GetMatrix();
-
-		mean.SetSize(meanMatrix.size());
-		for (unsigned int i = 0; i < meanMatrix.size(); i++)
-			mean[i] = meanMatrix(i, 0);
-	}
-	catch (const std::exception& e1)
+	if (!LoadModelContainer(mModelContainer, modeldirectory, { "Survival_ZScore_Mean.csv", "Survival_ZScore_Std.csv" }))
 	{
-		logger.WriteError("Error in reading the file: " + modeldirectory + "/Survival_ZScore_Mean.csv. Error code : " + std::string(e1.what()));
 		return results;
 	}
-	MatrixType stdMatrix;
-	try
+	const VariableLengthVectorType mean = mModelContainer.GetVector("Survival_ZScore_Mean");
+	const VariableLengthVectorType stddevition = mModelContainer.GetVector("Survival_ZScore_Std");
+
+	// the SVMs are the ones shipped with the data; the plain support vectors take precedence over the OpenCV models
+	const std::string modeldirectory1 = getCaPTkDataDir() + "/survival";
+	const bool supportVectorsShipped = cbica::isFile(modeldirectory1 + "/Survival_SVM_Model6.csv") && cbica::isFile(modeldirectory1 + "/Survival_SVM_Model18.csv");
+	if (!LoadModelContainer(mDefaultModelContainer, modeldirectory1, supportVectorsShipped ?
+		std::vector< std::string >{ "Survival_SVM_Model6.csv", "Survival_SVM_Model18.csv" } :
+		std::vector< std::string >{ mSixTrainedFile, mEighteenTrainedFile }))
 	{
-		reader->SetFileName(modeldirectory + "/Survival_ZScore_Std.csv");
-		reader->SetFieldDelimiterCharacter(',');
-		reader->HasColumnHeadersOff();
-		reader->HasRowHeadersOff();
-		reader->Parse();
-		stdMatrix = reader->GetArray2DDataObject()->GetMatrix();
-
-		stddevition.SetSize(stdMatrix.size());
-		for (unsigned int i = 0; i < stdMatrix.size(); i++)
-			stddevition[i] = stdMatrix(i, 0);
-	}
-	catch (const std::exception& e1)
-	{
-		logger.WriteError("Error in reading the file: " + modeldirectory + "/Survival_ZScore_Std.csv. Error code : " + std::string(e1.what()));
 		return results;
 	}
 	//----------------------------------------------------
@@ -666,13 +642,16 @@ VectorDouble SurvivalPredictor::SurvivalPredictionOnExistingModel(const std::str
 		std::ofstream myfile;
 		myfile.open(outputdirectory + "/results.csv");
 		myfile << "SubjectName,SPI (6 months), SPI (18 months), Composite SPI\n";
-		std::string modeldirectory1 = getCaPTkDataDir() + "/survival";
-		if (cbica::fileExists(modeldirectory1 + "/Survival_SVM_Model6.csv") == true && cbica::fileExists(modeldirectory1 + "/Survival_SVM_Model18.csv") == true)
+		const auto sixModel = mDefaultModelContainer.GetArray("Survival_SVM_Model6");
+		const auto eighteenModel = mDefaultModelContainer.GetArray("Survival_SVM_Model18");
+		const auto sixSerializedModel = mDefaultModelContainer.GetMetadata(mSixTrainedFile);
+		const auto eighteenSerializedModel = mDefaultModelContainer.GetMetadata(mEighteenTrainedFile);
+		if ((sixModel.data != nullptr) && (eighteenModel.data != nullptr))
 		{
 			VariableLengthVectorType result_6;
 			VariableLengthVectorType result_18;
-			result_6 = DistanceFunction(SixModelSelectedFeatures, modeldirectory1 + "/Survival_SVM_Model6.csv", -1.0927, 0.0313);
-			result_18 = DistanceFunction(EighteenModelSelectedFeatures, modeldirectory1 + "/Survival_SVM_Model18.csv", -0.2854, 0.5);
+			result_6 = DistanceFunction(SixModelSelectedFeatures, sixModel, -1.0927, 0.0313);
+			result_18 = DistanceFunction(EighteenModelSelectedFeatures, eighteenModel, -0.2854, 0.5);
 			results = CombineEstimates(result_6, result_18);
 			for (size_t i = 0; i < results.size(); i++)
 			{
@@ -680,12 +659,12 @@ VectorDouble SurvivalPredictor::SurvivalPredictionOnExistingModel(const std::str
 				myfile << static_cast<std::string>(currentsubject[CAPTK::ImageModalityType::IMAGE_TYPE_SUDOID]) + "," + std::to_string(result_6[i]) + "," + std::to_string(result_18[i]) + "," + std::to_string(results[i]) + "\n";
 			}
 		}
-		else if (cbica::fileExists(modeldirectory1 + "/Survival_SVM_Model6.xml") == true && cbica::fileExists(modeldirectory1 + "/Survival_SVM_Model18.xml") == true)
+		else if (!sixSerializedModel.empty() && !eighteenSerializedModel.empty())
 		{
 			VectorDouble result_6;
 			VectorDouble result_18;
-			result_6 = testOpenCVSVM(ScaledTestingData, modeldirectory1 + "/Survival_SVM_Model6.xml");
-			result_18 = testOpenCVSVM(ScaledTestingData, modeldirectory1 + "/Survival_SVM_Model18.xml");
+			result_6 = testLoadedOpenCVSVM(ScaledTestingData, cv::Algorithm::loadFromString< cv::ml::SVM >(sixSerializedModel));
+			result_18 = testLoadedOpenCVSVM(ScaledTestingData, cv::Algorithm::loadFromString< cv::ml::SVM >(eighteenSerializedModel));
 			results = CombineEstimates(result_6, result_18);
 			for (size_t i = 0; i < results.size(); i++)
 			{
@@ -704,6 +683,21 @@ VectorDouble SurvivalPredictor::SurvivalPredictionOnExistingModel(const std::str
 
 }
 
+bool SurvivalPredictor::LoadModelContainer(ModelContainer &container, const std::string &modeldirectory, const std::vector< std::string > &modelFiles)
+{
+	if (!container.ReadModelDirectory(modeldirectory, mTrainedModelNameContainer, modelFiles, "SurvivalPredictor"))
+	{
+		logger.WriteError("Model files could not be read: " + container.GetLastEncounteredError());
+		return false;
+	}
+	if (!container.GetLastEncounteredError().empty())
+	{
+		// e.g., the read-only data directory; the converted model is still usable for this run
+		logger.Write("Model container could not be written: " + container.GetLastEncounteredError());
+	}
+	return true;
+}
+
 VariableSizeMatrixType SurvivalPredictor::SelectSixMonthsModelFeatures(const VariableSizeMatrixType &SixModelFeatures)
 {
    int selectedFeatures[20] = { 1,    5,    9,    10,    20,    23,    24,    37,    38,    43,    44,    48,    49,    50,    51,    56,    57,    61,    62,    63};
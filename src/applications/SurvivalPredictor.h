@@ -29,6 +29,7 @@ See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
 #include "itkSignedMaurerDistanceMapImageFilter.h"
 #include "CaPTkEnums.h"
 #include "cbicaLogging.h"
+#include "ModelContainer.h"
 #ifdef APP_BASE_CAPTK_H
 #include "ApplicationBase.h"
 #endif
@@ -77,6 +78,7 @@ public:
 	{
 		mSixTrainedFile = "Survival_SVM_Model6.xml";
 		mEighteenTrainedFile = "Survival_SVM_Model18.xml";
+		mTrainedModelNameContainer = std::string("Survival_Model") + MODEL_CONTAINER_EXT;
 		logger.UseNewFile(loggerFile);
 	}
 
@@ -84,6 +86,9 @@ public:
   ~SurvivalPredictor() {};
 
 	std::string mEighteenTrainedFile, mSixTrainedFile;
+	std::string mTrainedModelNameContainer;
+	ModelContainer mModelContainer;        //!< z-scores (and trained SVMs) of the given model directory
+	ModelContainer mDefaultModelContainer; //!< SVMs shipped in the data directory
 	FeatureExtractionClass mFeatureExtractionLocalPtr;
 	FeatureScalingClass mFeatureScalingLocalPtr;
 	cbica::Logging logger;
@@ -268,7 +273,16 @@ public:
 	template<class ImageType>
 	typename ImageType::Pointer RemoveSmallerComponentsFromTumor(const typename ImageType::Pointer &etumorImage, const typename ImageType::Pointer &ncrImage);
 
+	/**
+	\brief Loads the model container of the given directory, converting its CSV and XML model files first if needed
+
+	\return True if the container holds the model after the call
+	*/
+	bool LoadModelContainer(ModelContainer &container, const std::string &modeldirectory, const std::vector< std::string > &modelFiles);
+
 	VariableLengthVectorType DistanceFunction(const VariableSizeMatrixType &testData, const std::string &filename, const double &rho, const double &bestg);
+	//! RBF distances from the support vectors stored with their coefficients in the last column
+	VariableLengthVectorType DistanceFunction(const VariableSizeMatrixType &testData, const ModelContainer::ArrayEntry &model, const double &rho, const double &bestg);
 	VectorDouble CombineEstimates(const VariableLengthVectorType &estimates1, const VariableLengthVectorType &estimates2);
 	VectorDouble CombineEstimates(const VectorDouble &estimates1, const VectorDouble &estimates2);
 
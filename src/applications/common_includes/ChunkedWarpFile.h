@@ -0,0 +1,108 @@
+/*=========================================================================
+
+  Program:   ALFABIS fast medical image registration programs
+  Language:  C++
+  Website:   github.com/pyushkevich/greedy
+  Copyright (c) Paul Yushkevich, University of Pennsylvania. All rights reserved.
+
+  This program is part of ALFABIS: Adaptive Large-Scale Framework for
+  Automatic Biomedical Image Segmentation.
+
+  ALFABIS development is funded by the NIH grant R01 EB017255.
+
+  ALFABIS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ALFABIS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ALFABIS.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef CHUNKEDWARPFILE_H
+#define CHUNKEDWARPFILE_H
+
+#include "itkImage.h"
+#include "itkCovariantVector.h"
+#include <string>
+#include <vector>
+
+/**
+ * Reads and writes warps in a tiled, compressed container (extension .gwarp).
+ *
+ * The warp is stored in physical units as float, split into tiles that are
+ * compressed separately with zlib. A table of tile offsets follows the header, so
+ * that ReadRegion() only decompresses the tiles that overlap the requested
+ * region. The file can also hold a root warp (e.g. the stationary velocity of
+ * diffeomorphic demons), together with the number of times it must be squared to
+ * get the actual warp. Exponentiation is not done here, see Header::exponent.
+ */
+template <class TFloat, unsigned int VDim>
+class ChunkedWarpFile
+{
+public:
+  typedef itk::CovariantVector<TFloat, VDim>          VectorType;
+  typedef itk::Image<VectorType, VDim>                VectorImageType;
+  typedef typename VectorImageType::Pointer           VectorImagePointer;
+  typedef itk::ImageBase<VDim>                        ImageBaseType;
+  typedef itk::ImageRegion<VDim>                      RegionType;
+
+  /** Information stored in the file header */
+  struct Header
+  {
+    /** Geometry of the warp (not allocated) */
+    typename ImageBaseType::Pointer space;
+
+    /** If positive, the file holds a root warp that must be squared this many times */
+    unsigned int exponent;
+
+    /** Size of the tiles, in voxels */
+    unsigned int tile_size;
+  };
+
+  /** Whether the filename has the .gwarp extension */
+  static bool IsChunkedWarpFile(const char *filename);
+
+  /**
+   * Write a warp (in physical units). The exponent is stored in the header, and
+   * should be non-zero if the warp is a root warp.
+   */
+  static void Write(const VectorImageType *warp, const char *filename,
+                    unsigned int exponent = 0, unsigned int tile_size = 32);
+
+  /** Read the header of a warp file */
+  static void ReadHeader(const char *filename, Header &header);
+
+  /** Read the whole warp, as stored (a root warp is not exponentiated) */
+  static VectorImagePointer Read(const char *filename);
+
+  /**
+   * Read the part of the warp in a region of its index space. The result is an
+   * image of its own, whose origin is at the start of the region.
+   */
+  static VectorImagePointer ReadRegion(const char *filename, const RegionType &region);
+
+  /**
+   * Get the region of the warp stored in a file that is needed to interpolate it
+   * at the points x + u(x), for all voxels x of the displacement field u (in
+   * physical units). The region is padded by a voxel for linear interpolation,
+   * and cropped to the extent of the warp.
+   */
+  static RegionType GetRegionForSampling(const Header &header, const VectorImageType *u);
+
+protected:
+
+  // The tiles of the warp, in the order they are stored
+  static void GetTileRegions(const Header &header, std::vector<RegionType> &tiles);
+};
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "ChunkedWarpFile.txx"
+#endif
+
+#endif // CHUNKEDWARPFILE_H
@@ -0,0 +1,376 @@
+/*=========================================================================
+
+  Program:   ALFABIS fast medical image registration programs
+  Language:  C++
+  Website:   github.com/pyushkevich/greedy
+  Copyright (c) Paul Yushkevich, University of Pennsylvania. All rights reserved.
+
+  This program is part of ALFABIS: Adaptive Large-Scale Framework for
+  Automatic Biomedical Image Segmentation.
+
+  ALFABIS development is funded by the NIH grant R01 EB017255.
+
+  ALFABIS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ALFABIS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ALFABIS.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef CHUNKEDWARPFILE_TXX
+#define CHUNKEDWARPFILE_TXX
+
+#include "ChunkedWarpFile.h"
+#include "GreedyException.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkContinuousIndex.h"
+#include "itk_zlib.h"
+#include <itksys/SystemTools.hxx>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+/*
+ * File layout (native byte order):
+ *   char[8]                   magic "GWARP001"
+ *   uint32                    dimension, exponent, tile size
+ *   uint64[dim]               size
+ *   double[dim]               origin
+ *   double[dim]               spacing
+ *   double[dim * dim]         direction (row major)
+ *   uint64[n_tiles + 1]       file offset of each tile, and of the end of the last
+ *   ...                       tiles, each a zlib stream of float vectors
+ *
+ * The tiles are ordered with x varying fastest. Before compression, the bytes of the
+ * floats in a tile are shuffled so that the first bytes of all values come first,
+ * then the second bytes, etc. This makes the quantized warps compress much better.
+ */
+namespace chunked_warp_file {
+
+const char magic[8] = { 'G', 'W', 'A', 'R', 'P', '0', '0', '1' };
+
+template <class T>
+void write_value(std::ostream &out, T value)
+{
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T>
+T read_value(std::istream &in)
+{
+  T value;
+  in.read(reinterpret_cast<char *>(&value), sizeof(T));
+  return value;
+}
+
+// Shuffle (or unshuffle) the bytes of n float values
+inline void shuffle(const unsigned char *src, unsigned char *trg, size_t n, bool forward)
+{
+  for(size_t i = 0; i < n; i++)
+    for(size_t b = 0; b < sizeof(float); b++)
+      {
+      if(forward)
+        trg[b * n + i] = src[i * sizeof(float) + b];
+      else
+        trg[i * sizeof(float) + b] = src[b * n + i];
+      }
+}
+
+} // namespace chunked_warp_file
+
+
+template <class TFloat, unsigned int VDim>
+bool
+ChunkedWarpFile<TFloat, VDim>
+::IsChunkedWarpFile(const char *filename)
+{
+  return itksys::SystemTools::GetFilenameLastExtension(filename) == ".gwarp";
+}
+
+template <class TFloat, unsigned int VDim>
+void
+ChunkedWarpFile<TFloat, VDim>
+::GetTileRegions(const Header &header, std::vector<RegionType> &tiles)
+{
+  RegionType full = header.space->GetLargestPossibleRegion();
+
+  // Number of tiles along each dimension
+  unsigned int n_tiles[VDim], n_total = 1;
+  for(unsigned int d = 0; d < VDim; d++)
+    {
+    n_tiles[d] = (full.GetSize()[d] + header.tile_size - 1) / header.tile_size;
+    n_total *= n_tiles[d];
+    }
+
+  tiles.clear();
+  for(unsigned int t = 0; t < n_total; t++)
+    {
+    RegionType tile;
+    for(unsigned int d = 0, r = t; d < VDim; r /= n_tiles[d], d++)
+      {
+      tile.SetIndex(d, full.GetIndex()[d] + (r % n_tiles[d]) * header.tile_size);
+      tile.SetSize(d, header.tile_size);
+      }
+    tile.Crop(full);
+    tiles.push_back(tile);
+    }
+}
+
+template <class TFloat, unsigned int VDim>
+void
+ChunkedWarpFile<TFloat, VDim>
+::Write(const VectorImageType *warp, const char *filename, unsigned int exponent, unsigned int tile_size)
+{
+  using namespace chunked_warp_file;
+
+  std::ofstream out(filename, std::ios::binary);
+  if(!out.good())
+    throw GreedyException("Can not open %s for writing", filename);
+
+  // Header
+  Header header;
+  header.space = ImageBaseType::New();
+  header.space->CopyInformation(warp);
+  header.space->SetLargestPossibleRegion(warp->GetBufferedRegion());
+  header.exponent = exponent;
+  header.tile_size = tile_size;
+
+  out.write(magic, sizeof(magic));
+  write_value<unsigned int>(out, VDim);
+  write_value<unsigned int>(out, exponent);
+  write_value<unsigned int>(out, tile_size);
+  for(unsigned int d = 0; d < VDim; d++)
+    write_value<itk::uint64_t>(out, warp->GetBufferedRegion().GetSize()[d]);
+  for(unsigned int d = 0; d < VDim; d++)
+    write_value<double>(out, warp->GetOrigin()[d]);
+  for(unsigned int d = 0; d < VDim; d++)
+    write_value<double>(out, warp->GetSpacing()[d]);
+  for(unsigned int r = 0; r < VDim; r++)
+    for(unsigned int c = 0; c < VDim; c++)
+      write_value<double>(out, warp->GetDirection()(r, c));
+
+  // Leave room for the tile offsets, they are filled in at the end
+  std::vector<RegionType> tiles;
+  GetTileRegions(header, tiles);
+  std::streampos table_pos = out.tellp();
+  std::vector<itk::uint64_t> offsets(tiles.size() + 1, 0);
+  out.write(reinterpret_cast<const char *>(&offsets[0]), offsets.size() * sizeof(itk::uint64_t));
+  offsets[0] = out.tellp();
+
+  std::vector<float> raw;
+  std::vector<unsigned char> shuffled, packed;
+  for(unsigned int t = 0; t < tiles.size(); t++)
+    {
+    // Copy the tile into a float array
+    raw.resize(tiles[t].GetNumberOfPixels() * VDim);
+    float *p = &raw[0];
+    typedef itk::ImageRegionConstIteratorWithIndex<VectorImageType> Iterator;
+    for(Iterator it(warp, tiles[t]); !it.IsAtEnd(); ++it)
+      for(unsigned int d = 0; d < VDim; d++)
+        *p++ = (float) it.Value()[d];
+
+    // Shuffle and compress
+    uLong n_bytes = raw.size() * sizeof(float);
+    shuffled.resize(n_bytes);
+    shuffle(reinterpret_cast<const unsigned char *>(&raw[0]), &shuffled[0], raw.size(), true);
+
+    uLongf n_packed = compressBound(n_bytes);
+    packed.resize(n_packed);
+    if(compress2(&packed[0], &n_packed, &shuffled[0], n_bytes, Z_DEFAULT_COMPRESSION) != Z_OK)
+      throw GreedyException("Compression of warp tile %d failed", t);
+
+    out.write(reinterpret_cast<const char *>(&packed[0]), n_packed);
+    offsets[t + 1] = offsets[t] + n_packed;
+    }
+
+  out.seekp(table_pos);
+  out.write(reinterpret_cast<const char *>(&offsets[0]), offsets.size() * sizeof(itk::uint64_t));
+  if(!out.good())
+    throw GreedyException("Error writing warp to %s", filename);
+}
+
+template <class TFloat, unsigned int VDim>
+void
+ChunkedWarpFile<TFloat, VDim>
+::ReadHeader(const char *filename, Header &header)
+{
+  using namespace chunked_warp_file;
+
+  std::ifstream in(filename, std::ios::binary);
+  char file_magic[sizeof(magic)];
+  in.read(file_magic, sizeof(magic));
+  if(!in.good() || !std::equal(magic, magic + sizeof(magic), file_magic))
+    throw GreedyException("%s is not a chunked warp file", filename);
+
+  if(read_value<unsigned int>(in) != VDim)
+    throw GreedyException("Warp in %s does not have dimension %d", filename, VDim);
+
+  header.exponent = read_value<unsigned int>(in);
+  header.tile_size = read_value<unsigned int>(in);
+
+  typename ImageBaseType::SizeType size;
+  typename ImageBaseType::PointType origin;
+  typename ImageBaseType::SpacingType spacing;
+  typename ImageBaseType::DirectionType direction;
+  for(unsigned int d = 0; d < VDim; d++)
+    size[d] = read_value<itk::uint64_t>(in);
+  for(unsigned int d = 0; d < VDim; d++)
+    origin[d] = read_value<double>(in);
+  for(unsigned int d = 0; d < VDim; d++)
+    spacing[d] = read_value<double>(in);
+  for(unsigned int r = 0; r < VDim; r++)
+    for(unsigned int c = 0; c < VDim; c++)
+      direction(r, c) = read_value<double>(in);
+
+  if(!in.good())
+    throw GreedyException("Error reading the header of %s", filename);
+
+  header.space = ImageBaseType::New();
+  header.space->SetLargestPossibleRegion(RegionType(size));
+  header.space->SetOrigin(origin);
+  header.space->SetSpacing(spacing);
+  header.space->SetDirection(direction);
+}
+
+template <class TFloat, unsigned int VDim>
+typename ChunkedWarpFile<TFloat, VDim>::VectorImagePointer
+ChunkedWarpFile<TFloat, VDim>
+::Read(const char *filename)
+{
+  Header header;
+  ReadHeader(filename, header);
+  return ReadRegion(filename, header.space->GetLargestPossibleRegion());
+}
+
+template <class TFloat, unsigned int VDim>
+typename ChunkedWarpFile<TFloat, VDim>::VectorImagePointer
+ChunkedWarpFile<TFloat, VDim>
+::ReadRegion(const char *filename, const RegionType &region)
+{
+  using namespace chunked_warp_file;
+
+  Header header;
+  ReadHeader(filename, header);
+  if(!header.space->GetLargestPossibleRegion().IsInside(region))
+    throw GreedyException("Requested region is outside of the warp in %s", filename);
+
+  // Read the tile offsets, which follow the header
+  std::vector<RegionType> tiles;
+  GetTileRegions(header, tiles);
+
+  std::ifstream in(filename, std::ios::binary);
+  in.seekg(sizeof(magic) + 3 * sizeof(unsigned int) + VDim * sizeof(itk::uint64_t)
+           + (2 * VDim + VDim * VDim) * sizeof(double));
+  std::vector<itk::uint64_t> offsets(tiles.size() + 1);
+  in.read(reinterpret_cast<char *>(&offsets[0]), offsets.size() * sizeof(itk::uint64_t));
+
+  // The output covers just the region
+  typename ImageBaseType::PointType origin;
+  header.space->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+
+  VectorImagePointer warp = VectorImageType::New();
+  warp->SetRegions(RegionType(region.GetSize()));
+  warp->SetOrigin(origin);
+  warp->SetSpacing(header.space->GetSpacing());
+  warp->SetDirection(header.space->GetDirection());
+  warp->Allocate();
+
+  std::vector<float> raw;
+  std::vector<unsigned char> shuffled, packed;
+  for(unsigned int t = 0; t < tiles.size(); t++)
+    {
+    // Only the tiles that overlap the region are read
+    RegionType overlap = tiles[t];
+    if(!overlap.Crop(region))
+      continue;
+
+    packed.resize(offsets[t + 1] - offsets[t]);
+    in.seekg(offsets[t]);
+    in.read(reinterpret_cast<char *>(&packed[0]), packed.size());
+
+    raw.resize(tiles[t].GetNumberOfPixels() * VDim);
+    uLongf n_bytes = raw.size() * sizeof(float);
+    shuffled.resize(n_bytes);
+    if(!in.good() || uncompress(&shuffled[0], &n_bytes, &packed[0], packed.size()) != Z_OK
+       || n_bytes != raw.size() * sizeof(float))
+      throw GreedyException("Error reading tile %d of %s", t, filename);
+
+    shuffle(&shuffled[0], reinterpret_cast<unsigned char *>(&raw[0]), raw.size(), false);
+
+    // Copy the overlap into the output
+    typedef itk::ImageRegionIteratorWithIndex<VectorImageType> Iterator;
+    RegionType out_region = overlap;
+    out_region.SetIndex(overlap.GetIndex() - region.GetIndex());
+    for(Iterator it(warp, out_region); !it.IsAtEnd(); ++it)
+      {
+      // Offset of the voxel in the tile
+      size_t offset = 0;
+      for(int d = VDim - 1; d >= 0; d--)
+        offset = offset * tiles[t].GetSize()[d]
+                 + (it.GetIndex()[d] + region.GetIndex()[d] - tiles[t].GetIndex()[d]);
+
+      const float *p = &raw[offset * VDim];
+      VectorType &v = it.Value();
+      for(unsigned int d = 0; d < VDim; d++)
+        v[d] = (TFloat) p[d];
+      }
+    }
+
+  return warp;
+}
+
+template <class TFloat, unsigned int VDim>
+typename ChunkedWarpFile<TFloat, VDim>::RegionType
+ChunkedWarpFile<TFloat, VDim>
+::GetRegionForSampling(const Header &header, const VectorImageType *u)
+{
+  // Bounding box of the sample points, in the index space of the stored warp
+  double lo[VDim], hi[VDim];
+  for(unsigned int d = 0; d < VDim; d++)
+    {
+    lo[d] = itk::NumericTraits<double>::max();
+    hi[d] = itk::NumericTraits<double>::NonpositiveMin();
+    }
+
+  typedef itk::ImageRegionConstIteratorWithIndex<VectorImageType> Iterator;
+  for(Iterator it(u, u->GetBufferedRegion()); !it.IsAtEnd(); ++it)
+    {
+    itk::Point<double, VDim> p;
+    itk::ContinuousIndex<double, VDim> cix;
+    u->TransformIndexToPhysicalPoint(it.GetIndex(), p);
+    for(unsigned int d = 0; d < VDim; d++)
+      p[d] += it.Value()[d];
+
+    header.space->TransformPhysicalPointToContinuousIndex(p, cix);
+    for(unsigned int d = 0; d < VDim; d++)
+      {
+      lo[d] = std::min(lo[d], cix[d]);
+      hi[d] = std::max(hi[d], cix[d]);
+      }
+    }
+
+  // Pad by a voxel for interpolation. If there is no overlap, nothing is gained from
+  // reading by region, and the whole warp is used
+  RegionType full = header.space->GetLargestPossibleRegion(), region;
+  for(unsigned int d = 0; d < VDim; d++)
+    {
+    if(!(lo[d] <= hi[d]))
+      return full;
+    long i0 = (long) std::floor(std::max(lo[d], -1.0e9)) - 1;
+    long i1 = (long) std::floor(std::min(hi[d], 1.0e9)) + 2;
+    region.SetIndex(d, i0);
+    region.SetSize(d, i1 - i0 + 1);
+    }
+
+  return region.Crop(full) ? region : full;
+}
+
+#endif // CHUNKEDWARPFILE_TXX
@@ -30,6 +30,7 @@
 #include "itkVectorImage.h"
 #include "itkNumericTraits.h"
 #include "itkNumericTraitsCovariantVectorPixel.h"
+#include <vector>
 
 template <class TFloat, class TInputComponentType>
 struct FastLinearInterpolatorOutputTraits
@@ -120,6 +121,23 @@ protected:
   int nComp;
   const InputComponentType *buffer;
 
+  // Scratch storage for row interpolation: for the samples of the row that are
+  // inside the image, their position in the row, the offset of their first corner
+  // in the buffer, and the corner weights (one block of the row length per corner)
+  std::vector<int> row_index, row_offset;
+  std::vector<RealType> row_weight;
+
+  void AllocateRowStorage(int n, int n_corners)
+  {
+    if((int) row_index.size() < n)
+      {
+      row_index.resize(n);
+      row_offset.resize(n);
+      }
+    if((int) row_weight.size() < n * n_corners)
+      row_weight.resize(n * n_corners);
+  }
+
   // Default value - for interpolation outside of the image bounds
   const InputComponentType *def_value;
   InputComponentType *def_value_store;
@@ -160,6 +178,12 @@ public:
   InOut InterpolateNearestNeighbor(RealType *cix, OutputComponentType *out)
     { return Superclass::INSIDE; }
 
+  void InterpolateRow(int n, const RealType *cix, OutputComponentType *out, InOut *status)
+    {
+    for(int i = 0; i < n; i++, cix += VDim, out += this->nComp)
+      status[i] = Interpolate(const_cast<RealType *>(cix), out);
+    }
+
   TFloat GetMask() { return 0.0; }
 
   TFloat GetMaskAndGradient(RealType *mask_gradient) { return 0.0; }
@@ -339,6 +363,78 @@ public:
     return this->status;
   }
 
+  /**
+   * Interpolate a row of n samples, with continuous indices in cix (in strides of 3),
+   * placing the values in out (in strides of nComp) and the status of each sample in
+   * status. The samples that are completely inside are separated from the rest in a
+   * single pass, their corner weights are then computed in a branch-free loop, and
+   * all components of each sample are gathered together. Border samples go through
+   * Interpolate(), and as with Interpolate(), out is not set for outside samples.
+   */
+  void InterpolateRow(int n, const RealType *cix, OutputComponentType *out, InOut *status)
+  {
+    if(n <= 0)
+      return;
+
+    this->AllocateRowStorage(n, 8);
+    int *r_index = &this->row_index[0], *r_offset = &this->row_offset[0];
+    RealType *w000 = &this->row_weight[0], *w001 = w000 + n, *w010 = w001 + n, *w011 = w010 + n;
+    RealType *w100 = w011 + n, *w101 = w100 + n, *w110 = w101 + n, *w111 = w110 + n;
+
+    // Sort out the inside samples, keeping their fractional offsets in the weights
+    int n_in = 0;
+    for(int i = 0; i < n; i++)
+      {
+      const RealType *c = cix + 3 * i;
+      int X = (int) floor(c[0]), Y = (int) floor(c[1]), Z = (int) floor(c[2]);
+      if(X >= 0 && X + 1 < xsize && Y >= 0 && Y + 1 < ysize && Z >= 0 && Z + 1 < zsize)
+        {
+        r_index[n_in] = i;
+        r_offset[n_in] = this->nComp * (X + xsize * (Y + ysize * Z));
+        w100[n_in] = c[0] - X;
+        w010[n_in] = c[1] - Y;
+        w001[n_in] = c[2] - Z;
+        status[i] = Superclass::INSIDE;
+        n_in++;
+        }
+      else
+        {
+        status[i] = this->Interpolate(const_cast<RealType *>(c), out + i * this->nComp);
+        }
+      }
+
+    // Compute the corner weights, as in Splat()
+    for(int j = 0; j < n_in; j++)
+      {
+      RealType fx = w100[j], fy = w010[j], fz = w001[j];
+      RealType fxy = fx * fy, fyz = fy * fz, fxz = fx * fz, fxyz = fxy * fz;
+      w111[j] = fxyz;
+      w011[j] = fyz - fxyz;
+      w101[j] = fxz - fxyz;
+      w110[j] = fxy - fxyz;
+      w001[j] = fz - fxz - w011[j];
+      w010[j] = fy - fyz - w110[j];
+      w100[j] = fx - fxy - w101[j];
+      w000[j] = 1.0 - fx - fy + fxy - w001[j];
+      }
+
+    // Gather all the components of each inside sample
+    int sx = this->nComp, sy = xsize * this->nComp, sz = xsize * ysize * this->nComp;
+    for(int j = 0; j < n_in; j++)
+      {
+      const InputComponentType *d = this->buffer + r_offset[j];
+      OutputComponentType *o = out + r_index[j] * this->nComp;
+      for(int iComp = 0; iComp < this->nComp; iComp++, d++)
+        {
+        o[iComp] =
+            w000[j] * d[0]       + w100[j] * d[sx] +
+            w010[j] * d[sy]      + w110[j] * d[sx + sy] +
+            w001[j] * d[sz]      + w101[j] * d[sx + sz] +
+            w011[j] * d[sy + sz] + w111[j] * d[sx + sy + sz];
+        }
+      }
+  }
+
   InOut InterpolateNearestNeighbor(RealType *cix, OutputComponentType *out)
   {
     x0 = (int) floor(cix[0] + 0.5);
@@ -710,6 +806,66 @@ public:
     return this->status;
   }
 
+  /**
+   * Interpolate a row of n samples, with continuous indices in cix (in strides of 2),
+   * placing the values in out (in strides of nComp) and the status of each sample in
+   * status. See the 3D version of this method for details.
+   */
+  void InterpolateRow(int n, const RealType *cix, OutputComponentType *out, InOut *status)
+  {
+    if(n <= 0)
+      return;
+
+    this->AllocateRowStorage(n, 4);
+    int *r_index = &this->row_index[0], *r_offset = &this->row_offset[0];
+    RealType *w00 = &this->row_weight[0], *w01 = w00 + n, *w10 = w01 + n, *w11 = w10 + n;
+
+    // Sort out the inside samples, keeping their fractional offsets in the weights
+    int n_in = 0;
+    for(int i = 0; i < n; i++)
+      {
+      const RealType *c = cix + 2 * i;
+      int X = (int) floor(c[0]), Y = (int) floor(c[1]);
+      if(X >= 0 && X + 1 < xsize && Y >= 0 && Y + 1 < ysize)
+        {
+        r_index[n_in] = i;
+        r_offset[n_in] = this->nComp * (X + xsize * Y);
+        w10[n_in] = c[0] - X;
+        w01[n_in] = c[1] - Y;
+        status[i] = Superclass::INSIDE;
+        n_in++;
+        }
+      else
+        {
+        status[i] = this->Interpolate(const_cast<RealType *>(c), out + i * this->nComp);
+        }
+      }
+
+    // Compute the corner weights, as in Splat()
+    for(int j = 0; j < n_in; j++)
+      {
+      RealType fx = w10[j], fy = w01[j], fxy = fx * fy;
+      w11[j] = fxy;
+      w01[j] = fy - fxy;
+      w10[j] = fx - fxy;
+      w00[j] = 1.0 - fx - fy + fxy;
+      }
+
+    // Gather all the components of each inside sample
+    int sx = this->nComp, sy = xsize * this->nComp;
+    for(int j = 0; j < n_in; j++)
+      {
+      const InputComponentType *d = this->buffer + r_offset[j];
+      OutputComponentType *o = out + r_index[j] * this->nComp;
+      for(int iComp = 0; iComp < this->nComp; iComp++, d++)
+        {
+        o[iComp] =
+            w00[j] * d[0]  + w10[j] * d[sx] +
+            w01[j] * d[sy] + w11[j] * d[sx + sy];
+        }
+      }
+  }
+
   InOut InterpolateNearestNeighbor(RealType *cix, OutputComponentType *out)
   {
     x0 = (int) floor(cix[0] + 0.5);
@@ -57,6 +57,11 @@ FastWarpCompositeImageFilter<TInputImage,TOutputImage,TDeformationField>
 
   int ncomp = fi.GetPointerIncrement();
 
+  // Sample positions and interpolation status for a whole line, so that the line
+  // can be interpolated in one call
+  std::vector<FloatType> cix_line(line_len * ImageDimension);
+  std::vector<typename FastInterpolator::InOut> status_line(line_len);
+
   // Loop over the lines in the image
   for(IterType it(this->GetOutput(), outputRegionForThread); !it.IsAtEnd(); it.NextLine())
     {
@@ -70,6 +75,7 @@ FastWarpCompositeImageFilter<TInputImage,TOutputImage,TDeformationField>
     // The current sample position
     itk::ContinuousIndex<FloatType, ImageDimension> cix;
     typename InputImageType::PointType p, pd, p_step;
+    FloatType *cix_ptr = &cix_line[0];
 
     if(m_UsePhysicalSpace)
       {
@@ -81,8 +87,8 @@ FastWarpCompositeImageFilter<TInputImage,TOutputImage,TDeformationField>
         p_step[j] -= p[j];
       }
 
-    // Loop over the line
-    for(int i = 0; i < line_len; i++)
+    // Compute the sample positions along the line
+    for(int i = 0; i < line_len; i++, cix_ptr += ImageDimension)
       {
       if(m_UsePhysicalSpace)
         {
@@ -94,29 +100,38 @@ FastWarpCompositeImageFilter<TInputImage,TOutputImage,TDeformationField>
 
         // TODO: this calls IsInside() internally, which limits efficiency
         input->TransformPhysicalPointToContinuousIndex(pd, cix);
+        for(uint j = 0; j < ImageDimension; j++)
+          cix_ptr[j] = cix[j];
         }
       else
         {
         for(uint j = 0; j < ImageDimension; j++)
-          cix[j] = idx[j] + phi[i][j] * m_DeformationScaling;
+          cix_ptr[j] = idx[j] + phi[i][j] * m_DeformationScaling;
         idx[0]++;
         }
+      }
 
-      // Perform the interpolation
-      typename  FastInterpolator::InOut status =
-          m_UseNearestNeighbor
-          ? fi.InterpolateNearestNeighbor(cix.GetDataPointer(), out)
-          : fi.Interpolate(cix.GetDataPointer(), out);
+    // Perform the interpolation
+    if(m_UseNearestNeighbor)
+      {
+      for(int i = 0; i < line_len; i++)
+        status_line[i] = fi.InterpolateNearestNeighbor(
+                           &cix_line[i * ImageDimension], out + i * ncomp);
+      }
+    else
+      {
+      fi.InterpolateRow(line_len, &cix_line[0], out, &status_line[0]);
+      }
 
-      if(status == FastInterpolator::INSIDE ||
-         (status == FastInterpolator::BORDER && m_ExtrapolateBorders))
-        {
-        out += ncomp;
-        }
-      else
+    // Fill in the samples that are outside
+    for(int i = 0; i < line_len; i++, out += ncomp)
+      {
+      typename FastInterpolator::InOut status = status_line[i];
+      if(status == FastInterpolator::OUTSIDE ||
+         (status == FastInterpolator::BORDER && !m_ExtrapolateBorders))
         {
         for(int k = 0; k < ncomp; k++)
-          *out++ = m_OutsideValue;
+          out[k] = m_OutsideValue;
         }
       }
     }
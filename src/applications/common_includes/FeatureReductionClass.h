@@ -19,6 +19,7 @@ See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
 //#include "vnl_matrix.h"
 #include "itkVariableSizeMatrix.h"
 #include "itkVariableLengthVector.h"
+#include "PrincipalComponentAnalysis.h"
 //#include "vtkTable.h"
 //#include "CAPTk.h"
 using VectorVectorDouble = std::vector< std::vector < double > >;
@@ -48,9 +49,35 @@ public:
   vtkSmartPointer< vtkTable >  GetDiscerningPerfusionTimePoints(vnl_matrix<double> &intensities);
   vtkSmartPointer<vtkTable> GetDiscerningPerfusionTimePoints(VectorVectorDouble &intensities, VariableSizeMatrixType &TransformationMatrix, VariableLengthVectorType &MeanVector);
   vtkSmartPointer<vtkTable> GetDiscerningPerfusionTimePointsForPSU(VectorVectorDouble &intensities, VariableSizeMatrixType &TransformationMatrix, VariableLengthVectorType &MeanVector);
+  /**
+  \brief Starts fitting PCA (all components) on samples that are added block by block, e.g., voxels streamed from a cohort
+
+  The samples are folded into the covariance as they are added, so they never need to be gathered into a single matrix.
+  \param numberOfFeatures Number of values of each sample
+  */
+  void BeginStreamedPCA(size_t numberOfFeatures);
+
+  /**
+  \brief Adds the rows of a row-major block to the streamed PCA
+  \param samples The first row
+  \param rows Number of rows
+  \param rowStride Distance between consecutive rows; only the first numberOfFeatures values of a row are used
+  */
+  void AddStreamedPCASamples(const double *samples, size_t rows, size_t rowStride);
+
+  //! Finishes the streamed PCA and updates the PCA transformation matrix and average perfusion signal
+  bool EndStreamedPCA();
+
+  /**
+  \brief Projects the rows of a row-major block on the current PCA transformation
+  \param output Row-major rows x numberOfComponents projections
+  */
+  void ProjectSamples(const double *samples, size_t rows, size_t rowStride, size_t numberOfComponents, double *output) const;
+
   /**
   \brief Applies the exsiting PCA model (developed on training data) on test data
   \param intensities Test data
+  \return Empty if the model has fewer features than the data; GetLastEncounteredError() has details
   */
   VectorVectorDouble ApplyPCAOnTestData(VectorVectorDouble &intensities);
   VectorVectorDouble  ApplyPCAOnTestDataWithGivenTransformations(VectorVectorDouble &intensities, VariableSizeMatrixType & TransformationMatrix, VariableLengthVectorType & MeanVector);
@@ -106,8 +133,30 @@ public:
     mPMeanvector.SetSize(0);
   }
 
+  //! Get the last error
+  std::string GetLastEncounteredError() const
+  {
+    return m_lastEncounteredError;
+  }
+
 private:
+  /**
+  \brief Fits PCA (all components) on the data, updates PCATransformationMatrix and mPMeanvector and returns the centered projection
+  \param intensities Samples as rows, features as columns
+  */
+  vtkSmartPointer< vtkTable > FitPCAAndProject(const PrincipalComponentAnalysis::MatrixType &intensities);
+
+  //! Copies the fitted components and mean into PCATransformationMatrix and mPMeanvector
+  void SetParametersFromPCA(const PrincipalComponentAnalysis &pca);
+
+  //! Projects (intensities - MeanVector) on the given transformation
+  VectorVectorDouble ProjectOnGivenTransformations(const VectorVectorDouble &intensities, const VariableSizeMatrixType &TransformationMatrix, const VariableLengthVectorType &MeanVector);
+
   VariableSizeMatrixType PCATransformationMatrix;
   VariableLengthVectorType mPMeanvector;
 
+  PrincipalComponentAnalysis mStreamedPCA;
+
+  std::string m_lastEncounteredError;
+
 };
@@ -41,9 +41,11 @@
 #include <itkTransformFactory.h>
 #include <itkTimeProbe.h>
 #include <itkImageFileWriter.h>
+#include <itksys/SystemTools.hxx>
 
 #include "MultiImageRegistrationHelper.h"
 #include "FastWarpCompositeImageFilter.h"
+#include "ChunkedWarpFile.h"
 #include "MultiComponentImageMetricBase.h"
 
 #include <vnl/algo/vnl_powell.h>
@@ -206,6 +208,9 @@ GreedyApproach<VDim, TReal>::PureAffineCostFunction
   m_Mask = ImageType::New();
   m_Mask->CopyInformation(helper->GetReferenceSpace(level));
   m_Mask->SetRegions(helper->GetReferenceSpace(level)->GetBufferedRegion());
+
+  // The NCC working image is allocated by the metric on the first call
+  m_NCCWorkingImage = CompositeImageType::New();
 }
 
 
@@ -249,7 +254,8 @@ GreedyApproach<VDim, TReal>::PureAffineCostFunction
 
       val = m_OFHelper->ComputeAffineNCCMatchAndGradient(
               m_Level, tran, array_caster<VDim>::to_itkSize(m_Param->metric_radius),
-              m_Metric, m_Mask, m_GradMetric, m_GradMask, m_Phi, grad);
+              m_Metric, m_Mask, m_GradMetric, m_GradMask, m_Phi, grad,
+              m_NCCWorkingImage);
 
       flatten_affine_transform(grad.GetPointer(), g->data_block());
 
@@ -281,7 +287,8 @@ GreedyApproach<VDim, TReal>::PureAffineCostFunction
       {
       val = m_OFHelper->ComputeAffineNCCMatchAndGradient(
               m_Level, tran, array_caster<VDim>::to_itkSize(m_Param->metric_radius)
-              , m_Metric, m_Mask, m_GradMetric, m_GradMask, m_Phi, NULL);
+              , m_Metric, m_Mask, m_GradMetric, m_GradMask, m_Phi, NULL,
+              m_NCCWorkingImage);
 
       // NCC should be maximized
       val *= -10000.0;
@@ -296,7 +303,9 @@ GreedyApproach<VDim, TReal>::PureAffineCostFunction
       }
     }
 
-  // Has the metric improved?
+  // Has the metric improved? Several cost functions may be computed at once during
+  // the rigid search, so the log is only accessed while holding the lock
+  m_Parent->m_MetricLogLock.Lock();
   if(m_Parent->GetMetricLog().size())
     {
     const std::vector<double> &log = m_Parent->GetMetricLog().back();
@@ -313,6 +322,7 @@ GreedyApproach<VDim, TReal>::PureAffineCostFunction
         }
       }
     }
+  m_Parent->m_MetricLogLock.Unlock();
 
   if(f)
     *f = val;
@@ -1088,6 +1098,19 @@ GreedyApproach<VDim, TReal>
 }
 
 
+template <unsigned int VDim, typename TReal>
+std::string GreedyApproach<VDim, TReal>
+::GetInputCacheKey(const std::string &filename)
+{
+  std::ostringstream oss;
+  typename ImageCache::const_iterator it = m_ImageCache.find(filename);
+  if(it != m_ImageCache.end())
+    oss << "cached " << filename << "@" << it->second << ":" << it->second->GetMTime();
+  else
+    oss << "file " << filename << "@" << itksys::SystemTools::ModifiedTime(filename.c_str());
+  return oss.str();
+}
+
 template <unsigned int VDim, typename TReal>
 void GreedyApproach<VDim, TReal>
 ::ReadImages(GreedyParameters &param, OFHelperType &ofhelper)
@@ -1164,6 +1187,43 @@ void GreedyApproach<VDim, TReal>
       }
     }
 
+  // Share the pyramids with other runs that have the same inputs. Batch jobs use the
+  // cache of the approach running the batch
+  if(m_UsePyramidCache || m_BatchOwner)
+    {
+    // The moving images and mask depend on the transforms applied to them
+    std::ostringstream oss_pre;
+    for(uint i = 0; i < param.moving_pre_transforms.size(); i++)
+      oss_pre << "|pre " << GetInputCacheKey(param.moving_pre_transforms[i].filename)
+              << "^" << param.moving_pre_transforms[i].exponent;
+
+    std::ostringstream oss_fixed, oss_images;
+    for(uint i = 0; i < param.inputs.size(); i++)
+      {
+      oss_fixed << "|fixed " << GetInputCacheKey(param.inputs[i].fixed);
+      oss_images << "|fixed " << GetInputCacheKey(param.inputs[i].fixed)
+                 << "|moving " << GetInputCacheKey(param.inputs[i].moving);
+      }
+    oss_images << oss_pre.str();
+
+    // Each batch job has its own moving images, so their pyramids are not kept
+    std::string images_key = m_BatchOwner ? std::string() : oss_images.str();
+
+    std::string gradient_mask_key, moving_mask_key;
+    if(param.gradient_mask.size())
+      gradient_mask_key = "gradient mask " + GetInputCacheKey(param.gradient_mask);
+    if(param.moving_mask.size())
+      {
+      moving_mask_key = "moving mask " + GetInputCacheKey(param.moving_mask);
+      if(param.moving_pre_transforms.size())
+        moving_mask_key += "|fixed " + GetInputCacheKey(param.inputs[0].fixed) + oss_pre.str();
+      }
+
+    Self *owner = m_BatchOwner ? m_BatchOwner : this;
+    ofhelper.SetPyramidCache(&owner->m_PyramidCache, &owner->m_PyramidCacheLock,
+                             oss_fixed.str(), images_key, gradient_mask_key, moving_mask_key);
+    }
+
   // Generate the optimized composite images. For the NCC metric, we add random noise to
   // the composite images, specified in units of the interquartile intensity range.
   double noise = (param.metric == GreedyParameters::NCC) ? param.ncc_noise_factor : 0.0;
@@ -1171,6 +1231,15 @@ void GreedyApproach<VDim, TReal>
   // Build the composite images
   ofhelper.BuildCompositeImages(noise);
 
+  // In mixed precision mode, the images are float but the NCC sums are kept in double
+  ofhelper.SetAccumulateInDouble(param.flag_float_mixed_precision);
+
+  // Streaming NCC only keeps a few planes of the NCC components in memory
+  ofhelper.SetStreamNCCBoxSums(param.flag_ncc_stream_box_sums);
+
+  // The metric filters use the threads of the parameters (0: the ITK global default)
+  ofhelper.SetNumberOfThreads(param.threads);
+
   // If the metric is NCC, then also apply special processing to the gradient masks
   if(param.metric == GreedyParameters::NCC)
     ofhelper.DilateCompositeGradientMasksForNCC(array_caster<VDim>::to_itkSize(param.metric_radius));
@@ -1325,6 +1394,128 @@ int GreedyApproach<VDim, TReal>
 */
 
 
+template <unsigned int VDim, typename TReal>
+ITK_THREAD_RETURN_TYPE
+GreedyApproach<VDim, TReal>
+::RigidCandidatesThreaderCallback(void *arg)
+{
+  typedef itk::MultiThreader::ThreadInfoStruct ThreadInfo;
+  ThreadInfo *info = static_cast<ThreadInfo *>(arg);
+  RigidCandidatesThreadData *data = static_cast<RigidCandidatesThreadData *>(info->UserData);
+
+  // The image operations of this thread get the same share as the metric filters. Thread 0
+  // is the caller's thread, whose own setting is restored at the end
+  typename LDDMMType::ThreadCountScope thread_scope(data->of_helper->GetNumberOfThreads());
+
+  try
+    {
+    // Each thread has its own cost function, and so its own metric working images
+    RigidCostFunction rigid_fn(data->param, data->greedy, data->level, data->of_helper);
+    ScalingCostFunction scaled_fn(
+          &rigid_fn,
+          rigid_fn.GetOptimalParameterScaling(
+            data->of_helper->GetReferenceSpace(data->level)->GetBufferedRegion().GetSize()));
+
+    // The candidates are interleaved between the threads
+    for(unsigned int i = info->ThreadID; i < data->x->size(); i += info->NumberOfThreads)
+      {
+      vnl_vector<double> &x = (*data->x)[i];
+      double &f = (*data->f)[i];
+
+      if(data->refine_iter > 0)
+        {
+        // Same optimizer as in RunAffine, but quiet, since threads would mix their output
+        vnl_vector<double> xScaled = element_product(x, scaled_fn.GetScaling()), xRefined;
+        if(data->param->flag_powell)
+          {
+          vnl_powell optimizer(&scaled_fn);
+          optimizer.set_f_tolerance(1e-9);
+          optimizer.set_x_tolerance(1e-4);
+          optimizer.set_g_tolerance(1e-6);
+          optimizer.set_max_function_evals(data->refine_iter);
+          optimizer.minimize(xScaled);
+          }
+        else
+          {
+          vnl_lbfgs optimizer(scaled_fn);
+          optimizer.set_f_tolerance(1e-9);
+          optimizer.set_x_tolerance(1e-4);
+          optimizer.set_g_tolerance(1e-6);
+          optimizer.set_max_function_evals(data->refine_iter);
+          optimizer.minimize(xScaled);
+          }
+
+        // Keep the refined vector if it is better
+        if(xScaled.size() > 0)
+          {
+          xRefined = element_quotient(xScaled, scaled_fn.GetScaling());
+          double fRefined;
+          rigid_fn.compute(xRefined, &fRefined, NULL);
+          if(fRefined < f)
+            {
+            x = xRefined;
+            f = fRefined;
+            }
+          }
+        }
+      else
+        {
+        rigid_fn.compute(x, &f, NULL);
+        }
+      }
+    }
+  catch(std::exception &exc)
+    {
+    data->errors[info->ThreadID] = exc.what();
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <unsigned int VDim, typename TReal>
+void
+GreedyApproach<VDim, TReal>
+::ComputeRigidCandidates(GreedyParameters &param, OFHelperType &of_helper, int level,
+                         std::vector<vnl_vector<double> > &x, std::vector<double> &f,
+                         int refine_iter)
+{
+  if(refine_iter <= 0)
+    f.assign(x.size(), 0.0);
+
+  if(x.size() == 0)
+    return;
+
+  // Use at most one thread per candidate, and split the remaining threads between the
+  // metric filters of the candidates, through the helper for the duration of the search
+  int n_helper = of_helper.GetNumberOfThreads();
+  int n_total = n_helper > 0 ? n_helper : std::max(1, (int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads());
+  int n_threads = std::min(n_total, (int) x.size());
+  of_helper.SetNumberOfThreads(std::max(1, n_total / n_threads));
+
+  RigidCandidatesThreadData data;
+  data.greedy = this;
+  data.param = &param;
+  data.of_helper = &of_helper;
+  data.level = level;
+  data.refine_iter = refine_iter;
+  data.x = &x;
+  data.f = &f;
+  data.errors.resize(n_threads);
+
+  itk::MultiThreader::Pointer mt = itk::MultiThreader::New();
+  mt->SetNumberOfThreads(n_threads);
+  mt->SetSingleMethod(&Self::RigidCandidatesThreaderCallback, &data);
+  mt->SingleMethodExecute();
+
+  of_helper.SetNumberOfThreads(n_helper);
+
+  // Report the first failure
+  for(unsigned int t = 0; t < data.errors.size(); t++)
+    if(data.errors[t].length())
+      throw GreedyException("Rigid search failed: %s", data.errors[t].c_str());
+}
+
+
 template <unsigned int VDim, typename TReal>
 int GreedyApproach<VDim, TReal>
 ::RunAffine(GreedyParameters &param)
@@ -1455,36 +1646,66 @@ int GreedyApproach<VDim, TReal>
         // At random, try a whole bunch of transforms, around 5 degrees
         vnl_random randy(12345);
 
-        // TODO: make a heap of k best tries
-        double fBest;
-        vnl_vector<double> xBest = xRigidInit;
-        search_fun.compute(xBest, &fBest, NULL);
+        // The initial transform is evaluated on its own first. This also sets up the data
+        // that the metric keeps between calls (e.g. MI binning) before the threads start
+        std::vector<vnl_vector<double> > xCand(1, xRigidInit);
+        std::vector<double> fCand(1);
+        search_fun.compute(xRigidInit, &fCand[0], NULL);
 
         // Report the initial best
-        std::cout << "Rigid search -> Initial best: " << fBest << " " << xBest << std::endl;
+        std::cout << "Rigid search -> Initial best: " << fCand[0] << " " << xRigidInit << std::endl;
 
+        // Draw all the tries up front, so that they do not depend on the number of threads
+        std::vector<vnl_vector<double> > xTry(param.rigid_search.iterations);
+        std::vector<double> fTry;
         for(int i = 0; i < param.rigid_search.iterations; i++)
           {
           // Get random coefficient
           // Compute a random rotation
-          vnl_vector<double> xTry = search_fun.GetRandomCoeff(xRigidInit, randy,
-                                                              param.rigid_search.sigma_angle,
-                                                              param.rigid_search.sigma_xyz,
-                                                              cfix, cmov);
+          xTry[i] = search_fun.GetRandomCoeff(xRigidInit, randy,
+                                              param.rigid_search.sigma_angle,
+                                              param.rigid_search.sigma_xyz,
+                                              cfix, cmov);
+          }
 
-          // Evaluate this transform
-          double f;
-          search_fun.compute(xTry, &f, NULL);
+        // Evaluate the tries concurrently
+        this->ComputeRigidCandidates(param, of_helper, level, xTry, fTry, 0);
+        xCand.insert(xCand.end(), xTry.begin(), xTry.end());
+        fCand.insert(fCand.end(), fTry.begin(), fTry.end());
+
+        // Rank the candidates. The sort is stable, so on ties the initial transform and
+        // then the earliest tries come first
+        std::vector<unsigned int> rank(xCand.size());
+        for(unsigned int i = 0; i < rank.size(); i++)
+          rank[i] = i;
+        std::stable_sort(rank.begin(), rank.end(),
+                         [&fCand](unsigned int a, unsigned int b) { return fCand[a] < fCand[b]; });
+
+        // Keep the best candidates
+        unsigned int n_keep = std::min((unsigned int) std::max(param.rigid_search.refine_count, 1),
+                                       (unsigned int) rank.size());
+        std::vector<vnl_vector<double> > xBest(n_keep);
+        std::vector<double> fBest(n_keep);
+        for(unsigned int k = 0; k < n_keep; k++)
+          {
+          xBest[k] = xCand[rank[k]];
+          fBest[k] = fCand[rank[k]];
+          std::cout << "Rigid search -> Candidate " << k << ": " << fBest[k] << " " << xBest[k] << std::endl;
+          }
 
-          if(f < fBest)
-            {
-            fBest = f;
-            xBest = xTry;
-            std::cout << "New best: " << fBest << " " << xBest << std::endl;
-            }
+        // Refine them concurrently with the optimizer of this level
+        if(param.rigid_search.refine_count > 0 && param.iter_per_level[level] > 0)
+          {
+          this->ComputeRigidCandidates(param, of_helper, level, xBest, fBest, param.iter_per_level[level]);
+          for(unsigned int k = 0; k < n_keep; k++)
+            std::cout << "Rigid search -> Refined " << k << ": " << fBest[k] << " " << xBest[k] << std::endl;
           }
 
-        xInit = xBest;
+        // Pick the best one
+        unsigned int kBest = std::min_element(fBest.begin(), fBest.end()) - fBest.begin();
+        std::cout << "Rigid search -> Best: " << fBest[kBest] << " " << xBest[kBest] << std::endl;
+
+        xInit = xBest[kBest];
         search_fun.GetTransform(xInit, tLevel);
         }
       }
@@ -1659,12 +1880,21 @@ int GreedyApproach<VDim, TReal>
   // The number of resolution levels
   unsigned nlevels = param.iter_per_level.size();
 
+  // Frequency domain regularizer, its FFT setup and kernels are cached across levels
+  LDDMMFFTRegularizer<TReal, VDim> fft_reg;
+  fft_reg.SetNumberOfThreads(param.threads);
+
   // Iterate over the resolution levels
   for(unsigned int level = 0; level < nlevels; ++level)
     {
     // Reference space
     ImageBaseType *refspace = of_helper.GetReferenceSpace(level);
 
+    // Regularizer used at this level
+    GreedyParameters::RegularizerType reg_type = GreedyParameters::REG_RECURSIVE_GAUSSIAN;
+    if(param.regularizer_per_level.size())
+      reg_type = param.regularizer_per_level[std::min((size_t) level, param.regularizer_per_level.size() - 1)];
+
     // Smoothing factors for this level, in physical units
     typename LDDMMType::Vec sigma_pre_phys =
         of_helper.GetSmoothingSigmasInPhysicalUnits(level, param.sigma_pre.sigma,
@@ -1728,7 +1958,7 @@ int GreedyApproach<VDim, TReal>
       VectorImagePointer uInit = VectorImageType::New();
 
       // Read the warp file
-      LDDMMType::vimg_read(param.initial_warp.c_str(), uInit );
+      this->ReadWarp(param.initial_warp, uInit);
 
       // Convert the warp file into voxel units from physical units
       OFHelperType::PhysicalWarpToVoxelWarp(uInit, uInit, uInit);
@@ -1947,7 +2177,18 @@ int GreedyApproach<VDim, TReal>
 
       // We have now computed the gradient vector field. Next, we smooth it
       tm_Gaussian1.Start();
-      LDDMMType::vimg_smooth_withborder(uk1, viTemp, sigma_pre_phys, 1);
+      if(reg_type == GreedyParameters::REG_RECURSIVE_GAUSSIAN)
+        {
+        LDDMMType::vimg_smooth_withborder(uk1, viTemp, sigma_pre_phys, 1);
+        }
+      else
+        {
+        if(reg_type == GreedyParameters::REG_FFT_NAVIER_STOKES)
+          fft_reg.vimg_navier_stokes(uk1, viTemp, param.ns_alpha, param.ns_gamma);
+        else
+          fft_reg.vimg_smooth(uk1, viTemp, sigma_pre_phys);
+        LDDMMType::vimg_clear_border(viTemp, 1);
+        }
       tm_Gaussian1.Stop();
 
       // After smoothing, compute the maximum vector norm and use it as a normalizing
@@ -1976,22 +2217,20 @@ int GreedyApproach<VDim, TReal>
         // v' = v + u (so-so)
         // v' = v + u + [v, u]/2 (this is the Lie bracket)
         
-        // Scale the update by 1 / 2^exponent (tiny update, first order approximation)
-        LDDMMType::vimg_scale_in_place(viTemp, 1.0 / (2 << param.warp_exponent));
+        // Scale the update by 1 / 2^exponent (tiny update, first order approximation).
+        // The scaling is folded into the update below, the bracket is linear in u
+        double u_scale = 1.0 / (2 << param.warp_exponent);
 
         // Use appropriate update
         if(param.flag_stationary_velocity_mode_use_lie_bracket)
           {
-          // Use the Lie Bracket approximation (v + u + [v,u])
+          // Use the Lie Bracket approximation (v + u + [v,u]/2), in one pass over the fields
           LDDMMType::lie_bracket(uk, viTemp, work_mat, uk1);
-          LDDMMType::vimg_scale_in_place(uk1, 0.5); 
-          LDDMMType::vimg_add_in_place(uk1, uk);
-          LDDMMType::vimg_add_in_place(uk1, viTemp);
+          LDDMMType::vimg_linear_combination_in_place(uk1, 0.5 * u_scale, uk, 1.0, viTemp, u_scale);
           }
         else
           {
-          LDDMMType::vimg_copy(uk, uk1);
-          LDDMMType::vimg_add_in_place(uk1, viTemp);
+          LDDMMType::vimg_add_scaled(uk, viTemp, u_scale, uk1);
           }
         }
       else
@@ -2013,7 +2252,15 @@ int GreedyApproach<VDim, TReal>
 
       // Another layer of smoothing
       tm_Gaussian2.Start();
-      LDDMMType::vimg_smooth_withborder(uk1, uk, sigma_post_phys, 1);
+      if(reg_type == GreedyParameters::REG_RECURSIVE_GAUSSIAN)
+        {
+        LDDMMType::vimg_smooth_withborder(uk1, uk, sigma_post_phys, 1);
+        }
+      else
+        {
+        fft_reg.vimg_smooth(uk1, uk, sigma_post_phys);
+        LDDMMType::vimg_clear_border(uk, 1);
+        }
       tm_Gaussian2.Stop();
 
       tm_Iteration.Stop();
@@ -2046,13 +2293,21 @@ int GreedyApproach<VDim, TReal>
   
   if(param.flag_stationary_velocity_mode)
     {
-    // Take current warp to 'exponent' power - this is the actual warp
-    VectorImagePointer uLevelExp = LDDMMType::alloc_vimg(uLevel);
     VectorImagePointer uLevelWork = LDDMMType::alloc_vimg(uLevel);
-    LDDMMType::vimg_exp(uLevel, uLevelExp, uLevelWork, param.warp_exponent, 1.0);
+    if(param.flag_store_root_warp && ChunkedWarpFileType::IsChunkedWarpFile(param.output.c_str()))
+      {
+      // Write the root warp, the reader takes it to the 'exponent' power
+      of_helper.WriteCompressedWarpInPhysicalSpace(nlevels - 1, uLevel, param.output.c_str(), 0, param.warp_exponent);
+      }
+    else
+      {
+      // Take current warp to 'exponent' power - this is the actual warp
+      VectorImagePointer uLevelExp = LDDMMType::alloc_vimg(uLevel);
+      LDDMMType::vimg_exp(uLevel, uLevelExp, uLevelWork, param.warp_exponent, 1.0);
 
-    // Write the resulting transformation field
-    of_helper.WriteCompressedWarpInPhysicalSpace(nlevels - 1, uLevelExp, param.output.c_str(), param.warp_precision);
+      // Write the resulting transformation field
+      of_helper.WriteCompressedWarpInPhysicalSpace(nlevels - 1, uLevelExp, param.output.c_str(), param.warp_precision);
+      }
 
     if(param.root_warp.size())
       {
@@ -2129,65 +2384,25 @@ int GreedyApproach<VDim, TReal>
   // Reference space
   ImageBaseType *refspace = of_helper.GetReferenceSpace(0);
 
-  // Intermediate images
+  // Best displacement (in voxel units) and best metric at each voxel
   VectorImagePointer u_best = VectorImageType::New();
-  VectorImagePointer u_curr = VectorImageType::New();
-  ImagePointer m_curr = ImageType::New();
   ImagePointer m_best = ImageType::New();
-
-  // Allocate the intermediate data
   LDDMMType::alloc_vimg(u_best, refspace);
-  LDDMMType::alloc_vimg(u_curr, refspace);
   LDDMMType::alloc_img(m_best, refspace);
-  LDDMMType::alloc_img(m_curr, refspace);
-
-  // Allocate m_best to a negative value
-  m_best->FillBuffer(-100.0);
 
-  // Create a neighborhood for computing offsets
-  itk::Neighborhood<float, VDim> dummy_nbr;
   itk::Size<VDim> search_rad = array_caster<VDim>::to_itkSize(param.brute_search_radius);
   itk::Size<VDim> metric_rad = array_caster<VDim>::to_itkSize(param.metric_radius);
-  dummy_nbr.SetRadius(search_rad);
 
-  // Iterate over all offsets
-  for(uint k = 0; k < dummy_nbr.Size(); k++)
-    {
-    // Get the offset corresponding to this iteration
-    itk::Offset<VDim> offset = dummy_nbr.GetOffset(k);
-
-    // Fill the deformation field with this offset
-    typename LDDMMType::Vec vec_offset;
-    for(uint i = 0; i < VDim; i++)
-      vec_offset[i] = offset[i];
-    u_curr->FillBuffer(vec_offset);
-
-    // Perform interpolation and metric computation
-    of_helper.ComputeNCCMetricImage(0, u_curr, metric_rad, m_curr);
-
-    // Temp: keep track of number of updates
-    unsigned long n_updates = 0;
-
-    // Out of laziness, just take a quick pass over the images
-    typename VectorImageType::RegionType rgn = refspace->GetBufferedRegion();
-    itk::ImageRegionIterator<VectorImageType> it_u(u_best, rgn);
-    itk::ImageRegionConstIterator<ImageType> it_m_curr(m_curr, rgn);
-    itk::ImageRegionIterator<ImageType> it_m_best(m_best, rgn);
-    for(; !it_m_best.IsAtEnd(); ++it_m_best, ++it_m_curr, ++it_u)
-      {
-      float v_curr = it_m_curr.Value();
-      if(v_curr > it_m_best.Value())
-        {
-        it_m_best.Set(v_curr);
-        it_u.Set(vec_offset);
-        ++n_updates;
-        }
-      }
+  unsigned long n_offsets = 1;
+  for(uint i = 0; i < VDim; i++)
+    n_offsets *= 2 * search_rad[i] + 1;
 
-    std::cout << "offset: " << offset << "     updates: " << n_updates << std::endl;
-    }
+  // Search all offsets, keeping the best one at each voxel
+  std::cout << "Searching " << n_offsets << " offsets" << std::endl;
+  of_helper.ComputeNCCBruteForceSearch(0, search_rad, metric_rad, u_best, m_best);
 
-  LDDMMType::vimg_write(u_best, param.output.c_str());
+  // Warps are written in float, whatever the precision of the computation
+  LDDMMType::vimg_write(u_best, param.output.c_str(), itk::ImageIOBase::FLOAT);
   LDDMMType::img_write(m_best, "mbest.nii.gz");
 
   return 0;
@@ -2199,6 +2414,32 @@ int GreedyApproach<VDim, TReal>
 #include "itkNearestNeighborInterpolateImageFunction.h"
 
 
+template <unsigned int VDim, typename TReal>
+void GreedyApproach<VDim, TReal>
+::ReadWarp(const std::string &filename, VectorImagePointer &warp)
+{
+  if(!ChunkedWarpFileType::IsChunkedWarpFile(filename.c_str()))
+    {
+    warp = VectorImageType::New();
+    LDDMMType::vimg_read(filename.c_str(), warp);
+    return;
+    }
+
+  typename ChunkedWarpFileType::Header header;
+  ChunkedWarpFileType::ReadHeader(filename.c_str(), header);
+  warp = ChunkedWarpFileType::Read(filename.c_str());
+
+  // A root warp is squared in voxel space to get the actual warp
+  if(header.exponent > 0)
+    {
+    VectorImagePointer warp_exp = LDDMMType::alloc_vimg(warp);
+    VectorImagePointer warp_work = LDDMMType::alloc_vimg(warp);
+    OFHelperType::PhysicalWarpToVoxelWarp(warp, warp, warp);
+    LDDMMType::vimg_exp(warp, warp_exp, warp_work, header.exponent, 1.0);
+    OFHelperType::VoxelWarpToPhysicalWarp(warp_exp, warp, warp);
+    }
+}
+
 template <unsigned int VDim, typename TReal>
 void GreedyApproach<VDim, TReal>
 ::ReadTransformChain(const std::vector<TransformSpec> &tran_chain,
@@ -2216,15 +2457,26 @@ void GreedyApproach<VDim, TReal>
     std::string tran = tran_chain[i].filename;
 
     // Determine if it's an affine transform
-    if(itk::ImageIOFactory::CreateImageIO(tran.c_str(), itk::ImageIOFactory::ReadMode))
+    bool chunked = ChunkedWarpFileType::IsChunkedWarpFile(tran.c_str());
+    if(chunked || itk::ImageIOFactory::CreateImageIO(tran.c_str(), itk::ImageIOFactory::ReadMode))
       {
       // Create a temporary warp
       VectorImagePointer warp_tmp = VectorImageType::New();
       LDDMMType::alloc_vimg(warp_tmp, ref_space);
 
-      // Read the next warp
-      VectorImagePointer warp_i = VectorImageType::New();
-      LDDMMType::vimg_read(tran.c_str(), warp_i);
+      // Read the next warp. Of a .gwarp file, only the part where the current warp
+      // takes the reference space voxels is read, unless it must be exponentiated
+      VectorImagePointer warp_i;
+      if(chunked && tran_chain[i].exponent == 1)
+        {
+        typename ChunkedWarpFileType::Header header;
+        ChunkedWarpFileType::ReadHeader(tran.c_str(), header);
+        if(header.exponent == 0)
+          warp_i = ChunkedWarpFileType::ReadRegion(
+                     tran.c_str(), ChunkedWarpFileType::GetRegionForSampling(header, out_warp));
+        }
+      if(warp_i.IsNull())
+        this->ReadWarp(tran, warp_i);
 
       // If there is an exponent on the transform spec, handle it
       if(tran_chain[i].exponent != 1)
@@ -2239,10 +2491,11 @@ void GreedyApproach<VDim, TReal>
 
         // Bring the transform into voxel space
         VectorImagePointer warp_exp = LDDMMType::alloc_vimg(warp_i);
+        VectorImagePointer warp_work = LDDMMType::alloc_vimg(warp_i);
         OFHelperType::PhysicalWarpToVoxelWarp(warp_i, warp_i, warp_i);
 
         // Square the transform N times (in its own space)
-        LDDMMType::vimg_exp(warp_i, warp_exp, warp_tmp, n, tran_chain[i].exponent / absexp);
+        LDDMMType::vimg_exp(warp_i, warp_exp, warp_work, n, tran_chain[i].exponent / absexp);
 
         // Bring the transform back into physical space
         OFHelperType::VoxelWarpToPhysicalWarp(warp_exp, warp_i, warp_i);
@@ -2486,7 +2739,7 @@ int GreedyApproach<VDim, TReal>
   VectorImagePointer warp;
 
   // Read the warp file
-  LDDMMType::vimg_read(param.jacobian_param.in_warp.c_str(), warp);
+  this->ReadWarp(param.jacobian_param.in_warp, warp);
 
   // Convert the warp file into voxel units from physical units
   OFHelperType::PhysicalWarpToVoxelWarp(warp, warp, warp);
@@ -2898,7 +3151,7 @@ int GreedyApproach<VDim, TReal>
   VectorImagePointer warp;
 
   // Read the warp file
-  LDDMMType::vimg_read(param.invwarp_param.in_warp.c_str(), warp);
+  this->ReadWarp(param.invwarp_param.in_warp, warp);
 
   // Convert the warp file into voxel units from physical units
   OFHelperType::PhysicalWarpToVoxelWarp(warp, warp, warp);
@@ -2926,7 +3179,7 @@ int GreedyApproach<VDim, TReal>
   VectorImagePointer warp;
 
   // Read the warp file
-  LDDMMType::vimg_read(param.warproot_param.in_warp.c_str(), warp);
+  this->ReadWarp(param.warproot_param.in_warp, warp);
 
   // Convert the warp file into voxel units from physical units
   OFHelperType::PhysicalWarpToVoxelWarp(warp, warp, warp);
@@ -2960,10 +3213,160 @@ GreedyApproach<VDim,TReal>
   return m_MetricLog;
 }
 
+template <unsigned int VDim, typename TReal>
+GreedyParameters
+GreedyApproach<VDim, TReal>
+::GetBatchJobParameters(const GreedyParameters &param, const BatchJobSpec &job)
+{
+  GreedyParameters job_param = param;
+  job_param.inputs[0].moving = job.moving;
+  job_param.output = job.output;
+  return job_param;
+}
+
+template <unsigned int VDim, typename TReal>
+ITK_THREAD_RETURN_TYPE
+GreedyApproach<VDim, TReal>
+::BatchThreaderCallback(void *arg)
+{
+  typedef itk::MultiThreader::ThreadInfoStruct ThreadInfo;
+  ThreadInfo *info = static_cast<ThreadInfo *>(arg);
+  BatchThreadData *data = static_cast<BatchThreadData *>(info->UserData);
+
+  // Jobs differ in length, so each thread takes the next job when it is done
+  while(true)
+    {
+    data->lock.Lock();
+    unsigned int i = data->next_job++;
+    data->lock.Unlock();
+
+    if(i >= data->jobs->size())
+      break;
+
+    RunBatchJob(data, *data->param, i);
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <unsigned int VDim, typename TReal>
+void GreedyApproach<VDim, TReal>
+::RunBatchJob(BatchThreadData *data, const GreedyParameters &param, unsigned int i)
+{
+  try
+    {
+    // Each job has its own approach, which reads the shared inputs from the cache
+    Self job_greedy;
+    job_greedy.m_ImageCache = data->image_cache;
+    job_greedy.m_BatchOwner = data->greedy;
+
+    GreedyParameters job_param = GetBatchJobParameters(param, (*data->jobs)[i]);
+    if(job_greedy.Run(job_param) != 0)
+      data->errors[i] = "registration failed";
+    }
+  catch(std::exception &exc)
+    {
+    data->errors[i] = exc.what();
+    }
+
+  printf("Batch job %d of %d (%s) %s\n", (int) i + 1, (int) data->jobs->size(),
+         (*data->jobs)[i].moving.c_str(), data->errors[i].length() ? "failed" : "done");
+}
+
+template <unsigned int VDim, typename TReal>
+int GreedyApproach<VDim, TReal>
+::RunBatch(GreedyParameters &param, const std::vector<BatchJobSpec> &jobs)
+{
+  if(param.inputs.size() != 1)
+    throw GreedyException("Batch registration requires exactly one fixed/moving image pair");
+
+  if(param.mode != GreedyParameters::GREEDY && param.mode != GreedyParameters::AFFINE
+     && param.mode != GreedyParameters::BRUTE && param.mode != GreedyParameters::MOMENTS)
+    throw GreedyException("Batch registration is only available in registration modes");
+
+  if(jobs.size() == 0)
+    return 0;
+
+  // Read the fixed image and the masks once, the jobs find them in their input cache.
+  // The pointers keep the images alive until the jobs are done
+  typedef typename OFHelperType::FloatImageType MaskType;
+  BatchThreadData data;
+  data.image_cache = m_ImageCache;
+
+  CompositeImagePointer fixed = ReadImageViaCache<CompositeImageType>(param.inputs[0].fixed);
+  data.image_cache[param.inputs[0].fixed] = fixed;
+
+  typename MaskType::Pointer gradient_mask, moving_mask;
+  if(param.gradient_mask.size())
+    {
+    gradient_mask = ReadImageViaCache<MaskType>(param.gradient_mask);
+    data.image_cache[param.gradient_mask] = gradient_mask;
+    }
+  if(param.moving_mask.size())
+    {
+    moving_mask = ReadImageViaCache<MaskType>(param.moving_mask);
+    data.image_cache[param.moving_mask] = moving_mask;
+    }
+
+  int n_total = param.threads > 0
+                ? param.threads : std::max(1, (int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads());
+
+  data.greedy = this;
+  data.jobs = &jobs;
+  data.errors.resize(jobs.size());
+
+  // The first job runs alone with all the threads. It builds the fixed image and mask
+  // pyramids, which the other jobs then find in the cache instead of each building them
+  GreedyParameters first_param = param;
+  first_param.threads = n_total;
+  RunBatchJob(&data, first_param, 0);
+
+  // Split the thread budget between the other jobs. Each job passes its share to its
+  // metric filters, its image operations and filters (LDDMMData::set_thread_count) and
+  // its FFT regularizer
+  int n_jobs = std::min((int) jobs.size() - 1, param.batch_jobs > 0 ? param.batch_jobs : n_total);
+  if(n_jobs > 0)
+    {
+    GreedyParameters job_param = param;
+    job_param.threads = std::max(1, n_total / n_jobs);
+    data.param = &job_param;
+    data.next_job = 1;
+
+    itk::MultiThreader::Pointer mt = itk::MultiThreader::New();
+    mt->SetNumberOfThreads(n_jobs);
+    mt->SetSingleMethod(&Self::BatchThreaderCallback, &data);
+    mt->SingleMethodExecute();
+    }
+
+  // The shared pyramids are only kept if the caller asked for the pyramid cache
+  if(!m_UsePyramidCache)
+    m_PyramidCache.clear();
+
+  // Report the failed jobs
+  int n_failed = 0;
+  for(unsigned int i = 0; i < jobs.size(); i++)
+    if(data.errors[i].length())
+      n_failed++;
+
+  if(n_failed)
+    {
+    fprintf(stderr, "%d of %d batch jobs failed:\n", n_failed, (int) jobs.size());
+    for(unsigned int i = 0; i < jobs.size(); i++)
+      if(data.errors[i].length())
+        fprintf(stderr, "  %s: %s\n", jobs[i].moving.c_str(), data.errors[i].c_str());
+    }
+
+  return n_failed;
+}
+
 template <unsigned int VDim, typename TReal>
 int GreedyApproach<VDim, TReal>
 ::Run(GreedyParameters &param)
 {
+  // The image operations and their ITK filters use the threads of the parameters. The
+  // setting only applies to the calling thread, so that the jobs of a batch keep their share
+  typename LDDMMType::ThreadCountScope thread_scope(param.threads);
+
   switch(param.mode)
     {
     case GreedyParameters::GREEDY:
@@ -35,8 +35,11 @@
 #include <map>
 
 #include "itkCommand.h"
+#include "itkSimpleFastMutexLock.h"
+#include "itkMultiThreader.h"
 
 template <typename T, unsigned int V> class MultiImageOpticalFlowHelper;
+template <class TFloat, unsigned int VDim> class ChunkedWarpFile;
 
 namespace itk {
   template <typename T, unsigned int D1, unsigned int D2> class MatrixOffsetTransformBase;
@@ -70,6 +73,8 @@ public:
 
   typedef MultiImageOpticalFlowHelper<TReal, VDim> OFHelperType;
 
+  typedef ChunkedWarpFile<TReal, VDim> ChunkedWarpFileType;
+
   typedef itk::MatrixOffsetTransformBase<TReal, VDim, VDim> LinearTransformType;
 
   struct ImagePair {
@@ -78,9 +83,23 @@ public:
     double weight;
   };
 
+  GreedyApproach() : m_UsePyramidCache(false), m_BatchOwner(NULL) {}
 
   int Run(GreedyParameters &param);
 
+  /**
+   * Register several moving images to one fixed image in one process. The
+   * parameters describe a single registration, whose only input pair gives the
+   * fixed image; each job replaces its moving image and output. The fixed image
+   * and the masks are read once, and their pyramids are built once (by the first
+   * job, which runs alone with all the threads) and shared by the other jobs. Up
+   * to param.batch_jobs of these (by default, one per thread) run at the same
+   * time, and the threads given by param.threads (or the ITK default) are split
+   * between them. A failed job does not stop the others; the failed jobs
+   * are printed at the end, and their number is returned (0 on success).
+   */
+  int RunBatch(GreedyParameters &param, const std::vector<BatchJobSpec> &jobs);
+
   int RunDeformable(GreedyParameters &param);
 
   int RunAffine(GreedyParameters &param);
@@ -126,6 +145,24 @@ public:
    */
   void AddCachedInputObject(std::string &string, itk::Object *object);
 
+  /**
+   * Keep the image pyramids (composite images, mask pyramids, and the data
+   * derived from them by the metrics) in an internal cache, so that runs with
+   * the same inputs reuse them instead of building them again. This helps when
+   * the same images are registered several times in one API session, e.g.,
+   * affine registration followed by deformable registration.
+   *
+   * Images read from disk are identified by filename and modification time.
+   * Cached input objects are identified by name, address and modification time,
+   * so objects whose pixels are changed in place must be marked as modified.
+   * Unlike the input cache, the pyramid cache holds references to its images,
+   * so it should be cleared when the pyramids are no longer needed.
+   */
+  void SetUsePyramidCache(bool flag) { m_UsePyramidCache = flag; }
+
+  /** Release the images held by the pyramid cache */
+  void ClearPyramidCache() { m_PyramidCache.clear(); }
+
   /**
    * Get the metric log - values of metric per level. Can be called from
    * callback functions and observers
@@ -139,10 +176,24 @@ protected:
   typedef std::map<std::string, itk::Object *> ImageCache;
   ImageCache m_ImageCache;
 
+  // Pyramids shared between runs, see SetUsePyramidCache
+  typedef std::map<std::string, itk::SmartPointer<itk::Object> > PyramidCache;
+  PyramidCache m_PyramidCache;
+  bool m_UsePyramidCache;
+
+  // Guards the pyramid cache when it is shared by batch jobs
+  itk::SimpleFastMutexLock m_PyramidCacheLock;
+
+  // For a batch job, the approach running the batch, whose pyramid cache is used
+  Self *m_BatchOwner;
+
   // A log of metric values used during registration - so metric can be looked up
   // in the callbacks to RunAffine, etc.
   std::vector< std::vector<double> > m_MetricLog;
 
+  // Guards the metric log when cost functions are computed on several threads
+  itk::SimpleFastMutexLock m_MetricLogLock;
+
   // This function reads the image from disk, or from a memory location mapped to a
   // string. The first approach is used by the command-line interface, and the second
   // approach is used by the API, allowing images to be passed from other software
@@ -155,10 +206,17 @@ protected:
 
   void ReadImages(GreedyParameters &param, OFHelperType &ofhelper);
 
+  // Identifies an input (file or cached object) in the keys of the pyramid cache
+  std::string GetInputCacheKey(const std::string &filename);
+
   void ReadTransformChain(const std::vector<TransformSpec> &tran_chain,
                           ImageBaseType *ref_space,
                           VectorImagePointer &out_warp);
 
+  // Read a warp in physical units, from an image or a .gwarp file. A root warp
+  // stored in a .gwarp file is exponentiated
+  void ReadWarp(const std::string &filename, VectorImagePointer &warp);
+
   static vnl_matrix<double> MapAffineToPhysicalRASSpace(
       OFHelperType &of_helper, int level,
       LinearTransformType *tran);
@@ -173,6 +231,49 @@ protected:
   // Compute the moments of a composite image (mean and covariance matrix of coordinate weighted by intensity)
   void ComputeImageMoments(CompositeImageType *image, const std::vector<double> &weights, VecFx &m1, MatFx &m2);
 
+  // Compute the rigid cost function at the given level for each of the parameter vectors
+  // in x, on multiple threads. If refine_iter > 0, each vector is first refined by the
+  // affine optimizer (at most refine_iter evaluations) and replaced if that improves on
+  // its value, which f must then hold on input
+  void ComputeRigidCandidates(GreedyParameters &param, OFHelperType &of_helper, int level,
+                              std::vector<vnl_vector<double> > &x, std::vector<double> &f,
+                              int refine_iter);
+
+  // Data passed to the threads of ComputeRigidCandidates
+  struct RigidCandidatesThreadData
+  {
+    Self *greedy;
+    GreedyParameters *param;
+    OFHelperType *of_helper;
+    int level, refine_iter;
+    std::vector<vnl_vector<double> > *x;
+    std::vector<double> *f;
+    std::vector<std::string> errors;
+  };
+
+  static ITK_THREAD_RETURN_TYPE RigidCandidatesThreaderCallback(void *arg);
+
+  // Parameters of a job of RunBatch
+  static GreedyParameters GetBatchJobParameters(const GreedyParameters &param, const BatchJobSpec &job);
+
+
+  // Data passed to the threads of RunBatch
+  struct BatchThreadData
+  {
+    Self *greedy;
+    const GreedyParameters *param;
+    const std::vector<BatchJobSpec> *jobs;
+    ImageCache image_cache;
+    unsigned int next_job;
+    itk::SimpleFastMutexLock lock;
+    std::vector<std::string> errors;
+  };
+
+  static ITK_THREAD_RETURN_TYPE BatchThreaderCallback(void *arg);
+
+  // Run job i of a batch with the given parameters, recording its error if it fails
+  static void RunBatchJob(BatchThreadData *data, const GreedyParameters &param, unsigned int i);
+
   class AbstractAffineCostFunction : public vnl_cost_function
   {
   public:
@@ -221,6 +322,9 @@ protected:
     VectorImagePointer m_Phi, m_GradMetric, m_GradMask;
     ImagePointer m_Metric, m_Mask;
 
+    // Working memory for the NCC metric (each cost function has its own)
+    CompositeImagePointer m_NCCWorkingImage;
+
     // Last set of coefficients evaluated
     vnl_vector<double> last_coeff;
   };
@@ -56,9 +56,15 @@ GreedyParameters
 	param.flag_debug_deriv = false;
 	param.flag_debug_aff_obj = false;
 	param.flag_float_math = false;
+	param.flag_float_mixed_precision = false;
+	param.flag_ncc_stream_box_sums = false;
+	param.batch_jobs = 0;
 	param.flag_stationary_velocity_mode = false;
 	param.flag_stationary_velocity_mode_use_lie_bracket = false;
+	param.flag_store_root_warp = false;
 	param.sigma_post.physical_units = false;
+	param.ns_alpha = 1.0;
+	param.ns_gamma = 1.0;
 	param.background = 0.0;
 
 	// reslice mode parameters
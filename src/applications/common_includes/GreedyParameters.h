@@ -53,7 +53,11 @@ struct RigidSearchSpec
   double sigma_xyz;
   double sigma_angle;
 
-  RigidSearchSpec() : iterations(0), sigma_xyz(0.0), sigma_angle(0.0) {}
+  // Number of best tries refined by the affine optimizer before picking the
+  // best one (0: the best try is used as is)
+  int refine_count;
+
+  RigidSearchSpec() : iterations(0), sigma_xyz(0.0), sigma_angle(0.0), refine_count(3) {}
 };
 
 struct InterpSpec
@@ -80,6 +84,13 @@ struct ResliceMeshSpec
   std::string output;
 };
 
+// A job of a batch registration against one fixed image
+struct BatchJobSpec
+{
+  std::string moving;
+  std::string output;
+};
+
 struct TransformSpec
 {
   // Transform file
@@ -144,6 +155,7 @@ struct GreedyParameters
   enum TimeStepMode { CONSTANT=0, SCALE, SCALEDOWN };
   enum Mode { GREEDY=0, AFFINE, BRUTE, RESLICE, INVERT_WARP, ROOT_WARP, JACOBIAN_WARP, MOMENTS };
   enum AffineDOF { DOF_RIGID=6, DOF_SIMILARITY=7, DOF_AFFINE=12 };
+  enum RegularizerType { REG_RECURSIVE_GAUSSIAN=0, REG_FFT_GAUSSIAN, REG_FFT_NAVIER_STOKES };
 
   std::vector<ImagePairSpec> inputs;
   std::string output;
@@ -180,6 +192,13 @@ struct GreedyParameters
   // Smoothing parameters
   SmoothingParameters sigma_pre, sigma_post;
 
+  // How the gradient and the warp are smoothed at each level. If there are fewer
+  // entries than levels, the last entry is used for the remaining levels. With
+  // REG_FFT_NAVIER_STOKES the gradient is regularized with the Navier-Stokes kernel
+  // (ns_alpha and ns_gamma, in voxel units) instead of sigma_pre
+  std::vector<RegularizerType> regularizer_per_level;
+  double ns_alpha, ns_gamma;
+
   MetricType metric;
   TimeStepMode time_step_mode;
 
@@ -236,9 +255,23 @@ struct GreedyParameters
   // Whether the lie bracket is used in the y velocity update
   bool flag_stationary_velocity_mode_use_lie_bracket;
 
+  // In stationary velocity mode, write the root warp to .gwarp outputs instead of the
+  // full warp; it is exponentiated when read
+  bool flag_store_root_warp;
+
   // Floating point precision?
   bool flag_float_math;
 
+  // With float math, accumulate the NCC box sums in double precision (mixed precision)
+  bool flag_float_mixed_precision;
+
+  // Compute the NCC box sums by streaming through the image, to save memory
+  bool flag_ncc_stream_box_sums;
+
+  // Largest number of batch jobs registered at the same time (0: decided by the
+  // number of threads)
+  int batch_jobs;
+
   static void SetToDefaults(GreedyParameters &param);
 };
 
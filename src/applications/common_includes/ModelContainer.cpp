@@ -0,0 +1,590 @@
+/**
+\file  ModelContainer.cpp
+
+\brief Implementation of the ModelContainer
+
+https://www.med.upenn.edu/sbia/software/ <br>
+software@cbica.upenn.edu
+
+Copyright (c) 2018 University of Pennsylvania. All rights reserved. <br>
+See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
+
+*/
+
+#include "ModelContainer.h"
+#include "cbicaUtilities.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  const char cMagic[8] = { 'C', 'A', 'P', 'T', 'K', 'M', 'D', 'L' };
+  const size_t cNameLength = 64;
+  const size_t cAlignment = 64;
+
+  struct FileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t numberOfArrays;
+    uint32_t numberOfMetadata;
+    uint32_t reserved;
+    uint64_t fileSize;
+    uint64_t checksum; // over everything after the header
+    char padding[24];
+  };
+  static_assert(sizeof(FileHeader) == 64, "ModelContainer header must be 64 bytes");
+
+  struct TableEntry
+  {
+    char name[cNameLength];
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t offset;
+  };
+
+  inline size_t AlignUp(const size_t value)
+  {
+    return (value + cAlignment - 1) & ~(cAlignment - 1);
+  }
+
+  //! Last modification time of a file; returns false if it does not exist
+  inline bool GetModificationTime(const std::string &fileName, int64_t &modificationTime)
+  {
+#ifdef _WIN32
+    struct _stat64 fileStat;
+    if (_stat64(fileName.c_str(), &fileStat) != 0)
+    {
+      return false;
+    }
+#else
+    struct stat fileStat;
+    if (stat(fileName.c_str(), &fileStat) != 0)
+    {
+      return false;
+    }
+#endif
+    modificationTime = static_cast< int64_t >(fileStat.st_mtime);
+    return true;
+  }
+}
+
+ModelContainer::ModelContainer()
+{
+}
+
+ModelContainer::~ModelContainer()
+{
+  Unmap();
+}
+
+uint64_t ModelContainer::Checksum(const unsigned char *data, const size_t size)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++)
+  {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+void ModelContainer::AddArray(const std::string &name, const double *data, const size_t rows, const size_t cols)
+{
+  auto &storage = mOwnedData[name];
+  storage.assign(data, data + rows * cols);
+  ArrayEntry entry;
+  entry.data = storage.data();
+  entry.rows = rows;
+  entry.cols = cols;
+  mArrays[name] = entry;
+}
+
+void ModelContainer::AddMatrix(const std::string &name, const VariableSizeMatrixType &matrix)
+{
+  std::vector< double > data(matrix.Rows() * matrix.Cols());
+  for (unsigned int i = 0; i < matrix.Rows(); i++)
+  {
+    for (unsigned int j = 0; j < matrix.Cols(); j++)
+    {
+      data[i * matrix.Cols() + j] = matrix(i, j);
+    }
+  }
+  AddArray(name, data.data(), matrix.Rows(), matrix.Cols());
+}
+
+void ModelContainer::AddVector(const std::string &name, const VariableLengthVectorType &vector)
+{
+  AddArray(name, vector.GetDataPointer(), 1, vector.Size());
+}
+
+bool ModelContainer::AddArrayFromCSV(const std::string &name, const std::string &csvFile)
+{
+  auto csvData = cbica::readCSVDataFile< double >(csvFile);
+  if (csvData.empty())
+  {
+    mLastEncounteredError = "Could not read CSV file: " + csvFile;
+    return false;
+  }
+  const size_t rows = csvData.size(), cols = csvData[0].size();
+  std::vector< double > data(rows * cols, 0.0);
+  for (size_t i = 0; i < rows; i++)
+  {
+    std::copy(csvData[i].begin(), csvData[i].begin() + std::min(cols, csvData[i].size()), data.begin() + i * cols);
+  }
+  AddArray(name, data.data(), rows, cols);
+  return true;
+}
+
+bool ModelContainer::AddMetadataFromFile(const std::string &key, const std::string &textFile)
+{
+  std::ifstream file(textFile.c_str(), std::ios::binary);
+  if (!file.is_open())
+  {
+    mLastEncounteredError = "Could not read file: " + textFile;
+    return false;
+  }
+  mMetadata[key].assign(std::istreambuf_iterator< char >(file), std::istreambuf_iterator< char >());
+  return true;
+}
+
+void ModelContainer::SetMetadata(const std::string &key, const std::string &value)
+{
+  mMetadata[key] = value;
+}
+
+std::string ModelContainer::GetMetadata(const std::string &key) const
+{
+  auto it = mMetadata.find(key);
+  return (it == mMetadata.end()) ? "" : it->second;
+}
+
+void ModelContainer::Clear()
+{
+  Unmap();
+  mArrays.clear();
+  mOwnedData.clear();
+  mMetadata.clear();
+}
+
+bool ModelContainer::Write(const std::string &fileName)
+{
+  // lay out table, metadata and payload
+  std::vector< TableEntry > table;
+  table.reserve(mArrays.size());
+  std::vector< char > metadataBlock;
+  for (auto &meta : mMetadata)
+  {
+    const std::string *strings[2] = { &meta.first, &meta.second };
+    for (auto *str : strings)
+    {
+      const uint32_t length = static_cast< uint32_t >(str->size());
+      const char *lengthBytes = reinterpret_cast< const char * >(&length);
+      metadataBlock.insert(metadataBlock.end(), lengthBytes, lengthBytes + sizeof(length));
+      metadataBlock.insert(metadataBlock.end(), str->begin(), str->end());
+    }
+  }
+
+  size_t offset = AlignUp(sizeof(FileHeader) + mArrays.size() * sizeof(TableEntry) + metadataBlock.size());
+  for (auto &array : mArrays)
+  {
+    if (array.first.size() >= cNameLength)
+    {
+      mLastEncounteredError = "Array name is longer than " + std::to_string(cNameLength - 1) + " characters: " + array.first;
+      return false;
+    }
+    TableEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    std::strncpy(entry.name, array.first.c_str(), cNameLength - 1);
+    entry.rows = array.second.rows;
+    entry.cols = array.second.cols;
+    entry.offset = offset;
+    table.push_back(entry);
+    offset = AlignUp(offset + array.second.rows * array.second.cols * sizeof(double));
+  }
+  const size_t fileSize = offset;
+
+  std::vector< unsigned char > buffer(fileSize, 0);
+  FileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, cMagic, sizeof(cMagic));
+  header.version = Version;
+  header.numberOfArrays = static_cast< uint32_t >(table.size());
+  header.numberOfMetadata = static_cast< uint32_t >(mMetadata.size());
+  header.fileSize = fileSize;
+
+  unsigned char *current = buffer.data() + sizeof(FileHeader);
+  if (!table.empty())
+  {
+    std::memcpy(current, table.data(), table.size() * sizeof(TableEntry));
+  }
+  current += table.size() * sizeof(TableEntry);
+  if (!metadataBlock.empty())
+  {
+    std::memcpy(current, metadataBlock.data(), metadataBlock.size());
+  }
+  size_t i = 0;
+  for (auto &array : mArrays)
+  {
+    std::memcpy(buffer.data() + table[i].offset, array.second.data, array.second.rows * array.second.cols * sizeof(double));
+    i++;
+  }
+
+  header.checksum = Checksum(buffer.data() + sizeof(FileHeader), fileSize - sizeof(FileHeader));
+  std::memcpy(buffer.data(), &header, sizeof(header));
+
+  std::ofstream file(fileName.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+  {
+    mLastEncounteredError = "Could not open file for writing: " + fileName;
+    return false;
+  }
+  file.write(reinterpret_cast< const char * >(buffer.data()), buffer.size());
+  if (!file.good())
+  {
+    mLastEncounteredError = "Could not write file: " + fileName;
+    return false;
+  }
+  return true;
+}
+
+bool ModelContainer::Read(const std::string &fileName, bool verifyChecksum)
+{
+  Clear();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    mLastEncounteredError = "Could not open model file: " + fileName;
+    return false;
+  }
+  LARGE_INTEGER size;
+  GetFileSizeEx(file, &size);
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL)
+  {
+    CloseHandle(file);
+    mLastEncounteredError = "Could not map model file: " + fileName;
+    return false;
+  }
+  mFileHandle = file;
+  mMappingHandle = mapping;
+  mMappedSize = static_cast< size_t >(size.QuadPart);
+  mMappedData = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+  int file = open(fileName.c_str(), O_RDONLY);
+  if (file < 0)
+  {
+    mLastEncounteredError = "Could not open model file: " + fileName;
+    return false;
+  }
+  struct stat fileStat;
+  fstat(file, &fileStat);
+  mMappedSize = static_cast< size_t >(fileStat.st_size);
+  mMappedData = (mMappedSize > 0) ? mmap(nullptr, mMappedSize, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+  close(file);
+  if (mMappedData == MAP_FAILED)
+  {
+    mMappedData = nullptr;
+  }
+#endif
+  if (mMappedData == nullptr)
+  {
+    Unmap();
+    mLastEncounteredError = "Could not map model file: " + fileName;
+    return false;
+  }
+
+  const unsigned char *base = static_cast< const unsigned char * >(mMappedData);
+  FileHeader header;
+  if (mMappedSize < sizeof(header))
+  {
+    Unmap();
+    mLastEncounteredError = "Model file is truncated: " + fileName;
+    return false;
+  }
+  std::memcpy(&header, base, sizeof(header));
+  if (std::memcmp(header.magic, cMagic, sizeof(cMagic)) != 0)
+  {
+    Unmap();
+    mLastEncounteredError = "Not a CaPTk model file: " + fileName;
+    return false;
+  }
+  if (header.version > Version)
+  {
+    Unmap();
+    mLastEncounteredError = "Model file version " + std::to_string(header.version) + " is newer than supported version " + std::to_string(Version);
+    return false;
+  }
+  if (header.fileSize != mMappedSize)
+  {
+    Unmap();
+    mLastEncounteredError = "Model file is truncated: " + fileName;
+    return false;
+  }
+  if (verifyChecksum && (Checksum(base + sizeof(FileHeader), mMappedSize - sizeof(FileHeader)) != header.checksum))
+  {
+    Unmap();
+    mLastEncounteredError = "Checksum mismatch in model file: " + fileName;
+    return false;
+  }
+
+  // array table
+  const unsigned char *current = base + sizeof(FileHeader);
+  const unsigned char *end = base + mMappedSize;
+  if (current + header.numberOfArrays * sizeof(TableEntry) > end)
+  {
+    Unmap();
+    mLastEncounteredError = "Corrupt array table in model file: " + fileName;
+    return false;
+  }
+  for (uint32_t i = 0; i < header.numberOfArrays; i++)
+  {
+    TableEntry entry;
+    std::memcpy(&entry, current, sizeof(entry));
+    current += sizeof(entry);
+    entry.name[cNameLength - 1] = '\0';
+    // checked without multiplying first, so that a corrupt size cannot overflow
+    const uint64_t available = (entry.offset <= mMappedSize) ? (mMappedSize - entry.offset) / sizeof(double) : 0;
+    if ((entry.offset % sizeof(double) != 0) || (entry.offset > mMappedSize) ||
+      ((entry.cols != 0) && (entry.rows > available / entry.cols)))
+    {
+      Unmap();
+      mLastEncounteredError = "Corrupt array entry '" + std::string(entry.name) + "' in model file: " + fileName;
+      return false;
+    }
+    ArrayEntry array;
+    array.data = reinterpret_cast< const double * >(base + entry.offset);
+    array.rows = entry.rows;
+    array.cols = entry.cols;
+    mArrays[entry.name] = array;
+  }
+
+  // metadata
+  for (uint32_t i = 0; i < header.numberOfMetadata; i++)
+  {
+    std::string strings[2];
+    for (auto &str : strings)
+    {
+      uint32_t length;
+      if (current + sizeof(length) > end)
+      {
+        Unmap();
+        mLastEncounteredError = "Corrupt metadata in model file: " + fileName;
+        return false;
+      }
+      std::memcpy(&length, current, sizeof(length));
+      current += sizeof(length);
+      if (current + length > end)
+      {
+        Unmap();
+        mLastEncounteredError = "Corrupt metadata in model file: " + fileName;
+        return false;
+      }
+      str.assign(reinterpret_cast< const char * >(current), length);
+      current += length;
+    }
+    mMetadata[strings[0]] = strings[1];
+  }
+
+  return true;
+}
+
+void ModelContainer::Unmap()
+{
+  if (mMappedData != nullptr)
+  {
+    // arrays read from the mapping become invalid
+    mArrays.clear();
+    mMetadata.clear();
+  }
+#ifdef _WIN32
+  if (mMappedData != nullptr)
+  {
+    UnmapViewOfFile(mMappedData);
+  }
+  if (mMappingHandle != nullptr)
+  {
+    CloseHandle(mMappingHandle);
+    mMappingHandle = nullptr;
+  }
+  if (mFileHandle != nullptr)
+  {
+    CloseHandle(mFileHandle);
+    mFileHandle = nullptr;
+  }
+#else
+  if (mMappedData != nullptr)
+  {
+    munmap(mMappedData, mMappedSize);
+  }
+#endif
+  mMappedData = nullptr;
+  mMappedSize = 0;
+}
+
+bool ModelContainer::HasArray(const std::string &name) const
+{
+  return mArrays.find(name) != mArrays.end();
+}
+
+ModelContainer::ArrayEntry ModelContainer::GetArray(const std::string &name) const
+{
+  auto it = mArrays.find(name);
+  return (it == mArrays.end()) ? ArrayEntry() : it->second;
+}
+
+VariableSizeMatrixType ModelContainer::GetMatrix(const std::string &name) const
+{
+  VariableSizeMatrixType matrix;
+  auto array = GetArray(name);
+  if (array.data == nullptr)
+  {
+    return matrix;
+  }
+  matrix.SetSize(array.rows, array.cols);
+  for (uint64_t i = 0; i < array.rows; i++)
+  {
+    for (uint64_t j = 0; j < array.cols; j++)
+    {
+      matrix(i, j) = array.data[i * array.cols + j];
+    }
+  }
+  return matrix;
+}
+
+VariableLengthVectorType ModelContainer::GetVector(const std::string &name) const
+{
+  VariableLengthVectorType vector;
+  auto array = GetArray(name);
+  if (array.data == nullptr)
+  {
+    return vector;
+  }
+  vector.SetSize(array.rows * array.cols);
+  std::copy(array.data, array.data + array.rows * array.cols, vector.GetDataPointer());
+  return vector;
+}
+
+std::vector< std::string > ModelContainer::GetArrayNames() const
+{
+  std::vector< std::string > names;
+  for (auto &array : mArrays)
+  {
+    names.push_back(array.first);
+  }
+  return names;
+}
+
+bool ModelContainer::ConvertFromCSVDirectory(const std::string &modelDirectory, const std::vector< std::string > &requiredFiles,
+  const std::string &outputFile, const std::string &applicationName)
+{
+  Clear();
+  for (auto &required : requiredFiles)
+  {
+    if (!cbica::isFile(modelDirectory + "/" + required))
+    {
+      mLastEncounteredError = "Required model file is missing: " + modelDirectory + "/" + required;
+      return false;
+    }
+  }
+
+  auto files = cbica::filesInDirectory(modelDirectory);
+  for (auto &file : files)
+  {
+    const auto extension = cbica::getFilenameExtension(file);
+    bool added = true;
+    if (extension == ".csv")
+    {
+      added = AddArrayFromCSV(cbica::getFilenameBase(file), file);
+    }
+    else if (extension == ".xml")
+    {
+      added = AddMetadataFromFile(cbica::getFilenameBase(file) + extension, file);
+    }
+    if (!added)
+    {
+      const auto error = mLastEncounteredError;
+      Clear();
+      mLastEncounteredError = error;
+      return false;
+    }
+  }
+  if (mArrays.empty())
+  {
+    mLastEncounteredError = "No CSV model files found in: " + modelDirectory;
+    return false;
+  }
+  if (!applicationName.empty())
+  {
+    SetMetadata("Application", applicationName);
+  }
+  return Write(outputFile);
+}
+
+bool ModelContainer::ReadModelDirectory(const std::string &modelDirectory, const std::string &containerName,
+  const std::vector< std::string > &modelFiles, const std::string &applicationName)
+{
+  const std::string containerFile = modelDirectory + "/" + containerName;
+  std::vector< std::string > modelPaths;
+  for (auto &file : modelFiles)
+  {
+    modelPaths.push_back(modelDirectory + "/" + file);
+  }
+
+  std::string readError;
+  if (cbica::isFile(containerFile) && IsUpToDate(containerFile, modelPaths))
+  {
+    if (Read(containerFile))
+    {
+      mLastEncounteredError.clear();
+      return true;
+    }
+    readError = mLastEncounteredError + "; ";
+  }
+
+  // the model files stay as they are
+  if (!ConvertFromCSVDirectory(modelDirectory, modelFiles, containerFile, applicationName))
+  {
+    mLastEncounteredError = readError + mLastEncounteredError;
+    return !mArrays.empty();
+  }
+  mLastEncounteredError.clear();
+  return true;
+}
+
+bool ModelContainer::IsUpToDate(const std::string &containerFile, const std::vector< std::string > &sourceFiles)
+{
+  int64_t containerTime = 0;
+  if (!GetModificationTime(containerFile, containerTime))
+  {
+    return false;
+  }
+  for (auto &source : sourceFiles)
+  {
+    int64_t sourceTime = 0;
+    if (GetModificationTime(source, sourceTime) && (sourceTime > containerTime))
+    {
+      return false;
+    }
+  }
+  return true;
+}
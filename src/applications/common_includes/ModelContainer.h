@@ -0,0 +1,193 @@
+/**
+\file  ModelContainer.h
+
+\brief Declaration of the ModelContainer
+
+https://www.med.upenn.edu/sbia/software/ <br>
+software@cbica.upenn.edu
+
+Copyright (c) 2018 University of Pennsylvania. All rights reserved. <br>
+See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "itkVariableSizeMatrix.h"
+#include "itkVariableLengthVector.h"
+
+using VariableSizeMatrixType = itk::VariableSizeMatrix< double >;
+using VariableLengthVectorType = itk::VariableLengthVector< double >;
+
+#define MODEL_CONTAINER_EXT ".captkmodel"
+
+/**
+\class ModelContainer
+
+\brief Single-file, versioned binary store for trained model parameters
+
+Replaces the set of CSV files (support vectors, z-score means/stds, PCA coefficients, etc.) written out by the
+classifier applications. Every array is stored as raw row-major doubles aligned to 64 bytes, and the whole
+file is protected by a 64-bit FNV-1a checksum. Reading maps the file into memory so no parsing happens at load;
+the pointers returned by GetArray() are valid for as long as the container is alive and not re-read.
+
+File layout (little-endian):
+- Header (64 bytes): magic "CAPTKMDL", version, number of arrays, number of metadata entries, payload size, checksum
+- Array table: name (64 chars), rows, cols, byte offset from start of file
+- Metadata: key/value strings, each prefixed by its 32-bit length
+- Payload: the array data
+*/
+class ModelContainer
+{
+public:
+  //! Constructor
+  ModelContainer();
+
+  //! Destructor; releases any mapping
+  ~ModelContainer();
+
+  ModelContainer(const ModelContainer &) = delete;
+  ModelContainer &operator=(const ModelContainer &) = delete;
+
+  //! Current on-disk version
+  static const uint32_t Version = 1;
+
+  //! Entry in the array table; data points to either the mapping or the internal storage
+  struct ArrayEntry
+  {
+    const double *data = nullptr;
+    uint64_t rows = 0;
+    uint64_t cols = 0;
+  };
+
+  /**
+  \brief Adds an array to be written out; data is copied
+  \param name Unique name for the array (max 63 characters)
+  \param data Row-major data
+  \param rows Number of rows
+  \param cols Number of columns
+  */
+  void AddArray(const std::string &name, const double *data, const size_t rows, const size_t cols);
+
+  //! Adds an itk::VariableSizeMatrix
+  void AddMatrix(const std::string &name, const VariableSizeMatrixType &matrix);
+
+  //! Adds an itk::VariableLengthVector as a 1xN array
+  void AddVector(const std::string &name, const VariableLengthVectorType &vector);
+
+  //! Adds a CSV file (without header) as an array
+  bool AddArrayFromCSV(const std::string &name, const std::string &csvFile);
+
+  /**
+  \brief Adds the contents of a text file (e.g., a serialized OpenCV model) as metadata
+  \param key The metadata key, conventionally the file name of the source
+  \param textFile The file to embed
+  */
+  bool AddMetadataFromFile(const std::string &key, const std::string &textFile);
+
+  //! Sets a metadata key/value pair (application name, kernel parameters, etc.)
+  void SetMetadata(const std::string &key, const std::string &value);
+
+  //! Gets metadata; returns empty string if not found
+  std::string GetMetadata(const std::string &key) const;
+
+  //! Clears all arrays and metadata and releases any mapping
+  void Clear();
+
+  /**
+  \brief Writes all added arrays and metadata to a single file
+  \param fileName Output file
+  \return True if successful, otherwise GetLastEncounteredError() has details
+  */
+  bool Write(const std::string &fileName);
+
+  /**
+  \brief Memory-maps a model file
+  \param fileName Input file
+  \param verifyChecksum Whether the payload checksum is validated (costs one pass over the file)
+  \return True if successful, otherwise GetLastEncounteredError() has details
+  */
+  bool Read(const std::string &fileName, bool verifyChecksum = true);
+
+  //! Checks if the named array is present
+  bool HasArray(const std::string &name) const;
+
+  //! Gets the named array; data is nullptr if not present
+  ArrayEntry GetArray(const std::string &name) const;
+
+  //! Copies the named array to an itk::VariableSizeMatrix
+  VariableSizeMatrixType GetMatrix(const std::string &name) const;
+
+  //! Copies the named array to an itk::VariableLengthVector (all elements in row-major order)
+  VariableLengthVectorType GetVector(const std::string &name) const;
+
+  //! Names of all arrays
+  std::vector< std::string > GetArrayNames() const;
+
+  /**
+  \brief Converts the model files in a directory into a single container
+
+  Every CSV file becomes an array named after the file without extension, so "Recurrence_ZScore_Mean.csv" is stored
+  as "Recurrence_ZScore_Mean". Every XML file (serialized OpenCV model) is stored as metadata keyed by its file name.
+  The conversion fails if any of the required files is missing or cannot be read; in that case the container is empty.
+  \param modelDirectory Directory with the model files
+  \param requiredFiles File names (relative to modelDirectory) that must be present
+  \param outputFile The container to write; if only this write fails, the converted model is still held
+  \param applicationName Stored in metadata as "Application"
+  */
+  bool ConvertFromCSVDirectory(const std::string &modelDirectory, const std::vector< std::string > &requiredFiles,
+    const std::string &outputFile, const std::string &applicationName = "");
+
+  /**
+  \brief Reads the container of a model directory, converting the model files next to it first when needed
+
+  The model files are converted if there is no container, if any of them is newer than the container, or if the
+  container cannot be read. If only writing the converted container fails (e.g., a read-only directory), the converted
+  model is still held and this returns true with the reason in GetLastEncounteredError().
+  \param modelDirectory Directory with the container and/or the model files
+  \param containerName File name of the container inside modelDirectory
+  \param modelFiles File names (relative to modelDirectory) that make up the model
+  \param applicationName Stored in metadata as "Application" when converting
+  \return True if the container holds the model after the call
+  */
+  bool ReadModelDirectory(const std::string &modelDirectory, const std::string &containerName,
+    const std::vector< std::string > &modelFiles, const std::string &applicationName);
+
+  /**
+  \brief Checks that a container was written after all of its source files were last modified
+
+  Source files that do not exist are ignored, so a container shipped without its CSV files is always up to date.
+  */
+  static bool IsUpToDate(const std::string &containerFile, const std::vector< std::string > &sourceFiles);
+
+  //! Get the last error
+  std::string GetLastEncounteredError()
+  {
+    return mLastEncounteredError;
+  }
+
+private:
+  //! Releases the current mapping
+  void Unmap();
+
+  //! 64-bit FNV-1a over a block of memory
+  static uint64_t Checksum(const unsigned char *data, const size_t size);
+
+  std::map< std::string, ArrayEntry > mArrays;
+  std::map< std::string, std::vector< double > > mOwnedData; // arrays added with Add*()
+  std::map< std::string, std::string > mMetadata;
+
+  void *mMappedData = nullptr;
+  size_t mMappedSize = 0;
+#ifdef _WIN32
+  void *mFileHandle = nullptr;
+  void *mMappingHandle = nullptr;
+#endif
+
+  std::string mLastEncounteredError;
+};
@@ -0,0 +1,154 @@
+/*=========================================================================
+
+  Program:   ALFABIS fast medical image registration programs
+  Language:  C++
+  Website:   github.com/pyushkevich/greedy
+  Copyright (c) Paul Yushkevich, University of Pennsylvania. All rights reserved.
+
+  This program is part of ALFABIS: Adaptive Large-Scale Framework for
+  Automatic Biomedical Image Segmentation.
+
+  ALFABIS development is funded by the NIH grant R01 EB017255.
+
+  ALFABIS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ALFABIS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ALFABIS.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef MULTICOMPONENTNCCBRUTEFORCESEARCH_H
+#define MULTICOMPONENTNCCBRUTEFORCESEARCH_H
+
+#include "itkImage.h"
+#include "itkVectorImage.h"
+#include "itkCovariantVector.h"
+#include "itkMultiThreader.h"
+#include "itkSimpleFastMutexLock.h"
+#include <vector>
+
+/**
+ * Brute force search for the integer displacement (in voxel units) that maximizes
+ * the NCC metric of MultiComponentNCCImageMetric at every voxel of the fixed image.
+ * The result is the same as computing the NCC metric image for each displacement
+ * within the search radius and keeping the best one, but:
+ *
+ *   - The box sums of the fixed image (and of the fixed mask) are computed once.
+ *   - Without a fixed mask, the box sums of the moving intensities and their squares
+ *     for any displacement are looked up in summed area tables of the moving image,
+ *     which are computed once. Only the fixed-moving products are summed for each
+ *     displacement. With a fixed mask, all moving box sums are computed for each
+ *     displacement.
+ *   - The displacements are split between the threads. Each thread keeps the best
+ *     metric so far and the displacement it was found at, instead of metric images.
+ *
+ * Each thread holds a few images the size of the fixed image (one per component for
+ * the fixed-moving products, three with a mask, and the best metric and displacement).
+ * Ties between displacements go to the first one, in the order of itk::Neighborhood.
+ */
+template <class TFloat, unsigned int VDim>
+class MultiComponentNCCBruteForceSearch
+{
+public:
+  typedef MultiComponentNCCBruteForceSearch<TFloat, VDim> Self;
+  typedef itk::VectorImage<TFloat, VDim>              MultiComponentImageType;
+  typedef itk::Image<TFloat, VDim>                    FloatImageType;
+  typedef itk::CovariantVector<TFloat, VDim>          VectorType;
+  typedef itk::Image<VectorType, VDim>                VectorImageType;
+  typedef itk::Size<VDim>                             SizeType;
+  typedef itk::Offset<VDim>                           OffsetType;
+
+  MultiComponentNCCBruteForceSearch();
+
+  /** The fixed and moving images must have the same number of components */
+  void SetFixedImage(MultiComponentImageType *image) { m_Fixed = image; }
+  void SetMovingImage(MultiComponentImageType *image) { m_Moving = image; }
+
+  /** Optional mask: voxels above 0 enter the box sums, above 0.5 get a metric value */
+  void SetFixedMaskImage(FloatImageType *mask) { m_FixedMask = mask; }
+
+  /** Weights of the components in the metric */
+  void SetWeights(const std::vector<double> &weights) { m_Weights = weights; }
+
+  void SetSearchRadius(const SizeType &radius) { m_SearchRadius = radius; }
+  void SetMetricRadius(const SizeType &radius) { m_MetricRadius = radius; }
+
+  /** Number of threads (0: the global default) */
+  void SetNumberOfThreads(int n) { m_NumberOfThreads = n; }
+
+  /** Number of displacements searched */
+  unsigned int GetNumberOfOffsets() const;
+
+  /** The displacement searched at position k */
+  OffsetType GetOffset(unsigned int k) const;
+
+  /**
+   * Run the search. The outputs must be allocated in the space of the fixed
+   * image, and receive the best displacement and the metric there.
+   */
+  void Compute(VectorImageType *out_offset, FloatImageType *out_metric);
+
+protected:
+
+  // Sizes and strides of the fixed or moving image buffer
+  struct Grid
+  {
+    int size[VDim];
+    long stride[VDim];
+    long n;
+  };
+
+  static Grid GetGrid(const itk::ImageRegion<VDim> &region);
+
+  // Replace the values in the buffer with their box sums (truncated at the edges)
+  static void BoxSumInPlace(TFloat *buffer, const Grid &grid, const int *radius, double *line);
+
+  // Summed area table of a component (or its square) of the moving image, set to zero
+  // where the moving image cannot be sampled
+  void ComputeSummedAreaTable(int comp, bool square, double *sat) const;
+
+  // Sum of the values in the box [lo, hi] (inclusive) from a summed area table
+  static double BoxSumFromTable(const double *sat, const Grid &grid, const int *lo, const int *hi);
+
+  // Fill the buffers with the terms of the moving box sums at a displacement. The
+  // moving intensities and their squares are only filled if the buffers are given
+  void ComputeMovingTerms(const OffsetType &offset, int comp,
+                          TFloat *fix_mov, TFloat *mov, TFloat *mov_sq) const;
+
+  // Data shared by the threads
+  struct ThreadData
+  {
+    MultiComponentNCCBruteForceSearch *search;
+    std::vector<std::vector<TFloat> > fix, fix_sq;
+    std::vector<TFloat> count;
+    std::vector<std::vector<double> > sat_mov, sat_mov_sq;
+    std::vector<TFloat> best_metric;
+    std::vector<unsigned int> best_offset;
+    itk::SimpleFastMutexLock lock;
+  };
+
+  static ITK_THREAD_RETURN_TYPE ThreaderCallback(void *arg);
+
+  void SearchOffsets(ThreadData *data, int thread, int n_threads);
+
+  typename MultiComponentImageType::Pointer m_Fixed, m_Moving;
+  typename FloatImageType::Pointer m_FixedMask;
+  std::vector<double> m_Weights;
+  SizeType m_SearchRadius, m_MetricRadius;
+  int m_NumberOfThreads;
+  Grid m_FixedGrid, m_MovingGrid;
+  int m_Radius[VDim];
+};
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "MultiComponentNCCBruteForceSearch.txx"
+#endif
+
+#endif // MULTICOMPONENTNCCBRUTEFORCESEARCH_H
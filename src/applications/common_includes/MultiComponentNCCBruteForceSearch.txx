@@ -0,0 +1,477 @@
+/*=========================================================================
+
+  Program:   ALFABIS fast medical image registration programs
+  Language:  C++
+  Website:   github.com/pyushkevich/greedy
+  Copyright (c) Paul Yushkevich, University of Pennsylvania. All rights reserved.
+
+  This program is part of ALFABIS: Adaptive Large-Scale Framework for
+  Automatic Biomedical Image Segmentation.
+
+  ALFABIS development is funded by the NIH grant R01 EB017255.
+
+  ALFABIS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ALFABIS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ALFABIS.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef MULTICOMPONENTNCCBRUTEFORCESEARCH_TXX
+#define MULTICOMPONENTNCCBRUTEFORCESEARCH_TXX
+
+#include "MultiComponentNCCBruteForceSearch.h"
+#include "itkNumericTraits.h"
+#include <algorithm>
+
+template <class TFloat, unsigned int VDim>
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::MultiComponentNCCBruteForceSearch()
+  : m_NumberOfThreads(0)
+{
+  m_SearchRadius.Fill(0);
+  m_MetricRadius.Fill(0);
+}
+
+template <class TFloat, unsigned int VDim>
+unsigned int
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::GetNumberOfOffsets() const
+{
+  unsigned int n = 1;
+  for(unsigned int d = 0; d < VDim; d++)
+    n *= 2 * m_SearchRadius[d] + 1;
+  return n;
+}
+
+template <class TFloat, unsigned int VDim>
+typename MultiComponentNCCBruteForceSearch<TFloat, VDim>::OffsetType
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::GetOffset(unsigned int k) const
+{
+  // Same order as itk::Neighborhood: the first dimension varies fastest
+  OffsetType offset;
+  for(unsigned int d = 0; d < VDim; d++)
+    {
+    unsigned int width = 2 * m_SearchRadius[d] + 1;
+    offset[d] = (int) (k % width) - (int) m_SearchRadius[d];
+    k /= width;
+    }
+  return offset;
+}
+
+template <class TFloat, unsigned int VDim>
+typename MultiComponentNCCBruteForceSearch<TFloat, VDim>::Grid
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::GetGrid(const itk::ImageRegion<VDim> &region)
+{
+  Grid grid;
+  long stride = 1;
+  for(unsigned int d = 0; d < VDim; d++)
+    {
+    grid.size[d] = (int) region.GetSize()[d];
+    grid.stride[d] = stride;
+    stride *= grid.size[d];
+    }
+  grid.n = stride;
+  return grid;
+}
+
+template <class TFloat, unsigned int VDim>
+void
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::BoxSumInPlace(TFloat *buffer, const Grid &grid, const int *radius, double *line)
+{
+  for(unsigned int d = 0; d < VDim; d++)
+    {
+    int r = radius[d], len = grid.size[d];
+    long s = grid.stride[d], block = s * len;
+    if(r == 0)
+      continue;
+
+    // Running sums along all the lines in dimension d
+    for(long outer = 0; outer < grid.n; outer += block)
+      {
+      for(long inner = 0; inner < s; inner++)
+        {
+        TFloat *p = buffer + outer + inner;
+        for(int i = 0; i < len; i++)
+          line[i] = p[i * s];
+
+        double sum = 0.0;
+        for(int i = 0; i < r && i < len; i++)
+          sum += line[i];
+
+        for(int i = 0; i < len; i++)
+          {
+          if(i + r < len)
+            sum += line[i + r];
+          if(i - r - 1 >= 0)
+            sum -= line[i - r - 1];
+          p[i * s] = (TFloat) sum;
+          }
+        }
+      }
+    }
+}
+
+template <class TFloat, unsigned int VDim>
+void
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::ComputeSummedAreaTable(int comp, bool square, double *sat) const
+{
+  const Grid &grid = m_MovingGrid;
+  int nc = m_Moving->GetNumberOfComponentsPerPixel();
+  const TFloat *mov = m_Moving->GetBufferPointer();
+
+  // The linear interpolator only samples the moving image inside its last voxel
+  // (see FastLinearInterpolator::ComputeCorners), the rest is ignored by the metric
+  int idx[VDim];
+  std::fill(idx, idx + VDim, 0);
+  for(long p = 0; p < grid.n; p++)
+    {
+    bool inside = true;
+    for(unsigned int d = 0; d < VDim; d++)
+      if(idx[d] > grid.size[d] - 2)
+        inside = false;
+
+    double v = mov[p * nc + comp];
+    sat[p] = inside ? (square ? v * v : v) : 0.0;
+
+    for(unsigned int d = 0; d < VDim; d++)
+      {
+      if(++idx[d] < grid.size[d])
+        break;
+      idx[d] = 0;
+      }
+    }
+
+  // Cumulative sums along each dimension
+  for(unsigned int d = 0; d < VDim; d++)
+    {
+    int len = grid.size[d];
+    long s = grid.stride[d], block = s * len;
+    for(long outer = 0; outer < grid.n; outer += block)
+      {
+      for(long inner = 0; inner < s; inner++)
+        {
+        double *p = sat + outer + inner;
+        for(int i = 1; i < len; i++)
+          p[i * s] += p[(i - 1) * s];
+        }
+      }
+    }
+}
+
+template <class TFloat, unsigned int VDim>
+double
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::BoxSumFromTable(const double *sat, const Grid &grid, const int *lo, const int *hi)
+{
+  for(unsigned int d = 0; d < VDim; d++)
+    if(lo[d] > hi[d])
+      return 0.0;
+
+  // Inclusion-exclusion over the corners of the box
+  double sum = 0.0;
+  for(unsigned int corner = 0; corner < (1u << VDim); corner++)
+    {
+    long p = 0;
+    bool sign = true, skip = false;
+    for(unsigned int d = 0; d < VDim && !skip; d++)
+      {
+      int x = hi[d];
+      if(corner & (1u << d))
+        {
+        x = lo[d] - 1;
+        sign = !sign;
+        }
+      skip = (x < 0);
+      p += x * grid.stride[d];
+      }
+
+    if(!skip)
+      sum += sign ? sat[p] : -sat[p];
+    }
+
+  return sum;
+}
+
+template <class TFloat, unsigned int VDim>
+void
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::ComputeMovingTerms(const OffsetType &offset, int comp,
+                     TFloat *fix_mov, TFloat *mov, TFloat *mov_sq) const
+{
+  const Grid &gf = m_FixedGrid, &gm = m_MovingGrid;
+  int nc = m_Fixed->GetNumberOfComponentsPerPixel();
+  const TFloat *fix_buffer = m_Fixed->GetBufferPointer();
+  const TFloat *mov_buffer = m_Moving->GetBufferPointer();
+  const TFloat *mask = m_FixedMask ? m_FixedMask->GetBufferPointer() : NULL;
+
+  // Range of the lines in which the moving image is sampled
+  int x_lo = std::max(0, (int) -offset[0]);
+  int x_hi = std::min(gf.size[0] - 1, gm.size[0] - 2 - (int) offset[0]);
+
+  // Index of the current line (the first entry is not used)
+  int idx[VDim];
+  std::fill(idx, idx + VDim, 0);
+  for(long line = 0; line < gf.n; line += gf.size[0])
+    {
+    // Is the line sampled in the moving image at all?
+    bool inside = true;
+    long p_mov = offset[0];
+    for(unsigned int d = 1; d < VDim; d++)
+      {
+      int z = idx[d] + (int) offset[d];
+      if(z < 0 || z > gm.size[d] - 2)
+        inside = false;
+      p_mov += z * gm.stride[d];
+      }
+
+    for(int x = 0; x < gf.size[0]; x++)
+      {
+      long p = line + x;
+      TFloat x_fix = 0, x_mov = 0;
+      if(inside && x >= x_lo && x <= x_hi && (!mask || mask[p] > 0.0))
+        {
+        x_fix = fix_buffer[p * nc + comp];
+        x_mov = mov_buffer[(p_mov + x) * nc + comp];
+        }
+
+      fix_mov[p] = x_fix * x_mov;
+      if(mov)
+        mov[p] = x_mov;
+      if(mov_sq)
+        mov_sq[p] = x_mov * x_mov;
+      }
+
+    for(unsigned int d = 1; d < VDim; d++)
+      {
+      if(++idx[d] < gf.size[d])
+        break;
+      idx[d] = 0;
+      }
+    }
+}
+
+template <class TFloat, unsigned int VDim>
+void
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::SearchOffsets(ThreadData *data, int thread, int n_threads)
+{
+  const Grid &gf = m_FixedGrid, &gm = m_MovingGrid;
+  int nc = m_Fixed->GetNumberOfComponentsPerPixel();
+  const TFloat *mask = m_FixedMask ? m_FixedMask->GetBufferPointer() : NULL;
+  unsigned int n_offsets = this->GetNumberOfOffsets();
+
+  // Box sums of the moving terms at the current displacement. Without a mask, the
+  // moving intensities are summed from the tables
+  std::vector<std::vector<TFloat> > fix_mov(nc, std::vector<TFloat>(gf.n)), mov, mov_sq;
+  if(mask)
+    {
+    mov.assign(nc, std::vector<TFloat>(gf.n));
+    mov_sq.assign(nc, std::vector<TFloat>(gf.n));
+    }
+
+  // Best metric so far, and the displacement it was found at
+  std::vector<TFloat> best(gf.n, -itk::NumericTraits<TFloat>::max());
+  std::vector<unsigned int> best_offset(gf.n, 0);
+
+  std::vector<double> line(*std::max_element(gf.size, gf.size + VDim));
+  const double eps = 1e-8;
+
+  for(unsigned int k = thread; k < n_offsets; k += n_threads)
+    {
+    OffsetType offset = this->GetOffset(k);
+
+    for(int c = 0; c < nc; c++)
+      {
+      this->ComputeMovingTerms(offset, c, &fix_mov[c][0],
+                               mask ? &mov[c][0] : NULL, mask ? &mov_sq[c][0] : NULL);
+      BoxSumInPlace(&fix_mov[c][0], gf, m_Radius, &line[0]);
+      if(mask)
+        {
+        BoxSumInPlace(&mov[c][0], gf, m_Radius, &line[0]);
+        BoxSumInPlace(&mov_sq[c][0], gf, m_Radius, &line[0]);
+        }
+      }
+
+    // Compute the metric as in MultiImageNNCPostComputeFunction
+    int idx[VDim], lo[VDim], hi[VDim];
+    std::fill(idx, idx + VDim, 0);
+    for(long p = 0; p < gf.n; p++)
+      {
+      double metric = 0.0;
+      if(!mask || mask[p] > 0.5)
+        {
+        // The box around the voxel, cut by the fixed image, shifted into the moving image
+        if(!mask)
+          {
+          for(unsigned int d = 0; d < VDim; d++)
+            {
+            lo[d] = std::max(std::max(idx[d] - m_Radius[d], 0) + (int) offset[d], 0);
+            hi[d] = std::min(std::min(idx[d] + m_Radius[d], gf.size[d] - 1) + (int) offset[d], gm.size[d] - 1);
+            }
+          }
+
+        double one_over_n = 1.0 / data->count[p];
+        for(int c = 0; c < nc; c++)
+          {
+          double x_fix = data->fix[c][p], x_fix_sq = data->fix_sq[c][p];
+          double x_fix_mov = fix_mov[c][p], x_mov, x_mov_sq;
+          if(mask)
+            {
+            x_mov = mov[c][p];
+            x_mov_sq = mov_sq[c][p];
+            }
+          else
+            {
+            x_mov = BoxSumFromTable(&data->sat_mov[c][0], gm, lo, hi);
+            x_mov_sq = BoxSumFromTable(&data->sat_mov_sq[c][0], gm, lo, hi);
+            }
+
+          double var_fix = x_fix_sq - x_fix * x_fix * one_over_n;
+          double var_mov = x_mov_sq - x_mov * x_mov * one_over_n;
+          if(var_fix < eps || var_mov < eps)
+            continue;
+
+          double cov_fix_mov = x_fix_mov - x_fix * x_mov * one_over_n;
+          double ncc_fix_mov = cov_fix_mov * cov_fix_mov / (var_fix * var_mov);
+          metric += (cov_fix_mov < 0 ? -m_Weights[c] : m_Weights[c]) * ncc_fix_mov;
+          }
+        }
+
+      if(metric > best[p])
+        {
+        best[p] = (TFloat) metric;
+        best_offset[p] = k;
+        }
+
+      for(unsigned int d = 0; d < VDim; d++)
+        {
+        if(++idx[d] < gf.size[d])
+          break;
+        idx[d] = 0;
+        }
+      }
+    }
+
+  // Merge with the results of the other threads, ties go to the first displacement
+  data->lock.Lock();
+  for(long p = 0; p < gf.n; p++)
+    {
+    if(best[p] > data->best_metric[p]
+       || (best[p] == data->best_metric[p] && best_offset[p] < data->best_offset[p]))
+      {
+      data->best_metric[p] = best[p];
+      data->best_offset[p] = best_offset[p];
+      }
+    }
+  data->lock.Unlock();
+}
+
+template <class TFloat, unsigned int VDim>
+ITK_THREAD_RETURN_TYPE
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::ThreaderCallback(void *arg)
+{
+  typedef itk::MultiThreader::ThreadInfoStruct ThreadInfo;
+  ThreadInfo *info = static_cast<ThreadInfo *>(arg);
+  ThreadData *data = static_cast<ThreadData *>(info->UserData);
+
+  data->search->SearchOffsets(data, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <class TFloat, unsigned int VDim>
+void
+MultiComponentNCCBruteForceSearch<TFloat, VDim>
+::Compute(VectorImageType *out_offset, FloatImageType *out_metric)
+{
+  m_FixedGrid = GetGrid(m_Fixed->GetBufferedRegion());
+  m_MovingGrid = GetGrid(m_Moving->GetBufferedRegion());
+  for(unsigned int d = 0; d < VDim; d++)
+    m_Radius[d] = (int) m_MetricRadius[d];
+
+  const Grid &gf = m_FixedGrid;
+  int nc = m_Fixed->GetNumberOfComponentsPerPixel();
+  const TFloat *fix_buffer = m_Fixed->GetBufferPointer();
+  const TFloat *mask = m_FixedMask ? m_FixedMask->GetBufferPointer() : NULL;
+
+  ThreadData data;
+  data.search = this;
+
+  // Box sums of the fixed image and of the voxels in the mask, which do not
+  // depend on the displacement
+  data.count.resize(gf.n);
+  data.fix.assign(nc, std::vector<TFloat>(gf.n));
+  data.fix_sq.assign(nc, std::vector<TFloat>(gf.n));
+  for(long p = 0; p < gf.n; p++)
+    {
+    bool in_mask = !mask || mask[p] > 0.0;
+    data.count[p] = in_mask ? 1 : 0;
+    for(int c = 0; c < nc; c++)
+      {
+      TFloat x_fix = in_mask ? fix_buffer[p * nc + c] : 0;
+      data.fix[c][p] = x_fix;
+      data.fix_sq[c][p] = x_fix * x_fix;
+      }
+    }
+
+  std::vector<double> line(*std::max_element(gf.size, gf.size + VDim));
+  BoxSumInPlace(&data.count[0], gf, m_Radius, &line[0]);
+  for(int c = 0; c < nc; c++)
+    {
+    BoxSumInPlace(&data.fix[c][0], gf, m_Radius, &line[0]);
+    BoxSumInPlace(&data.fix_sq[c][0], gf, m_Radius, &line[0]);
+    }
+
+  // Without a mask, the box sums of the moving image at any displacement come from
+  // summed area tables
+  if(!mask)
+    {
+    data.sat_mov.assign(nc, std::vector<double>(m_MovingGrid.n));
+    data.sat_mov_sq.assign(nc, std::vector<double>(m_MovingGrid.n));
+    for(int c = 0; c < nc; c++)
+      {
+      this->ComputeSummedAreaTable(c, false, &data.sat_mov[c][0]);
+      this->ComputeSummedAreaTable(c, true, &data.sat_mov_sq[c][0]);
+      }
+    }
+
+  data.best_metric.assign(gf.n, -itk::NumericTraits<TFloat>::max());
+  data.best_offset.assign(gf.n, 0);
+
+  // Split the displacements between the threads
+  unsigned int n_offsets = this->GetNumberOfOffsets();
+  int n_threads = m_NumberOfThreads > 0
+                  ? m_NumberOfThreads : (int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  n_threads = std::max(1, std::min(n_threads, (int) n_offsets));
+
+  itk::MultiThreader::Pointer mt = itk::MultiThreader::New();
+  mt->SetNumberOfThreads(n_threads);
+  mt->SetSingleMethod(&Self::ThreaderCallback, &data);
+  mt->SingleMethodExecute();
+
+  // Write the best displacements and metric values
+  VectorType *p_offset = out_offset->GetBufferPointer();
+  TFloat *p_metric = out_metric->GetBufferPointer();
+  for(long p = 0; p < gf.n; p++)
+    {
+    OffsetType offset = this->GetOffset(data.best_offset[p]);
+    for(unsigned int d = 0; d < VDim; d++)
+      p_offset[p][d] = offset[d];
+    p_metric[p] = data.best_metric[p];
+    }
+}
+
+#endif // MULTICOMPONENTNCCBRUTEFORCESEARCH_TXX
@@ -29,6 +29,72 @@
 
 #include "MultiComponentImageMetricBase.h"
 #include "itkBarrier.h"
+#include <vector>
+
+/**
+ * Scratch memory for computing the NCC box sums in streaming mode (see
+ * MultiComponentNCCImageMetric::SetStreamBoxSums). The buffers keep their size
+ * between runs, so the metric can be created at every iteration without allocating
+ * memory. There is a window buffer and a sum buffer shared by the threads, and a
+ * line buffer for each thread.
+ */
+template <class TComponent, unsigned int VDim>
+class MultiComponentNCCScratchArena : public itk::Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef MultiComponentNCCScratchArena<TComponent, VDim>   Self;
+  typedef itk::Object                                       Superclass;
+  typedef itk::SmartPointer<Self>                           Pointer;
+  typedef itk::SmartPointer<const Self>                     ConstPointer;
+
+  typedef itk::ImageRegion<VDim>                            RegionType;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self)
+
+  /** Run-time type information (and related methods) */
+  itkTypeMacro(MultiComponentNCCScratchArena, itk::Object)
+
+  /** Get the window buffer, holding the planes within the radius of the current plane */
+  TComponent *GetWindowBuffer(size_t size) { return Reserve(m_Window, size); }
+
+  /** Get the sum buffer, holding the box sums of the current plane */
+  double *GetSumBuffer(size_t size) { return Reserve(m_Sum, size); }
+
+  /** Set the number of threads. Must be called before the threads use their buffers */
+  void SetNumberOfThreads(itk::ThreadIdType n)
+    { if(m_ThreadBuffers.size() < n) m_ThreadBuffers.resize(n); }
+
+  /** Get the line buffer of a thread */
+  double *GetThreadBuffer(itk::ThreadIdType thread, size_t size)
+    { return Reserve(m_ThreadBuffers[thread], size); }
+
+  /** The region of the image the arena was last used for */
+  itkSetMacro(Region, RegionType)
+  itkGetConstReferenceMacro(Region, RegionType)
+
+protected:
+  MultiComponentNCCScratchArena() {}
+  ~MultiComponentNCCScratchArena() {}
+
+private:
+  MultiComponentNCCScratchArena(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  // Grow a buffer to the requested size (buffers never shrink)
+  template <class T> static T *Reserve(std::vector<T> &buffer, size_t size)
+    {
+    if(buffer.size() < size)
+      buffer.resize(size);
+    return buffer.data();
+    }
+
+  std::vector<TComponent> m_Window;
+  std::vector<double> m_Sum;
+  std::vector< std::vector<double> > m_ThreadBuffers;
+  RegionType m_Region;
+};
 
 /**
  * Normalized cross-correlation metric. This filter sets up a mini-pipeline with
@@ -80,6 +146,9 @@ public:
   /** Determine the image dimension. */
   itkStaticConstMacro(ImageDimension, unsigned int, InputImageType::ImageDimension );
 
+  /** Scratch memory for the streaming mode */
+  typedef MultiComponentNCCScratchArena<InputComponentType, ImageDimension> ScratchArenaType;
+
   /** Set the radius of the cross-correlation */
   itkSetMacro(Radius, SizeType)
 
@@ -109,6 +178,33 @@ public:
    */
   itkSetMacro(ReuseWorkingImageFixedComponents, bool)
 
+  /**
+   * Keep the running box sums in double precision, even when the working image is
+   * float (mixed precision). See OneDimensionalInPlaceAccumulateFilter
+   */
+  itkSetMacro(AccumulateInDouble, bool)
+  itkGetMacro(AccumulateInDouble, bool)
+
+  /**
+   * Compute the box sums by streaming through the image along its last dimension,
+   * instead of in a working image that holds all the components for the whole image
+   * (1 + nc * (5 + 3 * dim) components for nc image components, more in affine mode).
+   * Only the planes within the radius of the current plane are kept in memory, and
+   * the threads work on each plane together. The working image is not used in this
+   * mode, so the fixed components are computed at every run, and the sums are always
+   * accumulated in double precision.
+   */
+  itkSetMacro(StreamBoxSums, bool)
+  itkGetMacro(StreamBoxSums, bool)
+
+  /**
+   * Set the scratch memory for the streaming mode. Like the working image, this
+   * prevents repeated allocation of memory when the metric is created/destructed in
+   * a loop. If not set, the filter allocates its own. An arena must not be used by
+   * two filters at the same time.
+   */
+  itkSetObjectMacro(ScratchArena, ScratchArenaType)
+
   /**
    * Get the gradient scaling factor. To get the actual gradient of the metric, multiply the
    * gradient output of this filter by the scaling factor. Explanation: for efficiency, the
@@ -122,7 +218,9 @@ public:
 
 protected:
   MultiComponentNCCImageMetric()
-    : m_ApproximateGradient(false), m_ReuseWorkingImageFixedComponents(false)
+    : m_ApproximateGradient(false), m_ReuseWorkingImageFixedComponents(false),
+      m_AccumulateInDouble(false), m_StreamBoxSums(false),
+      m_NumberOfStreamingThreads(0), m_NumberOfStreamingComponents(0)
     { m_Radius.Fill(1); }
 
   ~MultiComponentNCCImageMetric() {}
@@ -134,6 +232,17 @@ protected:
   virtual void ThreadedGenerateData(const OutputImageRegionType &outputRegionForThread,
                                     itk::ThreadIdType threadId) ITK_OVERRIDE;
 
+  // Set up the streaming mode, called from BeforeThreadedGenerateData
+  void BeforeStreamingThreadedGenerateData();
+
+  // Streaming mode: all threads go through the planes of the whole image together
+  void StreamingThreadedGenerateData(itk::ThreadIdType threadId);
+
+  // Compute the metric (and gradient) for a line of pixels from the box sums
+  template <class TSum>
+  void PostComputeLine(const TSum *p_input, int nc, long offset_in_pixels, int line_len,
+                       typename Superclass::ThreadData &td);
+
 private:
   MultiComponentNCCImageMetric(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
@@ -146,6 +255,17 @@ private:
   // if the filter is being run repeatedly on the same image
   bool m_ReuseWorkingImageFixedComponents;
 
+  // Whether the box sums are accumulated in double precision
+  bool m_AccumulateInDouble;
+
+  // Streaming mode: scratch memory, barrier between the steps of each plane,
+  // number of threads and of components per pixel
+  bool m_StreamBoxSums;
+  typename ScratchArenaType::Pointer m_ScratchArena;
+  typename itk::Barrier::Pointer m_Barrier;
+  itk::ThreadIdType m_NumberOfStreamingThreads;
+  int m_NumberOfStreamingComponents;
+
   // Radius of the cross-correlation
   SizeType m_Radius;
 
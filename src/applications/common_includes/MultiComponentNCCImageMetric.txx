@@ -30,6 +30,7 @@
 #include "MultiComponentNCCImageMetric.h"
 #include "OneDimensionalInPlaceAccumulateFilter.h"
 #include "itkImageFileWriter.h"
+#include <algorithm>
 
 
 
@@ -94,6 +95,131 @@ MultiImageNCCPrecomputeFilter<TMetricTraits,TOutputImage>
   return 1 + nc * 2;
 }
 
+/**
+ * Compute the components for the voxel at the current position of the metric worker, and
+ * write them to out (one pixel of the working image). These are 1, the fixed intensities
+ * and their squares (only if generate_fixed is set, otherwise they are skipped), then for
+ * each component the moving intensity, its square, the product with the fixed intensity
+ * and the gradient terms. Returns the pointer to the next pixel.
+ */
+template <class TMetricTraits, class TWorker, class TOutputComponent>
+TOutputComponent *
+MultiImageNCCPrecomputeVoxel(TWorker &iter, MultiComponentNCCImageMetric<TMetricTraits> *parent,
+                             int ncomp_in, int ncomp_out, bool generate_fixed, TOutputComponent *out)
+{
+  typedef typename TWorker::InterpType FastInterpolator;
+  typedef typename TWorker::InputComponentType InputComponentType;
+  const unsigned int ImageDimension = TWorker::ImageDimension;
+
+  // Number of invariant components (fixed-only)
+  int ncomp_fixed = ncomp_in * 2 + 1;
+
+  // The start of the next pixel
+  TOutputComponent *out_next = out + ncomp_out;
+
+  // The mask is 0.5 for points in range of the user mask, and 1.0 for the user mask
+  // We can safely ignore the points outside of range - they have no impact on the
+  // region that we are going to measure
+  if(iter.CheckFixedMask(0.0))
+    {
+    // Is this the first time the filter is being run for this output working image. If
+    // so, we store the fixed components for future accumulation.
+    if(generate_fixed)
+      {
+      // Store the components that are invariant of the moving image at the beginning. This
+      // helps avoid having to do repeated accumulation on these components
+      *out++ = 1.0;
+      for(int k = 0; k < ncomp_in; k++)
+        {
+        InputComponentType x_fix = iter.GetFixedLine()[k];
+        *out++ = x_fix;
+        *out++ = x_fix * x_fix;
+        }
+      }
+    else
+      {
+      out += ncomp_fixed;
+      }
+
+    // Interpolate the moving image at the current position. The worker knows
+    // whether to interpolate the gradient or not
+    typename FastInterpolator::InOut status = iter.Interpolate();
+
+    // TODO: debugging border issues: setting mask=0 on the border
+    // TODO: i added this check for affine/non-affine. Seems like there were some problems previously
+    // with the NCC metric at the border in deformable mode, but in affine mode you need the border
+    // values to be included.
+    // Outside interpolations are ignored
+    if((parent->GetComputeAffine() && status == FastInterpolator::OUTSIDE) ||
+       (!parent->GetComputeAffine() && (status == FastInterpolator::OUTSIDE || status == FastInterpolator::BORDER)))
+      {
+      // Iterate over the components
+      for(int k = 0; k < ncomp_in; k++)
+        {
+        *out++ = 0.0;
+        *out++ = 0.0;
+        *out++ = 0.0;
+
+        int n = parent->GetComputeGradient()
+                ? ( parent->GetComputeAffine()
+                    ? 3 * ImageDimension * (1 + ImageDimension)
+                    : 3 * ImageDimension)
+                : 0;
+
+        for(int j = 0; j < n; j++)
+          *out++ = 0.0;
+        }
+      }
+    else
+      {
+      // Iterate over the components
+      for(int k = 0; k < ncomp_in; k++)
+        {
+        InputComponentType x_mov = iter.GetMovingSample()[k];
+        InputComponentType x_fix = iter.GetFixedLine()[k];
+
+        // Write the five components
+        *out++ = x_mov;
+        *out++ = x_mov * x_mov;
+        *out++ = x_fix * x_mov;
+
+        // If gradient, do more
+        if(parent->GetComputeGradient())
+          {
+          const InputComponentType *mov_grad = iter.GetMovingSampleGradient(k);
+          for(int i = 0; i < ImageDimension; i++)
+            {
+            InputComponentType mov_grad_i = mov_grad[i];
+            *out++ = mov_grad_i;
+            *out++ = x_fix * mov_grad_i;
+            *out++ = x_mov * mov_grad_i;
+
+            // If affine, tack on additional components
+            if(parent->GetComputeAffine())
+              {
+              for(int j = 0; j < ImageDimension; j++)
+                {
+                double x = iter.GetIndex()[j];
+                *out++ = mov_grad_i * x;
+                *out++ = x_fix * mov_grad_i * x;
+                *out++ = x_mov * mov_grad_i * x;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  else
+    {
+    // TODO: do we need this? Zero out the images
+    for(int q = 0; q < ncomp_out; q++)
+      *out++ = 0;
+    }
+
+  return out_next;
+}
+
 /**
  * Compute the output for the region specified by outputRegionForThread.
  */
@@ -104,18 +230,10 @@ MultiImageNCCPrecomputeFilter<TMetricTraits,TOutputImage>
   const OutputImageRegionType& outputRegionForThread,
   itk::ThreadIdType threadId )
 {
-  typedef FastLinearInterpolator<InputImageType, RealType, ImageDimension> FastInterpolator;
-
   // Get the number of input and output components
   int ncomp_in = m_Parent->GetFixedImage()->GetNumberOfComponentsPerPixel();
   int ncomp_out = this->GetNumberOfOutputComponents();
 
-  // Number of invariant components (fixed-only)
-  int ncomp_fixed = ncomp_in * 2 + 1;
-
-  // Get the pointer to the output image
-  OutputImageType *out = this->GetOutput();
-
   // Create an iterator specialized for going through metrics
   typedef MultiComponentMetricWorker<TMetricTraits, TOutputImage> InterpType;
   InterpType iter(m_Parent, this->GetOutput(), outputRegionForThread);
@@ -126,113 +244,8 @@ MultiImageNCCPrecomputeFilter<TMetricTraits,TOutputImage>
     // Iterate over the pixels in the line
     for(; !iter.IsAtEndOfLine(); ++iter)
       {
-      // The mask is 0.5 for points in range of the user mask, and 1.0 for the user mask
-      // We can safely ignore the points outside of range - they have no impact on the
-      // region that we are going to measure
-      if(iter.CheckFixedMask(0.0))
-        {
-        // Get the output pointer for this voxel
-        OutputComponentType *out;
-
-        // Is this the first time the filter is being run for this output working image. If
-        // so, we store the fixed components for future accumulation.
-        if(this->m_FlagGenerateFixedComponents)
-          {
-          out = iter.GetOutputLine();
-          // Store the components that are invariant of the moving image at the beginning. This
-          // helps avoid having to do repeated accumulation on these components
-          *out++ = 1.0;
-          for(int k = 0; k < ncomp_in; k++)
-            {
-            InputComponentType x_fix = iter.GetFixedLine()[k];
-            *out++ = x_fix;
-            *out++ = x_fix * x_fix;
-            }
-          }
-        else
-          {
-          out = iter.GetOutputLine() + ncomp_fixed;
-          }
-
-        // Interpolate the moving image at the current position. The worker knows
-        // whether to interpolate the gradient or not
-        typename FastInterpolator::InOut status = iter.Interpolate();
-
-        // TODO: debugging border issues: setting mask=0 on the border
-        // TODO: i added this check for affine/non-affine. Seems like there were some problems previously
-        // with the NCC metric at the border in deformable mode, but in affine mode you need the border
-        // values to be included.
-        // Outside interpolations are ignored
-        if((m_Parent->GetComputeAffine() && status == FastInterpolator::OUTSIDE) ||
-           (!m_Parent->GetComputeAffine() && (status == FastInterpolator::OUTSIDE || status == FastInterpolator::BORDER)))
-          {
-          // Iterate over the components
-          for(int k = 0; k < ncomp_in; k++)
-            {
-            InputComponentType x_fix = iter.GetFixedLine()[k];
-            *out++ = 0.0;
-            *out++ = 0.0;
-            *out++ = 0.0;
-
-            int n = m_Parent->GetComputeGradient()
-                    ? ( m_Parent->GetComputeAffine()
-                        ? 3 * ImageDimension * (1 + ImageDimension)
-                        : 3 * ImageDimension)
-                    : 0;
-
-            for(int j = 0; j < n; j++)
-              *out++ = 0.0;
-            }
-          }
-        else
-          {
-          // Iterate over the components
-          for(int k = 0; k < ncomp_in; k++)
-            {
-            InputComponentType x_mov = iter.GetMovingSample()[k];
-            InputComponentType x_fix = iter.GetFixedLine()[k];
-
-            // Write the five components
-            *out++ = x_mov;
-            *out++ = x_mov * x_mov;
-            *out++ = x_fix * x_mov;
-
-            // If gradient, do more
-            if(m_Parent->GetComputeGradient())
-              {
-              const InputComponentType *mov_grad = iter.GetMovingSampleGradient(k);
-              for(int i = 0; i < ImageDimension; i++)
-                {
-                InputComponentType mov_grad_i = mov_grad[i];
-                *out++ = mov_grad_i;
-                *out++ = x_fix * mov_grad_i;
-                *out++ = x_mov * mov_grad_i;
-
-                // If affine, tack on additional components
-                if(m_Parent->GetComputeAffine())
-                  {
-                  for(int j = 0; j < ImageDimension; j++)
-                    {
-                    double x = iter.GetIndex()[j];
-                    *out++ = mov_grad_i * x;
-                    *out++ = x_fix * mov_grad_i * x;
-                    *out++ = x_mov * mov_grad_i * x;
-                    }
-                  }
-                }
-
-
-              }
-            }
-          }
-        }
-      else
-        {
-        // TODO: do we need this? Zero out the images
-        OutputComponentType *out = iter.GetOutputLine();
-        for(int q = 0; q < ncomp_out; q++)
-          *out++ = 0;
-        }
+      MultiImageNCCPrecomputeVoxel(iter, m_Parent, ncomp_in, ncomp_out,
+                                   this->m_FlagGenerateFixedComponents, iter.GetOutputLine());
       }
     }
 }
@@ -417,6 +430,13 @@ MultiComponentNCCImageMetric<TMetricTraits>
   // Call the parent method
   Superclass::BeforeThreadedGenerateData();
 
+  // In streaming mode, all the work is done by the threads
+  if(m_StreamBoxSums)
+    {
+    this->BeforeStreamingThreadedGenerateData();
+    return;
+    }
+
   // Pre-compute filter
   typedef MultiImageNCCPrecomputeFilter<TMetricTraits, InputImageType> PreFilterType;
   typename PreFilterType::Pointer preFilter = PreFilterType::New();
@@ -491,7 +511,8 @@ MultiComponentNCCImageMetric<TMetricTraits>
   // image. Next, we run the fast sum computation to give us the local average of
   // intensities, products, gradients in the working image
   typename InputImageType::Pointer img_accum =
-      AccumulateNeighborhoodSumsInPlace(img_pre, m_Radius, ncomp_ignore, n_overalloc_comp);
+      AccumulateNeighborhoodSumsInPlace(img_pre, m_Radius, ncomp_ignore, n_overalloc_comp,
+                                        m_AccumulateInDouble);
 
 #ifdef DUMP_NCC
   typename itk::ImageFileWriter<InputImageType>::Pointer pwriter = itk::ImageFileWriter<InputImageType>::New();
@@ -507,11 +528,130 @@ MultiComponentNCCImageMetric<TMetricTraits>
 
 
 template <class TMetricTraits>
+template <class TSum>
 void
 MultiComponentNCCImageMetric<TMetricTraits>
-::ThreadedGenerateData(const OutputImageRegionType &outputRegionForThread, itk::ThreadIdType threadId)
+::PostComputeLine(const TSum *p_input, int nc, long offset_in_pixels, int line_len,
+                  typename Superclass::ThreadData &td)
 {
   int nc_img = this->GetFixedImage()->GetNumberOfComponentsPerPixel();
+
+  // Pointer to the metric data for this line
+  MetricPixelType *p_metric = this->GetMetricOutput()->GetBufferPointer() + offset_in_pixels;
+
+  // The gradient output is optional
+  GradientPixelType *p_grad_metric = (this->m_ComputeGradient && !this->m_ComputeAffine)
+                                     ? this->GetDeformationGradientOutput()->GetBufferPointer() + offset_in_pixels
+                                     : NULL;
+
+  // Get the fixed mask like
+  typename MaskImageType::PixelType *fixed_mask_line =
+      this->GetFixedMaskImage()
+      ? this->GetFixedMaskImage()->GetBufferPointer() + offset_in_pixels
+      : NULL;
+
+  // Case 1 - dense gradient field requested
+  if(!this->m_ComputeAffine)
+    {
+    if(this->m_ComputeGradient)
+      {
+      // Loop over the pixels in the line
+      for(int i = 0; i < line_len; ++i)
+        {
+        // Clear the metric and the gradient
+        *p_metric = itk::NumericTraits<MetricPixelType>::ZeroValue();
+        *p_grad_metric = itk::NumericTraits<GradientPixelType>::ZeroValue();
+
+        if(!fixed_mask_line || fixed_mask_line[i] > 0.5)
+          {
+          p_input = MultiImageNNCPostComputeFunction(p_input, p_input + nc, nc_img, this->m_Weights.data_block(),
+                                                     p_metric, p_grad_metric++, ImageDimension);
+          }
+        else
+          {
+          p_grad_metric++;
+          p_input+=nc;
+          }
+
+        // Accumulate the total metric
+        td.metric += *p_metric;
+        td.mask += 1.0;
+        }
+      }
+    else
+      {
+      // Loop over the pixels in the line
+      for(int i = 0; i < line_len; ++i)
+        {
+        // Clear the metric and the gradient
+        *p_metric = itk::NumericTraits<MetricPixelType>::Zero;
+
+        // Apply the post computation
+        if(!fixed_mask_line || fixed_mask_line[i] > 0.5)
+          {
+          p_input = MultiImageNNCPostComputeFunction(p_input, p_input + nc, nc_img, this->m_Weights.data_block(),
+                                                     p_metric, (GradientPixelType *)(NULL), ImageDimension);
+          }
+        else
+          {
+          p_input+=nc;
+          }
+
+        // Accumulate the total metric
+        td.metric += *p_metric;
+        td.mask += 1.0;
+        }
+      }
+    }
+  // Computing affine
+  else
+    {
+    double *p_grad = this->m_ComputeGradient ? td.gradient.data_block() : NULL;
+
+    // Is there a mask?
+    typename MaskImageType::PixelType *mask_line = NULL;
+    if(this->GetFixedMaskImage())
+      mask_line = this->GetFixedMaskImage()->GetBufferPointer() + offset_in_pixels;
+
+    // Loop over the pixels in the line
+    for(int i = 0; i < line_len; ++i)
+      {
+      // Use mask
+      if(!fixed_mask_line || fixed_mask_line[i] > 0.5)
+        {
+        // Clear the metric and the gradient
+        *p_metric = itk::NumericTraits<MetricPixelType>::Zero;
+
+        // Apply the post computation
+        p_input = MultiImageNNCPostComputeAffineGradientFunction(
+                    p_input, p_input + nc, nc_img, this->m_Weights.data_block(),
+                    p_metric, p_grad, ImageDimension);
+
+        // Accumulate the total metric
+        td.metric += *p_metric;
+        td.mask += 1.0;
+        }
+      else
+        {
+        p_input+=nc;
+        }
+      }
+    }
+}
+
+
+template <class TMetricTraits>
+void
+MultiComponentNCCImageMetric<TMetricTraits>
+::ThreadedGenerateData(const OutputImageRegionType &outputRegionForThread, itk::ThreadIdType threadId)
+{
+  // In streaming mode, the threads go through the whole image together
+  if(m_StreamBoxSums)
+    {
+    this->StreamingThreadedGenerateData(threadId);
+    return;
+    }
+
   int nc = m_WorkingImage->GetNumberOfComponentsPerPixel();
   int line_len = outputRegionForThread.GetSize()[0];
 
@@ -532,106 +672,293 @@ MultiComponentNCCImageMetric<TMetricTraits>
     // Pointer to the input pixel data for this line
     const InputComponentType *p_input = m_WorkingImage->GetBufferPointer() + nc * offset_in_pixels;
 
-    // Pointer to the metric data for this line
-    MetricPixelType *p_metric = this->GetMetricOutput()->GetBufferPointer() + offset_in_pixels;
+    // Compute the metric for this line
+    this->PostComputeLine(p_input, nc, offset_in_pixels, line_len, td);
+    }
+}
+
+
+/**
+ * Compute the box sums along one dimension for the lines of a buffer that lie in the
+ * box [lo, hi) (the box spans the whole buffer in dimension d). The buffer has n_dims
+ * dimensions and nc components per pixel, the strides are in pixels. The sums are
+ * computed in double precision, using a line buffer (size[d] * nc) and a sum buffer (nc).
+ */
+template <class TComponent>
+void
+MultiImageNCCAccumulateLinesInPlace(TComponent *buffer, const int *size, const long *stride, int n_dims,
+                                    int d, int radius, int nc, const int *lo, const int *hi,
+                                    double *line, double *sum)
+{
+  // Nothing to do for an empty box
+  for(int j = 0; j < n_dims; j++)
+    if(j != d && lo[j] >= hi[j])
+      return;
 
-    // The gradient output is optional
-    GradientPixelType *p_grad_metric = (this->m_ComputeGradient && !this->m_ComputeAffine)
-                                       ? this->GetDeformationGradientOutput()->GetBufferPointer() + offset_in_pixels
-                                       : NULL;
+  // Index of the start of the current line
+  std::vector<int> idx(lo, lo + n_dims);
+  idx[d] = 0;
 
-    // Get the fixed mask like
-    typename MaskImageType::PixelType *fixed_mask_line =
-        this->GetFixedMaskImage()
-        ? this->GetFixedMaskImage()->GetBufferPointer() + offset_in_pixels
-        : NULL;
+  int line_length = size[d];
+  long jump = stride[d] * nc;
 
-    // Case 1 - dense gradient field requested
-    if(!this->m_ComputeAffine)
+  while(true)
+    {
+    long offset_in_pixels = 0;
+    for(int j = 0; j < n_dims; j++)
+      offset_in_pixels += idx[j] * stride[j];
+    TComponent *p_line = buffer + offset_in_pixels * nc;
+
+    // Copy the line, since it is overwritten by the sums
+    for(int i = 0; i < line_length; i++)
+      for(int k = 0; k < nc; k++)
+        line[i * nc + k] = p_line[i * jump + k];
+
+    // Running sum: at step i, pixel i enters the window and pixel i - 2r - 1 leaves it,
+    // the sum is then the box sum for pixel i - r
+    for(int k = 0; k < nc; k++)
+      sum[k] = 0.0;
+
+    for(int i = 0; i < line_length + radius; i++)
       {
-      if(this->m_ComputeGradient)
-        {
-        // Loop over the pixels in the line
-        for(int i = 0; i < line_len; ++i)
-          {
-          // Clear the metric and the gradient
-          *p_metric = itk::NumericTraits<MetricPixelType>::ZeroValue();
-          *p_grad_metric = itk::NumericTraits<GradientPixelType>::ZeroValue();
+      if(i < line_length)
+        for(int k = 0; k < nc; k++)
+          sum[k] += line[i * nc + k];
 
-          if(!fixed_mask_line || fixed_mask_line[i] > 0.5)
-            {
-            p_input = MultiImageNNCPostComputeFunction(p_input, p_input + nc, nc_img, this->m_Weights.data_block(),
-                                                       p_metric, p_grad_metric++, ImageDimension);
-            }
-          else
-            {
-            p_grad_metric++;
-            p_input+=nc;
-            }
+      if(i > 2 * radius)
+        for(int k = 0; k < nc; k++)
+          sum[k] -= line[(i - 2 * radius - 1) * nc + k];
 
-          // Accumulate the total metric
-          td.metric += *p_metric;
-          td.mask += 1.0;
-          }
-        }
-      else
+      if(i >= radius)
         {
-        // Loop over the pixels in the line
-        for(int i = 0; i < line_len; ++i)
-          {
-          // Clear the metric and the gradient
-          *p_metric = itk::NumericTraits<MetricPixelType>::Zero;
+        TComponent *p_write = p_line + (i - radius) * jump;
+        for(int k = 0; k < nc; k++)
+          p_write[k] = (TComponent) sum[k];
+        }
+      }
 
-          // Apply the post computation
-          if(!fixed_mask_line || fixed_mask_line[i] > 0.5)
-            {
-            p_input = MultiImageNNCPostComputeFunction(p_input, p_input + nc, nc_img, this->m_Weights.data_block(),
-                                                       p_metric, (GradientPixelType *)(NULL), ImageDimension);
-            }
-          else
-            {
-            p_input+=nc;
-            }
+    // Go to the next line in the box
+    int j = 0;
+    for(; j < n_dims; j++)
+      {
+      if(j == d)
+        continue;
+      if(++idx[j] < hi[j])
+        break;
+      idx[j] = lo[j];
+      }
 
-          // Accumulate the total metric
-          td.metric += *p_metric;
-          td.mask += 1.0;
-          }
+    if(j == n_dims)
+      break;
+    }
+}
+
+
+template <class TMetricTraits>
+void
+MultiComponentNCCImageMetric<TMetricTraits>
+::BeforeStreamingThreadedGenerateData()
+{
+  // The precompute filter knows the number of components
+  typedef MultiImageNCCPrecomputeFilter<TMetricTraits, InputImageType> PreFilterType;
+  typename PreFilterType::Pointer preFilter = PreFilterType::New();
+  preFilter->SetParent(this);
+  m_NumberOfStreamingComponents = preFilter->GetNumberOfOutputComponents();
+
+  // Figure out the number of threads that will run (see the MI metric)
+  itk::ThreadIdType nbOfThreads = this->GetNumberOfThreads();
+  if ( itk::MultiThreader::GetGlobalMaximumNumberOfThreads() != 0 )
+    {
+    nbOfThreads = vnl_math_min( this->GetNumberOfThreads(), itk::MultiThreader::GetGlobalMaximumNumberOfThreads() );
+    }
+
+  itk::ImageRegion<ImageDimension> splitRegion;  // dummy region - just to call
+                                                  // the following method
+  nbOfThreads = this->SplitRequestedRegion(0, nbOfThreads, splitRegion);
+  m_NumberOfStreamingThreads = nbOfThreads;
+
+  // Initialize the barrier
+  m_Barrier = itk::Barrier::New();
+  m_Barrier->Initialize(nbOfThreads);
+
+  // Set up the scratch memory
+  if(m_ScratchArena.IsNull())
+    m_ScratchArena = ScratchArenaType::New();
+
+  m_ScratchArena->SetNumberOfThreads(nbOfThreads);
+  m_ScratchArena->SetRegion(this->GetFixedImage()->GetBufferedRegion());
+
+  // Clear the sums, they are accumulated plane by plane
+  const typename InputImageType::SizeType &size = this->GetFixedImage()->GetBufferedRegion().GetSize();
+  size_t n_sum = m_NumberOfStreamingComponents;
+  for(unsigned int d = 0; d < ImageDimension - 1; d++)
+    n_sum *= size[d];
+
+  double *sum = m_ScratchArena->GetSumBuffer(n_sum);
+  std::fill(sum, sum + n_sum, 0.0);
+}
+
+
+template <class TMetricTraits>
+void
+MultiComponentNCCImageMetric<TMetricTraits>
+::StreamingThreadedGenerateData(itk::ThreadIdType threadId)
+{
+  // The image is processed one plane (last index fixed) at a time. Each plane goes
+  // through these steps, separated by barriers:
+  //   1. the working components of the plane are computed
+  //   2. box sums within the plane, one step for each dimension of the plane
+  //   3. the plane is added to the sums over the last dimension, and the plane that
+  //      leaves the window is subtracted; the sums are complete for the plane that
+  //      is radius behind, whose metric is computed
+  // The window holds 2 * radius + 2 planes, so that the plane that leaves the window
+  // is still there when the next plane is computed. Steps 1 and 3 split the plane
+  // along its last dimension, so a thread only touches the same rows in both.
+  const unsigned int D = ImageDimension, a = ImageDimension - 1;
+  const OutputImageRegionType &region = this->GetFixedImage()->GetBufferedRegion();
+
+  int nc = m_NumberOfStreamingComponents;
+  int nc_img = this->GetFixedImage()->GetNumberOfComponentsPerPixel();
+  int nt = m_NumberOfStreamingThreads;
+
+  // Size and strides (in pixels) of the image
+  int size[ImageDimension];
+  long stride[ImageDimension];
+  int max_line_length = 0;
+  for(unsigned int d = 0; d < D; d++)
+    {
+    size[d] = region.GetSize(d);
+    stride[d] = (d == 0) ? 1 : stride[d-1] * size[d-1];
+    if(d < a)
+      max_line_length = std::max(max_line_length, size[d]);
+    }
+
+  // Planes and the window over the last dimension
+  long plane_pixels = stride[a];
+  int n_planes = size[a], radius = m_Radius[a], n_slots = 2 * radius + 2;
+  InputComponentType *window = m_ScratchArena->GetWindowBuffer(n_slots * plane_pixels * nc);
+  double *sum = m_ScratchArena->GetSumBuffer(plane_pixels * nc);
+
+  // Buffers of this thread
+  double *line = m_ScratchArena->GetThreadBuffer(threadId, (max_line_length + 1) * nc);
+  double *line_sum = line + max_line_length * nc;
+
+  // Rows of the plane for steps 1 and 3: a range along the last dimension of the plane.
+  // For 2D images the plane is a single line, which goes to the first thread
+  int row_lo[ImageDimension], row_hi[ImageDimension];
+  for(unsigned int d = 0; d < a; d++)
+    {
+    row_lo[d] = 0;
+    row_hi[d] = size[d];
+    }
+
+  unsigned int p = a - 1;
+  if(D > 2)
+    {
+    row_lo[p] = (size[p] * threadId) / nt;
+    row_hi[p] = (size[p] * (threadId + 1)) / nt;
+    }
+  else if(threadId > 0)
+    {
+    row_hi[p] = 0;
+    }
+
+  // The same rows, as an image region in the current plane
+  OutputImageRegionType row_region = region;
+  for(unsigned int d = 0; d < a; d++)
+    {
+    row_region.SetIndex(d, region.GetIndex(d) + row_lo[d]);
+    row_region.SetSize(d, std::max(0, row_hi[d] - row_lo[d]));
+    }
+  row_region.SetSize(a, 1);
+
+  // Offsets (in pixels, within the plane) of the lines along the first dimension in the rows
+  std::vector<long> row_lines;
+  if(row_region.GetNumberOfPixels() > 0)
+    {
+    for(long offset = 0; offset < plane_pixels; offset += size[0])
+      {
+      bool in_rows = true;
+      for(unsigned int d = 1; d < a; d++)
+        {
+        int idx = (offset / stride[d]) % size[d];
+        in_rows = in_rows && idx >= row_lo[d] && idx < row_hi[d];
         }
+      if(in_rows)
+        row_lines.push_back(offset);
       }
-    // Computing affine
-    else
+    }
+
+  // Our thread data
+  typename Superclass::ThreadData &td = this->m_ThreadData[threadId];
+
+  typedef MultiComponentMetricWorker<TMetricTraits, MetricImageType> WorkerType;
+
+  for(int t = 0; t < n_planes + radius; t++)
+    {
+    InputComponentType *slot = window + (t % n_slots) * plane_pixels * nc;
+
+    // Step 1: compute the working components for plane t
+    if(t < n_planes && row_lines.size())
       {
-      double *p_grad = this->m_ComputeGradient ? td.gradient.data_block() : NULL;
+      row_region.SetIndex(a, region.GetIndex(a) + t);
+      WorkerType iter(this, this->GetMetricOutput(), row_region);
+      for(; !iter.IsAtEnd(); iter.NextLine())
+        {
+        InputComponentType *out = slot + (iter.GetOffsetInPixels() - t * plane_pixels) * nc;
+        for(; !iter.IsAtEndOfLine(); ++iter)
+          out = MultiImageNCCPrecomputeVoxel(iter, this, nc_img, nc, true, out);
+        }
+      }
 
-      // Is there a mask?
-      typename MaskImageType::PixelType *mask_line = NULL;
-      if(this->GetFixedMaskImage())
-        mask_line = this->GetFixedMaskImage()->GetBufferPointer() + offset_in_pixels;
+    m_Barrier->Wait();
 
-      // Loop over the pixels in the line
-      for(int i = 0; i < line_len; ++i)
+    // Step 2: box sums within the plane, one dimension at a time. The lines along dimension
+    // d are split between the threads along another dimension of the plane
+    for(unsigned int d = 0; d < a; d++)
+      {
+      int lo[ImageDimension], hi[ImageDimension];
+      for(unsigned int j = 0; j < a; j++)
         {
-        // Use mask
-        if(!fixed_mask_line || fixed_mask_line[i] > 0.5)
-          {
-          // Clear the metric and the gradient
-          *p_metric = itk::NumericTraits<MetricPixelType>::Zero;
+        lo[j] = 0;
+        hi[j] = size[j];
+        }
 
-          // Apply the post computation
-          p_input = MultiImageNNCPostComputeAffineGradientFunction(
-                      p_input, p_input + nc, nc_img, this->m_Weights.data_block(),
-                      p_metric, p_grad, ImageDimension);
+      unsigned int q = (d == p) ? 0 : p;
+      if(q != d)
+        {
+        lo[q] = (size[q] * threadId) / nt;
+        hi[q] = (size[q] * (threadId + 1)) / nt;
+        }
+      else if(threadId > 0)
+        {
+        hi[q] = 0;
+        }
 
-          // Accumulate the total metric
-          td.metric += *p_metric;
-          td.mask += 1.0;
-          }
-        else
-          {
-          p_input+=nc;
-          }
+      if(t < n_planes)
+        MultiImageNCCAccumulateLinesInPlace(slot, size, stride, a, d, m_Radius[d], nc, lo, hi,
+                                            line, line_sum);
+
+      m_Barrier->Wait();
+      }
+
+    // Step 3: update the sums over the last dimension and compute the metric for the plane
+    // at the center of the window
+    const InputComponentType *slot_leaving = window + ((t + 1) % n_slots) * plane_pixels * nc;
+    int t_out = t - radius;
+    for(size_t i = 0; i < row_lines.size(); i++)
+      {
+      long offset = row_lines[i] * nc, offset_end = offset + size[0] * nc;
+      for(long k = offset; k < offset_end; k++)
+        {
+        if(t < n_planes)
+          sum[k] += slot[k];
+        if(t > 2 * radius)
+          sum[k] -= slot_leaving[k];
         }
+
+      if(t_out >= 0)
+        this->PostComputeLine(sum + offset, nc, t_out * plane_pixels + row_lines[i], size[0], td);
       }
     }
 }
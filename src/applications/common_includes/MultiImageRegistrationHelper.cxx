@@ -36,12 +36,89 @@
 #include "MultiComponentNCCImageMetric.h"
 #include "MultiComponentApproximateNCCImageMetric.h"
 #include "MultiComponentMutualInfoImageMetric.h"
+#include "MultiComponentNCCBruteForceSearch.h"
 #include "MahalanobisDistanceToTargetWarpMetric.h"
 #include "itkVectorIndexSelectionCastImageFilter.h"
+#include "itkSimpleDataObjectDecorator.h"
 #include "OneDimensionalInPlaceAccumulateFilter.h"
 #include "itkUnaryFunctorImageFilter.h"
 #include "itkImageFileWriter.h"
 #include "GreedyException.h"
+#include "ChunkedWarpFile.h"
+
+#include <sstream>
+
+template <class TFloat, unsigned int VDim>
+void
+MultiImageOpticalFlowHelper<TFloat, VDim>
+::SetPyramidCache(PyramidCacheType *cache, itk::SimpleFastMutexLock *lock,
+                  const std::string &fixed_key, const std::string &images_key,
+                  const std::string &gradient_mask_key, const std::string &moving_mask_key)
+{
+  m_PyramidCache = cache;
+  m_PyramidCacheLock = lock;
+  m_FixedCacheKey = fixed_key;
+  m_ImagesCacheKey = images_key;
+  m_GradientMaskCacheKey = gradient_mask_key;
+  m_MovingMaskCacheKey = moving_mask_key;
+}
+
+template <class TFloat, unsigned int VDim>
+std::string
+MultiImageOpticalFlowHelper<TFloat, VDim>
+::GetPyramidCacheKey(const std::string &input_key, const std::string &item, int level) const
+{
+  // Items of inputs without a key are not cached
+  if(input_key.empty())
+    return std::string();
+
+  // The factor rather than the level identifies the pyramid level, so that runs with
+  // different numbers of levels share the levels they have in common
+  std::ostringstream oss;
+  oss << input_key << "|" << item << "|factor " << m_PyramidFactors[level];
+  return oss.str();
+}
+
+template <class TFloat, unsigned int VDim>
+template <class TObject>
+bool
+MultiImageOpticalFlowHelper<TFloat, VDim>
+::FindInPyramidCache(const std::string &key, itk::SmartPointer<TObject> &object) const
+{
+  if(!m_PyramidCache || key.empty())
+    return false;
+
+  if(m_PyramidCacheLock)
+    m_PyramidCacheLock->Lock();
+
+  typename PyramidCacheType::const_iterator it = m_PyramidCache->find(key);
+  TObject *cached = (it != m_PyramidCache->end())
+                    ? dynamic_cast<TObject *>(it->second.GetPointer()) : NULL;
+  if(cached)
+    object = cached;
+
+  if(m_PyramidCacheLock)
+    m_PyramidCacheLock->Unlock();
+
+  return cached != NULL;
+}
+
+template <class TFloat, unsigned int VDim>
+void
+MultiImageOpticalFlowHelper<TFloat, VDim>
+::StoreInPyramidCache(const std::string &key, itk::Object *object)
+{
+  if(!m_PyramidCache || key.empty())
+    return;
+
+  if(m_PyramidCacheLock)
+    m_PyramidCacheLock->Lock();
+
+  (*m_PyramidCache)[key] = object;
+
+  if(m_PyramidCacheLock)
+    m_PyramidCacheLock->Unlock();
+}
 
 template <class TFloat, unsigned int VDim>
 void
@@ -135,17 +212,35 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
 {
   typedef LDDMMData<TFloat, VDim> LDDMMType;
 
+  // The dilated masks depend on the radius
+  std::ostringstream oss_item;
+  oss_item << "ncc dilated";
+  for(unsigned int d = 0; d < VDim; d++)
+    oss_item << " " << radius[d];
+
   for(int level = 0; level < m_PyramidFactors.size(); level++)
     {
     if(m_GradientMaskComposite[level])
       {
-      // Threshold the mask itself
-      LDDMMType::img_threshold_in_place(m_GradientMaskComposite[level], 0.5, 1e100, 0.5, 0);
+      // Look for the dilated mask in the cache
+      std::string key = this->GetPyramidCacheKey(m_GradientMaskCacheKey, oss_item.str(), level);
+      typename FloatImageType::Pointer mask_dilated;
+      if(this->FindInPyramidCache(key, mask_dilated))
+        {
+        m_GradientMaskComposite[level] = mask_dilated;
+        continue;
+        }
+
+      // Threshold a copy of the mask, since the mask may be the user's mask or be
+      // shared with other helpers through the cache
+      LDDMMType::alloc_img(mask_dilated, m_GradientMaskComposite[level]);
+      LDDMMType::img_copy(m_GradientMaskComposite[level], mask_dilated);
+      LDDMMType::img_threshold_in_place(mask_dilated, 0.5, 1e100, 0.5, 0);
 
       // Make a copy of the mask
       typename FloatImageType::Pointer mask_copy;
-      LDDMMType::alloc_img(mask_copy, m_GradientMaskComposite[level]);
-      LDDMMType::img_copy(m_GradientMaskComposite[level], mask_copy);
+      LDDMMType::alloc_img(mask_copy, mask_dilated);
+      LDDMMType::img_copy(mask_dilated, mask_copy);
 
       // Run the accumulation filter on the mask
       typename FloatImageType::Pointer mask_accum =
@@ -155,7 +250,10 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
       LDDMMType::img_threshold_in_place(mask_accum, 0.25, 1e100, 0.5, 0);
 
       // Add the two images - the result has 1 for the initial mask, 0.5 for the 'outer' mask
-      LDDMMType::img_add_in_place(m_GradientMaskComposite[level], mask_accum);
+      LDDMMType::img_add_in_place(mask_dilated, mask_accum);
+
+      m_GradientMaskComposite[level] = mask_dilated;
+      this->StoreInPyramidCache(key, mask_dilated);
       }
     }
 }
@@ -175,22 +273,60 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   m_FixedComposite.resize(m_PyramidFactors.size());
   m_MovingComposite.resize(m_PyramidFactors.size());
 
+  // The binned images are computed from the composites
+  m_FixedBinnedComposite.clear();
+  m_MovingBinnedComposite.clear();
+
+  // The composites depend on the inputs, the noise and the scaling of the fixed images.
+  // The fixed composites do not depend on the moving images
+  std::ostringstream oss_opts;
+  oss_opts << "|noise " << noise_sigma_relative << "|scale " << m_ScaleFixedImageWithVoxelSize;
+  m_FixedCompositeCacheKey = m_FixedCacheKey.size() ? m_FixedCacheKey + oss_opts.str() : std::string();
+  m_CompositeCacheKey = m_ImagesCacheKey.size() ? m_ImagesCacheKey + oss_opts.str() : std::string();
+
+  // Check which levels are already in the cache, these are not built again
+  std::vector<bool> fixed_cached(m_PyramidFactors.size()), moving_cached(m_PyramidFactors.size());
+  bool all_fixed_cached = true, all_levels_cached = true;
+  for(size_t i = 0; i < m_PyramidFactors.size(); i++)
+    {
+    fixed_cached[i] =
+        this->FindInPyramidCache(this->GetPyramidCacheKey(m_FixedCompositeCacheKey, "fixed", i), m_FixedComposite[i]);
+    moving_cached[i] =
+        this->FindInPyramidCache(this->GetPyramidCacheKey(m_CompositeCacheKey, "moving", i), m_MovingComposite[i]);
+    all_fixed_cached = all_fixed_cached && fixed_cached[i];
+    all_levels_cached = all_levels_cached && fixed_cached[i] && moving_cached[i];
+    }
+
+  // The noise level of each fixed component is cached with the fixed pyramid
+  typedef itk::SimpleDataObjectDecorator<double> NoiseSigmaType;
+
   // Repeat for each of the input images
-  for(size_t j = 0; j < m_Fixed.size(); j++)
+  for(size_t j = 0; j < m_Fixed.size() && !all_levels_cached; j++)
     {
     // Repeat for each component
     for(unsigned k = 0; k < m_Fixed[j]->GetNumberOfComponentsPerPixel(); k++)
       {
-      // Extract the k-th image component from fixed and moving images
+      // Extract the k-th image component from fixed and moving images. The fixed image is
+      // not needed if all of its levels come from the cache. It may be shared with other
+      // helpers (e.g. the jobs of a batch), so the filter reads it through a graft of its
+      // own, rather than updating the pipeline of the shared image
       typedef itk::VectorIndexSelectionCastImageFilter<MultiComponentImageType, FloatImageType> ExtractType;
       typename ExtractType::Pointer fltExtractFixed, fltExtractMoving;
 
-      fltExtractFixed = ExtractType::New();
-      fltExtractFixed->SetInput(m_Fixed[j]);
-      fltExtractFixed->SetIndex(k);
-      fltExtractFixed->Update();
+      if(!all_fixed_cached)
+        {
+        typename MultiComponentImageType::Pointer fixed_view = MultiComponentImageType::New();
+        fixed_view->Graft(m_Fixed[j]);
+
+        fltExtractFixed = ExtractType::New();
+        this->SetUpThreads(fltExtractFixed);
+        fltExtractFixed->SetInput(fixed_view);
+        fltExtractFixed->SetIndex(k);
+        fltExtractFixed->Update();
+        }
 
       fltExtractMoving = ExtractType::New();
+      this->SetUpThreads(fltExtractMoving);
       fltExtractMoving->SetInput(m_Moving[j]);
       fltExtractMoving->SetIndex(k);
       fltExtractMoving->Update();
@@ -200,18 +336,37 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
 
       if(noise_sigma_relative > 0.0)
         {
-        // Figure out the quartiles of the fixed image
         typedef MutualInformationPreprocessingFilter<FloatImageType, FloatImageType> QuantileFilter;
-        typename QuantileFilter::Pointer fltQuantileFixed = QuantileFilter::New();
-        fltQuantileFixed->SetLowerQuantile(0.01);
-        fltQuantileFixed->SetUpperQuantile(0.99);
-        fltQuantileFixed->SetInput(fltExtractFixed->GetOutput());
-        fltQuantileFixed->Update();
-        double range_fixed = fltQuantileFixed->GetUpperQuantileValue(0) - fltQuantileFixed->GetLowerQuantileValue(0);
-        noise_sigma_fixed = noise_sigma_relative * range_fixed;
+
+        // Figure out the quartiles of the fixed image, unless its noise level is cached
+        // or no fixed level is built
+        std::ostringstream oss_noise;
+        oss_noise << "fixed noise sigma " << j << " " << k;
+        std::string noise_key = this->GetPyramidCacheKey(m_FixedCompositeCacheKey, oss_noise.str(), 0);
+        typename NoiseSigmaType::Pointer cached_sigma;
+        if(this->FindInPyramidCache(noise_key, cached_sigma))
+          {
+          noise_sigma_fixed = cached_sigma->Get();
+          }
+        else if(!all_fixed_cached)
+          {
+          typename QuantileFilter::Pointer fltQuantileFixed = QuantileFilter::New();
+          this->SetUpThreads(fltQuantileFixed);
+          fltQuantileFixed->SetLowerQuantile(0.01);
+          fltQuantileFixed->SetUpperQuantile(0.99);
+          fltQuantileFixed->SetInput(fltExtractFixed->GetOutput());
+          fltQuantileFixed->Update();
+          double range_fixed = fltQuantileFixed->GetUpperQuantileValue(0) - fltQuantileFixed->GetLowerQuantileValue(0);
+          noise_sigma_fixed = noise_sigma_relative * range_fixed;
+
+          typename NoiseSigmaType::Pointer sigma = NoiseSigmaType::New();
+          sigma->Set(noise_sigma_fixed);
+          this->StoreInPyramidCache(noise_key, sigma);
+          }
 
         // Figure out the quartiles of the moving image
         typename QuantileFilter::Pointer fltQuantileMoving = QuantileFilter::New();
+        this->SetUpThreads(fltQuantileMoving);
         fltQuantileMoving->SetLowerQuantile(0.01);
         fltQuantileMoving->SetUpperQuantile(0.99);
         fltQuantileMoving->SetInput(fltExtractMoving->GetOutput());
@@ -226,34 +381,57 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
       // Compute the pyramid for this component
       for(size_t i = 0; i < m_PyramidFactors.size(); i++)
         {
-        // Downsample the image to the right pyramid level
+        if(fixed_cached[i] && moving_cached[i])
+          continue;
+
+        // Downsample the images to the right pyramid level
         typename FloatImageType::Pointer lFixed, lMoving;
         if (m_PyramidFactors[i] == 1)
           {
-          lFixed = fltExtractFixed->GetOutput();
-          lMoving = fltExtractMoving->GetOutput();
+          if(!fixed_cached[i])
+            lFixed = fltExtractFixed->GetOutput();
+          if(!moving_cached[i])
+            lMoving = fltExtractMoving->GetOutput();
           }
         else
           {
-          lFixed = FloatImageType::New();
-          lMoving = FloatImageType::New();
-          LDDMMType::img_downsample(fltExtractFixed->GetOutput(), lFixed, m_PyramidFactors[i]);
-          LDDMMType::img_downsample(fltExtractMoving->GetOutput(), lMoving, m_PyramidFactors[i]);
-
-          // For the Mahalanobis metric, the fixed image needs to be scaled by the factor of the 
-          // pyramid level because it describes voxel coordinates
-          if(m_ScaleFixedImageWithVoxelSize)
-            LDDMMType::img_scale_in_place(lFixed, 1.0 / m_PyramidFactors[i]);
+          if(!fixed_cached[i])
+            {
+            lFixed = FloatImageType::New();
+            LDDMMType::img_downsample(fltExtractFixed->GetOutput(), lFixed, m_PyramidFactors[i]);
+
+            // For the Mahalanobis metric, the fixed image needs to be scaled by the factor of the
+            // pyramid level because it describes voxel coordinates
+            if(m_ScaleFixedImageWithVoxelSize)
+              LDDMMType::img_scale_in_place(lFixed, 1.0 / m_PyramidFactors[i]);
+            }
+          if(!moving_cached[i])
+            {
+            lMoving = FloatImageType::New();
+            LDDMMType::img_downsample(fltExtractMoving->GetOutput(), lMoving, m_PyramidFactors[i]);
+            }
           }
 
-        // Add some noise to the images
+        // Add some noise to the images. The moving noise follows the fixed noise in the
+        // random sequence, so the sequence is advanced past the fixed noise if the fixed
+        // composite comes from the cache
         if(noise_sigma_relative > 0.0)
           {
           vnl_random randy(12345);
-          for(size_t i = 0; i < lFixed->GetPixelContainer()->Size(); i++)
-            lFixed->GetBufferPointer()[i] += randy.normal() * noise_sigma_fixed;
-          for(size_t i = 0; i < lMoving->GetPixelContainer()->Size(); i++)
-            lMoving->GetBufferPointer()[i] += randy.normal() * noise_sigma_moving;
+          size_t n_fixed = fixed_cached[i]
+                           ? m_FixedComposite[i]->GetBufferedRegion().GetNumberOfPixels()
+                           : lFixed->GetPixelContainer()->Size();
+          for(size_t i = 0; i < n_fixed; i++)
+            {
+            double noise = randy.normal() * noise_sigma_fixed;
+            if(lFixed)
+              lFixed->GetBufferPointer()[i] += noise;
+            }
+          if(lMoving)
+            {
+            for(size_t i = 0; i < lMoving->GetPixelContainer()->Size(); i++)
+              lMoving->GetBufferPointer()[i] += randy.normal() * noise_sigma_moving;
+            }
           }
 
         // Compute the gradient of the moving image
@@ -262,14 +440,16 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
         //LDDMMType::image_gradient(lMoving, gradMoving);
 
         // Allocate the composite images if they have not been allocated
-        if(j == 0 && k == 0)
+        if(j == 0 && k == 0 && lFixed)
           {
           m_FixedComposite[i] = MultiComponentImageType::New();
           m_FixedComposite[i]->CopyInformation(lFixed);
           m_FixedComposite[i]->SetNumberOfComponentsPerPixel(m_Weights.size());
           m_FixedComposite[i]->SetRegions(lFixed->GetBufferedRegion());
           m_FixedComposite[i]->Allocate();
-
+          }
+        if(j == 0 && k == 0 && lMoving)
+          {
           m_MovingComposite[i] = MultiComponentImageType::New();
           m_MovingComposite[i]->CopyInformation(lMoving);
           m_MovingComposite[i]->SetNumberOfComponentsPerPixel(m_Weights.size());
@@ -278,8 +458,10 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
           }
 
         // Pack the data into the fixed and moving composite images
-        this->PlaceIntoComposite(lFixed, m_FixedComposite[i], off_fixed);
-        this->PlaceIntoComposite(lMoving, m_MovingComposite[i], off_moving);
+        if(lFixed)
+          this->PlaceIntoComposite(lFixed, m_FixedComposite[i], off_fixed);
+        if(lMoving)
+          this->PlaceIntoComposite(lMoving, m_MovingComposite[i], off_moving);
         }
 
       // Update the offsets
@@ -288,24 +470,35 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
       }
     }
 
+  // Store the newly built levels in the cache
+  for(size_t i = 0; i < m_PyramidFactors.size(); i++)
+    {
+    if(!fixed_cached[i])
+      this->StoreInPyramidCache(this->GetPyramidCacheKey(m_FixedCompositeCacheKey, "fixed", i), m_FixedComposite[i]);
+    if(!moving_cached[i])
+      this->StoreInPyramidCache(this->GetPyramidCacheKey(m_CompositeCacheKey, "moving", i), m_MovingComposite[i]);
+    }
+
   // Set up the mask pyramid
   m_GradientMaskComposite.resize(m_PyramidFactors.size(), NULL);
   if(m_GradientMaskImage)
     {
     for(size_t i = 0; i < m_PyramidFactors.size(); i++)
       {
-      // Downsample the image to the right pyramid level
+      // Downsample the image to the right pyramid level, unless it is in the cache
+      std::string key = this->GetPyramidCacheKey(m_GradientMaskCacheKey, "gradient mask", i);
       if (m_PyramidFactors[i] == 1)
         {
         m_GradientMaskComposite[i] = m_GradientMaskImage;
         }
-      else
+      else if(!this->FindInPyramidCache(key, m_GradientMaskComposite[i]))
         {
         m_GradientMaskComposite[i] = FloatImageType::New();
 
         // Downsampling the mask involves smoothing, so the mask will no longer be binary
         LDDMMType::img_downsample(m_GradientMaskImage, m_GradientMaskComposite[i], m_PyramidFactors[i]);
         LDDMMType::img_threshold_in_place(m_GradientMaskComposite[i], 0.5, 1e100, 1.0, 0.0);
+        this->StoreInPyramidCache(key, m_GradientMaskComposite[i]);
         }      
       }
     }
@@ -316,17 +509,19 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
     {
     for(size_t i = 0; i < m_PyramidFactors.size(); i++)
       {
-      // Downsample the image to the right pyramid level
+      // Downsample the image to the right pyramid level, unless it is in the cache
+      std::string key = this->GetPyramidCacheKey(m_MovingMaskCacheKey, "moving mask", i);
       if (m_PyramidFactors[i] == 1)
         {
         m_MovingMaskComposite[i] = m_MovingMaskImage;
         }
-      else
+      else if(!this->FindInPyramidCache(key, m_MovingMaskComposite[i]))
         {
         m_MovingMaskComposite[i] = FloatImageType::New();
 
         // Downsampling the mask involves smoothing, so the mask will no longer be binary
         LDDMMType::img_downsample(m_MovingMaskImage, m_MovingMaskComposite[i], m_PyramidFactors[i]);
+        this->StoreInPyramidCache(key, m_MovingMaskComposite[i]);
 
         // We don't need the moving mask to be binary, we can leave it be floating point...
         // LDDMMType::img_threshold_in_place(m_MovingMaskComposite[i], 0.5, 1e100, 1.0, 0.0);
@@ -338,8 +533,16 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   m_JitterComposite.resize(m_PyramidFactors.size(), NULL);
   if(m_JitterSigma > 0)
     {
+    // The jitter only depends on the reference space and sigma
+    std::ostringstream oss_item;
+    oss_item << "jitter " << m_JitterSigma;
+
     for(size_t i = 0; i < m_PyramidFactors.size(); i++)
       {
+      std::string key = this->GetPyramidCacheKey(m_FixedCompositeCacheKey, oss_item.str(), i);
+      if(this->FindInPyramidCache(key, m_JitterComposite[i]))
+        continue;
+
       // Get the reference space
       ImageBaseType *base = this->GetReferenceSpace(i);
       VectorImagePointer iJitter = VectorImageType::New();
@@ -358,6 +561,7 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
         }
 
       m_JitterComposite[i] = iJitter;
+      this->StoreInPyramidCache(key, iJitter);
       }
     }
 }
@@ -409,6 +613,7 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   typedef MultiImageOpticalFlowImageFilter<TraitsType> FilterType;
 
   typename FilterType::Pointer filter = FilterType::New();
+  this->SetUpThreads(filter);
 
   // Scale the weights by epsilon
   vnl_vector<float> wscaled(m_Weights.size());
@@ -429,6 +634,53 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   return filter->GetAllMetricValues();
 }
 
+template <class TFloat, unsigned int VDim>
+void
+MultiImageOpticalFlowHelper<TFloat, VDim>
+::GetBinnedComposites(int level, BinnedImageType *&fixed, BinnedImageType *&moving)
+{
+  typedef MutualInformationPreprocessingFilter<MultiComponentImageType, BinnedImageType> BinnerType;
+
+  m_FixedBinnedComposite.resize(m_PyramidFactors.size());
+  m_MovingBinnedComposite.resize(m_PyramidFactors.size());
+
+  if(m_FixedBinnedComposite[level].IsNull())
+    {
+    std::string key_fixed = this->GetPyramidCacheKey(m_CompositeCacheKey, "fixed binned", level);
+    std::string key_moving = this->GetPyramidCacheKey(m_CompositeCacheKey, "moving binned", level);
+
+    if(!this->FindInPyramidCache(key_fixed, m_FixedBinnedComposite[level])
+       || !this->FindInPyramidCache(key_moving, m_MovingBinnedComposite[level]))
+      {
+      typename BinnerType::Pointer binner_fixed = BinnerType::New();
+      this->SetUpThreads(binner_fixed);
+      binner_fixed->SetInput(m_FixedComposite[level]);
+      binner_fixed->SetBins(128);
+      binner_fixed->SetLowerQuantile(0.01);
+      binner_fixed->SetUpperQuantile(0.99);
+      binner_fixed->SetStartAtBinOne(true);
+      binner_fixed->Update();
+
+      typename BinnerType::Pointer binner_moving = BinnerType::New();
+      this->SetUpThreads(binner_moving);
+      binner_moving->SetInput(m_MovingComposite[level]);
+      binner_moving->SetBins(128);
+      binner_moving->SetLowerQuantile(0.01);
+      binner_moving->SetUpperQuantile(0.99);
+      binner_moving->SetStartAtBinOne(true);
+      binner_moving->Update();
+
+      m_FixedBinnedComposite[level] = binner_fixed->GetOutput();
+      m_MovingBinnedComposite[level] = binner_moving->GetOutput();
+      this->StoreInPyramidCache(key_fixed, m_FixedBinnedComposite[level]);
+      this->StoreInPyramidCache(key_moving, m_MovingBinnedComposite[level]);
+      }
+    }
+
+  fixed = m_FixedBinnedComposite[level];
+  moving = m_MovingBinnedComposite[level];
+}
+
 template <class TFloat, unsigned int VDim>
 vnl_vector<double>
 MultiImageOpticalFlowHelper<TFloat, VDim>
@@ -448,40 +700,16 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   typedef DefaultMultiComponentMutualInfoImageMetricTraits<TFloat, unsigned char, VDim> TraitsType;
   typedef MultiComponentMutualInfoImageMetric<TraitsType> MetricType;
 
-  typedef itk::VectorImage<unsigned char, VDim> BinnedImageType;
-  typedef MutualInformationPreprocessingFilter<MultiComponentImageType, BinnedImageType> BinnerType;
-
-  // TODO: this is utter laziness, get rid of this garbage!
-  static typename BinnerType::Pointer binner_fixed;
-  static typename BinnerType::Pointer binner_moving;
-
-  if(binner_fixed.IsNull()
-     || binner_fixed->GetOutput()->GetBufferedRegion()
-     != m_FixedComposite[level]->GetBufferedRegion())
-    {
-    binner_fixed = BinnerType::New();
-    binner_fixed->SetInput(m_FixedComposite[level]);
-    binner_fixed->SetBins(128);
-    binner_fixed->SetLowerQuantile(0.01);
-    binner_fixed->SetUpperQuantile(0.99);
-    binner_fixed->SetStartAtBinOne(true);
-    binner_fixed->Update();
-
-    binner_moving = BinnerType::New();
-    binner_moving->SetInput(m_MovingComposite[level]);
-    binner_moving->SetBins(128);
-    binner_moving->SetLowerQuantile(0.01);
-    binner_moving->SetUpperQuantile(0.99);
-    binner_moving->SetStartAtBinOne(true);
-    binner_moving->Update();
-    }
-
+  // Get the binned fixed and moving images
+  BinnedImageType *binned_fixed, *binned_moving;
+  this->GetBinnedComposites(level, binned_fixed, binned_moving);
 
   typename MetricType::Pointer metric = MetricType::New();
+  this->SetUpThreads(metric);
 
   metric->SetComputeNormalizedMutualInformation(normalized_mutual_information);
-  metric->SetFixedImage(binner_fixed->GetOutput());
-  metric->SetMovingImage(binner_moving->GetOutput());
+  metric->SetFixedImage(binned_fixed);
+  metric->SetMovingImage(binned_moving);
   metric->SetDeformationField(def);
   metric->SetWeights(wscaled);
   metric->SetComputeGradient(true);
@@ -499,6 +727,16 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
 #define DUMP_NCC 1
 
 
+template <class TFloat, unsigned int VDim>
+typename MultiImageOpticalFlowHelper<TFloat, VDim>::NCCScratchArenaType *
+MultiImageOpticalFlowHelper<TFloat, VDim>
+::GetNCCScratchArena()
+{
+  if(m_NCCScratchArena.IsNull())
+    m_NCCScratchArena = NCCScratchArenaType::New().GetPointer();
+  return static_cast<NCCScratchArenaType *>(m_NCCScratchArena.GetPointer());
+}
+
 template <class TFloat, unsigned int VDim>
 typename MultiImageOpticalFlowHelper<TFloat, VDim>::SizeType
 MultiImageOpticalFlowHelper<TFloat, VDim>
@@ -537,6 +775,7 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   // typedef MultiComponentApproximateNCCImageMetric<TraitsType> FilterType;
 
   typename FilterType::Pointer filter = FilterType::New();
+  this->SetUpThreads(filter);
 
   // Scale the weights by epsilon
   vnl_vector<float> wscaled(m_Weights.size());
@@ -547,9 +786,11 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   if(m_NCCWorkingImage.IsNull())
     m_NCCWorkingImage = MultiComponentImageType::New();
 
-  // Is this the first time that this function is being called with this image?
-  bool first_run =
-      m_NCCWorkingImage->GetBufferedRegion() != m_FixedComposite[level]->GetBufferedRegion();
+  // Is this the first time that this function is being called with this image? In
+  // streaming mode the working image is not used, the scratch memory keeps the region
+  bool first_run = m_StreamNCCBoxSums
+      ? this->GetNCCScratchArena()->GetRegion() != m_FixedComposite[level]->GetBufferedRegion()
+      : m_NCCWorkingImage->GetBufferedRegion() != m_FixedComposite[level]->GetBufferedRegion();
 
   // Check the radius against the size of the image
   SizeType radius_fix = AdjustNCCRadius(level, radius, first_run);
@@ -565,6 +806,12 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   filter->SetRadius(radius_fix);
   filter->SetWorkingImage(m_NCCWorkingImage);
   filter->SetReuseWorkingImageFixedComponents(!first_run);
+  filter->SetAccumulateInDouble(m_AccumulateInDouble);
+  if(m_StreamNCCBoxSums)
+    {
+    filter->SetStreamBoxSums(true);
+    filter->SetScratchArena(this->GetNCCScratchArena());
+    }
   filter->SetFixedMaskImage(m_GradientMaskComposite[level]);
 
   // TODO: support moving masks...
@@ -575,6 +822,32 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   return filter->GetMetricValue();
 }
 
+template <class TFloat, unsigned int VDim>
+void
+MultiImageOpticalFlowHelper<TFloat, VDim>
+::ComputeNCCBruteForceSearch(int level,
+                             const SizeType &search_radius,
+                             const SizeType &metric_radius,
+                             VectorImageType *out_offset,
+                             FloatImageType *out_metric)
+{
+  typedef MultiComponentNCCBruteForceSearch<TFloat, VDim> SearchType;
+
+  // Check the radius against the size of the image
+  SizeType radius_fix = AdjustNCCRadius(level, metric_radius, true);
+
+  SearchType search;
+  search.SetFixedImage(m_FixedComposite[level]);
+  search.SetMovingImage(m_MovingComposite[level]);
+  if(m_GradientMaskComposite[level])
+    search.SetFixedMaskImage(m_GradientMaskComposite[level]);
+  search.SetWeights(m_Weights);
+  search.SetSearchRadius(search_radius);
+  search.SetMetricRadius(radius_fix);
+  search.SetNumberOfThreads(m_NumberOfThreads);
+  search.Compute(out_offset, out_metric);
+}
+
 template <class TFloat, unsigned int VDim>
 double
 MultiImageOpticalFlowHelper<TFloat, VDim>
@@ -585,6 +858,7 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   typedef DefaultMahalanobisDistanceToTargetMetricTraits<TFloat, VDim> TraitsType;
   typedef MahalanobisDistanceToTargetWarpMetric<TraitsType> FilterType;
   typename FilterType::Pointer filter = FilterType::New();
+  this->SetUpThreads(filter);
 
   filter->SetFixedImage(m_FixedComposite[level]);
   filter->SetMovingImage(m_MovingComposite[level]);
@@ -621,6 +895,7 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   typedef DefaultMultiComponentImageMetricTraits<TFloat, VDim> TraitsType;
   typedef MultiImageOpticalFlowImageFilter<TraitsType> MetricType;
   typename MetricType::Pointer metric = MetricType::New();
+  this->SetUpThreads(metric);
 
   metric->SetFixedImage(m_FixedComposite[level]);
   metric->SetMovingImage(m_MovingComposite[level]);
@@ -678,39 +953,15 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   typedef DefaultMultiComponentMutualInfoImageMetricTraits<TFloat, unsigned char, VDim> TraitsType;
   typedef MultiComponentMutualInfoImageMetric<TraitsType> MetricType;
 
-  typedef itk::VectorImage<unsigned char, VDim> BinnedImageType;
-  typedef MutualInformationPreprocessingFilter<MultiComponentImageType, BinnedImageType> BinnerType;
-
-  // TODO: this is utter laziness, get rid of this garbage!
-  static typename BinnerType::Pointer binner_fixed;
-  static typename BinnerType::Pointer binner_moving;
-
-  if(binner_fixed.IsNull()
-     || binner_fixed->GetOutput()->GetBufferedRegion()
-     != m_FixedComposite[level]->GetBufferedRegion())
-    {
-    binner_fixed = BinnerType::New();
-    binner_fixed->SetInput(m_FixedComposite[level]);
-    binner_fixed->SetBins(128);
-    binner_fixed->SetLowerQuantile(0.01);
-    binner_fixed->SetUpperQuantile(0.99);
-    binner_fixed->SetStartAtBinOne(true);
-    binner_fixed->Update();
-
-    binner_moving = BinnerType::New();
-    binner_moving->SetInput(m_MovingComposite[level]);
-    binner_moving->SetBins(128);
-    binner_moving->SetLowerQuantile(0.01);
-    binner_moving->SetUpperQuantile(0.99);
-    binner_moving->SetStartAtBinOne(true);
-    binner_moving->Update();
-    }
-
+  // Get the binned fixed and moving images
+  BinnedImageType *binned_fixed, *binned_moving;
+  this->GetBinnedComposites(level, binned_fixed, binned_moving);
   typename MetricType::Pointer metric = MetricType::New();
+  this->SetUpThreads(metric);
 
   metric->SetComputeNormalizedMutualInformation(normalized_mutual_info);
-  metric->SetFixedImage(binner_fixed->GetOutput());
-  metric->SetMovingImage(binner_moving->GetOutput());
+  metric->SetFixedImage(binned_fixed);
+  metric->SetMovingImage(binned_moving);
   metric->SetWeights(wscaled);
   metric->SetAffineTransform(tran);
   metric->SetComputeMovingDomainMask(true);
@@ -745,25 +996,37 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
                                    VectorImageType *wrkGradMetric,
                                    VectorImageType *wrkGradMask,
                                    VectorImageType *wrkPhi,
-                                   LinearTransformType *grad)
+                                   LinearTransformType *grad,
+                                   MultiComponentImageType *wrkNCC)
 {
   // Scale the weights by epsilon
   vnl_vector<float> wscaled(m_Weights.size());
   for (unsigned i = 0; i < wscaled.size(); i++)
     wscaled[i] = m_Weights[i];
 
-  // Allocate a working image
-  if(m_NCCWorkingImage.IsNull())
-    m_NCCWorkingImage = MultiComponentImageType::New();
+  // Allocate a working image, unless the caller provides one. The caller's working
+  // image means the call may run concurrently with others, so in streaming mode it
+  // can't use the helper's scratch memory (the metric allocates its own)
+  NCCScratchArenaType *arena = NULL;
+  if(!wrkNCC)
+    {
+    if(m_NCCWorkingImage.IsNull())
+      m_NCCWorkingImage = MultiComponentImageType::New();
+    wrkNCC = m_NCCWorkingImage;
+    if(m_StreamNCCBoxSums)
+      arena = this->GetNCCScratchArena();
+    }
 
   // Set up the optical flow computation
   typedef DefaultMultiComponentImageMetricTraits<TFloat, VDim> TraitsType;
   typedef MultiComponentNCCImageMetric<TraitsType> MetricType;
   typename MetricType::Pointer metric = MetricType::New();
+  this->SetUpThreads(metric);
 
   // Is this the first time that this function is being called with this image?
-  bool first_run =
-      m_NCCWorkingImage->GetBufferedRegion() != m_FixedComposite[level]->GetBufferedRegion();
+  bool first_run = m_StreamNCCBoxSums
+      ? arena && arena->GetRegion() != m_FixedComposite[level]->GetBufferedRegion()
+      : wrkNCC->GetBufferedRegion() != m_FixedComposite[level]->GetBufferedRegion();
 
   // Check the radius against the size of the image
   SizeType radius_fix = AdjustNCCRadius(level, radius, first_run);
@@ -776,8 +1039,14 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   metric->GetMetricOutput()->Graft(wrkMetric);
   metric->SetComputeGradient(grad != NULL);
   metric->SetRadius(radius_fix);
-  metric->SetWorkingImage(m_NCCWorkingImage);
+  metric->SetWorkingImage(wrkNCC);
   metric->SetReuseWorkingImageFixedComponents(!first_run);
+  metric->SetAccumulateInDouble(m_AccumulateInDouble);
+  if(m_StreamNCCBoxSums)
+    {
+    metric->SetStreamBoxSums(true);
+    metric->SetScratchArena(arena);
+    }
   metric->SetFixedMaskImage(m_GradientMaskComposite[level]);
   metric->SetJitterImage(m_JitterComposite[level]);
   metric->Update();
@@ -1111,6 +1380,7 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   Functor functor(warp, moving_space);
 
   typename Filter::Pointer filter = Filter::New();
+  LDDMMData<TFloat, VDim>::set_up_threads(filter);
   filter->SetFunctor(functor);
   filter->SetInput(warp);
   filter->GraftOutput(result);
@@ -1127,6 +1397,7 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   Functor functor(warp, moving_space);
 
   typename Filter::Pointer filter = Filter::New();
+  LDDMMData<TFloat, VDim>::set_up_threads(filter);
   filter->SetFunctor(functor);
   filter->SetInput(warp);
   filter->GraftOutput(result);
@@ -1164,15 +1435,17 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
 template <class TFloat, unsigned int VDim>
 void
 MultiImageOpticalFlowHelper<TFloat, VDim>
-::WriteCompressedWarpInPhysicalSpace(int level, VectorImageType *warp, const char *filename, double precision)
+::WriteCompressedWarpInPhysicalSpace(int level, VectorImageType *warp, const char *filename, double precision,
+                                     unsigned int root_exponent)
 {
-  WriteCompressedWarpInPhysicalSpace(warp, this->GetMovingReferenceSpace(level), filename, precision);
+  WriteCompressedWarpInPhysicalSpace(warp, this->GetMovingReferenceSpace(level), filename, precision, root_exponent);
 }
 
 template <class TFloat, unsigned int VDim>
 void
 MultiImageOpticalFlowHelper<TFloat, VDim>
-::WriteCompressedWarpInPhysicalSpace(VectorImageType *warp, ImageBaseType *moving_ref_space, const char *filename, double precision)
+::WriteCompressedWarpInPhysicalSpace(VectorImageType *warp, ImageBaseType *moving_ref_space, const char *filename, double precision,
+                                     unsigned int root_exponent)
 {
   // Define a _float_ output type, even if working with double precision (less space on disk)
   typedef itk::CovariantVector<float, VDim> OutputVectorType;
@@ -1183,11 +1456,17 @@ MultiImageOpticalFlowHelper<TFloat, VDim>
   Functor functor(warp, moving_ref_space, precision);
 
   typename Filter::Pointer filter = Filter::New();
+  LDDMMData<TFloat, VDim>::set_up_threads(filter);
   filter->SetFunctor(functor);
   filter->SetInput(warp);
   filter->Update();
 
-  LDDMMData<float, VDim>::vimg_write(filter->GetOutput(), filename);
+  if(ChunkedWarpFile<float, VDim>::IsChunkedWarpFile(filename))
+    ChunkedWarpFile<float, VDim>::Write(filter->GetOutput(), filename, root_exponent);
+  else if(root_exponent == 0)
+    LDDMMData<float, VDim>::vimg_write(filter->GetOutput(), filename);
+  else
+    throw GreedyException("Root warps can only be written to .gwarp files");
 }
 
 template <class TFloat, unsigned int VDim>
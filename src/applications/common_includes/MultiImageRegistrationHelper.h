@@ -31,7 +31,12 @@
 #include "itkImage.h"
 #include "itkVectorImage.h"
 #include "itkMatrixOffsetTransformBase.h"
+#include "itkProcessObject.h"
+#include "itkSimpleFastMutexLock.h"
+#include <map>
+#include <string>
 
+template <class TComponent, unsigned int VDim> class MultiComponentNCCScratchArena;
 
 
 /**
@@ -60,6 +65,9 @@ public:
 
   typedef itk::MatrixOffsetTransformBase<TFloat, VDim, VDim> LinearTransformType;
 
+  typedef itk::VectorImage<unsigned char, VDim> BinnedImageType;
+  typedef std::map<std::string, itk::SmartPointer<itk::Object> > PyramidCacheType;
+
   /** Set default (power of two) pyramid factors */
   void SetDefaultPyramidFactors(int n_levels);
 
@@ -85,6 +93,45 @@ public:
   /** Set jitter sigma - for jittering image samples in affine mode */
   void SetJitterSigma(double sigma);
 
+  /**
+   * Accumulate the NCC box sums in double precision. This only makes a difference
+   * when TFloat is float: images and warps are then stored in float, while the sums
+   * that lose precision over long lines are kept in double (mixed precision)
+   */
+  void SetAccumulateInDouble(bool flag) { m_AccumulateInDouble = flag; }
+
+  /**
+   * Compute the NCC box sums by streaming through the fixed image plane by plane,
+   * instead of in a working image with all the NCC components of the whole image.
+   * This uses much less memory for multi-component images (see
+   * MultiComponentNCCImageMetric::SetStreamBoxSums)
+   */
+  void SetStreamNCCBoxSums(bool flag) { m_StreamNCCBoxSums = flag; }
+
+  /**
+   * Number of threads of the filters that compute the metrics (0: the ITK global
+   * default). Helpers used on several threads at the same time can split the threads
+   * between them this way, without changing the global default
+   */
+  void SetNumberOfThreads(int n) { m_NumberOfThreads = n; }
+  int GetNumberOfThreads() const { return m_NumberOfThreads; }
+
+  /**
+   * Share the pyramids with other helpers through a cache owned by the caller. The
+   * composites, mask pyramids and jitter images built by BuildCompositeImages, the
+   * NCC dilated masks and the binned images used by the MI metrics are looked up in
+   * the cache before they are computed, and stored in it afterwards. The keys must
+   * identify the inputs: the fixed key covers the fixed images, the images key covers
+   * the fixed and moving images (including any transforms applied to the moving
+   * images), the mask keys cover the masks. Items whose key is empty are not cached,
+   * e.g., an empty images key only shares the fixed composites. If the cache is used
+   * by helpers on other threads, the lock must be given. Must be called before
+   * BuildCompositeImages.
+   */
+  void SetPyramidCache(PyramidCacheType *cache, itk::SimpleFastMutexLock *lock,
+                       const std::string &fixed_key, const std::string &images_key,
+                       const std::string &gradient_mask_key, const std::string &moving_mask_key);
+
   /** Compute the composite image - must be run before any sampling is done */
   void BuildCompositeImages(double noise_sigma_relative = 0.0);
 
@@ -140,6 +187,14 @@ public:
                               FloatImageType *out_metric, VectorImageType *out_gradient = NULL,
                                double result_scaling = 1.0);
 
+  /**
+   * Brute force search for the displacement (in voxel units) with the best NCC
+   * metric at each voxel of the fixed image, see MultiComponentNCCBruteForceSearch
+   */
+  void ComputeNCCBruteForceSearch(int level, const SizeType &search_radius,
+                                  const SizeType &metric_radius,
+                                  VectorImageType *out_offset, FloatImageType *out_metric);
+
   /** Compute the Mahalanobis metric with gradient */
   double ComputeMahalanobisMetricImage(int level, VectorImageType *def, 
                                        FloatImageType *out_metric, 
@@ -164,6 +219,11 @@ public:
                                          VectorImageType *wrkPhi,
                                          LinearTransformType *grad = NULL);
 
+  /**
+   * Compute the affine NCC match and gradient. The working image wrkNCC holds the
+   * fixed image components between calls; when it is NULL, the helper's own working
+   * image is used, so concurrent calls must each pass their own.
+   */
   double ComputeAffineNCCMatchAndGradient(int level, LinearTransformType *tran,
                                           const SizeType &radius,
                                           FloatImageType *wrkMetric,
@@ -171,7 +231,8 @@ public:
                                           VectorImageType *wrkGradMetric,
                                           VectorImageType *wrkGradMask,
                                           VectorImageType *wrkPhi,
-                                          LinearTransformType *grad = NULL);
+                                          LinearTransformType *grad = NULL,
+                                          MultiComponentImageType *wrkNCC = NULL);
 
   static void AffineToField(LinearTransformType *tran, VectorImageType *def);
 
@@ -183,13 +244,17 @@ public:
 
   /* 
    * Write a warp to a file. The warp must be in voxel space, not physical space 
-   * this is the static version of this method
+   * this is the static version of this method. Files with the .gwarp extension are
+   * written as a ChunkedWarpFile, which can also hold a root warp: a non-zero
+   * root_exponent is the number of times the warp must be squared when it is read
    */
   static void WriteCompressedWarpInPhysicalSpace(
-    VectorImageType *warp, ImageBaseType *moving_ref_space, const char *filename, double precision);
+    VectorImageType *warp, ImageBaseType *moving_ref_space, const char *filename, double precision,
+    unsigned int root_exponent = 0);
 
   /** Write a warp to a file. The warp must be in voxel space, not physical space */
-  void WriteCompressedWarpInPhysicalSpace(int level, VectorImageType *warp, const char *filename, double precision);
+  void WriteCompressedWarpInPhysicalSpace(int level, VectorImageType *warp, const char *filename, double precision,
+                                          unsigned int root_exponent = 0);
 
   /**
    * Invert a deformation field by first dividing it into small transformations using the
@@ -219,7 +284,8 @@ public:
     FloatImageType *error_norm = NULL, double tol = 0.0, int max_iter = 20);
 
   MultiImageOpticalFlowHelper() : 
-    m_JitterSigma(0.0), m_ScaleFixedImageWithVoxelSize(false) {}
+    m_JitterSigma(0.0), m_ScaleFixedImageWithVoxelSize(false), m_AccumulateInDouble(false),
+    m_StreamNCCBoxSums(false), m_NumberOfThreads(0), m_PyramidCache(NULL), m_PyramidCacheLock(NULL) {}
 
 protected:
 
@@ -243,6 +309,14 @@ protected:
   // Working memory image for NCC computation
   typename MultiComponentImageType::Pointer m_NCCWorkingImage;
 
+  // Scratch memory for the NCC computation in streaming mode, kept between
+  // iterations. This is a MultiComponentNCCScratchArena, see GetNCCScratchArena
+  itk::Object::Pointer m_NCCScratchArena;
+
+  // Get the NCC scratch memory, allocating it on first use
+  typedef MultiComponentNCCScratchArena<TFloat, VDim> NCCScratchArenaType;
+  NCCScratchArenaType *GetNCCScratchArena();
+
   // Gradient mask image - used to multiply the gradient
   typename FloatImageType::Pointer m_GradientMaskImage;
 
@@ -268,6 +342,43 @@ protected:
   // when subsampling. This is needed for the Mahalanobis distance metric, but not for
   // any of the metrics that use image intensities
   bool m_ScaleFixedImageWithVoxelSize;
+
+  // Whether the NCC box sums are accumulated in double precision
+  bool m_AccumulateInDouble;
+
+  // Whether the NCC box sums are computed by streaming
+  bool m_StreamNCCBoxSums;
+
+  // Number of threads of the metric filters (0: the ITK global default)
+  int m_NumberOfThreads;
+
+  // Give a filter the number of threads of the helper
+  void SetUpThreads(itk::ProcessObject *filter)
+    { if(m_NumberOfThreads > 0) filter->SetNumberOfThreads(m_NumberOfThreads); }
+
+  // Cache shared with other helpers (not owned), its lock, and the keys of the inputs
+  // in it. The composites keys also cover the noise and scaling used to build them
+  PyramidCacheType *m_PyramidCache;
+  itk::SimpleFastMutexLock *m_PyramidCacheLock;
+  std::string m_FixedCacheKey, m_ImagesCacheKey, m_GradientMaskCacheKey, m_MovingMaskCacheKey;
+  std::string m_FixedCompositeCacheKey, m_CompositeCacheKey;
+
+  // Binned composites for the mutual information metrics, computed on demand
+  typedef std::vector<typename BinnedImageType::Pointer> BinnedImageSet;
+  BinnedImageSet m_FixedBinnedComposite, m_MovingBinnedComposite;
+
+  // Key of an item of the pyramid cache at a pyramid level
+  std::string GetPyramidCacheKey(const std::string &input_key, const std::string &item, int level) const;
+
+  // Look up an item in the pyramid cache, false if there is no cache or no such item
+  template <class TObject>
+  bool FindInPyramidCache(const std::string &key, itk::SmartPointer<TObject> &object) const;
+
+  // Store an item in the pyramid cache (if there is one)
+  void StoreInPyramidCache(const std::string &key, itk::Object *object);
+
+  // Get the binned fixed and moving composites used by the MI metrics
+  void GetBinnedComposites(int level, BinnedImageType *&fixed, BinnedImageType *&moving);
 };
 
 #endif
@@ -1,6 +1,122 @@
 #include "NiftiDataManager.h"
 //#include "CAPTk.h"
 #include "CaPTkEnums.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+  //! Fixed-capacity producer/consumer queue; Push() blocks while full and Pop() blocks while empty
+  template< class TItem >
+  class BoundedQueue
+  {
+  public:
+    explicit BoundedQueue(size_t capacity) : mCapacity(std::max< size_t >(capacity, 1))
+    {
+    }
+
+    //! Returns false if the queue has been closed
+    bool Push(TItem &&item)
+    {
+      std::unique_lock< std::mutex > lock(mMutex);
+      mNotFull.wait(lock, [this] { return mClosed || (mItems.size() < mCapacity); });
+      if (mClosed)
+      {
+        return false;
+      }
+      mItems.push_back(std::move(item));
+      mNotEmpty.notify_one();
+      return true;
+    }
+
+    //! Returns false once the queue has been closed and drained
+    bool Pop(TItem &item)
+    {
+      std::unique_lock< std::mutex > lock(mMutex);
+      mNotEmpty.wait(lock, [this] { return mClosed || !mItems.empty(); });
+      if (mItems.empty())
+      {
+        return false;
+      }
+      item = std::move(mItems.front());
+      mItems.pop_front();
+      mNotFull.notify_one();
+      return true;
+    }
+
+    //! Wakes up both sides; called by the producer when done and by the consumer to abort
+    void Close()
+    {
+      std::lock_guard< std::mutex > lock(mMutex);
+      mClosed = true;
+      mNotFull.notify_all();
+      mNotEmpty.notify_all();
+    }
+
+  private:
+    std::mutex mMutex;
+    std::condition_variable mNotFull, mNotEmpty;
+    std::deque< TItem > mItems;
+    size_t mCapacity;
+    bool mClosed = false;
+  };
+
+  //! Reservoir (algorithm R) over the rows of a contiguous feature matrix
+  class RowReservoir
+  {
+  public:
+    RowReservoir(std::vector< double > &storage, size_t &rows, size_t &seen, size_t capacity, std::mt19937_64 &generator) :
+      mStorage(storage), mRows(rows), mSeen(seen), mCapacity(capacity), mGenerator(generator)
+    {
+    }
+
+    void Allocate(size_t columns)
+    {
+      mColumns = columns;
+      mStorage.assign(mCapacity * mColumns, 0);
+    }
+
+    //! Row to write the next visited sample to, or nullptr if the sample is not kept
+    double *Next()
+    {
+      size_t slot;
+      if ((mCapacity == 0) || (mSeen < mCapacity))
+      {
+        slot = mRows++;
+        if (mStorage.size() < mRows * mColumns)
+        {
+          mStorage.resize(mRows * mColumns); // unbounded reservoir
+        }
+      }
+      else
+      {
+        slot = std::uniform_int_distribution< size_t >(0, mSeen)(mGenerator);
+      }
+      mSeen++;
+      return (slot < mRows) ? &mStorage[slot * mColumns] : nullptr;
+    }
+
+    void Finalize()
+    {
+      mStorage.resize(mRows * mColumns);
+    }
+
+  private:
+    std::vector< double > &mStorage;
+    size_t &mRows;
+    size_t &mSeen;
+    size_t mCapacity;
+    size_t mColumns = 0;
+    std::mt19937_64 &mGenerator;
+  };
+}
 
 NiftiDataManager::NiftiDataManager()
 {
@@ -9,6 +125,163 @@ NiftiDataManager::NiftiDataManager()
 NiftiDataManager::~NiftiDataManager()
 {
 }
+
+bool NiftiDataManager::StreamTrainingSamples(size_t numberOfSubjects, const TrainingSubjectReader &reader,
+  size_t maxNearSamples, size_t maxFarSamples, StreamedTrainingSamples &output,
+  bool useConventionalData, bool useDTIData, bool usePerfData, bool useDistData,
+  unsigned int seed, size_t queueSize)
+{
+  typedef ImageTypeFloat3D ImageType;
+  typedef ImageTypeFloat4D PerfusionImageType;
+  typedef std::pair< size_t, TrainingSubjectImages > QueueItem;
+
+  output = StreamedTrainingSamples();
+  output.otherColumns = (useConventionalData ? 4 : 0) + (useDTIData ? 4 : 0);
+  output.distanceColumns = useDistData ? 1 : 0;
+
+  BoundedQueue< QueueItem > queue(queueSize);
+  std::string readerError;
+  std::thread loader([&]
+  {
+    for (size_t sid = 0; sid < numberOfSubjects; sid++)
+    {
+      QueueItem item;
+      item.first = sid;
+      try
+      {
+        reader(sid, item.second);
+        if (useDistData)
+        {
+          item.second.distanceMap = GetDistanceMap< ImageType >(item.second.labelImage);
+        }
+      }
+      catch (const std::exception &e)
+      {
+        readerError = "Error in reading the images of subject " + std::to_string(sid + 1) + ". Error code : " + std::string(e.what());
+        break;
+      }
+      if (!queue.Push(std::move(item)))
+      {
+        break; // sampling was aborted
+      }
+    }
+    queue.Close();
+  });
+
+  std::mt19937_64 generator(seed);
+  RowReservoir nearReservoir(output.nearSamples, output.nearRows, output.nearSeen, maxNearSamples, generator);
+  RowReservoir farReservoir(output.farSamples, output.farRows, output.farSeen, maxFarSamples, generator);
+  std::string samplingError;
+  bool allocated = false;
+
+  QueueItem item;
+  while (samplingError.empty() && queue.Pop(item))
+  {
+    const size_t sid = item.first;
+    const TrainingSubjectImages &images = item.second;
+    std::cout << "Patient's data loading:" << sid + 1 << std::endl;
+    try
+    {
+      if (!images.nearMask || !images.farMask)
+      {
+        throw std::runtime_error("near and far masks are required");
+      }
+
+      const PerfusionImageType::PixelType *perfusionBuffer = nullptr;
+      itk::OffsetValueType perfusionStride = 0;
+      if (usePerfData)
+      {
+        const size_t timeStamps = images.perfusion->GetLargestPossibleRegion().GetSize()[3];
+        if (output.perfusionColumns == 0)
+        {
+          output.perfusionColumns = timeStamps;
+        }
+        else if (timeStamps != output.perfusionColumns)
+        {
+          throw std::runtime_error("perfusion has " + std::to_string(timeStamps) + " time points, expected " + std::to_string(output.perfusionColumns));
+        }
+        perfusionBuffer = images.perfusion->GetBufferPointer();
+        perfusionStride = images.perfusion->GetOffsetTable()[3];
+      }
+      if (!allocated)
+      {
+        // the number of perfusion time points is only known once the first subject is read
+        nearReservoir.Allocate(output.Columns());
+        farReservoir.Allocate(output.Columns());
+        allocated = true;
+      }
+
+      auto fillRow = [&](double *row, const ImageType::IndexType &index)
+      {
+        if (usePerfData)
+        {
+          PerfusionImageType::IndexType perfVoxelIndex;
+          perfVoxelIndex[0] = index[0];
+          perfVoxelIndex[1] = index[1];
+          perfVoxelIndex[2] = index[2];
+          perfVoxelIndex[3] = 0;
+          const PerfusionImageType::PixelType *perfusionVoxel = perfusionBuffer + images.perfusion->ComputeOffset(perfVoxelIndex);
+          for (size_t j = 0; j < output.perfusionColumns; j++)
+            *row++ = std::round(perfusionVoxel[j * perfusionStride]);
+        }
+        if (useConventionalData)
+        {
+          *row++ = std::round(images.t1->GetPixel(index));
+          *row++ = std::round(images.t1ce->GetPixel(index));
+          *row++ = std::round(images.t2->GetPixel(index));
+          *row++ = std::round(images.t2flair->GetPixel(index));
+        }
+        if (useDTIData)
+        {
+          *row++ = std::round(images.fa->GetPixel(index));
+          *row++ = std::round(images.rad->GetPixel(index));
+          *row++ = std::round(images.tr->GetPixel(index));
+          *row++ = std::round(images.ax->GetPixel(index));
+        }
+        if (useDistData)
+          *row = images.distanceMap->GetPixel(index);
+      };
+
+      typedef itk::ImageRegionConstIteratorWithIndex< ImageType > IteratorType;
+      IteratorType nearIt(images.nearMask, images.nearMask->GetLargestPossibleRegion());
+      for (nearIt.GoToBegin(); !nearIt.IsAtEnd(); ++nearIt)
+      {
+        if (nearIt.Get() != 0)
+        {
+          double *row = nearReservoir.Next();
+          if (row != nullptr)
+            fillRow(row, nearIt.GetIndex());
+        }
+      }
+      IteratorType farIt(images.farMask, images.farMask->GetLargestPossibleRegion());
+      for (farIt.GoToBegin(); !farIt.IsAtEnd(); ++farIt)
+      {
+        if (farIt.Get() != 0)
+        {
+          double *row = farReservoir.Next();
+          if (row != nullptr)
+            fillRow(row, farIt.GetIndex());
+        }
+      }
+    }
+    catch (const std::exception &e)
+    {
+      samplingError = "Error in calculating the features for subject " + std::to_string(sid + 1) + ". Error code : " + std::string(e.what());
+    }
+    item = QueueItem(); // release the subject's images before waiting for the next one
+  }
+  queue.Close();
+  loader.join();
+
+  if (!readerError.empty() || !samplingError.empty())
+  {
+    mLastEncounteredError = !readerError.empty() ? readerError : samplingError;
+    return false;
+  }
+  nearReservoir.Finalize();
+  farReservoir.Finalize();
+  return true;
+}
 ImageTypeFloat3D::Pointer NiftiDataManager::ReadNiftiImage(std::string filename)
 {
   ImageTypeFloat3D::Pointer image;
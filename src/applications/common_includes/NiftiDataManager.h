@@ -5,6 +5,8 @@
 #include "cbicaITKSafeImageIO.h"
 #include "itkSignedMaurerDistanceMapImageFilter.h"
 
+#include <functional>
+
 
 using ImageTypeFloat4D = itk::Image< float, 4 >;
 using VectorVectorDouble = std::vector< std::vector < double > >;
@@ -18,6 +20,66 @@ public:
   //!Destructor
   ~NiftiDataManager();
 
+  //! Images of a single training subject; only the ones needed by the use*Data flags have to be set
+  struct TrainingSubjectImages
+  {
+    ImageTypeFloat3D::Pointer labelImage; // tumor mask used for the distance feature
+    ImageTypeFloat3D::Pointer nearMask;
+    ImageTypeFloat3D::Pointer farMask;
+    ImageTypeFloat3D::Pointer t1ce, t2flair, t1, t2;
+    ImageTypeFloat3D::Pointer ax, fa, rad, tr;
+    ImageTypeFloat4D::Pointer perfusion;
+    ImageTypeFloat3D::Pointer distanceMap; // filled in by the loader
+  };
+
+  //! Reads the images of the subject at the given position in the cohort; runs on the loader thread and may throw
+  using TrainingSubjectReader = std::function< void(size_t, TrainingSubjectImages &) >;
+
+  /**
+  \brief Near and far samples gathered by StreamTrainingSamples()
+
+  Each class is a contiguous row-major matrix with columns [perfusion time points, conventional (T1, T1CE, T2, FLAIR), DTI (FA, RAD, TR, AX), distance],
+  where only the groups enabled for the run are present.
+  */
+  struct StreamedTrainingSamples
+  {
+    std::vector< double > nearSamples, farSamples;
+    size_t nearRows = 0, farRows = 0;
+    size_t nearSeen = 0, farSeen = 0; // total voxels visited per class, before sampling
+    size_t perfusionColumns = 0, otherColumns = 0, distanceColumns = 0;
+
+    size_t Columns() const
+    {
+      return perfusionColumns + otherColumns + distanceColumns;
+    }
+  };
+
+  /**
+  \brief Gathers near/far training samples of a whole cohort with bounded memory
+
+  Subjects are read on a background thread into a bounded queue, so reading the next subject overlaps sampling of the current one
+  and at most queueSize subjects are held in memory at any time. Near and far voxels are sampled as separate strata, each with
+  a reservoir of fixed capacity, so every voxel of the cohort has the same chance of being kept regardless of the subject it came from.
+  \param numberOfSubjects Number of subjects to read
+  \param reader Reads the images of a subject
+  \param maxNearSamples Capacity of the near reservoir; 0 keeps every near voxel
+  \param maxFarSamples Capacity of the far reservoir; 0 keeps every far voxel
+  \param output The sampled feature matrices
+  \param seed Seed for the reservoir sampling
+  \param queueSize Maximum number of subjects waiting in the queue
+  \return False if reading or sampling failed; GetLastEncounteredError() has details
+  */
+  bool StreamTrainingSamples(size_t numberOfSubjects, const TrainingSubjectReader &reader,
+    size_t maxNearSamples, size_t maxFarSamples, StreamedTrainingSamples &output,
+    bool useConventionalData, bool useDTIData, bool usePerfData, bool useDistData,
+    unsigned int seed = 0, size_t queueSize = 2);
+
+  //! Get the last error
+  std::string GetLastEncounteredError() const
+  {
+    return mLastEncounteredError;
+  }
+
   /**
   \brief Loads training data from given input images and a label image
   \param labelImagePointer Segmentated image
@@ -218,6 +280,8 @@ public:
   template<class InputPixelType = float, class OutputPixelType = float, unsigned int VImageDimension = 3>
   typename itk::Image<OutputPixelType, VImageDimension>::Pointer  ReadImageWithDimAndInputPixelType(std::string filename);
 
+private:
+  std::string mLastEncounteredError;
 };
 
 template<class InputPixelType, class OutputPixelType, unsigned int VImageDimension>
@@ -81,6 +81,14 @@ public:
   itkGetMacro(ComponentOffsetFront, int)
   itkGetMacro(ComponentOffsetBack, int)
 
+  /**
+   * Keep the running sums in double precision, even for float images (mixed precision).
+   * The box sums are differences of long running sums, so for float images they lose
+   * precision along long lines. The default is to accumulate in the pixel type.
+   */
+  itkGetMacro(AccumulateInDouble, bool)
+  itkSetMacro(AccumulateInDouble, bool)
+
 protected:
 
   OneDimensionalInPlaceAccumulateFilter();
@@ -101,6 +109,9 @@ protected:
   // Range of included components
   int m_ComponentOffsetFront, m_ComponentOffsetBack;
 
+  // Whether the running sums are kept in double precision
+  bool m_AccumulateInDouble;
+
   // Region splitter
   typename SplitterType::Pointer m_Splitter;
 
@@ -112,7 +123,8 @@ protected:
 template <class TInputImage>
 typename TInputImage::Pointer
 AccumulateNeighborhoodSumsInPlace(TInputImage *image, const typename TInputImage::SizeType &radius,
-                                  int num_ignored_at_start = 0, int num_ignored_at_end = 0);
+                                  int num_ignored_at_start = 0, int num_ignored_at_end = 0,
+                                  bool accumulate_in_double = false);
 
 
 #ifndef ITK_MANUAL_INSTANTIATION
@@ -36,6 +36,7 @@ OneDimensionalInPlaceAccumulateFilter<TInputImage>
   m_Radius = 0;
   m_Dimension = 0;
   m_ComponentOffsetFront = m_ComponentOffsetBack = 0;
+  m_AccumulateInDouble = false;
   m_Splitter = SplitterType::New();
   this->InPlaceOn();
 }
@@ -62,9 +63,9 @@ OneDimensionalInPlaceAccumulateFilter<TInputImage>
 
 /**
  * This worker class is defined to allow partial specialization of the ThreadedGenerateData
- * based on the pixel type (float/double)
+ * based on the pixel type (float/double) and the type of the running sums (TAccum)
  */
-template <class TPixel, class TInputImage>
+template <class TPixel, class TAccum, class TInputImage>
 class OneDimensionalInPlaceAccumulateFilterWorker
 {
 public:
@@ -77,9 +78,9 @@ public:
 };
 
 
-template <class TPixel, class TInputImage>
+template <class TPixel, class TAccum, class TInputImage>
 void
-OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
+OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TAccum, TInputImage>
 ::ThreadedGenerateData(FilterType *filter,
                        const OutputImageRegionType & outputRegionForThread,
                        itk::ThreadIdType threadId)
@@ -128,17 +129,17 @@ OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
 
   // Allocate an array to hold the current running sum
   // OutputImageComponentType *sum = new OutputImageComponentType[nc], *sum_end = sum + nc, *p_sum;
-  TPixel *sum = new TPixel[nc];
+  TAccum *sum = new TAccum[nc];
 
   // Pointers into the sum array for the included components
-  TPixel *sum_start = sum + c_first, *sum_end = sum + c_last + 1;
+  TAccum *sum_start = sum + c_first, *sum_end = sum + c_last + 1;
 
   // Two versions of the code - I thought that maybe the second version (further down) would be
   // more optimized by the compiler, but if anything, I see an opposite effect (although tiny)
 
 #ifdef _ACCUM_ITER_CODE_
 
-  TPixel *p_sum;
+  TAccum *p_sum;
 
   // Start iterating over lines
   for(itLine.GoToBegin(); !itLine.IsAtEnd(); itLine.NextLine())
@@ -147,7 +148,7 @@ OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
 
     // Initialize the sum to zero
     for(p_sum = sum_start; p_sum < sum_end; p_sum++)
-      *p_sum  = itk::NumericTraits<TPixel>::Zero;
+      *p_sum  = itk::NumericTraits<TAccum>::Zero;
 
     // Pointer to the current position in the line
     TPixel *p_line = line + c_first, *p_tail = p_line;
@@ -183,7 +184,7 @@ OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
         {
         *p_line = *p_scan;
         *p_sum += *p_line;
-        *p_write = *p_sum;
+        *p_write = (TPixel) *p_sum;
         }
 
       p_scan_pixel += jump;
@@ -200,7 +201,7 @@ OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
         {
         *p_line = *p_scan;
         *p_sum += *p_line - *p_tail;
-        *p_write = *p_sum;
+        *p_write = (TPixel) *p_sum;
         }
 
       p_scan_pixel += jump;
@@ -217,7 +218,7 @@ OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
           p_sum++, p_write++, p_tail++)
         {
         *p_sum -= *p_tail;
-        *p_write = *p_sum;
+        *p_write = (TPixel) *p_sum;
         }
 
       p_write_pixel += jump;
@@ -235,7 +236,7 @@ OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
 
     // Initialize the sum to zero
     for(int k = c_first; k <= c_last; k++)
-      sum[k] = itk::NumericTraits<TPixel>::Zero;
+      sum[k] = itk::NumericTraits<TAccum>::Zero;
 
     // Pointer to the current position in the line
     TPixel *p_line = line, *p_tail = p_line;
@@ -266,7 +267,7 @@ OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
       {
       for(k = c_first; k <= c_last; k++)
         {
-        p_write_pixel[k] = (sum[k] += p_line[k] = p_scan_pixel[k]);
+        p_write_pixel[k] = (TPixel) (sum[k] += p_line[k] = p_scan_pixel[k]);
         }
 
       p_scan_pixel += jump;
@@ -279,7 +280,7 @@ OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
       {
       for(k = c_first; k <= c_last; k++)
         {
-        p_write_pixel[k] = (sum[k] += (p_line[k] = p_scan_pixel[k]) - p_tail[k]);
+        p_write_pixel[k] = (TPixel) (sum[k] += (p_line[k] = p_scan_pixel[k]) - p_tail[k]);
         }
 
       p_scan_pixel += jump;
@@ -293,7 +294,7 @@ OneDimensionalInPlaceAccumulateFilterWorker<TPixel, TInputImage>
       {
       for(k = c_first; k <= c_last; k++)
         {
-        p_write_pixel[k] = (sum[k] -= p_tail[k]);
+        p_write_pixel[k] = (TPixel) (sum[k] -= p_tail[k]);
         }
 
       p_write_pixel += jump;
@@ -340,7 +341,7 @@ inline void allocate_aligned(int elements, float ** pointer)
  * SSE intrinsics for faster computation
  */
 template <class TInputImage>
-class OneDimensionalInPlaceAccumulateFilterWorker<float, TInputImage>
+class OneDimensionalInPlaceAccumulateFilterWorker<float, float, TInputImage>
 {
 public:
   typedef OneDimensionalInPlaceAccumulateFilter<TInputImage> FilterType;
@@ -353,7 +354,7 @@ public:
 
 template <class TInputImage>
 void
-OneDimensionalInPlaceAccumulateFilterWorker<float, TInputImage>
+OneDimensionalInPlaceAccumulateFilterWorker<float, float, TInputImage>
 ::ThreadedGenerateData(FilterType *filter,
                        const OutputImageRegionType & outputRegionForThread,
                        itk::ThreadIdType threadId)
@@ -554,8 +555,15 @@ OneDimensionalInPlaceAccumulateFilter<TInputImage>
     const OutputImageRegionType & outputRegionForThread,
     itk::ThreadIdType threadId)
 {
-  typedef OneDimensionalInPlaceAccumulateFilterWorker<OutputImageComponentType, InputImageType> WorkerType;
-  WorkerType::ThreadedGenerateData(this, outputRegionForThread, threadId);
+  typedef OneDimensionalInPlaceAccumulateFilterWorker<
+      OutputImageComponentType, OutputImageComponentType, InputImageType> WorkerType;
+  typedef OneDimensionalInPlaceAccumulateFilterWorker<
+      OutputImageComponentType, double, InputImageType> DoubleAccumWorkerType;
+
+  if(m_AccumulateInDouble)
+    DoubleAccumWorkerType::ThreadedGenerateData(this, outputRegionForThread, threadId);
+  else
+    WorkerType::ThreadedGenerateData(this, outputRegionForThread, threadId);
 }
 
 
@@ -564,7 +572,8 @@ OneDimensionalInPlaceAccumulateFilter<TInputImage>
 template <class TInputImage>
 typename TInputImage::Pointer
 AccumulateNeighborhoodSumsInPlace(TInputImage *image, const typename TInputImage::SizeType &radius,
-                                  int num_ignored_at_start, int num_ignored_at_end)
+                                  int num_ignored_at_start, int num_ignored_at_end,
+                                  bool accumulate_in_double)
 {
   typedef OneDimensionalInPlaceAccumulateFilter<TInputImage> AccumFilterType;
 
@@ -576,6 +585,7 @@ AccumulateNeighborhoodSumsInPlace(TInputImage *image, const typename TInputImage
     accum->SetDimension(dir);
     accum->SetRadius(radius[dir]);
     accum->SetComponentRange(num_ignored_at_start, num_ignored_at_end);
+    accum->SetAccumulateInDouble(accumulate_in_double);
     pipeTail = accum;
 
     accum->Update();
@@ -0,0 +1,260 @@
+/**
+\file  PrincipalComponentAnalysis.cpp
+
+\brief Implementation of the PrincipalComponentAnalysis class
+
+https://www.med.upenn.edu/sbia/software/ <br>
+software@cbica.upenn.edu
+
+Copyright (c) 2018 University of Pennsylvania. All rights reserved. <br>
+See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
+
+*/
+
+#include "PrincipalComponentAnalysis.h"
+
+#include <algorithm>
+#include <random>
+
+#include "Eigen/Eigenvalues"
+#include "Eigen/QR"
+#include "Eigen/SVD"
+
+namespace
+{
+  const size_t cStreamBlockSize = 1024; // samples folded into the scatter matrix at once
+}
+
+PrincipalComponentAnalysis::PrincipalComponentAnalysis()
+{
+}
+
+PrincipalComponentAnalysis::~PrincipalComponentAnalysis()
+{
+}
+
+size_t PrincipalComponentAnalysis::ComponentsToKeep(size_t numberOfFeatures) const
+{
+  if ((m_numberOfComponents == 0) || (m_numberOfComponents > numberOfFeatures))
+  {
+    return numberOfFeatures;
+  }
+  return m_numberOfComponents;
+}
+
+PrincipalComponentAnalysis::MatrixType PrincipalComponentAnalysis::ToMatrix(const std::vector< std::vector< double > > &data)
+{
+  MatrixType output;
+  if (data.empty())
+  {
+    return output;
+  }
+  output.resize(data.size(), data[0].size());
+  for (size_t i = 0; i < data.size(); i++)
+  {
+    output.row(i) = Eigen::Map< const Eigen::RowVectorXd >(data[i].data(), data[i].size());
+  }
+  return output;
+}
+
+void PrincipalComponentAnalysis::NormalizeSigns()
+{
+  for (Eigen::Index c = 0; c < m_components.cols(); c++)
+  {
+    Eigen::Index maxIndex;
+    m_components.col(c).cwiseAbs().maxCoeff(&maxIndex);
+    if (m_components(maxIndex, c) < 0)
+    {
+      m_components.col(c) *= -1;
+    }
+  }
+}
+
+void PrincipalComponentAnalysis::SolveCovariance(const MatrixType &covariance)
+{
+  const size_t numberOfFeatures = covariance.rows();
+  const size_t numberToKeep = ComponentsToKeep(numberOfFeatures);
+
+  // eigenvalues come in increasing order
+  Eigen::SelfAdjointEigenSolver< Eigen::MatrixXd > solver(covariance);
+  m_components.resize(numberOfFeatures, numberToKeep);
+  m_explainedVariance.resize(numberToKeep);
+  for (size_t c = 0; c < numberToKeep; c++)
+  {
+    const size_t source = numberOfFeatures - 1 - c;
+    m_components.col(c) = solver.eigenvectors().col(source);
+    m_explainedVariance[c] = std::max(0.0, solver.eigenvalues()[source]);
+  }
+}
+
+bool PrincipalComponentAnalysis::Fit(const MatrixType &data)
+{
+  const size_t numberOfSamples = data.rows();
+  const size_t numberOfFeatures = data.cols();
+  if ((numberOfSamples < 2) || (numberOfFeatures == 0))
+  {
+    m_lastEncounteredError = "PCA needs at least 2 samples and 1 feature";
+    return false;
+  }
+  const size_t numberToKeep = ComponentsToKeep(numberOfFeatures);
+
+  m_mean = data.colwise().mean().transpose();
+  const MatrixType centered = data.rowwise() - m_mean.transpose();
+
+  auto solver = m_solver;
+  if (solver == Auto)
+  {
+    solver = ((numberToKeep * 4 < numberOfFeatures) && (numberOfFeatures > 500)) ? RandomizedSVD : Covariance;
+  }
+
+  switch (solver)
+  {
+  case ThinSVD:
+  {
+    // with fewer samples than features the thin V only has numberOfSamples columns
+    Eigen::BDCSVD< Eigen::MatrixXd > svd(centered, Eigen::ComputeThinV);
+    const size_t available = std::min(numberToKeep, static_cast< size_t >(svd.matrixV().cols()));
+    m_components = svd.matrixV().leftCols(available);
+    m_explainedVariance = svd.singularValues().head(available).array().square() / static_cast< double >(numberOfSamples - 1);
+    break;
+  }
+  case RandomizedSVD:
+  {
+    // range finder on a (features x (k + p)) gaussian test matrix
+    const size_t sketchSize = std::min(numberToKeep + m_oversampling, std::min(numberOfSamples, numberOfFeatures));
+    std::mt19937 generator(m_seed);
+    std::normal_distribution< double > distribution(0.0, 1.0);
+    Eigen::MatrixXd omega(numberOfFeatures, sketchSize);
+    for (Eigen::Index i = 0; i < omega.size(); i++)
+    {
+      omega.data()[i] = distribution(generator);
+    }
+
+    Eigen::MatrixXd sample = centered * omega;
+    Eigen::MatrixXd basis = Eigen::HouseholderQR< Eigen::MatrixXd >(sample).householderQ() * Eigen::MatrixXd::Identity(numberOfSamples, sketchSize);
+    for (size_t iteration = 0; iteration < m_powerIterations; iteration++)
+    {
+      Eigen::MatrixXd projected = centered.transpose() * basis;
+      projected = Eigen::HouseholderQR< Eigen::MatrixXd >(projected).householderQ() * Eigen::MatrixXd::Identity(numberOfFeatures, sketchSize);
+      sample = centered * projected;
+      basis = Eigen::HouseholderQR< Eigen::MatrixXd >(sample).householderQ() * Eigen::MatrixXd::Identity(numberOfSamples, sketchSize);
+    }
+
+    // small SVD of the (k + p) x features matrix
+    const Eigen::MatrixXd reduced = basis.transpose() * centered;
+    Eigen::JacobiSVD< Eigen::MatrixXd > svd(reduced, Eigen::ComputeThinV);
+    const size_t available = std::min(numberToKeep, static_cast< size_t >(svd.singularValues().size()));
+    m_components = svd.matrixV().leftCols(available);
+    m_explainedVariance = svd.singularValues().head(available).array().square() / static_cast< double >(numberOfSamples - 1);
+    break;
+  }
+  default:
+  {
+    Eigen::MatrixXd covariance(numberOfFeatures, numberOfFeatures);
+    covariance.setZero();
+    covariance.selfadjointView< Eigen::Lower >().rankUpdate(centered.transpose());
+    covariance = covariance.selfadjointView< Eigen::Lower >();
+    covariance /= static_cast< double >(numberOfSamples - 1);
+    SolveCovariance(covariance);
+    break;
+  }
+  }
+
+  NormalizeSigns();
+  return true;
+}
+
+bool PrincipalComponentAnalysis::Fit(const std::vector< std::vector< double > > &data)
+{
+  return Fit(ToMatrix(data));
+}
+
+void PrincipalComponentAnalysis::BeginStreamedFit(size_t numberOfFeatures)
+{
+  m_streamedCount = 0;
+  m_streamShift.setZero(numberOfFeatures);
+  m_streamSum.setZero(numberOfFeatures);
+  m_streamScatter.setZero(numberOfFeatures, numberOfFeatures);
+  m_streamBuffer.resize(cStreamBlockSize, numberOfFeatures);
+  m_streamBufferRows = 0;
+}
+
+void PrincipalComponentAnalysis::FlushStreamBuffer()
+{
+  if (m_streamBufferRows == 0)
+  {
+    return;
+  }
+  auto block = m_streamBuffer.topRows(m_streamBufferRows);
+  m_streamSum += block.colwise().sum().transpose();
+  m_streamScatter.selfadjointView< Eigen::Lower >().rankUpdate(block.transpose());
+  m_streamBufferRows = 0;
+}
+
+void PrincipalComponentAnalysis::AddSample(const double *sample)
+{
+  Eigen::Map< const Eigen::RowVectorXd > current(sample, m_streamShift.size());
+  if (m_streamedCount == 0)
+  {
+    m_streamShift = current.transpose();
+  }
+  m_streamBuffer.row(m_streamBufferRows) = current - m_streamShift.transpose();
+  m_streamBufferRows++;
+  m_streamedCount++;
+  if (m_streamBufferRows == static_cast< size_t >(m_streamBuffer.rows()))
+  {
+    FlushStreamBuffer();
+  }
+}
+
+void PrincipalComponentAnalysis::AddSamples(const MatrixType &samples)
+{
+  for (Eigen::Index i = 0; i < samples.rows(); i++)
+  {
+    AddSample(samples.row(i).data());
+  }
+}
+
+bool PrincipalComponentAnalysis::EndStreamedFit()
+{
+  FlushStreamBuffer();
+  if (m_streamedCount < 2)
+  {
+    m_lastEncounteredError = "PCA needs at least 2 samples";
+    return false;
+  }
+  const double count = static_cast< double >(m_streamedCount);
+  const VectorType shiftedMean = m_streamSum / count;
+  m_mean = m_streamShift + shiftedMean;
+
+  MatrixType covariance = m_streamScatter.selfadjointView< Eigen::Lower >();
+  covariance -= count * shiftedMean * shiftedMean.transpose();
+  covariance /= (count - 1);
+  SolveCovariance(covariance);
+  NormalizeSigns();
+
+  m_streamScatter.resize(0, 0);
+  m_streamBuffer.resize(0, 0);
+  return true;
+}
+
+PrincipalComponentAnalysis::MatrixType PrincipalComponentAnalysis::Transform(const MatrixType &data, const MatrixType &components, const VectorType &mean)
+{
+  return (data.rowwise() - mean.transpose()) * components;
+}
+
+PrincipalComponentAnalysis::MatrixType PrincipalComponentAnalysis::Transform(const MatrixType &data) const
+{
+  return Transform(data, m_components, m_mean);
+}
+
+std::vector< std::vector< double > > PrincipalComponentAnalysis::Transform(const std::vector< std::vector< double > > &data) const
+{
+  const MatrixType projected = Transform(ToMatrix(data));
+  std::vector< std::vector< double > > output(projected.rows());
+  for (Eigen::Index i = 0; i < projected.rows(); i++)
+  {
+    output[i].assign(projected.row(i).data(), projected.row(i).data() + projected.cols());
+  }
+  return output;
+}
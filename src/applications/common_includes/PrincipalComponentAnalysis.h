@@ -0,0 +1,173 @@
+/**
+\file  PrincipalComponentAnalysis.h
+
+\brief Declaration of the PrincipalComponentAnalysis class
+
+https://www.med.upenn.edu/sbia/software/ <br>
+software@cbica.upenn.edu
+
+Copyright (c) 2018 University of Pennsylvania. All rights reserved. <br>
+See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
+
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Eigen/Dense"
+
+/**
+\class PrincipalComponentAnalysis
+
+\brief Eigen-based PCA with no limit on the number of features or components
+
+Samples are rows and features are columns. Three solvers are available:
+- Covariance: eigen-decomposition of the (features x features) covariance; best when samples >> features
+- ThinSVD: SVD of the centered data; more accurate when the covariance is ill-conditioned; keeps at most as many components as there are samples
+- RandomizedSVD: Halko-Martinsson-Tropp randomized range finder; for wide data when only a few components are needed
+
+Data that does not fit in memory (e.g., all voxels of a cohort) can be fitted with BeginStreamedFit(),
+AddSample()/AddSamples() and EndStreamedFit(), which accumulate the covariance one block at a time.
+
+Components are stored column-wise (features x components) so that Transform() is (data - mean) * components.
+Each component is sign-normalized so that its largest-magnitude entry is positive, which keeps results reproducible across solvers.
+*/
+class PrincipalComponentAnalysis
+{
+public:
+  using MatrixType = Eigen::Matrix< double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor >;
+  using VectorType = Eigen::VectorXd;
+
+  enum SolverType
+  {
+    Auto, Covariance, ThinSVD, RandomizedSVD
+  };
+
+  //! Constructor
+  PrincipalComponentAnalysis();
+
+  //! Destructor
+  ~PrincipalComponentAnalysis();
+
+  //! Solver to use; Auto picks RandomizedSVD for wide data with few requested components, otherwise Covariance
+  void SetSolver(SolverType solver)
+  {
+    m_solver = solver;
+  }
+
+  //! Number of components to keep; 0 (default) keeps all
+  void SetNumberOfComponents(size_t numberOfComponents)
+  {
+    m_numberOfComponents = numberOfComponents;
+  }
+
+  //! Extra random directions used by the randomized solver (default 10)
+  void SetOversampling(size_t oversampling)
+  {
+    m_oversampling = oversampling;
+  }
+
+  //! Number of power iterations used by the randomized solver (default 2)
+  void SetPowerIterations(size_t powerIterations)
+  {
+    m_powerIterations = powerIterations;
+  }
+
+  //! Seed for the randomized solver
+  void SetRandomSeed(unsigned int seed)
+  {
+    m_seed = seed;
+  }
+
+  /**
+  \brief Fits the model on a samples x features matrix
+  \return False if there is not enough data; GetLastEncounteredError() has details
+  */
+  bool Fit(const MatrixType &data);
+
+  //! Fits the model on a vector of samples
+  bool Fit(const std::vector< std::vector< double > > &data);
+
+  //! Starts a streamed fit over samples of the given size
+  void BeginStreamedFit(size_t numberOfFeatures);
+
+  //! Adds one sample (of numberOfFeatures values) to the streamed fit
+  void AddSample(const double *sample);
+
+  //! Adds a block of samples (rows) to the streamed fit
+  void AddSamples(const MatrixType &samples);
+
+  //! Finishes the streamed fit using the covariance solver
+  bool EndStreamedFit();
+
+  //! Projects data onto the components: (data - mean) * components
+  MatrixType Transform(const MatrixType &data) const;
+
+  //! Projects a vector of samples onto the components
+  std::vector< std::vector< double > > Transform(const std::vector< std::vector< double > > &data) const;
+
+  //! Projects with given parameters; used with models read from disk
+  static MatrixType Transform(const MatrixType &data, const MatrixType &components, const VectorType &mean);
+
+  //! The principal components, column-wise (features x components)
+  const MatrixType &GetComponents() const
+  {
+    return m_components;
+  }
+
+  //! Mean of each feature
+  const VectorType &GetMean() const
+  {
+    return m_mean;
+  }
+
+  //! Variance explained by each component (eigenvalues of the covariance)
+  const VectorType &GetExplainedVariance() const
+  {
+    return m_explainedVariance;
+  }
+
+  //! Get the last error
+  std::string GetLastEncounteredError() const
+  {
+    return m_lastEncounteredError;
+  }
+
+  //! Converts a vector of samples to a samples x features matrix
+  static MatrixType ToMatrix(const std::vector< std::vector< double > > &data);
+
+private:
+  //! Number of components that will be kept for the given number of features
+  size_t ComponentsToKeep(size_t numberOfFeatures) const;
+
+  //! Eigen-decomposition of a covariance matrix, sorted by decreasing eigenvalue
+  void SolveCovariance(const MatrixType &covariance);
+
+  //! Sign-normalizes each component
+  void NormalizeSigns();
+
+  //! Folds the buffered streamed samples into the scatter matrix
+  void FlushStreamBuffer();
+
+  SolverType m_solver = Auto;
+  size_t m_numberOfComponents = 0;
+  size_t m_oversampling = 10;
+  size_t m_powerIterations = 2;
+  unsigned int m_seed = 0;
+
+  MatrixType m_components;
+  VectorType m_mean;
+  VectorType m_explainedVariance;
+
+  // streamed fit state; samples are shifted by the first one for numerical stability
+  size_t m_streamedCount = 0;
+  VectorType m_streamShift;
+  VectorType m_streamSum;
+  Eigen::MatrixXd m_streamScatter;
+  MatrixType m_streamBuffer;
+  size_t m_streamBufferRows = 0;
+
+  std::string m_lastEncounteredError;
+};
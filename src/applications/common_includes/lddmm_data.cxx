@@ -30,9 +30,8 @@
 #include "itkNumericTraitsCovariantVectorPixel.h"
 #include "itkOptVectorLinearInterpolateImageFunction.h"
 #include "itkLinearInterpolateImageFunction.h"
-#include "itkAddImageFilter.h"
-#include "itkSubtractImageFilter.h"
 #include "itkMultiplyImageFilter.h"
+#include "itkBinaryFunctorImageFilter.h"
 #include "itkGradientImageFilter.h"
 #include "itkUnaryFunctorImageFilter.h"
 #include "itkImageFileReader.h"
@@ -52,9 +51,130 @@
 #include "itkComposeImageFilter.h"
 #include "itkMinimumMaximumImageFilter.h"
 #include "itkTernaryFunctorImageFilter.h"
-#include "itkShiftScaleImageFilter.h"
 
 #include "FastWarpCompositeImageFilter.h"
+#include "itkMultiThreader.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace lddmm_data_kernels {
+
+// Below this many values per thread the kernels run on a single thread
+const itk::SizeValueType min_values_per_thread = 0x10000;
+
+template <class TOp>
+struct ParallelForData
+{
+  TOp *op;
+  itk::SizeValueType n;
+};
+
+template <class TOp>
+ITK_THREAD_RETURN_TYPE parallel_for_callback(void *arg)
+{
+  typedef itk::MultiThreader::ThreadInfoStruct ThreadInfo;
+  ThreadInfo *info = static_cast<ThreadInfo *>(arg);
+  ParallelForData<TOp> *data = static_cast<ParallelForData<TOp> *>(info->UserData);
+
+  itk::SizeValueType chunk = (data->n + info->NumberOfThreads - 1) / info->NumberOfThreads;
+  itk::SizeValueType begin = std::min(data->n, chunk * info->ThreadID);
+  itk::SizeValueType end = std::min(data->n, begin + chunk);
+  if(begin < end)
+    (*data->op)(begin, end, info->ThreadID);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+// Number of threads set by LDDMMData::set_thread_count for the calling thread (0: none)
+static thread_local int thread_count = 0;
+
+// Maximum number of threads parallel_for will use (for sizing per-thread results)
+inline unsigned int max_threads()
+{
+  if(thread_count > 0)
+    return (unsigned int) thread_count;
+  return std::max(1u, (unsigned int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads());
+}
+
+// Give an ITK filter the number of threads of the calling thread
+inline void set_up_threads(itk::ProcessObject *filter)
+{
+  if(thread_count > 0)
+    filter->SetNumberOfThreads(thread_count);
+}
+
+// Call op(begin, end, thread) on contiguous chunks of [0, n), one chunk per thread.
+// The chunks are visited in a single pass over the data, nothing is allocated. The
+// grain is the least number of items worth giving a thread (lower for costly items).
+// At most max_thr threads are used, or max_threads() if it is 0
+template <class TOp>
+void parallel_for(itk::SizeValueType n, TOp op, itk::SizeValueType grain = min_values_per_thread,
+                  unsigned int max_thr = 0)
+{
+  itk::SizeValueType n_threads = std::min((itk::SizeValueType) (max_thr ? max_thr : max_threads()), n / grain);
+  if(n_threads <= 1)
+    {
+    op(0, n, 0);
+    return;
+    }
+
+  ParallelForData<TOp> data = { &op, n };
+  itk::MultiThreader::Pointer mt = itk::MultiThreader::New();
+  mt->SetNumberOfThreads(n_threads);
+  mt->SetSingleMethod(parallel_for_callback<TOp>, &data);
+  mt->SingleMethodExecute();
+}
+
+// The buffer of a scalar or vector image as a flat array of scalars
+template <class TFloat, class TImage>
+TFloat *flat(TImage *img)
+{
+  return reinterpret_cast<TFloat *>(img->GetBufferPointer());
+}
+
+template <class TFloat, class TImage>
+const TFloat *flat(const TImage *img)
+{
+  return reinterpret_cast<const TFloat *>(img->GetBufferPointer());
+}
+
+// Number of pixels of an image, checking that the other image has the same buffer size
+template <class TImage1, class TImage2>
+itk::SizeValueType checked_size(const TImage1 *img, const TImage2 *other)
+{
+  itk::SizeValueType n = img->GetBufferedRegion().GetNumberOfPixels();
+  if(other->GetBufferedRegion().GetNumberOfPixels() != n)
+    itkGenericExceptionMacro(<< "Image buffer sizes do not match: " << n << " and "
+                             << other->GetBufferedRegion().GetNumberOfPixels());
+  return n;
+}
+
+} // namespace lddmm_data_kernels
+
+template <class TFloat, uint VDim>
+void
+LDDMMData<TFloat, VDim>
+::set_thread_count(int n)
+{
+  lddmm_data_kernels::thread_count = std::max(0, n);
+}
+
+template <class TFloat, uint VDim>
+int
+LDDMMData<TFloat, VDim>
+::get_thread_count()
+{
+  return lddmm_data_kernels::thread_count;
+}
+
+template <class TFloat, uint VDim>
+void
+LDDMMData<TFloat, VDim>
+::set_up_threads(itk::ProcessObject *filter)
+{
+  lddmm_data_kernels::set_up_threads(filter);
+}
 
 template <class TFloat, uint VDim>
 void 
@@ -232,6 +352,7 @@ LDDMMData<TFloat, VDim>
 {
   typedef FastWarpCompositeImageFilter<VectorImageType, VectorImageType, VectorImageType> WF;
   typename WF::Pointer wf = WF::New();
+  lddmm_data_kernels::set_up_threads(wf);
   wf->SetDeformationField(field);
   wf->SetMovingImage(data);
   wf->GraftOutput(out);
@@ -330,6 +451,7 @@ LDDMMData<TFloat, VDim>
 {
   typedef FastWarpCompositeImageFilter<ImageType, ImageType, VectorImageType> WF;
   typename WF::Pointer wf = WF::New();
+  lddmm_data_kernels::set_up_threads(wf);
   wf->SetDeformationField(field);
   wf->SetMovingImage(data);
   wf->GraftOutput(out);
@@ -343,6 +465,7 @@ LDDMMData<TFloat, VDim>
   typedef itk::SimpleWarpImageFilter<
     ImageType, ImageType, VectorImageType, TFloat> WarpFilterType;
   typename WarpFilterType::Pointer flt = WarpFilterType::New();
+  lddmm_data_kernels::set_up_threads(flt);
 
   // Create an interpolation function
   typedef itk::LinearInterpolateImageFunction<ImageType, TFloat> InterpType;
@@ -374,6 +497,7 @@ LDDMMData<TFloat, VDim>
 {
   typedef FastWarpCompositeImageFilter<CompositeImageType, CompositeImageType, VectorImageType> WF;
   typename WF::Pointer wf = WF::New();
+  lddmm_data_kernels::set_up_threads(wf);
   wf->SetDeformationField(field);
   wf->SetMovingImage(data);
   wf->GraftOutput(out);
@@ -383,17 +507,22 @@ LDDMMData<TFloat, VDim>
   wf->Update();
 }
 
+// The arithmetic below runs on the raw buffers (see lddmm_data_kernels), in one
+// multi-threaded pass and without allocating, since the deformable loop of greedy
+// chains several of these operations per iteration. The target can be one of the inputs.
 template <class TFloat, uint VDim>
 void 
 LDDMMData<TFloat, VDim>
 ::vimg_add_in_place(VectorImageType *trg, VectorImageType *a)
 {
-  typedef itk::AddImageFilter<VectorImageType> AddFilter;
-  typename AddFilter::Pointer flt = AddFilter::New();
-  flt->SetInput(0,trg);
-  flt->SetInput(1,a);
-  flt->GraftOutput(trg);
-  flt->Update();
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(trg, a) * VDim;
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg);
+  const TFloat *p_a = lddmm_data_kernels::flat<TFloat>(a);
+  lddmm_data_kernels::parallel_for(n, [p_trg, p_a](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_trg[i] += p_a[i];
+    });
 }
 
 template <class TFloat, uint VDim>
@@ -401,12 +530,14 @@ void
 LDDMMData<TFloat, VDim>
 ::vimg_subtract_in_place(VectorImageType *trg, VectorImageType *a)
 {
-  typedef itk::SubtractImageFilter<VectorImageType> SubtractFilter;
-  typename SubtractFilter::Pointer flt = SubtractFilter::New();
-  flt->SetInput(0,trg);
-  flt->SetInput(1,a);
-  flt->GraftOutput(trg);
-  flt->Update();
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(trg, a) * VDim;
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg);
+  const TFloat *p_a = lddmm_data_kernels::flat<TFloat>(a);
+  lddmm_data_kernels::parallel_for(n, [p_trg, p_a](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_trg[i] -= p_a[i];
+    });
 }
 
 // Scalar math
@@ -415,13 +546,15 @@ void
 LDDMMData<TFloat, VDim>
 ::vimg_multiply_in_place(VectorImageType *trg, ImageType *s)
 {
-  typedef itk::MultiplyImageFilter<
-    VectorImageType, ImageType, VectorImageType> MultiplyFilter;
-  typename MultiplyFilter::Pointer flt = MultiplyFilter::New();
-  flt->SetInput1(trg);
-  flt->SetInput2(s);
-  flt->GraftOutput(trg);
-  flt->Update();
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(trg, s);
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg);
+  const TFloat *p_s = lddmm_data_kernels::flat<TFloat>(s);
+  lddmm_data_kernels::parallel_for(n, [p_trg, p_s](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      for(uint d = 0; d < VDim; d++)
+        p_trg[i * VDim + d] *= p_s[i];
+    });
 }
 
 template <class TFloat, uint VDim>
@@ -429,12 +562,13 @@ void
 LDDMMData<TFloat, VDim>
 ::img_scale_in_place(ImageType *img, TFloat scale)
 {
-  typedef itk::ShiftScaleImageFilter<ImageType, ImageType> FilterType;
-  typename FilterType::Pointer filter = FilterType::New();
-  filter->SetScale(scale);
-  filter->SetInput(img);
-  filter->GraftOutput(img);
-  filter->Update();
+  itk::SizeValueType n = img->GetBufferedRegion().GetNumberOfPixels();
+  TFloat *p_img = lddmm_data_kernels::flat<TFloat>(img);
+  lddmm_data_kernels::parallel_for(n, [p_img, scale](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_img[i] *= scale;
+    });
 }
 
 
@@ -446,6 +580,7 @@ LDDMMData<TFloat, VDim>
   typedef itk::MultiplyImageFilter<
     MatrixImageType, MatrixImageType, MatrixImageType> MultiplyFilter;
   typename MultiplyFilter::Pointer flt = MultiplyFilter::New();
+  lddmm_data_kernels::set_up_threads(flt);
   flt->SetInput1(trg);
   flt->SetInput2(s);
   flt->GraftOutput(trg);
@@ -459,12 +594,14 @@ void
 LDDMMData<TFloat, VDim>
 ::img_add_in_place(ImagePointer &trg, ImageType *a)
 {
-  typedef itk::AddImageFilter<ImageType> AddFilter;
-  typename AddFilter::Pointer flt = AddFilter::New();
-  flt->SetInput(0,trg);
-  flt->SetInput(1,a);
-  flt->GraftOutput(trg);
-  flt->Update();
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(trg.GetPointer(), a);
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg.GetPointer());
+  const TFloat *p_a = lddmm_data_kernels::flat<TFloat>(a);
+  lddmm_data_kernels::parallel_for(n, [p_trg, p_a](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_trg[i] += p_a[i];
+    });
 }
 
 template <class TFloat, uint VDim>
@@ -472,12 +609,14 @@ void
 LDDMMData<TFloat, VDim>
 ::img_subtract_in_place(ImagePointer &trg, ImageType *a)
 {
-  typedef itk::SubtractImageFilter<ImageType> SubtractFilter;
-  typename SubtractFilter::Pointer flt = SubtractFilter::New();
-  flt->SetInput(0,trg);
-  flt->SetInput(1,a);
-  flt->GraftOutput(trg);
-  flt->Update();
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(trg.GetPointer(), a);
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg.GetPointer());
+  const TFloat *p_a = lddmm_data_kernels::flat<TFloat>(a);
+  lddmm_data_kernels::parallel_for(n, [p_trg, p_a](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_trg[i] -= p_a[i];
+    });
 }
 
 template <class TFloat, uint VDim>
@@ -485,12 +624,14 @@ void
 LDDMMData<TFloat, VDim>
 ::img_multiply_in_place(ImagePointer &trg, ImageType *a)
 {
-  typedef itk::MultiplyImageFilter<ImageType> MultiplyFilter;
-  typename MultiplyFilter::Pointer flt = MultiplyFilter::New();
-  flt->SetInput(0,trg);
-  flt->SetInput(1,a);
-  flt->GraftOutput(trg);
-  flt->Update();
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(trg.GetPointer(), a);
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg.GetPointer());
+  const TFloat *p_a = lddmm_data_kernels::flat<TFloat>(a);
+  lddmm_data_kernels::parallel_for(n, [p_trg, p_a](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_trg[i] *= p_a[i];
+    });
 }
 
 template <class TFloat, uint VDim>
@@ -554,6 +695,7 @@ LDDMMData<TFloat, VDim>
   typedef LinearToConstRectifierFunctor<TFloat, VDim> Functor;
   typedef itk::UnaryFunctorImageFilter<ImageType, ImageType, Functor> Filter;
   typename Filter::Pointer flt = Filter::New();
+  lddmm_data_kernels::set_up_threads(flt);
 
   Functor func(thresh);
   flt->SetFunctor(func);
@@ -592,6 +734,7 @@ LDDMMData<TFloat, VDim>
   typedef LinearToConstRectifierDerivFunctor<TFloat, VDim> Functor;
   typedef itk::UnaryFunctorImageFilter<ImageType, ImageType, Functor> Filter;
   typename Filter::Pointer flt = Filter::New();
+  lddmm_data_kernels::set_up_threads(flt);
 
   Functor func(thresh);
   flt->SetFunctor(func);
@@ -621,6 +764,7 @@ LDDMMData<TFloat, VDim>
   // Add all voxels in the image
   typedef itk::MinimumMaximumImageFilter<ImageType> FilterType;
   typename FilterType::Pointer filter = FilterType::New();
+  lddmm_data_kernels::set_up_threads(filter);
   filter->SetInput(src);
   filter->Update();
   out_min = filter->GetMinimum();
@@ -628,41 +772,18 @@ LDDMMData<TFloat, VDim>
 }
 
 
-template <class TFloat, uint VDim>
-class VectorScaleFunctor
-{
-public:
-  VectorScaleFunctor() { this->Scale = 1.0; }
-  typedef itk::CovariantVector<TFloat,VDim> Vec;
-
-  Vec operator() (const Vec &x)
-    { return x * Scale; }
-
-  bool operator== (const VectorScaleFunctor<TFloat, VDim> &other)
-    { return Scale == other.Scale; }
-
-  bool operator!= (const VectorScaleFunctor<TFloat, VDim> &other)
-    { return Scale != other.Scale; }
-
-  TFloat Scale;
-};
-
 template <class TFloat, uint VDim>
 void 
 LDDMMData<TFloat, VDim>
 ::vimg_scale_in_place(VectorImageType *trg, TFloat s)
 {
-  typedef VectorScaleFunctor<TFloat, VDim> Functor;
-  typedef itk::UnaryFunctorImageFilter<
-    VectorImageType, VectorImageType, Functor> Filter;
-  typename Filter::Pointer flt = Filter::New();
-
-  Functor func;
-  func.Scale = s;
-  flt->SetFunctor(func);
-  flt->SetInput(trg);
-  flt->GraftOutput(trg);
-  flt->Update();
+  itk::SizeValueType n = trg->GetBufferedRegion().GetNumberOfPixels() * VDim;
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg);
+  lddmm_data_kernels::parallel_for(n, [p_trg, s](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_trg[i] *= s;
+    });
 }
 
 template <class TFloat, uint VDim>
@@ -670,55 +791,58 @@ void
 LDDMMData<TFloat, VDim>
 ::vimg_scale(const VectorImageType*src, TFloat s, VectorImageType *trg)
 {
-  typedef VectorScaleFunctor<TFloat, VDim> Functor;
-  typedef itk::UnaryFunctorImageFilter<
-    VectorImageType, VectorImageType, Functor> Filter;
-  typename Filter::Pointer flt = Filter::New();
-
-  Functor func;
-  func.Scale = s;
-  flt->SetFunctor(func);
-  flt->SetInput(src);
-  flt->GraftOutput(trg);
-  flt->Update();
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(trg, src) * VDim;
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg);
+  const TFloat *p_src = lddmm_data_kernels::flat<TFloat>(src);
+  lddmm_data_kernels::parallel_for(n, [p_trg, p_src, s](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_trg[i] = p_src[i] * s;
+    });
 }
 
 template <class TFloat, uint VDim>
-class VectorScaleAddFunctor
+void 
+LDDMMData<TFloat, VDim>
+::vimg_add_scaled_in_place(VectorImageType *trg, VectorImageType *a, TFloat s)
 {
-public:
-  VectorScaleAddFunctor() { this->Scale = 1.0; }
-  typedef itk::CovariantVector<TFloat,VDim> Vec;
-
-  Vec operator() (const Vec &x, const Vec &y)
-    { return x + y * Scale; }
-
-  bool operator== (const VectorScaleAddFunctor<TFloat, VDim> &other)
-    { return Scale == other.Scale; }
-
-  bool operator!= (const VectorScaleAddFunctor<TFloat, VDim> &other)
-    { return Scale != other.Scale; }
-
-  TFloat Scale;
-};
+  vimg_add_scaled(trg, a, s, trg);
+}
 
 template <class TFloat, uint VDim>
 void 
 LDDMMData<TFloat, VDim>
-::vimg_add_scaled_in_place(VectorImageType *trg, VectorImageType *a, TFloat s)
+::vimg_add_scaled(const VectorImageType *a, const VectorImageType *b, TFloat s, VectorImageType *trg)
 {
-  typedef VectorScaleAddFunctor<TFloat, VDim> Functor;
-  typedef itk::BinaryFunctorImageFilter<
-    VectorImageType, VectorImageType, VectorImageType, Functor> Filter;
-  typename Filter::Pointer flt = Filter::New();
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(trg, a) * VDim;
+  lddmm_data_kernels::checked_size(trg, b);
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg);
+  const TFloat *p_a = lddmm_data_kernels::flat<TFloat>(a);
+  const TFloat *p_b = lddmm_data_kernels::flat<TFloat>(b);
+  lddmm_data_kernels::parallel_for(n, [p_trg, p_a, p_b, s](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_trg[i] = p_a[i] + s * p_b[i];
+    });
+}
 
-  Functor func;
-  func.Scale = s;
-  flt->SetFunctor(func);
-  flt->SetInput1(trg);
-  flt->SetInput2(a);
-  flt->GraftOutput(trg);
-  flt->Update();
+template <class TFloat, uint VDim>
+void 
+LDDMMData<TFloat, VDim>
+::vimg_linear_combination_in_place(VectorImageType *trg, TFloat s_trg,
+                                   const VectorImageType *a, TFloat s_a,
+                                   const VectorImageType *b, TFloat s_b)
+{
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(trg, a) * VDim;
+  lddmm_data_kernels::checked_size(trg, b);
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg);
+  const TFloat *p_a = lddmm_data_kernels::flat<TFloat>(a);
+  const TFloat *p_b = lddmm_data_kernels::flat<TFloat>(b);
+  lddmm_data_kernels::parallel_for(n, [=](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+    {
+    for(itk::SizeValueType i = begin; i < end; i++)
+      p_trg[i] = s_trg * p_trg[i] + s_a * p_a[i] + s_b * p_b[i];
+    });
 }
 
 template <class TFloat, uint VDim>
@@ -752,6 +876,7 @@ LDDMMData<TFloat, VDim>
   typedef itk::BinaryFunctorImageFilter<
     VectorImageType, VectorImageType, ImageType, Functor> Filter;
   typename Filter::Pointer flt = Filter::New();
+  lddmm_data_kernels::set_up_threads(flt);
 
   Functor func;
   flt->SetFunctor(func);
@@ -853,12 +978,14 @@ LDDMMData<TFloat, VDim>
     // Extract the a'th component of the displacement field
     typedef itk::VectorIndexSelectionCastImageFilter<VectorImageType, ImageType> CompFilterType;
     typename CompFilterType::Pointer comp = CompFilterType::New();
+    lddmm_data_kernels::set_up_threads(comp);
     comp->SetIndex(a);
     comp->SetInput(vec);
 
     // Compute the gradient of this component
     typedef itk::GradientImageFilter<ImageType, TFloat, TFloat> GradientFilter;
     typename GradientFilter::Pointer grad = GradientFilter::New();
+    lddmm_data_kernels::set_up_threads(grad);
     grad->SetInput(comp->GetOutput());
     grad->SetUseImageSpacingOff();
     grad->SetUseImageDirection(false);
@@ -870,6 +997,7 @@ LDDMMData<TFloat, VDim>
     typedef itk::BinaryFunctorImageFilter<
       MatrixImageType, VectorImageType, MatrixImageType, RowOperatorType> RowFilterType;
     typename RowFilterType::Pointer rof = RowFilterType::New();
+    lddmm_data_kernels::set_up_threads(rof);
     rof->SetInput1(out);
     rof->SetInput2(grad->GetOutput());
     rof->SetFunctor(rop);
@@ -907,6 +1035,7 @@ LDDMMData<TFloat, VDim>
   typedef JacobianCompisitionFunctor<TFloat, VDim> Functor;
   typedef itk::BinaryFunctorImageFilter<MatrixImageType,MatrixImageType,MatrixImageType,Functor> BinaryFilter;
   typename BinaryFilter::Pointer flt = BinaryFilter::New();
+  lddmm_data_kernels::set_up_threads(flt);
   flt->SetInput1(out_Dw);
   flt->SetInput2(Dv);
   flt->GraftOutput(out_Dw);
@@ -953,6 +1082,7 @@ LDDMMData<TFloat, VDim>
   functor.SetLambda(lambda);
   typedef itk::UnaryFunctorImageFilter<MatrixImageType, ImageType, FunctorType> FilterType;
   typename FilterType::Pointer filter = FilterType::New();
+  lddmm_data_kernels::set_up_threads(filter);
   filter->SetInput(M);
   filter->SetFunctor(functor);
   filter->GraftOutput(out_det);
@@ -1007,6 +1137,7 @@ LDDMMData<TFloat, VDim>
     Functor> FilterType;
 
   typename FilterType::Pointer filter = FilterType::New();
+  lddmm_data_kernels::set_up_threads(filter);
   filter->SetInput1(A);
   filter->SetInput2(x);
   filter->SetInput3(b);
@@ -1039,6 +1170,7 @@ LDDMMData<TFloat, VDim>
   
   typedef LieBracketFilter<VectorImageType, VectorImageType> LieBracketFilterType;
   typename LieBracketFilterType::Pointer fltLieBracket = LieBracketFilterType::New();
+  lddmm_data_kernels::set_up_threads(fltLieBracket);
   fltLieBracket->SetFieldU(v);
   fltLieBracket->SetFieldV(u);
   fltLieBracket->GraftOutput(alt);
@@ -1060,6 +1192,7 @@ LDDMMData<TFloat, VDim>
   typedef itk::DisplacementFieldJacobianDeterminantFilter<
     VectorImageType, TFloat, ImageType> Filter;
   typename Filter::Pointer filter = Filter::New();
+  lddmm_data_kernels::set_up_threads(filter);
   filter->SetInput(vec);
   filter->SetUseImageSpacingOff();
   filter->GraftOutput(out);
@@ -1074,6 +1207,7 @@ LDDMMData<TFloat, VDim>
   // Create a gradient image filter
   typedef itk::GradientImageFilter<ImageType, TFloat, TFloat> Filter;
   typename Filter::Pointer flt = Filter::New();
+  lddmm_data_kernels::set_up_threads(flt);
   flt->SetInput(src);
   flt->GraftOutput(grad);
   flt->SetUseImageSpacingOff();
@@ -1089,6 +1223,7 @@ LDDMMData<TFloat, VDim>
   // typedef itk::SmoothingRecursiveGaussianImageFilter<ImageType, ImageType> Filter;
   typedef itk::DiscreteGaussianImageFilter<ImageType, ImageType> Filter;
   typename Filter::Pointer flt = Filter::New();
+  lddmm_data_kernels::set_up_threads(flt);
   flt->SetInput(src);
   // flt->SetSigma(sigma);
   flt->SetVariance(sigma * sigma);
@@ -1112,6 +1247,7 @@ LDDMMData<TFloat, VDim>
 {
   typedef itk::SmoothingRecursiveGaussianImageFilter<VectorImageType, VectorImageType> Filter;
   typename Filter::Pointer fltSmooth = Filter::New();
+  lddmm_data_kernels::set_up_threads(fltSmooth);
   fltSmooth->SetInput(src);
   fltSmooth->SetSigmaArray(sigma);
   // fltSmooth->SetSigma(sigma);
@@ -1128,15 +1264,22 @@ void
 LDDMMData<TFloat, VDim>
 ::vimg_smooth_withborder(VectorImageType *src, VectorImageType *trg, Vec sigma, int border_size)
 {
-
-  // Define a region of interest
-  RegionType region = src->GetBufferedRegion();
-  region.ShrinkByRadius(border_size);
-
   // Perform smoothing
   vimg_smooth(src, trg, sigma);
 
   // Clear the border
+  vimg_clear_border(trg, border_size);
+}
+
+template <class TFloat, uint VDim>
+void
+LDDMMData<TFloat, VDim>
+::vimg_clear_border(VectorImageType *trg, int border_size)
+{
+  // Define a region of interest
+  RegionType region = trg->GetBufferedRegion();
+  region.ShrinkByRadius(border_size);
+
   Vec zerovec; zerovec.Fill(0);
   typedef itk::ImageRegionIteratorWithIndex<VectorImageType> VIterator;
   for(VIterator it(trg, trg->GetBufferedRegion()); !it.IsAtEnd(); ++it)
@@ -1149,37 +1292,38 @@ LDDMMData<TFloat, VDim>
 }
 
 
-template <class TFloat, unsigned int VDim>
-struct VectorSquareNormFunctor
-{
-  template <class TVector> TFloat operator() (const TVector &v)
-  {
-    TFloat norm_sqr = 0.0;
-    for(uint i = 0; i < VDim; i++)
-      norm_sqr += v[i] * v[i];
-    return norm_sqr;
-  }
-};
-
 template <class TFloat, uint VDim>
 void
 LDDMMData<TFloat, VDim>
 ::vimg_norm_min_max(VectorImageType *image, ImageType *normsqr,
                     TFloat &min_norm, TFloat &max_norm)
 {
-  // Compute the squared norm of the displacement
-  typedef VectorSquareNormFunctor<TFloat, VDim> NormFunctor;
-  typedef itk::UnaryFunctorImageFilter<VectorImageType, ImageType, NormFunctor> NormFilter;
-  typename NormFilter::Pointer fltNorm = NormFilter::New();
-  fltNorm->SetInput(image);
-  fltNorm->GraftOutput(normsqr);
-  fltNorm->Update();
+  // Compute the squared norm of the displacement and its range in one pass
+  itk::SizeValueType n = lddmm_data_kernels::checked_size(image, normsqr);
+  const TFloat *p_img = lddmm_data_kernels::flat<TFloat>(image);
+  TFloat *p_nsq = lddmm_data_kernels::flat<TFloat>(normsqr);
 
-  // Compute the maximum squared norm of the displacement
-  img_min_max(normsqr, min_norm, max_norm);
+  unsigned int n_threads = lddmm_data_kernels::max_threads();
+  std::vector<TFloat> t_min(n_threads, itk::NumericTraits<TFloat>::max());
+  std::vector<TFloat> t_max(n_threads, itk::NumericTraits<TFloat>::NonpositiveMin());
+  lddmm_data_kernels::parallel_for(n, [&](itk::SizeValueType begin, itk::SizeValueType end, unsigned int thread)
+    {
+    TFloat nsq_min = t_min[thread], nsq_max = t_max[thread];
+    for(itk::SizeValueType i = begin; i < end; i++)
+      {
+      TFloat nsq = 0.0;
+      for(uint d = 0; d < VDim; d++)
+        nsq += p_img[i * VDim + d] * p_img[i * VDim + d];
+      p_nsq[i] = nsq;
+      nsq_min = std::min(nsq_min, nsq);
+      nsq_max = std::max(nsq_max, nsq);
+      }
+    t_min[thread] = nsq_min;
+    t_max[thread] = nsq_max;
+    });
 
-  min_norm = sqrt(min_norm);
-  max_norm = sqrt(max_norm);
+  min_norm = sqrt(*std::min_element(t_min.begin(), t_min.end()));
+  max_norm = sqrt(*std::max_element(t_max.begin(), t_max.end()));
 }
 
 template <class TFloat, uint VDim>
@@ -1188,20 +1332,12 @@ LDDMMData<TFloat, VDim>
 ::vimg_normalize_to_fixed_max_length(VectorImageType *trg, ImageType *normsqr,
                                      double max_displacement, bool scale_down_only)
 {
-  // Compute the squared norm of the displacement
-  typedef VectorSquareNormFunctor<TFloat, VDim> NormFunctor;
-  typedef itk::UnaryFunctorImageFilter<VectorImageType, ImageType, NormFunctor> NormFilter;
-  typename NormFilter::Pointer fltNorm = NormFilter::New();
-  fltNorm->SetInput(trg);
-  fltNorm->GraftOutput(normsqr);
-  fltNorm->Update();
-
-  // Compute the maximum squared norm of the displacement
-  TFloat nsq_min, nsq_max;
-  img_min_max(normsqr, nsq_min, nsq_max);
+  // Compute the squared norm of the displacement and its maximum
+  TFloat norm_min, norm_max;
+  vimg_norm_min_max(trg, normsqr, norm_min, norm_max);
 
   // Compute the scale functor
-  TFloat scale = max_displacement / sqrt(nsq_max);
+  TFloat scale = max_displacement / norm_max;
 
   // Apply the scale
   if(scale_down_only && scale >= 1.0)
@@ -1438,6 +1574,7 @@ LDDMMData<TFloat, VDim>
 {
   typedef itk::CastImageFilter<VectorImageType, VectorImageType> CastFilter;
   typename CastFilter::Pointer fltCast = CastFilter::New();
+  lddmm_data_kernels::set_up_threads(fltCast);
   fltCast->SetInput(src);
   fltCast->GraftOutput(trg);
   fltCast->Update();
@@ -1450,6 +1587,7 @@ LDDMMData<TFloat, VDim>
 {
   typedef itk::CastImageFilter<ImageType, ImageType> CastFilter;
   typename CastFilter::Pointer fltCast = CastFilter::New();
+  lddmm_data_kernels::set_up_threads(fltCast);
   fltCast->SetInput(src);
   fltCast->GraftOutput(trg);
   fltCast->Update();
@@ -1462,6 +1600,7 @@ LDDMMData<TFloat, VDim>
 {
   typedef itk::CastImageFilter<MatrixImageType, MatrixImageType> CastFilter;
   typename CastFilter::Pointer fltCast = CastFilter::New();
+  lddmm_data_kernels::set_up_threads(fltCast);
   fltCast->SetInput(src);
   fltCast->GraftOutput(trg);
   fltCast->Update();
@@ -1473,6 +1612,7 @@ LDDMMData<TFloat, VDim>
 {
   typedef itk::ShrinkImageFilter<ImageType, ImageType> Filter;
   typename Filter::Pointer filter = Filter::New();
+  lddmm_data_kernels::set_up_threads(filter);
   filter->SetInput(src);
   filter->SetShrinkFactors(factor);
   filter->GraftOutput(trg);
@@ -1489,6 +1629,7 @@ LDDMMData<TFloat, VDim>
   typedef itk::LinearInterpolateImageFunction<ImageType, TFloat> InterpType;
 
   typename ResampleFilter::Pointer filter = ResampleFilter::New();
+  lddmm_data_kernels::set_up_threads(filter);
   typename TranType::Pointer tran = TranType::New();
   typename InterpType::Pointer func = InterpType::New();
 
@@ -1519,6 +1660,7 @@ LDDMMData<TFloat, VDim>
   // Begin by smoothing the image
   typedef itk::SmoothingRecursiveGaussianImageFilter<ImageType, ImageType> SmoothType;
   typename SmoothType::Pointer fltSmooth = SmoothType::New();
+  lddmm_data_kernels::set_up_threads(fltSmooth);
   fltSmooth->SetInput(src);
   fltSmooth->SetSigmaArray(0.5 * factor * src->GetSpacing());
 
@@ -1528,6 +1670,7 @@ LDDMMData<TFloat, VDim>
   typedef itk::LinearInterpolateImageFunction<ImageType, TFloat> InterpType;
 
   typename ResampleFilter::Pointer filter = ResampleFilter::New();
+  lddmm_data_kernels::set_up_threads(filter);
   typename TranType::Pointer tran = TranType::New();
   typename InterpType::Pointer func = InterpType::New();
 
@@ -1581,6 +1724,7 @@ LDDMMData<TFloat, VDim>
   typedef itk::OptVectorLinearInterpolateImageFunction<VectorImageType, TFloat> InterpType;
 
   typename ResampleFilter::Pointer filter = ResampleFilter::New();
+  lddmm_data_kernels::set_up_threads(filter);
   typename TranType::Pointer tran = TranType::New();
   typename InterpType::Pointer func = InterpType::New();
 
@@ -1612,6 +1756,7 @@ LDDMMData<TFloat, VDim>
 {
   typedef itk::BinaryThresholdImageFilter<ImageType, ImageType> FilterType;
   typename FilterType::Pointer filter = FilterType::New();
+  lddmm_data_kernels::set_up_threads(filter);
   filter->SetInput(src);
   filter->GraftOutput(src);
   filter->SetLowerThreshold(lt);
@@ -1671,6 +1816,7 @@ LDDMMData<TFloat, VDim>
   // Set up filter
   typedef itk::UnaryFunctorImageFilter<VectorImageType, VectorImageType, FunctorType> FilterType;
   typename FilterType::Pointer filter = FilterType::New();
+  lddmm_data_kernels::set_up_threads(filter);
   filter->SetInput(src);
   filter->GraftOutput(trg);
   filter->SetFunctor(fnk);
@@ -1820,6 +1966,302 @@ LDDMMFFTInterface<TFloat, VDim>
 #endif // _LDDMM_FFT_
 
 
+/* =============================== */
+
+template <class TFloat, uint VDim>
+int
+LDDMMFFTRegularizer<TFloat, VDim>
+::padded_length(int n, int pad)
+{
+  for(int len = n + 2 * pad; ; len++)
+    {
+    int m = len;
+    while(m % 2 == 0) m /= 2;
+    while(m % 3 == 0) m /= 3;
+    while(m % 5 == 0) m /= 5;
+    if(m == 1)
+      return len;
+    }
+}
+
+template <class TFloat, uint VDim>
+typename LDDMMFFTRegularizer<TFloat, VDim>::FFTType * const *
+LDDMMFFTRegularizer<TFloat, VDim>
+::get_fft(int n)
+{
+  // The vnl FFT is not documented as thread-safe, so each thread gets its own
+  std::vector<FFTType *> &fft = m_FFT[n];
+  while(fft.size() < this->threads())
+    fft.push_back(new FFTType(n));
+  return &fft[0];
+}
+
+template <class TFloat, uint VDim>
+unsigned int
+LDDMMFFTRegularizer<TFloat, VDim>
+::threads() const
+{
+  return m_NumberOfThreads > 0 ? (unsigned int) m_NumberOfThreads : lddmm_data_kernels::max_threads();
+}
+
+template <class TFloat, uint VDim>
+const typename LDDMMFFTRegularizer<TFloat, VDim>::Spectrum &
+LDDMMFFTRegularizer<TFloat, VDim>
+::gaussian_spectrum(int len, double sigma)
+{
+  std::vector<double> key(3);
+  key[0] = 0; key[1] = len; key[2] = sigma;
+
+  Spectrum &spec = m_Spectra[key];
+  if(spec.size() == 0)
+    {
+    // Fourier transform of the Gaussian, sampled at the DFT frequencies
+    spec.resize(len);
+    for(int i = 0; i < len; i++)
+      {
+      double f = std::min(i, len - i) * 1.0 / len;
+      spec[i] = exp(-2.0 * vnl_math::pi * vnl_math::pi * sigma * sigma * f * f) / len;
+      }
+    }
+  return spec;
+}
+
+template <class TFloat, uint VDim>
+const typename LDDMMFFTRegularizer<TFloat, VDim>::Spectrum &
+LDDMMFFTRegularizer<TFloat, VDim>
+::navier_stokes_spectrum(const int *len, double alpha, double gamma)
+{
+  std::vector<double> key(1, 1.0);
+  itk::SizeValueType n = 1;
+  for(uint d = 0; d < VDim; d++)
+    {
+    key.push_back(len[d]);
+    n *= len[d];
+    }
+  key.push_back(alpha);
+  key.push_back(gamma);
+
+  Spectrum &spec = m_Spectra[key];
+  if(spec.size() == 0)
+    {
+    // The eigenvalues of the discrete Laplacian are -2 sum(1 - cos(2 pi k_d / len_d))
+    spec.resize(n);
+    for(itk::SizeValueType i = 0; i < n; i++)
+      {
+      double lambda = 0.0;
+      itk::SizeValueType r = i;
+      for(uint d = 0; d < VDim; r /= len[d], d++)
+        lambda += 2.0 * (1.0 - cos(2.0 * vnl_math::pi * (r % len[d]) / len[d]));
+      double k = 1.0 + (alpha / gamma) * lambda;
+      spec[i] = 1.0 / (k * k * n);
+      }
+    }
+  return spec;
+}
+
+template <class TFloat, uint VDim>
+void
+LDDMMFFTRegularizer<TFloat, VDim>
+::transform_axis(const int *len, uint axis, int dir)
+{
+  itk::SizeValueType stride = 1, n = 1;
+  for(uint d = 0; d < VDim; d++)
+    {
+    stride *= (d < axis) ? len[d] : 1;
+    n *= len[d];
+    }
+
+  int n_axis = len[axis];
+  FFTType * const *fft = this->get_fft(n_axis);
+  Complex *work = &m_Work[0];
+
+  // Each line is copied out, transformed and copied back
+  lddmm_data_kernels::parallel_for(n / n_axis, [=](itk::SizeValueType begin, itk::SizeValueType end, unsigned int thread)
+    {
+    std::vector<Complex> line(n_axis);
+    for(itk::SizeValueType l = begin; l < end; l++)
+      {
+      Complex *p = work + (l / stride) * stride * n_axis + l % stride;
+      for(int i = 0; i < n_axis; i++)
+        line[i] = p[i * stride];
+      fft[thread]->transform(&line[0], dir);
+      for(int i = 0; i < n_axis; i++)
+        p[i * stride] = line[i];
+      }
+    }, 64, this->threads());
+}
+
+template <class TFloat, uint VDim>
+void
+LDDMMFFTRegularizer<TFloat, VDim>
+::vimg_smooth(VectorImageType *src, VectorImageType *trg, Vec sigma)
+{
+  if(trg != src)
+    LDDMMType::vimg_copy(src, trg);
+
+  itk::Size<VDim> size = trg->GetBufferedRegion().GetSize();
+  itk::SizeValueType n_pix = trg->GetBufferedRegion().GetNumberOfPixels();
+  TFloat *data = lddmm_data_kernels::flat<TFloat>(trg);
+
+  // Smooth along one axis at a time, in place
+  itk::SizeValueType stride = 1;
+  for(uint d = 0; d < VDim; stride *= size[d], d++)
+    {
+    int n = size[d];
+    double sigma_vox = sigma[d] / trg->GetSpacing()[d];
+    if(sigma_vox <= 0.0 || n < 2)
+      continue;
+
+    int pad = (int) ceil(4.0 * sigma_vox);
+    int len = padded_length(n, pad);
+    FFTType * const *fft = this->get_fft(len);
+    const double *spec = &this->gaussian_spectrum(len, sigma_vox)[0];
+    itk::SizeValueType pstride = stride * VDim;
+
+    lddmm_data_kernels::parallel_for(n_pix / n, [=](itk::SizeValueType begin, itk::SizeValueType end, unsigned int thread)
+      {
+      std::vector<Complex> line(len);
+      for(itk::SizeValueType l = begin; l < end; l++)
+        {
+        TFloat *p = data + ((l / stride) * stride * n + l % stride) * VDim;
+
+        // The kernel is real and even, so two components can be filtered at once
+        // as the real and imaginary parts of one signal
+        for(uint c = 0; c < VDim; c += 2)
+          {
+          bool pair = (c + 1 < VDim);
+          for(int i = 0; i < len; i++)
+            {
+            const TFloat *q = p + std::min(std::max(i - pad, 0), n - 1) * pstride + c;
+            line[i] = Complex(q[0], pair ? q[1] : 0.0);
+            }
+
+          fft[thread]->transform(&line[0], 1);
+          for(int i = 0; i < len; i++)
+            line[i] *= spec[i];
+          fft[thread]->transform(&line[0], -1);
+
+          for(int i = 0; i < n; i++)
+            {
+            TFloat *q = p + i * pstride + c;
+            q[0] = (TFloat) line[i + pad].real();
+            if(pair)
+              q[1] = (TFloat) line[i + pad].imag();
+            }
+          }
+        }
+      }, 64, this->threads());
+    }
+}
+
+template <class TFloat, uint VDim>
+void
+LDDMMFFTRegularizer<TFloat, VDim>
+::vimg_navier_stokes(VectorImageType *src, VectorImageType *trg, double alpha, double gamma)
+{
+  if(gamma <= 0.0 || alpha < 0.0)
+    itkGenericExceptionMacro(<< "Navier-Stokes kernel needs gamma > 0 and alpha >= 0, got "
+                             << alpha << ", " << gamma);
+
+  // The kernel falls off over about sqrt(alpha/gamma) voxels
+  itk::Size<VDim> size = src->GetBufferedRegion().GetSize();
+  int pad[VDim], len[VDim];
+  itk::SizeValueType n_work = 1;
+  for(uint d = 0; d < VDim; d++)
+    {
+    pad[d] = std::min((int) size[d], (int) ceil(5.0 * sqrt(alpha / gamma)));
+    len[d] = padded_length(size[d], pad[d]);
+    n_work *= len[d];
+    }
+
+  const double *spec = &this->navier_stokes_spectrum(len, alpha, gamma)[0];
+  m_Work.resize(n_work);
+  Complex *work = &m_Work[0];
+
+  const TFloat *p_src = lddmm_data_kernels::flat<TFloat>(src);
+  TFloat *p_trg = lddmm_data_kernels::flat<TFloat>(trg);
+  itk::SizeValueType n_rows = n_work / len[0];
+
+  // As in vimg_smooth, two components are filtered at once
+  for(uint c = 0; c < VDim; c += 2)
+    {
+    bool pair = (c + 1 < VDim);
+
+    // Fill the padded volume, repeating the values at the edges of the image
+    lddmm_data_kernels::parallel_for(n_rows, [&](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+      {
+      for(itk::SizeValueType row = begin; row < end; row++)
+        {
+        itk::SizeValueType offset = 0, stride = size[0], r = row;
+        for(uint d = 1; d < VDim; r /= len[d], stride *= size[d], d++)
+          offset += std::min(std::max((int) (r % len[d]) - pad[d], 0), (int) size[d] - 1) * stride;
+
+        Complex *p = work + row * len[0];
+        for(int i = 0; i < len[0]; i++)
+          {
+          const TFloat *q = p_src + (offset + std::min(std::max(i - pad[0], 0), (int) size[0] - 1)) * VDim + c;
+          p[i] = Complex(q[0], pair ? q[1] : 0.0);
+          }
+        }
+      }, 64, this->threads());
+
+    // Convolve with the kernel
+    for(uint d = 0; d < VDim; d++)
+      this->transform_axis(len, d, 1);
+
+    lddmm_data_kernels::parallel_for(n_work, [=](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+      {
+      for(itk::SizeValueType i = begin; i < end; i++)
+        work[i] *= spec[i];
+      }, lddmm_data_kernels::min_values_per_thread, this->threads());
+
+    for(uint d = 0; d < VDim; d++)
+      this->transform_axis(len, d, -1);
+
+    // Copy the unpadded part to the output
+    lddmm_data_kernels::parallel_for(n_rows, [&](itk::SizeValueType begin, itk::SizeValueType end, unsigned int)
+      {
+      for(itk::SizeValueType row = begin; row < end; row++)
+        {
+        itk::SizeValueType offset = 0, stride = size[0], r = row;
+        bool inside = true;
+        for(uint d = 1; inside && d < VDim; r /= len[d], stride *= size[d], d++)
+          {
+          int k = (int) (r % len[d]) - pad[d];
+          inside = (k >= 0 && k < (int) size[d]);
+          offset += k * stride;
+          }
+
+        if(inside)
+          {
+          const Complex *p = work + row * len[0] + pad[0];
+          for(unsigned int i = 0; i < size[0]; i++)
+            {
+            TFloat *q = p_trg + (offset + i) * VDim + c;
+            q[0] = (TFloat) p[i].real();
+            if(pair)
+              q[1] = (TFloat) p[i].imag();
+            }
+          }
+        }
+      }, 64, this->threads());
+    }
+}
+
+template <class TFloat, uint VDim>
+void
+LDDMMFFTRegularizer<TFloat, VDim>
+::clear_cache()
+{
+  for(typename std::map<int, std::vector<FFTType *> >::iterator it = m_FFT.begin(); it != m_FFT.end(); ++it)
+    for(unsigned int i = 0; i < it->second.size(); i++)
+      delete it->second[i];
+  m_FFT.clear();
+  m_Spectra.clear();
+  std::vector<Complex>().swap(m_Work);
+}
+
+
 template <class TFloat, uint VDim>
 LDDMMImageMatchingObjective<TFloat, VDim>
 ::LDDMMImageMatchingObjective(LDDMM &p)
@@ -1928,6 +2370,14 @@ template class LDDMMData<double, 2>;
 template class LDDMMData<double, 3>;
 template class LDDMMData<double, 4>;
 
+template class LDDMMFFTRegularizer<float, 2>;
+template class LDDMMFFTRegularizer<float, 3>;
+template class LDDMMFFTRegularizer<float, 4>;
+
+template class LDDMMFFTRegularizer<double, 2>;
+template class LDDMMFFTRegularizer<double, 3>;
+template class LDDMMFFTRegularizer<double, 4>;
+
 #ifdef _LDDMM_FFT_
 template class LDDMMFFTInterface<double, 2>;
 template class LDDMMFFTInterface<double, 3>;
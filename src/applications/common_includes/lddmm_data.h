@@ -35,7 +35,10 @@
 #include <itkCovariantVector.h>
 #include <itkMatrix.h>
 #include <vnl/vnl_math.h>
+#include <vnl/algo/vnl_fft_1d.h>
 #include <vector>
+#include <complex>
+#include <map>
 
 #include <itkImageIOBase.h>
 
@@ -92,6 +95,25 @@ public:
   // Number of timesteps, number of voxels
   uint nt, nv;
 
+  // Number of threads of the operations below and of their ITK filters, for the calling
+  // thread only (0: the ITK global default). Concurrent registrations, such as the jobs
+  // of a batch, use this to split the threads between them
+  static void set_thread_count(int n);
+  static int get_thread_count();
+
+  // Give an ITK filter the thread count of the calling thread, if one is set
+  static void set_up_threads(itk::ProcessObject *filter);
+
+  // Sets the thread count of the calling thread for the lifetime of the object
+  class ThreadCountScope
+  {
+  public:
+    ThreadCountScope(int n) : m_Saved(get_thread_count()) { set_thread_count(n); }
+    ~ThreadCountScope() { set_thread_count(m_Saved); }
+  private:
+    int m_Saved;
+  };
+
   // Allocate a velocity field
   static void alloc_vf(VelocityField &vf, uint nt, ImageBaseType *ref);
   static void alloc_img(ImagePointer &img, ImageBaseType *ref);
@@ -167,6 +189,9 @@ public:
   // Smooth a displacement field with a border of zeros around it
   static void vimg_smooth_withborder(VectorImageType *src, VectorImageType *trg, Vec sigma, int border_size);
 
+  // Set the vectors within border_size voxels of the image edge to zero
+  static void vimg_clear_border(VectorImageType *trg, int border_size);
+
   // Take gradient of an image
   static void image_gradient(ImageType *src, VectorImageType *grad);
 
@@ -178,6 +203,14 @@ public:
   // compute trg = trg + s * a
   static void vimg_add_scaled_in_place(VectorImageType *trg, VectorImageType *a, TFloat s);
 
+  // compute trg = a + s * b in one pass (trg may be a or b)
+  static void vimg_add_scaled(const VectorImageType *a, const VectorImageType *b, TFloat s, VectorImageType *trg);
+
+  // compute trg = s_trg * trg + s_a * a + s_b * b in one pass
+  static void vimg_linear_combination_in_place(VectorImageType *trg, TFloat s_trg,
+                                               const VectorImageType *a, TFloat s_a,
+                                               const VectorImageType *b, TFloat s_b);
+
   static void vimg_scale(const VectorImageType *src, TFloat s, VectorImageType *trg);
   static void vimg_multiply_in_place(VectorImageType *trg, ImageType *s);
   static void vimg_euclidean_inner_product(ImagePointer &trg, VectorImageType *a, VectorImageType *b);
@@ -338,6 +371,78 @@ public:
 #endif // _LDDMM_FFT_
 
 
+/**
+ * Frequency domain smoothing of vector fields, as an alternative to the recursive
+ * Gaussian in LDDMMData::vimg_smooth. The Gaussian is separable and is applied with
+ * 1D FFTs along each axis. The Navier-Stokes kernel is applied with an N-D FFT. Image
+ * lines are padded by repeating their end values, both to keep the periodic
+ * convolution away from the data and to reach a length that the vnl FFT supports
+ * (only factors 2, 3 and 5). The FFT setup for each length and the kernel spectra
+ * are cached, so one regularizer can be reused over the iterations and levels of
+ * a registration. Unlike the LDDMMFFTInterface, this does not require FFTW.
+ */
+template <class TFloat, uint VDim>
+class LDDMMFFTRegularizer
+{
+public:
+  typedef LDDMMData<TFloat, VDim> LDDMMType;
+  typedef typename LDDMMType::VectorImageType VectorImageType;
+  typedef typename LDDMMType::Vec Vec;
+
+  LDDMMFFTRegularizer() : m_NumberOfThreads(0) {}
+  ~LDDMMFFTRegularizer() { clear_cache(); }
+
+  // Number of threads of the transforms (0: LDDMMData::get_thread_count, or the ITK
+  // global default if that is not set either)
+  void SetNumberOfThreads(int n) { m_NumberOfThreads = n; }
+  int GetNumberOfThreads() const { return m_NumberOfThreads; }
+
+  // Gaussian smoothing with sigmas in physical units, like LDDMMData::vimg_smooth
+  void vimg_smooth(VectorImageType *src, VectorImageType *trg, Vec sigma);
+
+  // Apply the inverse of the Navier-Stokes operator (gamma Id - alpha Laplacian)^2,
+  // scaled to unit gain at zero frequency. Alpha is in voxel units
+  void vimg_navier_stokes(VectorImageType *src, VectorImageType *trg, double alpha, double gamma);
+
+  // Release the cached FFT setups, spectra and work memory
+  void clear_cache();
+
+private:
+  typedef std::complex<double> Complex;
+  typedef vnl_fft_1d<double> FFTType;
+  typedef std::vector<double> Spectrum;
+
+  // FFT setup for each line length, one per thread
+  std::map<int, std::vector<FFTType *> > m_FFT;
+
+  // Kernel spectra (including the 1/N scaling of the inverse FFT), keyed by the
+  // kernel type, padded size and kernel parameters
+  std::map<std::vector<double>, Spectrum> m_Spectra;
+
+  // Padded volume for the N-D transform
+  std::vector<Complex> m_Work;
+
+  int m_NumberOfThreads;
+
+  // Number of threads the transforms use
+  unsigned int threads() const;
+
+  // Smallest length >= n + 2 * pad that only has factors 2, 3 and 5
+  static int padded_length(int n, int pad);
+
+  FFTType * const *get_fft(int n);
+  const Spectrum &gaussian_spectrum(int len, double sigma);
+  const Spectrum &navier_stokes_spectrum(const int *len, double alpha, double gamma);
+
+  // Apply the FFT along one axis of the padded volume
+  void transform_axis(const int *len, uint axis, int dir);
+
+  // Owns the FFT objects, not copyable
+  LDDMMFFTRegularizer(const LDDMMFFTRegularizer &);
+  void operator = (const LDDMMFFTRegularizer &);
+};
+
+
 // Class for iteratively computing the objective function
 template<class TFloat, uint VDim>
 class LDDMMImageMatchingObjective 
@@ -168,16 +168,14 @@ inline VectorDouble trainOpenCVSVM(const VariableSizeMatrixType &trainingDataAnd
 }
 
 /**
-\brief Load the SVM classifier and get the distances from the hyperplane
+\brief Get the distances from the hyperplane of an already loaded SVM classifier
 
 \param testingData Input training data with last column as training labels
-\param inputModelName File to save the model
+\param svm The trained model
 \return Distances of classification
 */
-inline VectorDouble testOpenCVSVM(const VariableSizeMatrixType &testingData, const std::string &inputModelName)
+inline VectorDouble testLoadedOpenCVSVM(const VariableSizeMatrixType &testingData, const cv::Ptr< cv::ml::SVM > &svm)
 {
-  auto svm = cv::Algorithm::load<cv::ml::SVM>(inputModelName);
-
   //std::ofstream file;
   //file.open("Z:/Projects/testingData.csv");
   //for (size_t i = 0; i < testingData.Rows(); i++)
@@ -235,6 +233,18 @@ inline VectorDouble testOpenCVSVM(const VariableSizeMatrixType &testingData, con
   return returnVec;
 }
 
+/**
+\brief Load the SVM classifier and get the distances from the hyperplane
+
+\param testingData Input training data with last column as training labels
+\param inputModelName File to save the model
+\return Distances of classification
+*/
+inline VectorDouble testOpenCVSVM(const VariableSizeMatrixType &testingData, const std::string &inputModelName)
+{
+  return testLoadedOpenCVSVM(testingData, cv::Algorithm::load<cv::ml::SVM>(inputModelName));
+}
+
 /**
 \brief Load the SVM classifier and predict the probabilities
 
@@ -6648,9 +6648,8 @@ void fMainWindow::ApplicationGeodesicTraining()
 
   /*unsigned int dimensions = 3;*/
 
-  // Different operations happen if the user reruns it on the same images
+  // The segmentation is loaded as a ROI only if the user is still on the same images when it finishes
   std::string firstFileName = mSlicerManagers[0]->mFileName;
-  bool isRerun = (firstFileName == m_GeodesicTrainingFirstFileNameFromLastExec);
   m_GeodesicTrainingFirstFileNameFromLastExec = firstFileName;
 
   updateProgress(0, "Geodesic Training segmentation started, please wait");
@@ -6668,69 +6667,45 @@ void fMainWindow::ApplicationGeodesicTraining()
 
   // The input that GeodesicTraining needs
   std::vector<InputImagePointer3D> inputImages;
-  LabelsImagePointer3D mask;
+  LabelsImagePointer3D mask = currentROI;
 
-  // Find the input images
+  // Find the input images, the session of the app continues while they are the same
+  // (reruns only add the points that the user drew on the output segmentation)
+  std::string sessionKey = "";
   for (SlicerManager* sm : mSlicerManagers)
   {
     inputImages.push_back(sm->mITKImage);
+    sessionKey += sm->mFileName + "|";
   }
 
-  if (!isRerun)
-  {
-    // The user runs the algorithm for the first time for this subject
-    mask = convertVtkToItk<int, 3>(mSlicerManagers[0]->mMask);
-  }
-  else {
-    // The user is doing a rerun for the same subject
-    // The new points that the user drew on the output segmentation are added
-    // to the old mask and the algorithm executes again.
-    mask = cbica::ReadImage<LabelsImageType3D>(m_tempFolderLocation + "/GeodesicTrainingOutput/mask.nii.gz");
-    LabelsImagePointer3D previousResult =
-      cbica::ReadImage<LabelsImageType3D>(m_tempFolderLocation + "/GeodesicTrainingOutput/labels_res.nii.gz");
-
-    itk::ImageRegionIterator<LabelsImageType3D> iter_m(mask, mask->GetRequestedRegion());
-    itk::ImageRegionIterator<LabelsImageType3D> iter_p(previousResult, previousResult->GetRequestedRegion());
-    itk::ImageRegionIterator<LabelsImageType3D> iter_c(currentROI, currentROI->GetRequestedRegion());
-
-    for (iter_m.GoToBegin(), iter_p.GoToBegin(), iter_c.GoToBegin(); !iter_m.IsAtEnd(); ++iter_m, ++iter_p, ++iter_c)
-    {
-      int p = iter_p.Get();
-      int c = iter_c.Get();
-
-      if (p != c)
-      {
-        iter_m.Set(c);
-      }
-    }
-  }
-
-  // Save the mask for potential reruns on the same subject
   if (!cbica::isDir(m_tempFolderLocation + "/GeodesicTrainingOutput"))
   {
     cbica::createDir(m_tempFolderLocation + "/GeodesicTrainingOutput");
   }
-  cbica::WriteImage<LabelsImageType3D>(mask, m_tempFolderLocation + "/GeodesicTrainingOutput/mask.nii.gz");
 
   if (dimensions == 3)
   {
     // 3D
-    m_GeodesicTrainingCaPTkApp3D = new GeodesicTrainingCaPTkApp<3>(this);
-
-    // Connect the signals/slots for progress updates and notifying that the algorithm is finished
-    connect(m_GeodesicTrainingCaPTkApp3D, SIGNAL(GeodesicTrainingFinished()),
-      this, SLOT(GeodesicTrainingFinishedHandler())
-    );
-    connect(m_GeodesicTrainingCaPTkApp3D, SIGNAL(GeodesicTrainingFinishedWithError(QString)),
-      this, SLOT(GeodesicTrainingSegmentationResultErrorHandler(QString))
-    );
-    auto test = connect(m_GeodesicTrainingCaPTkApp3D, SIGNAL(GeodesicTrainingProgressUpdate(int, std::string, int)),
-      this, SLOT(updateProgress(int, std::string, int))
-    );
+    if (m_GeodesicTrainingCaPTkApp3D == nullptr)
+    {
+      // The app (and the images, maps and models it keeps) lives as long as the window
+      m_GeodesicTrainingCaPTkApp3D = new GeodesicTrainingCaPTkApp<3>(this);
+
+      // Connect the signals/slots for progress updates and notifying that the algorithm is finished
+      connect(m_GeodesicTrainingCaPTkApp3D, SIGNAL(GeodesicTrainingFinished()),
+        this, SLOT(GeodesicTrainingFinishedHandler())
+      );
+      connect(m_GeodesicTrainingCaPTkApp3D, SIGNAL(GeodesicTrainingFinishedWithError(QString)),
+        this, SLOT(GeodesicTrainingSegmentationResultErrorHandler(QString))
+      );
+      connect(m_GeodesicTrainingCaPTkApp3D, SIGNAL(GeodesicTrainingProgressUpdate(int, std::string, int)),
+        this, SLOT(updateProgress(int, std::string, int))
+      );
+    }
 
     // Run the algorithm
     m_GeodesicTrainingCaPTkApp3D->SetOutputPath(m_tempFolderLocation + "/GeodesicTrainingOutput");
-    m_GeodesicTrainingCaPTkApp3D->Run(inputImages, mask);
+    m_GeodesicTrainingCaPTkApp3D->Run(inputImages, mask, sessionKey);
   }
   else {
     // 2D (which has been loaded as a 3D image with a single slize in z-direction)
@@ -6769,22 +6744,26 @@ void fMainWindow::ApplicationGeodesicTraining()
     mask2D->DisconnectPipeline();
 
     // Same as 3D but in 2D form
-    m_GeodesicTrainingCaPTkApp2D = new GeodesicTrainingCaPTkApp<2>(this);
-
-    // Connect the signals/slots for progress updates and notifying that the algorithm is finished
-    connect(m_GeodesicTrainingCaPTkApp2D, SIGNAL(GeodesicTrainingFinished()),
-      this, SLOT(GeodesicTrainingFinishedHandler())
-    );
-    connect(m_GeodesicTrainingCaPTkApp2D, SIGNAL(GeodesicTrainingFinishedWithError(QString)),
-      this, SLOT(GeodesicTrainingSegmentationResultErrorHandler(QString))
-    );
-    auto test = connect(m_GeodesicTrainingCaPTkApp2D, SIGNAL(GeodesicTrainingProgressUpdate(int, std::string, int)),
-      this, SLOT(updateProgress(int, std::string, int))
-    );
+    if (m_GeodesicTrainingCaPTkApp2D == nullptr)
+    {
+      // The app (and the images, maps and models it keeps) lives as long as the window
+      m_GeodesicTrainingCaPTkApp2D = new GeodesicTrainingCaPTkApp<2>(this);
+
+      // Connect the signals/slots for progress updates and notifying that the algorithm is finished
+      connect(m_GeodesicTrainingCaPTkApp2D, SIGNAL(GeodesicTrainingFinished()),
+        this, SLOT(GeodesicTrainingFinishedHandler())
+      );
+      connect(m_GeodesicTrainingCaPTkApp2D, SIGNAL(GeodesicTrainingFinishedWithError(QString)),
+        this, SLOT(GeodesicTrainingSegmentationResultErrorHandler(QString))
+      );
+      connect(m_GeodesicTrainingCaPTkApp2D, SIGNAL(GeodesicTrainingProgressUpdate(int, std::string, int)),
+        this, SLOT(updateProgress(int, std::string, int))
+      );
+    }
 
     // Run the algorithm
     m_GeodesicTrainingCaPTkApp2D->SetOutputPath(m_tempFolderLocation + "/GeodesicTrainingOutput");
-    m_GeodesicTrainingCaPTkApp2D->Run(inputImages2D, mask2D);
+    m_GeodesicTrainingCaPTkApp2D->Run(inputImages2D, mask2D, sessionKey);
   }
 
 }
@@ -6793,6 +6772,11 @@ void fMainWindow::ApplicationGeodesicTraining()
 #ifdef BUILD_GEODESIC
 void fMainWindow::ApplicationGeodesic()
 {
+  if (m_geodesicWatcher.isRunning())
+  {
+    ShowErrorMessage("Geodesic Segmentation is already running.", this);
+    return;
+  }
   m_imgGeodesicOut = NULL;
   auto items = m_imagesTable->selectedItems();
   if (items.empty())
@@ -6831,16 +6815,43 @@ void fMainWindow::ApplicationGeodesic()
   Inp = filter->GetOutput();
   updateProgress(15, "Running Geodesic Segmentation");
 
-  GeodesicSegmentation< ImageTypeGeodesic > geodesicSegmentor;
-  Inp = geodesicSegmentor.Run/*<ImageTypeGeodesic>*/(Inp, tumorPoints);
+  // the segmentation runs on a worker thread and reports its progress through the future,
+  // m_geodesicWatcher calls ApplicationGeodesicProgress and ApplicationGeodesicFinished on the GUI thread
+  QFutureInterface< ImageTypeGeodesic::Pointer > geodesicInterface;
+  geodesicInterface.setProgressRange(0, 100);
+  geodesicInterface.reportStarted();
+  connect(&m_geodesicWatcher, SIGNAL(progressValueChanged(int)), this, SLOT(ApplicationGeodesicProgress(int)), Qt::UniqueConnection);
+  connect(&m_geodesicWatcher, SIGNAL(finished()), this, SLOT(ApplicationGeodesicFinished()), Qt::UniqueConnection);
+  m_geodesicWatcher.setFuture(geodesicInterface.future());
+
+  QtConcurrent::run([geodesicInterface, Inp, tumorPoints]() mutable
+  {
+    GeodesicSegmentation< ImageTypeGeodesic > geodesicSegmentor;
+    geodesicSegmentor.SetProgressCallback([&geodesicInterface](int progress)
+    {
+      geodesicInterface.setProgressValue(progress);
+    });
+    auto geodesicOutput = geodesicSegmentor.Run/*<ImageTypeGeodesic>*/(Inp, tumorPoints);
+    geodesicInterface.reportResult(geodesicOutput);
+    geodesicInterface.reportFinished();
+  });
+}
+
+void fMainWindow::ApplicationGeodesicProgress(int progress)
+{
+  updateProgress(15 + progress * 70 / 100, "Running Geodesic Segmentation");
+}
 
+void fMainWindow::ApplicationGeodesicFinished()
+{
+  typedef ImageTypeShort3D ImageTypeGeodesic;
   updateProgress(85, "Running Geodesic Segmentation");
-  filter->SetInput(Inp);
+  auto filter = itk::RescaleIntensityImageFilter< ImageTypeGeodesic, ImageTypeGeodesic >::New();
+  filter->SetInput(m_geodesicWatcher.result());
   filter->SetOutputMinimum(0);
   filter->SetOutputMaximum(255);
   filter->Update();
-  Inp = filter->GetOutput();
-  m_imgGeodesicOut = Inp;
+  m_imgGeodesicOut = filter->GetOutput();
   updateProgress(90, "Displaying Geodesic Segmentation");
   ApplicationGeodesicTreshold();
   updateProgress(0, "Geodesic Segmentation Finished!");
@@ -8685,40 +8696,45 @@ void fMainWindow::Registration(std::string fixedFileName, std::vector<std::strin
       ShowErrorMessage("Input file '" + std::to_string(i) + "' is undefined; please check");
       return;
     }
-    updateProgress(static_cast<int>(100 / ((i + 1) * inputFileNames.size())), "processing Registration");
+  }
+  updateProgress(10, "processing Registration");
 
-    std::string fixedFileCommand = "-f " + fixedFileName;
-    std::string movingFileCommand = " -i " + inputFileNames[i];
-    std::string affineMatrixCommand = " -t " + matrixFileNames[i];
-    std::string outputCommand = " -o " + outputFileNames[i];
-    std::string metricsCommand = " -m " + metrics;
-    std::string iterationsCommand = " -n " + iterations;
-    QStringList args;
-    args << "-reg" << "-trf" << "-a" << "-f" << fixedFileName.c_str()
-      << "-i" << inputFileNames[i].c_str() << "-t" << matrixFileNames[i].c_str() << "-o" << outputFileNames[i].c_str()
-      << "-m" << metrics.c_str() << "-n" << iterations.c_str();
+  // All the moving images are registered in one process (batch mode), which reads the fixed image once
+  std::string inputFilesList, matrixFilesList, outputFilesList;
+  for (unsigned int i = 0; i < inputFileNames.size(); i++)
+  {
+    const std::string separator = (i == 0) ? "" : ",";
+    inputFilesList += separator + inputFileNames[i];
+    matrixFilesList += separator + matrixFileNames[i];
+    outputFilesList += separator + outputFileNames[i];
+  }
 
-    if (metrics == "NCC")
-      args << "-ri" << radii.c_str();
-    if (affineMode)
-    {
-      args << "-a";
-    }
-    else
-    {
-      args << "-r";
-    }
-    std::string fullCommandToRun = getApplicationPath("GreedyRegistration");
+  QStringList args;
+  args << "-reg" << "-trf" << "-a" << "-f" << fixedFileName.c_str()
+    << "-i" << inputFilesList.c_str() << "-t" << matrixFilesList.c_str() << "-o" << outputFilesList.c_str()
+    << "-m" << metrics.c_str() << "-n" << iterations.c_str() << "-b" << "0";
 
-    if (startExternalProcess(fullCommandToRun.c_str(), args) != 0)
-    {
-      ShowErrorMessage("Couldn't register with the default parameters; please use command line functionality");
-      return;
-    }
-    else
-    {
-      affineMatrix.push_back(matrixFileNames[i] + ".mat");
-    }
+  if (metrics == "NCC")
+    args << "-ri" << radii.c_str();
+  if (affineMode)
+  {
+    args << "-a";
+  }
+  else
+  {
+    args << "-r";
+  }
+  std::string fullCommandToRun = getApplicationPath("GreedyRegistration");
+
+  if (startExternalProcess(fullCommandToRun.c_str(), args) != 0)
+  {
+    ShowErrorMessage("Couldn't register with the default parameters; please use command line functionality");
+    return;
+  }
+
+  for (unsigned int i = 0; i < inputFileNames.size(); i++)
+  {
+    affineMatrix.push_back(matrixFileNames[i] + ".mat");
 
     if (matrixFileNames[i].find("remove") != std::string::npos)
     {
@@ -8732,42 +8748,42 @@ void fMainWindow::Registration(std::string fixedFileName, std::vector<std::strin
 
       updateProgress(static_cast<int>(100 / ((i + 1) * inputFileNames.size())), "Writing File");
     }
+  }
 
-    updateProgress(100, "Registration Complete.");
+  updateProgress(100, "Registration Complete.");
 
-    time_t t = std::time(0);
-    long int now = static_cast<long int> (t);
+  time_t t = std::time(0);
+  long int now = static_cast<long int> (t);
 
-    std::ofstream file;
-    file.open(configFileName.c_str());
+  std::ofstream file;
+  file.open(configFileName.c_str());
 
-    std::string mode;
+  std::string mode;
 
-    if (affineMode == true)
-      mode = "Affine";
-    else
-      mode = "Rigid";
+  if (affineMode == true)
+    mode = "Affine";
+  else
+    mode = "Rigid";
 
-    if (file.is_open())
-    {
-      if (metrics != "NCC") {
-        file << fixedFileName << ","
-          << metrics << ","
-          << mode << ","
-          << iterations << ","
-          << now << "\n";
-      }
-      else {
-        file << fixedFileName << ","
-          << metrics << ","
-          << radii << ","
-          << mode << ","
-          << iterations << ","
-          << now << "\n";
-      }
+  if (file.is_open())
+  {
+    if (metrics != "NCC") {
+      file << fixedFileName << ","
+        << metrics << ","
+        << mode << ","
+        << iterations << ","
+        << now << "\n";
+    }
+    else {
+      file << fixedFileName << ","
+        << metrics << ","
+        << radii << ","
+        << mode << ","
+        << iterations << ","
+        << now << "\n";
     }
-    file.close();
   }
+  file.close();
   //// This happens because the qconcurrent doesn't allow more than 5 function parameters, without std::bind + not sure what else
   //std::vector<std::string> compVector = {
   //  fixedFileName,
@@ -8829,40 +8845,45 @@ void fMainWindow::RegistrationWorker(std::vector<std::string> compVector, std::v
       ShowErrorMessage("Input file '" + std::to_string(i) + "' is undefined; please check");
       return;
     }
-    updateProgress(static_cast<int>(100 / ((i + 1) * inputFileNames.size())), "processing Registration");
-
-    std::string fixedFileCommand = "-f " + fixedFileName;
-    std::string movingFileCommand = " -i " + inputFileNames[i];
-    std::string affineMatrixCommand = " -t " + matrixFileNames[i];
-    std::string outputCommand = " -o " + outputFileNames[i];
-    std::string metricsCommand = " -m " + metrics;
-    std::string iterationsCommand = " -n " + iterations;
-    QStringList args;
-    args << "-reg" << "-trf" << "-a" << "-f" << fixedFileName.c_str()
-      << "-i" << inputFileNames[i].c_str() << "-t" << matrixFileNames[i].c_str() << "-o" << outputFileNames[i].c_str()
-      << "-m" << metrics.c_str() << "-n" << iterations.c_str();
-        
-    if (metrics == "NCC")
-      args << "-ri" << radii.c_str();
-    if (affineMode)
-    {
-      args << "-a";
-    }
-    else
-    {
-      args << "-r";
-    }
-    std::string fullCommandToRun = getApplicationPath("GreedyRegistration");
+  }
+  updateProgress(10, "processing Registration");
 
-    if (startExternalProcess(fullCommandToRun.c_str(), args) != 0)
-    {
-      ShowErrorMessage("Couldn't register with the default parameters; please use command line functionality");
-      return;
-    }
-    else
-    {
-      affineMatrix.push_back(matrixFileNames[i] + ".mat");
-    }
+  // All the moving images are registered in one process (batch mode), which reads the fixed image once
+  std::string inputFilesList, matrixFilesList, outputFilesList;
+  for (unsigned int i = 0; i < inputFileNames.size(); i++)
+  {
+    const std::string separator = (i == 0) ? "" : ",";
+    inputFilesList += separator + inputFileNames[i];
+    matrixFilesList += separator + matrixFileNames[i];
+    outputFilesList += separator + outputFileNames[i];
+  }
+
+  QStringList args;
+  args << "-reg" << "-trf" << "-a" << "-f" << fixedFileName.c_str()
+    << "-i" << inputFilesList.c_str() << "-t" << matrixFilesList.c_str() << "-o" << outputFilesList.c_str()
+    << "-m" << metrics.c_str() << "-n" << iterations.c_str() << "-b" << "0";
+
+  if (metrics == "NCC")
+    args << "-ri" << radii.c_str();
+  if (affineMode)
+  {
+    args << "-a";
+  }
+  else
+  {
+    args << "-r";
+  }
+  std::string fullCommandToRun = getApplicationPath("GreedyRegistration");
+
+  if (startExternalProcess(fullCommandToRun.c_str(), args) != 0)
+  {
+    ShowErrorMessage("Couldn't register with the default parameters; please use command line functionality");
+    return;
+  }
+
+  for (unsigned int i = 0; i < inputFileNames.size(); i++)
+  {
+    affineMatrix.push_back(matrixFileNames[i] + ".mat");
 
     if (matrixFileNames[i].find("remove") != std::string::npos)
     {
@@ -8876,42 +8897,42 @@ void fMainWindow::RegistrationWorker(std::vector<std::string> compVector, std::v
 
       updateProgress(static_cast<int>(100 / ((i + 1) * inputFileNames.size())), "Writing File");
     }
+  }
 
-    updateProgress(100, "Registration Complete.");
+  updateProgress(100, "Registration Complete.");
 
-    time_t t = std::time(0);
-    long int now = static_cast<long int> (t);
+  time_t t = std::time(0);
+  long int now = static_cast<long int> (t);
 
-    std::ofstream file;
-    file.open(configFileName.c_str());
+  std::ofstream file;
+  file.open(configFileName.c_str());
 
-    std::string mode;
+  std::string mode;
 
-    if (affineMode == true)
-      mode = "Affine";
-    else
-      mode = "Rigid";
+  if (affineMode == true)
+    mode = "Affine";
+  else
+    mode = "Rigid";
 
-    if (file.is_open())
-    {
-      if (metrics != "NCC") {
-        file << fixedFileName << ","
-          << metrics << ","
-          << mode << ","
-          << iterations << ","
-          << now << "\n";
-      }
-      else {
-        file << fixedFileName << ","
-          << metrics << ","
-          << radii << ","
-          << mode << ","
-          << iterations << ","
-          << now << "\n";
-      }
+  if (file.is_open())
+  {
+    if (metrics != "NCC") {
+      file << fixedFileName << ","
+        << metrics << ","
+        << mode << ","
+        << iterations << ","
+        << now << "\n";
+    }
+    else {
+      file << fixedFileName << ","
+        << metrics << ","
+        << radii << ","
+        << mode << ","
+        << iterations << ","
+        << now << "\n";
     }
-    file.close();
   }
+  file.close();
 
   //std::terminate();
 }
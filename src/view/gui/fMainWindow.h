@@ -68,6 +68,7 @@ See COPYING file or https://www.med.upenn.edu/sbia/software-agreement.html
 #include "GeodesicTrainingCaPTkApp.h"
 
 #include <QMessageBox>
+#include <QFutureWatcher>
 
 #include "itkJoinSeriesImageFilter.h"
 #include "itkExtractImageFilter.h"
@@ -1354,6 +1355,10 @@ public slots:
 #ifdef BUILD_GEODESIC
   //! GUI control for Geodesic Segmentation
   void ApplicationGeodesic();
+  //! Shows the progress of the Geodesic Segmentation running on the worker thread
+  void ApplicationGeodesicProgress(int progress);
+  //! Rescales and displays the result once the Geodesic Segmentation has finished
+  void ApplicationGeodesicFinished();
 #endif
 #ifdef BUILD_GEODESICTRAINING
   //! GUI control for Geodesic Training
@@ -1524,14 +1529,15 @@ private:
   ImageTypeShort3D::Pointer m_imgGeodesicOut;
   ImageTypeShort3D::Pointer m_imgGeodesicOutPositive;
   ImageTypeShort3D::Pointer m_imgGeodesicOutNegative;
+  QFutureWatcher< ImageTypeShort3D::Pointer > m_geodesicWatcher; //! watches the Geodesic Segmentation worker
   std::map<std::string, float> m_fetalbrainfeatures;
   int m_fetalslice;
   bool m_ComparisonMode; //! comparison mode
   vtkSmartPointer<Slicer> m_ComparisonViewerLeft, m_ComparisonViewerCenter, m_ComparisonViewerRight;
 
   // GeodesicTraining private variables
-  GeodesicTrainingCaPTkApp<2>* m_GeodesicTrainingCaPTkApp2D;
-  GeodesicTrainingCaPTkApp<3>* m_GeodesicTrainingCaPTkApp3D;
+  GeodesicTrainingCaPTkApp<2>* m_GeodesicTrainingCaPTkApp2D = nullptr;
+  GeodesicTrainingCaPTkApp<3>* m_GeodesicTrainingCaPTkApp3D = nullptr;
   std::string m_GeodesicTrainingFirstFileNameFromLastExec = "";
   bool m_IsGeodesicTrainingRunning = false;
 
@@ -1,5 +1,9 @@
+#include <functional>
+
 #include "itkImage.h"
 #include "itkImageRegionIteratorWithIndex.h"
+#include "itkEuler3DTransform.h"
+#include "itkResampleImageFilter.h"
 #include "itkTestingComparisonImageFilter.h"
 #include "itkExceptionObject.h"
 
@@ -11,6 +15,16 @@
 #include "EGFRvIIISurrogateIndex.h"
 #include "CaPTkEnums.h"
 #include "CaPTkUtils.h"
+#include "FeatureReductionClass.h"
+#include "NiftiDataManager.h"
+#include "RFSuiteManager.h"
+#include "SvmSuiteFusedModel.h"
+#include "SvmSuiteWarmStart.h"
+#include "PrincipalComponentAnalysis.h"
+#include "lddmm_data.h"
+#include "ChunkedWarpFile.h"
+#include "vtkTable.h"
+#include "vtkVariant.h"
 
 int main(int argc, char** argv)
 {
@@ -22,6 +36,14 @@ int main(int argc, char** argv)
   parser.addOptionalParameter("geo", "geodesic", cbica::Parameter::FILE, ".nii.gz drawing", "Geodesic test");
   parser.addOptionalParameter("egfr", "egfrviii", cbica::Parameter::FILE, ".nii.gz drawing", "EGFRvIII test");
   parser.addOptionalParameter("recur", "recurrene", cbica::Parameter::FILE, ".nii.gz drawing", "Recurrence test");
+  parser.addOptionalParameter("pca", "pcaTest", cbica::Parameter::NONE, "none", "PCA projection test");
+  parser.addOptionalParameter("samp", "samplingTest", cbica::Parameter::NONE, "none", "Training sample cap test");
+  parser.addOptionalParameter("rf", "rfTest", cbica::Parameter::NONE, "none", "Random forest backends test");
+  parser.addOptionalParameter("sws", "svmWarmStartTest", cbica::Parameter::NONE, "none", "SVM warm start solver test");
+  parser.addOptionalParameter("svf", "svmFusedModelTest", cbica::Parameter::NONE, "none", "Fused SVM testing model test");
+  parser.addOptionalParameter("lfft", "lddmmFFTTest", cbica::Parameter::NONE, "none", "LDDMM FFT regularizer test");
+  parser.addOptionalParameter("cwf", "chunkedWarpTest", cbica::Parameter::NONE, "none", "Chunked warp file test");
+  parser.addOptionalParameter("gmv", "greedyMovingImage", cbica::Parameter::FILE, ".nii.gz output", "Writes a rotated, shifted and intensity biased copy of the input file (-i), the moving image of the Greedy tests");
 
   std::string dataDir;
 
@@ -52,6 +74,729 @@ int main(int argc, char** argv)
     return EXIT_SUCCESS;
   }
 
+  if (parser.isPresent("pcaTest"))
+  {
+    // projections of the covariance eigen-decomposition (what vtkPCAStatistics computed), with each component's
+    // largest-magnitude entry made positive
+    const size_t rows = 6, cols = 3;
+    const double data[rows][cols] = { { 2.5, 2.4, 1.0 }, { 0.5, 0.7, 2.0 }, { 2.2, 2.9, 0.5 }, { 1.9, 2.2, 1.5 }, { 3.1, 3.0, 0.2 }, { 2.3, 2.7, 1.1 } };
+    const double expected[rows][cols] = {
+      { 0.340149825095, 0.168325888994, -0.197534926374 },
+      { -2.445918079202, -0.175345275886, -0.098966355957 },
+      { 0.687738317807, -0.333450627845, 0.268729555314 },
+      { -0.395470372114, 0.284504070468, 0.111278213902 },
+      { 1.460984141985, -0.147974863822, -0.258233096448 },
+      { 0.352516166430, 0.203940808091, 0.174726609565 } };
+    const double tolerance = 1e-8;
+
+    VectorVectorDouble intensities(rows);
+    for (size_t i = 0; i < rows; i++)
+    {
+      intensities[i].assign(data[i], data[i] + cols);
+    }
+    auto checkProjection = [&](const std::string &name, const std::function< double(size_t, size_t) > &projected)
+    {
+      for (size_t i = 0; i < rows; i++)
+      {
+        for (size_t j = 0; j < cols; j++)
+        {
+          if (std::abs(projected(i, j) - expected[i][j]) > tolerance)
+          {
+            cbica::Logging(loggerFile, "PCA test failed for '" + name + "' at (" + std::to_string(i) + "," + std::to_string(j) + "): expected '"
+              + std::to_string(expected[i][j]) + "', got '" + std::to_string(projected(i, j)) + "'");
+            return false;
+          }
+        }
+      }
+      return true;
+    };
+
+    // in-memory fit and projection of the training data
+    FeatureReductionClass inMemory;
+    auto projectedTable = inMemory.GetDiscerningPerfusionTimePoints(intensities);
+    if (!checkProjection("in-memory fit", [&](size_t i, size_t j) { return projectedTable->GetValue(i, j).ToDouble(); }))
+    {
+      return EXIT_FAILURE;
+    }
+    auto projectedTest = inMemory.ApplyPCAOnTestData(intensities);
+    if (!checkProjection("test data projection", [&](size_t i, size_t j) { return projectedTest[i][j]; }))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // streamed fit over two blocks of a strided matrix (one padding column)
+    const size_t stride = cols + 1;
+    std::vector< double > strided(rows * stride, -1000.0);
+    for (size_t i = 0; i < rows; i++)
+    {
+      std::copy(data[i], data[i] + cols, strided.begin() + i * stride);
+    }
+    FeatureReductionClass streamed;
+    streamed.BeginStreamedPCA(cols);
+    streamed.AddStreamedPCASamples(strided.data(), 2, stride);
+    streamed.AddStreamedPCASamples(strided.data() + 2 * stride, rows - 2, stride);
+    std::vector< double > projectedStreamed(rows * cols);
+    if (!streamed.EndStreamedPCA())
+    {
+      cbica::Logging(loggerFile, "PCA test failed: streamed fit did not finish");
+      return EXIT_FAILURE;
+    }
+    streamed.ProjectSamples(strided.data(), rows, stride, cols, projectedStreamed.data());
+    if (!checkProjection("streamed fit", [&](size_t i, size_t j) { return projectedStreamed[i * cols + j]; }))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // every solver gives the same components
+    const auto matrix = PrincipalComponentAnalysis::ToMatrix(intensities);
+    const PrincipalComponentAnalysis::SolverType solvers[] = { PrincipalComponentAnalysis::Covariance, PrincipalComponentAnalysis::ThinSVD, PrincipalComponentAnalysis::RandomizedSVD };
+    for (auto solver : solvers)
+    {
+      PrincipalComponentAnalysis pca;
+      pca.SetSolver(solver);
+      if (!pca.Fit(matrix))
+      {
+        cbica::Logging(loggerFile, "PCA test failed: " + pca.GetLastEncounteredError());
+        return EXIT_FAILURE;
+      }
+      const auto projected = pca.Transform(matrix);
+      if (!checkProjection("solver " + std::to_string(solver), [&](size_t i, size_t j) { return projected(i, j); }))
+      {
+        return EXIT_FAILURE;
+      }
+    }
+
+    // fewer samples than features: the centered data has rank 3, so only the first 3 projections are compared
+    const size_t wideRows = 4, wideCols = 10, wideRank = wideRows - 1;
+    PrincipalComponentAnalysis::MatrixType wide(wideRows, wideCols);
+    for (size_t i = 0; i < wideRows; i++)
+    {
+      for (size_t j = 0; j < wideCols; j++)
+      {
+        wide(i, j) = std::sin(1.7 * i + 0.3 * j * j) + 0.1 * j;
+      }
+    }
+    PrincipalComponentAnalysis::MatrixType wideReference;
+    for (auto solver : solvers)
+    {
+      PrincipalComponentAnalysis pca;
+      pca.SetSolver(solver);
+      if (!pca.Fit(wide))
+      {
+        cbica::Logging(loggerFile, "PCA wide test failed: " + pca.GetLastEncounteredError());
+        return EXIT_FAILURE;
+      }
+      const auto projected = pca.Transform(wide);
+      if (static_cast< size_t >(projected.cols()) < wideRank)
+      {
+        cbica::Logging(loggerFile, "PCA wide test failed for solver " + std::to_string(solver) + ": only '" + std::to_string(projected.cols()) + "' components");
+        return EXIT_FAILURE;
+      }
+      if (wideReference.size() == 0)
+      {
+        wideReference = projected.leftCols(wideRank);
+        continue;
+      }
+      const double difference = (projected.leftCols(wideRank) - wideReference).cwiseAbs().maxCoeff();
+      if (difference > 1e-6)
+      {
+        cbica::Logging(loggerFile, "PCA wide test failed for solver " + std::to_string(solver) + ": projections differ by '" + std::to_string(difference) + "'");
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (parser.isPresent("samplingTest"))
+  {
+    // two synthetic subjects with 500 near and 250 far voxels each; T1 tells the classes apart
+    const size_t numberOfSubjects = 2, nearPerSubject = 500, farPerSubject = 250;
+    auto createImage = [](float value)
+    {
+      auto image = ImageTypeFloat3D::New();
+      ImageTypeFloat3D::SizeType size;
+      size.Fill(10);
+      image->SetRegions(ImageTypeFloat3D::RegionType(size));
+      image->Allocate();
+      image->FillBuffer(value);
+      return image;
+    };
+    auto readSubject = [&](size_t, NiftiDataManager::TrainingSubjectImages &images)
+    {
+      images.nearMask = createImage(0);
+      images.farMask = createImage(0);
+      images.t1 = createImage(0);
+      images.t1ce = createImage(0);
+      images.t2 = createImage(0);
+      images.t2flair = createImage(0);
+      itk::ImageRegionIteratorWithIndex< ImageTypeFloat3D > it(images.t1, images.t1->GetLargestPossibleRegion());
+      for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+      {
+        const auto index = it.GetIndex();
+        if (index[2] < 5)
+        {
+          images.nearMask->SetPixel(index, 1);
+          it.Set(1);
+        }
+        else if (index[2] < 7 || (index[2] == 7 && index[1] < 5))
+        {
+          images.farMask->SetPixel(index, 1);
+          it.Set(2);
+        }
+      }
+    };
+
+    const size_t caps[] = { 0, 100 };
+    for (auto cap : caps)
+    {
+      NiftiDataManager dataManager;
+      NiftiDataManager::StreamedTrainingSamples samples;
+      if (!dataManager.StreamTrainingSamples(numberOfSubjects, readSubject, cap, cap, samples, true, false, false, false))
+      {
+        cbica::Logging(loggerFile, "Sampling test failed: " + dataManager.GetLastEncounteredError());
+        return EXIT_FAILURE;
+      }
+      const size_t expectedNear = (cap == 0) ? numberOfSubjects * nearPerSubject : cap;
+      const size_t expectedFar = (cap == 0) ? numberOfSubjects * farPerSubject : cap;
+      if ((samples.nearSeen != numberOfSubjects * nearPerSubject) || (samples.farSeen != numberOfSubjects * farPerSubject) ||
+        (samples.nearRows != expectedNear) || (samples.farRows != expectedFar) ||
+        (samples.nearSamples.size() != expectedNear * samples.Columns()) || (samples.farSamples.size() != expectedFar * samples.Columns()))
+      {
+        cbica::Logging(loggerFile, "Sampling test failed for cap '" + std::to_string(cap) + "': got '" + std::to_string(samples.nearRows) + "' near and '"
+          + std::to_string(samples.farRows) + "' far rows");
+        return EXIT_FAILURE;
+      }
+      for (size_t i = 0; i < samples.nearRows; i++)
+      {
+        if (samples.nearSamples[i * samples.Columns()] != 1)
+        {
+          cbica::Logging(loggerFile, "Sampling test failed: a near row was not sampled from the near mask");
+          return EXIT_FAILURE;
+        }
+      }
+      for (size_t i = 0; i < samples.farRows; i++)
+      {
+        if (samples.farSamples[i * samples.Columns()] != 2)
+        {
+          cbica::Logging(loggerFile, "Sampling test failed: a far row was not sampled from the far mask");
+          return EXIT_FAILURE;
+        }
+      }
+    }
+  }
+
+  if (parser.isPresent("rfTest"))
+  {
+    // two classes split at x0 = 0.5 (the second feature is noise)
+    auto createSamples = [](int rows, uint64 seed, cv::Mat &samples, cv::Mat &labels)
+    {
+      cv::RNG rng(seed);
+      samples = cv::Mat(rows, 2, CV_32F);
+      labels = cv::Mat(rows, 1, CV_32S);
+      rng.fill(samples, cv::RNG::UNIFORM, 0.0, 1.0);
+      for (int i = 0; i < rows; i++)
+      {
+        labels.at< int >(i, 0) = (samples.at< float >(i, 0) > 0.5f) ? 2 : 1;
+      }
+    };
+    cv::Mat trainingSamples, trainingLabels, testingSamples, testingLabels;
+    createSamples(600, 1, trainingSamples, trainingLabels);
+    createSamples(400, 2, testingSamples, testingLabels);
+    cv::Mat priors = (cv::Mat_< double >(2, 1) << 1.0, 1.0); // not CV_32F on purpose
+
+    const std::string modelFile = cbica::createTmpDir() + "rf_model.bin";
+    const bool backends[] = { false, true };
+    for (auto useOpenCV : backends)
+    {
+      const std::string backend = useOpenCV ? "OpenCV" : "in-tree";
+      RFSuite::Manager rfManager;
+      rfManager.SetUseOpenCV(useOpenCV);
+      rfManager.SetNumberOfThreads(2);
+      rfManager.SetTrainDataFromMats(trainingSamples, trainingLabels);
+      rfManager.SetPriorsMat(priors);
+      rfManager.SetMinSampleCountPercentage(1);
+      rfManager.SetNumberOfTrees(20);
+      rfManager.Train();
+
+      auto predicted = rfManager.Test(testingSamples);
+      int wrong = 0;
+      for (int i = 0; i < testingSamples.rows; i++)
+      {
+        wrong += (predicted->at< int >(i, 0) != testingLabels.at< int >(i, 0));
+      }
+      if (wrong > testingSamples.rows / 20)
+      {
+        cbica::Logging(loggerFile, "RF test failed: the " + backend + " forest mislabeled '" + std::to_string(wrong) + "' of '"
+          + std::to_string(testingSamples.rows) + "' samples");
+        return EXIT_FAILURE;
+      }
+
+      if (!useOpenCV)
+      {
+        // the saved forest predicts the same labels
+        rfManager.SaveModel(modelFile);
+        RFSuite::Forest loaded;
+        std::vector< int > loadedLabels(testingSamples.rows);
+        if (!loaded.Load(modelFile))
+        {
+          cbica::Logging(loggerFile, "RF test failed: the saved forest could not be read");
+          return EXIT_FAILURE;
+        }
+        loaded.Predict(testingSamples.ptr< float >(0), testingSamples.rows, testingSamples.step1(), loadedLabels.data());
+        for (int i = 0; i < testingSamples.rows; i++)
+        {
+          if (loadedLabels[i] != predicted->at< int >(i, 0))
+          {
+            cbica::Logging(loggerFile, "RF test failed: the saved forest predicts differently");
+            return EXIT_FAILURE;
+          }
+        }
+      }
+    }
+  }
+
+  if (parser.isPresent("svmWarmStartTest"))
+  {
+    // three classes around the corners of the unit square (non-negative features for CHI2 and INTER)
+    auto createSamples = [](int rows, uint64 seed, cv::Mat &samples, cv::Mat &labels)
+    {
+      cv::RNG rng(seed);
+      samples = cv::Mat(rows, 2, CV_32F);
+      labels = cv::Mat(rows, 1, CV_32S);
+      rng.fill(samples, cv::RNG::UNIFORM, 0.0, 1.0);
+      for (int i = 0; i < rows; i++)
+      {
+        const float x = samples.at< float >(i, 0), y = samples.at< float >(i, 1);
+        labels.at< int >(i, 0) = (x + y < 0.8f) ? 1 : ((x > y) ? 2 : 3);
+      }
+    };
+    cv::Mat firstSamples, firstLabels, testingSamples, testingLabels;
+    createSamples(300, 1, firstSamples, firstLabels);
+    createSamples(400, 2, testingSamples, testingLabels);
+
+    // the second training keeps the first samples (same keys) and adds a few new ones
+    cv::Mat extraSamples, extraLabels, secondSamples, secondLabels;
+    createSamples(30, 3, extraSamples, extraLabels);
+    cv::vconcat(firstSamples, extraSamples, secondSamples);
+    cv::vconcat(firstLabels, extraLabels, secondLabels);
+    std::vector< size_t > secondKeys(secondSamples.rows);
+    for (size_t i = 0; i < secondKeys.size(); i++)
+    {
+      secondKeys[i] = i;
+    }
+    const std::vector< size_t > firstKeys(secondKeys.begin(), secondKeys.begin() + firstSamples.rows);
+
+    const cv::TermCriteria termCriteria(cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS, 100000, 1e-6);
+    const double C = 10, gamma = 2, coef0 = -1, degree = 2;
+    const int kernels[] = { cv::ml::SVM::LINEAR, cv::ml::SVM::POLY, cv::ml::SVM::RBF,
+      cv::ml::SVM::SIGMOID, cv::ml::SVM::CHI2, cv::ml::SVM::INTER };
+    const std::string kernelNames[] = { "LINEAR", "POLY", "RBF", "SIGMOID", "CHI2", "INTER" };
+    for (size_t k = 0; k < 6; k++)
+    {
+      const int kernelType = kernels[k];
+      const std::string &kernel = kernelNames[k];
+      if (!SvmSuite::WarmStartTrainer::IsSupported(cv::ml::SVM::C_SVC, kernelType))
+      {
+        cbica::Logging(loggerFile, "SVM warm start test failed: kernel '" + kernel + "' is not supported");
+        return EXIT_FAILURE;
+      }
+
+      SvmSuite::WarmStartTrainer trainer;
+      trainer.SetNumberOfThreads(2);
+      for (int training = 0; training < 2; training++)
+      {
+        const cv::Mat &samples = (training == 0) ? firstSamples : secondSamples;
+        const cv::Mat &labels = (training == 0) ? firstLabels : secondLabels;
+        if (!trainer.Train(samples, labels, (training == 0) ? firstKeys : secondKeys,
+          kernelType, C, gamma, coef0, degree, cv::Mat(), termCriteria))
+        {
+          cbica::Logging(loggerFile, "SVM warm start test failed: kernel '" + kernel + "' could not be trained");
+          return EXIT_FAILURE;
+        }
+        if ((training == 1) != trainer.WasWarmStarted())
+        {
+          cbica::Logging(loggerFile, "SVM warm start test failed: kernel '" + kernel + "' did not start from the previous solution");
+          return EXIT_FAILURE;
+        }
+
+        // the same problem solved by OpenCV from scratch
+        auto coldSvm = cv::ml::SVM::create();
+        coldSvm->setType(cv::ml::SVM::C_SVC);
+        coldSvm->setKernel(kernelType);
+        coldSvm->setC(C);
+        coldSvm->setGamma(gamma);
+        coldSvm->setCoef0(coef0);
+        coldSvm->setDegree(degree);
+        coldSvm->setTermCriteria(termCriteria);
+        coldSvm->train(samples, cv::ml::ROW_SAMPLE, labels);
+
+        cv::Mat warmPredicted, coldPredicted;
+        trainer.GetModel()->predict(testingSamples, warmPredicted);
+        coldSvm->predict(testingSamples, coldPredicted);
+        int different = 0;
+        for (int i = 0; i < testingSamples.rows; i++)
+        {
+          different += (warmPredicted.at< float >(i, 0) != coldPredicted.at< float >(i, 0));
+        }
+        if (different > testingSamples.rows / 50)
+        {
+          cbica::Logging(loggerFile, "SVM warm start test failed: kernel '" + kernel + "' predicts '" + std::to_string(different) + "' of '"
+            + std::to_string(testingSamples.rows) + "' samples differently than cv::ml::SVM (training " + std::to_string(training) + ")");
+          return EXIT_FAILURE;
+        }
+      }
+    }
+  }
+
+  if (parser.isPresent("svmFusedModelTest"))
+  {
+    // three classes around the corners of the unit square; the two class problem is class 1 against the others
+    cv::Mat samples(300, 2, CV_32F), labels(300, 1, CV_32S), binaryLabels(300, 1, CV_32S), testingSamples(400, 2, CV_32F);
+    cv::RNG rng(1);
+    rng.fill(samples, cv::RNG::UNIFORM, 0.0, 1.0);
+    rng.fill(testingSamples, cv::RNG::UNIFORM, 0.0, 1.0);
+    for (int i = 0; i < samples.rows; i++)
+    {
+      const float x = samples.at< float >(i, 0), y = samples.at< float >(i, 1);
+      labels.at< int >(i, 0) = (x + y < 0.8f) ? 1 : ((x > y) ? 2 : 3);
+      binaryLabels.at< int >(i, 0) = (labels.at< int >(i, 0) == 1) ? 1 : 2;
+    }
+
+    const int kernels[] = { cv::ml::SVM::LINEAR, cv::ml::SVM::POLY, cv::ml::SVM::RBF, cv::ml::SVM::SIGMOID };
+    const std::string kernelNames[] = { "LINEAR", "POLY", "RBF", "SIGMOID" };
+    for (size_t k = 0; k < 4; k++)
+    {
+      const std::string &kernel = kernelNames[k];
+      for (int classes = 2; classes <= 3; classes++)
+      {
+        auto svm = cv::ml::SVM::create();
+        svm->setType(cv::ml::SVM::C_SVC);
+        svm->setKernel(kernels[k]);
+        svm->setC(10);
+        svm->setGamma(2);
+        svm->setCoef0(-1);
+        svm->setDegree(2);
+        svm->train(samples, cv::ml::ROW_SAMPLE, (classes == 2) ? binaryLabels : labels);
+        std::vector< int > classLabels = { 1, 2 };
+        if (classes == 3)
+        {
+          classLabels.push_back(3);
+        }
+
+        SvmSuite::FusedModel fused;
+        if (!fused.Build(svm, classLabels))
+        {
+          cbica::Logging(loggerFile, "SVM fused model test failed: kernel '" + kernel + "' could not be built");
+          return EXIT_FAILURE;
+        }
+        std::vector< float > decision(testingSamples.rows);
+        std::vector< int > predicted(testingSamples.rows);
+        std::vector< double > kernelBuffer;
+        fused.Predict(testingSamples.ptr< float >(0), testingSamples.rows, decision.data(), predicted.data(), kernelBuffer);
+
+        // OpenCV evaluates the kernels in single precision, so samples right on the boundary may flip
+        cv::Mat expectedLabels, expectedDecision;
+        svm->predict(testingSamples, expectedLabels);
+        svm->predict(testingSamples, expectedDecision, cv::ml::StatModel::RAW_OUTPUT);
+        int different = 0;
+        for (int i = 0; i < testingSamples.rows; i++)
+        {
+          different += (predicted[i] != static_cast< int >(expectedLabels.at< float >(i, 0)));
+          if ((classes == 2) && (std::abs(decision[i] - expectedDecision.at< float >(i, 0)) > 1e-3 * (1 + std::abs(expectedDecision.at< float >(i, 0)))))
+          {
+            cbica::Logging(loggerFile, "SVM fused model test failed: kernel '" + kernel + "' decision '" + std::to_string(decision[i]) + "' differs from cv::ml::SVM '"
+              + std::to_string(expectedDecision.at< float >(i, 0)) + "' at sample " + std::to_string(i));
+            return EXIT_FAILURE;
+          }
+        }
+        if (different > testingSamples.rows / 100)
+        {
+          cbica::Logging(loggerFile, "SVM fused model test failed: kernel '" + kernel + "' predicts '" + std::to_string(different) + "' of '"
+            + std::to_string(testingSamples.rows) + "' samples differently than cv::ml::SVM (" + std::to_string(classes) + " classes)");
+          return EXIT_FAILURE;
+        }
+      }
+    }
+  }
+
+  if (parser.isPresent("lddmmFFTTest"))
+  {
+    typedef LDDMMData< float, 3 > LDDMMType;
+    typedef LDDMMType::VectorImageType VectorImageType;
+
+    // a smooth bump in the middle of an anisotropic field, different in each component
+    VectorImageType::SizeType size;
+    size[0] = 24;
+    size[1] = 20;
+    size[2] = 16;
+    VectorImageType::SpacingType spacing;
+    spacing[0] = 1.0;
+    spacing[1] = 1.5;
+    spacing[2] = 2.0;
+    auto field = VectorImageType::New();
+    field->SetRegions(VectorImageType::RegionType(size));
+    field->SetSpacing(spacing);
+    field->Allocate();
+    itk::ImageRegionIteratorWithIndex< VectorImageType > fieldIt(field, field->GetLargestPossibleRegion());
+    for (fieldIt.GoToBegin(); !fieldIt.IsAtEnd(); ++fieldIt)
+    {
+      double distanceSquared = 0;
+      for (unsigned int d = 0; d < 3; d++)
+      {
+        const double x = (fieldIt.GetIndex()[d] - 0.5 * size[d]) * spacing[d];
+        distanceSquared += x * x;
+      }
+      LDDMMType::Vec value;
+      for (unsigned int d = 0; d < 3; d++)
+      {
+        value[d] = (d + 1.0) * std::exp(-distanceSquared / 32.0) + 0.1 * std::sin(0.7 * fieldIt.GetIndex()[d]);
+      }
+      fieldIt.Set(value);
+    }
+
+    LDDMMFFTRegularizer< float, 3 > regularizer;
+    regularizer.SetNumberOfThreads(2);
+
+    // the Navier-Stokes operator (Id - alpha / gamma Laplacian)^2 on the output of its inverse gives back the input,
+    // wherever the 6-neighbour Laplacian (applied twice) does not reach the border
+    const double alpha = 2.0, gamma = 1.0;
+    auto inverse = LDDMMType::alloc_vimg(field);
+    regularizer.vimg_navier_stokes(field, inverse, alpha, gamma);
+    auto applyOperator = [&size, alpha, gamma](VectorImageType *input, VectorImageType *output, int border)
+    {
+      itk::ImageRegionIteratorWithIndex< VectorImageType > it(output, output->GetLargestPossibleRegion());
+      for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+      {
+        auto index = it.GetIndex();
+        bool inside = true;
+        for (unsigned int d = 0; d < 3; d++)
+        {
+          inside = inside && (index[d] >= border) && (index[d] < static_cast< int >(size[d]) - border);
+        }
+        LDDMMType::Vec value;
+        value.Fill(0);
+        if (inside)
+        {
+          value = input->GetPixel(index) * static_cast< float >(1.0 + 6.0 * alpha / gamma);
+          for (unsigned int d = 0; d < 3; d++)
+          {
+            for (int step = -1; step <= 1; step += 2)
+            {
+              auto neighbour = index;
+              neighbour[d] += step;
+              value -= input->GetPixel(neighbour) * static_cast< float >(alpha / gamma);
+            }
+          }
+        }
+        it.Set(value);
+      }
+    };
+    auto work = LDDMMType::alloc_vimg(field), recovered = LDDMMType::alloc_vimg(field);
+    applyOperator(inverse, work, 1);
+    applyOperator(work, recovered, 2);
+
+    double maximumDifference = 0, maximumValue = 0;
+    for (fieldIt.GoToBegin(); !fieldIt.IsAtEnd(); ++fieldIt)
+    {
+      auto index = fieldIt.GetIndex();
+      bool inside = true;
+      for (unsigned int d = 0; d < 3; d++)
+      {
+        inside = inside && (index[d] >= 2) && (index[d] < static_cast< int >(size[d]) - 2);
+      }
+      for (unsigned int d = 0; inside && d < 3; d++)
+      {
+        maximumDifference = std::max(maximumDifference, std::abs(static_cast< double >(recovered->GetPixel(index)[d] - fieldIt.Get()[d])));
+        maximumValue = std::max(maximumValue, std::abs(static_cast< double >(fieldIt.Get()[d])));
+      }
+    }
+    if (maximumDifference > 1e-3 * maximumValue)
+    {
+      cbica::Logging(loggerFile, "LDDMM FFT test failed: the Navier-Stokes operator does not invert its kernel (difference '"
+        + std::to_string(maximumDifference) + "')");
+      return EXIT_FAILURE;
+    }
+
+    // FFT Gaussian smoothing is close to the recursive Gaussian of LDDMMData
+    LDDMMType::Vec sigma;
+    sigma[0] = 1.5;
+    sigma[1] = 2.0;
+    sigma[2] = 3.0;
+    auto fftSmoothed = LDDMMType::alloc_vimg(field), recursiveSmoothed = LDDMMType::alloc_vimg(field);
+    regularizer.vimg_smooth(field, fftSmoothed, sigma);
+    LDDMMType::vimg_smooth(field, recursiveSmoothed, sigma);
+
+    maximumDifference = 0;
+    maximumValue = 0;
+    itk::ImageRegionIteratorWithIndex< VectorImageType > fftIt(fftSmoothed, fftSmoothed->GetLargestPossibleRegion());
+    for (fftIt.GoToBegin(); !fftIt.IsAtEnd(); ++fftIt)
+    {
+      for (unsigned int d = 0; d < 3; d++)
+      {
+        const double recursiveValue = recursiveSmoothed->GetPixel(fftIt.GetIndex())[d];
+        maximumDifference = std::max(maximumDifference, std::abs(fftIt.Get()[d] - recursiveValue));
+        maximumValue = std::max(maximumValue, std::abs(recursiveValue));
+      }
+    }
+    if (maximumDifference > 0.02 * maximumValue)
+    {
+      cbica::Logging(loggerFile, "LDDMM FFT test failed: the FFT Gaussian differs from the recursive Gaussian by '"
+        + std::to_string(maximumDifference) + "' (maximum '" + std::to_string(maximumValue) + "')");
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (parser.isPresent("chunkedWarpTest"))
+  {
+    typedef ChunkedWarpFile< float, 3 > WarpFileType;
+    typedef WarpFileType::VectorImageType VectorImageType;
+
+    // 16 voxel tiles, so that the last tiles along each axis are partial
+    const unsigned int tileSize = 16;
+    VectorImageType::SizeType size;
+    size[0] = 40;
+    size[1] = 36;
+    size[2] = 20;
+    VectorImageType::SpacingType spacing;
+    spacing[0] = 1.0;
+    spacing[1] = 1.25;
+    spacing[2] = 2.0;
+    VectorImageType::PointType origin;
+    origin[0] = -10.0;
+    origin[1] = 5.0;
+    origin[2] = 3.0;
+    auto warp = VectorImageType::New();
+    warp->SetRegions(VectorImageType::RegionType(size));
+    warp->SetSpacing(spacing);
+    warp->SetOrigin(origin);
+    warp->Allocate();
+    itk::ImageRegionIteratorWithIndex< VectorImageType > warpIt(warp, warp->GetLargestPossibleRegion());
+    for (warpIt.GoToBegin(); !warpIt.IsAtEnd(); ++warpIt)
+    {
+      // every voxel and component has its own (exactly representable) value
+      const auto index = warpIt.GetIndex();
+      WarpFileType::VectorType value;
+      for (unsigned int d = 0; d < 3; d++)
+      {
+        value[d] = index[0] + 64.0f * index[1] + 4096.0f * index[2] + 0.25f * d;
+      }
+      warpIt.Set(value);
+    }
+
+    // the region starts in the first tile and ends in the second one along each axis
+    VectorImageType::IndexType regionIndex;
+    regionIndex[0] = 10;
+    regionIndex[1] = 12;
+    regionIndex[2] = 5;
+    VectorImageType::SizeType regionSize;
+    regionSize[0] = 20;
+    regionSize[1] = 15;
+    regionSize[2] = 13;
+    const VectorImageType::RegionType region(regionIndex, regionSize);
+
+    const std::string warpFile = cbica::createTmpDir() + "chunked_warp.gwarp";
+    VectorImageType::Pointer whole, part;
+    WarpFileType::Header header;
+    try
+    {
+      WarpFileType::Write(warp, warpFile.c_str(), 2, tileSize);
+      WarpFileType::ReadHeader(warpFile.c_str(), header);
+      whole = WarpFileType::Read(warpFile.c_str());
+      part = WarpFileType::ReadRegion(warpFile.c_str(), region);
+    }
+    catch (const std::exception &e)
+    {
+      cbica::Logging(loggerFile, "Chunked warp test failed: " + std::string(e.what()));
+      return EXIT_FAILURE;
+    }
+
+    if ((header.exponent != 2) || (header.tile_size != tileSize) || (whole->GetLargestPossibleRegion().GetSize() != size) ||
+      (part->GetLargestPossibleRegion().GetSize() != regionSize))
+    {
+      cbica::Logging(loggerFile, "Chunked warp test failed: the header or the sizes read back differ from the written ones");
+      return EXIT_FAILURE;
+    }
+
+    VectorImageType::PointType regionOrigin;
+    warp->TransformIndexToPhysicalPoint(regionIndex, regionOrigin);
+    if ((whole->GetOrigin().EuclideanDistanceTo(origin) > 1e-6) || (part->GetOrigin().EuclideanDistanceTo(regionOrigin) > 1e-6))
+    {
+      cbica::Logging(loggerFile, "Chunked warp test failed: the origin read back is not the origin of the (region of the) warp");
+      return EXIT_FAILURE;
+    }
+
+    for (warpIt.GoToBegin(); !warpIt.IsAtEnd(); ++warpIt)
+    {
+      const auto index = warpIt.GetIndex();
+      bool same = (whole->GetPixel(index) == warpIt.Get());
+      if (same && region.IsInside(index))
+      {
+        auto partIndex = index;
+        for (unsigned int d = 0; d < 3; d++)
+        {
+          partIndex[d] -= regionIndex[d];
+        }
+        same = (part->GetPixel(partIndex) == warpIt.Get());
+      }
+      if (!same)
+      {
+        cbica::Logging(loggerFile, "Chunked warp test failed: the warp read back differs at voxel (" + std::to_string(index[0]) + ","
+          + std::to_string(index[1]) + "," + std::to_string(index[2]) + ")");
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (parser.isPresent("greedyMovingImage"))
+  {
+    using ImageType = itk::Image< float, 3 >;
+    std::string fixedFile, movingFile;
+    parser.getParameterValue("inputFile", fixedFile);
+    parser.getParameterValue("greedyMovingImage", movingFile);
+    auto fixedImage = cbica::ReadImage< ImageType >(fixedFile);
+    if (!fixedImage)
+    {
+      cbica::Logging(loggerFile, "Greedy moving image: '" + fixedFile + "' could not be read");
+      return EXIT_FAILURE;
+    }
+
+    // 3 degrees around the center of the image, and a few mm of translation
+    const auto size = fixedImage->GetLargestPossibleRegion().GetSize();
+    ImageType::IndexType centerIndex;
+    for (unsigned int d = 0; d < 3; d++)
+    {
+      centerIndex[d] = size[d] / 2;
+    }
+    ImageType::PointType center;
+    fixedImage->TransformIndexToPhysicalPoint(centerIndex, center);
+
+    using TransformType = itk::Euler3DTransform< double >;
+    auto transform = TransformType::New();
+    transform->SetCenter(center);
+    transform->SetRotation(0.0, 0.0, 3.0 * 0.01745329252);
+    TransformType::OutputVectorType translation;
+    translation[0] = 4.0;
+    translation[1] = -2.0;
+    translation[2] = 1.0;
+    transform->SetTranslation(translation);
+
+    auto resampler = itk::ResampleImageFilter< ImageType, ImageType >::New();
+    resampler->SetInput(fixedImage);
+    resampler->SetTransform(transform);
+    resampler->SetReferenceImage(fixedImage);
+    resampler->UseReferenceImageOn();
+    resampler->SetDefaultPixelValue(0);
+    resampler->Update();
+    ImageType::Pointer movingImage = resampler->GetOutput();
+
+    // a smooth intensity bias along x, so that the intensities differ too
+    itk::ImageRegionIteratorWithIndex< ImageType > movingIt(movingImage, movingImage->GetLargestPossibleRegion());
+    for (movingIt.GoToBegin(); !movingIt.IsAtEnd(); ++movingIt)
+    {
+      movingIt.Set(movingIt.Get() * (0.9f + 0.2f * movingIt.GetIndex()[0] / size[0]));
+    }
+    cbica::WriteImage< ImageType >(movingImage, movingFile);
+  }
+
   const int numberOfPixelsTolerance = 10; // number of pixels that are acceptable to have intensity differences
   std::string inputFile, drawingFile;
 